@@ -0,0 +1,53 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "adc_block.h"
+
+#if ADC_BLOCK_FILTER == ADC_BLOCK_MEDIAN
+static int adc_block_select(int *v, int n, int k)
+{
+    int lo = 0, hi = n - 1;
+
+    while (lo < hi) {
+        int pivot = v[(lo + hi) / 2];
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (v[i] < pivot) i++;
+            while (v[j] > pivot) j--;
+            if (i <= j) {
+                int t = v[i];
+                v[i++] = v[j];
+                v[j--] = t;
+            }
+        }
+        if (k <= j) {
+            hi = j;
+        } else if (k >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+    return v[k];
+}
+#endif
+
+q16_t adc_block_decimate(int *samples, int n)
+{
+    if (n <= 0) {
+        return 0;
+    }
+#if ADC_BLOCK_FILTER == ADC_BLOCK_MEDIAN
+    int upper = adc_block_select(samples, n, n / 2);
+    if (n & 1) {
+        return q16_from_int(upper);
+    }
+    return (q16_from_int(adc_block_select(samples, n, n / 2 - 1)) + q16_from_int(upper)) / 2;
+#else
+    int64_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    return (q16_t)((sum << Q16_SHIFT) / n);
+#endif
+}
@@ -0,0 +1,25 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include "fan_fixed.h"
+
+/*---------------------------------------------------------------
+        ADC block acquisition Macros
+
+        All channels are scanned by the DMA at ADC_CHAN_RATE_HZ each,
+        ADC_BLOCK_N samples per channel are decimated into one frame.
+        The rate scales with the pattern, so a frame takes the same
+        time however many zones are scanned.
+---------------------------------------------------------------*/
+#define ADC_CHAN_RATE_HZ    500     // Conversions per second and channel
+#define ADC_BLOCK_MS        (ADC_BLOCK_N * 1000 / ADC_CHAN_RATE_HZ)
+#define ADC_BLOCK_N         64      // Samples per channel in one frame
+
+#define ADC_BLOCK_MEAN      0
+#define ADC_BLOCK_MEDIAN    1
+#define ADC_BLOCK_FILTER    ADC_BLOCK_MEAN
+
+// Decimate n samples into one value, may reorder the buffer
+q16_t adc_block_decimate(int *samples, int n);
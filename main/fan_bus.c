@@ -0,0 +1,365 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "fan_hal.h"
+#include "fan_perf.h"
+#include "fan_bus.h"
+
+const static char *TAG = "Fan-Bus";
+
+#define BUS_CONFIG          (((FAN_BUS_RESOLUTION - 9) << 5) | 0x1F)   // R1 R0 of the config register
+#define BUS_RAW_MASK        (~((1 << (12 - FAN_BUS_RESOLUTION)) - 1))  // Bits below the resolution are undefined
+#define BUS_POWER_ON        0x0550      // 85 ℃, the register before the first conversion
+#define BUS_COPY_MS         10          // EEPROM write of the scratchpad
+
+static portMUX_TYPE bus_lock = portMUX_INITIALIZER_UNLOCKED;
+static fan_bus_sensor_t bus_sensors[FAN_BUS_SENSORS_MAX];   // Written by the bus task under the lock
+static fan_bus_stats_t bus_stats;
+static uint8_t bus_miss_run[FAN_BUS_SENSORS_MAX];           // Bus task only
+static int64_t bus_convert_us;                              // Last broadcast, 0 when it failed
+static bool bus_running;
+static bool bus_fresh[FAN_ZONE_NUM];                        // Control task only
+
+//-------------Staged by any task, taken by the bus task at its next tick---------------//
+static int bus_assign_index = -1;
+static uint8_t bus_assign_zone;
+static uint8_t bus_assign_weight;
+static bool bus_scan_pending;
+
+// Dallas/Maxim CRC8, x^8 + x^5 + x^4 + 1 reflected
+static uint8_t bus_crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+
+    while (len--) {
+        uint8_t byte = *data++;
+        for (int i = 0; i < 8; i++) {
+            uint8_t mix = (crc ^ byte) & 1;
+            crc >>= 1;
+            crc ^= mix ? 0x8C : 0;
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+static esp_err_t bus_read_pad(uint64_t rom, uint8_t *pad)
+{
+    static const uint8_t absent[FAN_BUS_PAD_LEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    esp_err_t ret = fan_hal_bus_read(rom, FAN_BUS_READ_PAD, pad, FAN_BUS_PAD_LEN);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    //-------------Nobody pulls the line low: the pull-up reads as all ones---------------//
+    if (memcmp(pad, absent, FAN_BUS_PAD_LEN) == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return bus_crc8(pad, FAN_BUS_PAD_LEN - 1) == pad[FAN_BUS_PAD_LEN - 1] ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+static esp_err_t bus_write_pad(uint64_t rom, uint8_t th, uint8_t tl)
+{
+    const uint8_t cmd[] = { FAN_BUS_WRITE_PAD, th, tl, BUS_CONFIG };
+    return fan_hal_bus_write(&rom, cmd, sizeof(cmd));
+}
+
+/*---------------------------------------------------------------
+        Scan
+---------------------------------------------------------------*/
+// Zone, weight and resolution of one sensor from its own scratchpad
+static esp_err_t bus_setup(fan_bus_sensor_t *s)
+{
+    uint8_t pad[FAN_BUS_PAD_LEN];
+
+    ESP_RETURN_ON_ERROR(bus_read_pad(s->rom, pad), TAG, "%016llx: scratchpad read failed", (unsigned long long)s->rom);
+    s->zone = pad[2] < FAN_ZONE_NUM ? pad[2] : FAN_BUS_UNASSIGNED;
+    s->weight = pad[3] >= 1 && pad[3] <= 100 ? pad[3] : 100;
+    //-------------The config register comes back at 12 bits after every power-on, only RAM is written---------------//
+    if (pad[4] != BUS_CONFIG) {
+        ESP_RETURN_ON_ERROR(bus_write_pad(s->rom, pad[2], pad[3]), TAG, "%016llx: resolution not set",
+                            (unsigned long long)s->rom);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t bus_scan(void)
+{
+    static fan_bus_sensor_t sensors[FAN_BUS_SENSORS_MAX];
+    uint64_t roms[FAN_BUS_SENSORS_MAX];
+    int64_t start_us = fan_hal_now_us();
+    int found = fan_hal_bus_scan(roms, FAN_BUS_SENSORS_MAX);
+    uint32_t scan_us = (uint32_t)(fan_hal_now_us() - start_us);
+    int num = 0;
+    int assigned = 0;
+
+    ESP_RETURN_ON_FALSE(found >= 0, ESP_FAIL, TAG, "ROM search failed");
+    for (int i = 0; i < found; i++) {
+        if ((roms[i] & 0xFF) != FAN_BUS_FAMILY) {
+            ESP_LOGW(TAG, "%016llx: not a DS18B20, skipped", (unsigned long long)roms[i]);
+            continue;
+        }
+        memset(&sensors[num], 0, sizeof(sensors[num]));
+        sensors[num].rom = roms[i];
+        sensors[num].zone = FAN_BUS_UNASSIGNED;
+        if (bus_setup(&sensors[num]) == ESP_OK && sensors[num].zone != FAN_BUS_UNASSIGNED) {
+            assigned++;
+        }
+        ESP_LOGI(TAG, "#%d %016llx: %s, weight %d%%", num, (unsigned long long)roms[i],
+                 sensors[num].zone == FAN_BUS_UNASSIGNED ? "unassigned" : fan_zones[sensors[num].zone].name,
+                 sensors[num].weight);
+        bus_miss_run[num] = 0;
+        num++;
+    }
+    portENTER_CRITICAL(&bus_lock);
+    memcpy(bus_sensors, sensors, num * sizeof(sensors[0]));
+    bus_stats.sensors = num;
+    bus_stats.scan_us = scan_us;
+    portEXIT_CRITICAL(&bus_lock);
+    ESP_LOGI(TAG, "%d sensors, %d assigned, ROM search %luus", num, assigned, (unsigned long)scan_us);
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        Conversion cycle
+---------------------------------------------------------------*/
+static void bus_convert(void)
+{
+    static const uint8_t cmd = FAN_BUS_CONVERT;
+
+    bus_convert_us = fan_hal_bus_write(NULL, &cmd, 1) == ESP_OK ? fan_hal_now_us() : 0;
+    if (bus_convert_us == 0) {
+        ESP_LOGD(TAG, "Conversion not started");
+    }
+}
+
+static void bus_fold(const fan_bus_sensor_t *sensors, int num, q16_t *tzone)
+{
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        int64_t sum = 0;
+        int32_t weights = 0;
+        q16_t hottest = INT32_MIN;
+
+        for (int i = 0; i < num; i++) {
+            if (sensors[i].zone != zone || !sensors[i].valid) {
+                continue;
+            }
+            sum += (int64_t)sensors[i].temp * sensors[i].weight;
+            weights += sensors[i].weight;
+            hottest = sensors[i].temp > hottest ? sensors[i].temp : hottest;
+        }
+        if (weights == 0) {
+            tzone[zone] = 0;
+        } else {
+            tzone[zone] = FAN_BUS_FOLD == FAN_BUS_FOLD_MAX ? hottest : (q16_t)(sum / weights);
+        }
+    }
+}
+
+// Every scratchpad of the last conversion in one batch, then decode, fold and publish
+static void bus_collect(void)
+{
+    static fan_bus_sensor_t sensors[FAN_BUS_SENSORS_MAX];
+    static uint8_t pads[FAN_BUS_SENSORS_MAX][FAN_BUS_PAD_LEN];
+    esp_err_t rets[FAN_BUS_SENSORS_MAX];
+    q16_t tzone[FAN_ZONE_NUM];
+    int num;
+
+    portENTER_CRITICAL(&bus_lock);
+    num = bus_stats.sensors;
+    memcpy(sensors, bus_sensors, num * sizeof(sensors[0]));
+    portEXIT_CRITICAL(&bus_lock);
+
+    int64_t start_us = fan_hal_now_us();
+    for (int i = 0; i < num; i++) {
+        rets[i] = bus_read_pad(sensors[i].rom, pads[i]);
+    }
+    uint32_t read_us = (uint32_t)(fan_hal_now_us() - start_us);
+    fan_perf_add(FAN_PERF_BUS_READ, read_us);
+
+    uint32_t bench = fan_hal_bench_now();
+    for (int i = 0; i < num; i++) {
+        fan_bus_sensor_t *s = &sensors[i];
+        int16_t raw = (int16_t)(pads[i][0] | pads[i][1] << 8) & BUS_RAW_MASK;
+        bool good = rets[i] == ESP_OK;
+
+        s->crc_errors += rets[i] == ESP_ERR_INVALID_CRC;
+        //-------------85 ℃ is the power-on value: a sensor that reset missed the broadcast---------------//
+        if (good && raw == BUS_POWER_ON && !(s->valid && s->temp > Q16(80))) {
+            good = false;
+        }
+        if (good) {
+            s->temp = (q16_t)raw * 4096;     // 1/16 ℃ to Q16.16, no shift: sub-zero readings are negative
+            s->reads++;
+            bus_miss_run[i] = 0;
+        } else {
+            s->misses++;
+            bus_miss_run[i] += bus_miss_run[i] < UINT8_MAX;
+        }
+        bool valid = bus_miss_run[i] < FAN_BUS_MISS_MAX && s->reads > 0;
+        if (valid != s->valid && !valid) {
+            ESP_LOGW(TAG, "#%d %016llx: no reading %d times in a row, left out", i, (unsigned long long)s->rom,
+                     bus_miss_run[i]);
+        }
+        s->valid = valid;
+    }
+    bus_fold(sensors, num, tzone);
+    fan_perf_add(FAN_PERF_BUS_CPU, fan_hal_bench_now() - bench);
+    //-------------Stamped when the chips latched the temperatures---------------//
+    fan_frame_publish(FAN_FRAME_BUS, tzone, bus_convert_us + FAN_BUS_CONVERT_MS * 1000LL);
+
+    portENTER_CRITICAL(&bus_lock);
+    memcpy(bus_sensors, sensors, num * sizeof(sensors[0]));
+    bus_stats.cycles++;
+    bus_stats.read_us = read_us;
+    bus_stats.last_us = fan_hal_now_us();
+    portEXIT_CRITICAL(&bus_lock);
+}
+
+// Zone and weight into TH/TL and on to the EEPROM, the sensor keeps them across boards
+static void bus_assign(int index, uint8_t zone, uint8_t weight)
+{
+    static const uint8_t copy = FAN_BUS_COPY_PAD;
+    uint64_t rom = bus_sensors[index].rom;
+
+    if (bus_write_pad(rom, zone, weight) != ESP_OK || fan_hal_bus_write(&rom, &copy, 1) != ESP_OK) {
+        ESP_LOGW(TAG, "#%d %016llx: assignment not written", index, (unsigned long long)rom);
+        return;
+    }
+    fan_hal_delay_ms(BUS_COPY_MS);
+    portENTER_CRITICAL(&bus_lock);
+    bus_sensors[index].zone = zone;
+    bus_sensors[index].weight = weight;
+    portEXIT_CRITICAL(&bus_lock);
+    ESP_LOGI(TAG, "#%d %016llx: %s, weight %d%%, stored in the sensor", index, (unsigned long long)rom,
+             zone == FAN_BUS_UNASSIGNED ? "unassigned" : fan_zones[zone].name, weight);
+}
+
+static void bus_task(void *arg)
+{
+    fan_perf_task_register(FAN_PERF_BUS, FAN_BUS_STACK);
+    bus_convert();
+    while (1) {
+        fan_sched_wait(SCHED_BUS_TICK);
+        //-------------A tick sooner than the conversion waits out the rest, the chips are never polled---------------//
+        int64_t left_us = bus_convert_us + FAN_BUS_CONVERT_MS * 1000LL - fan_hal_now_us();
+        if (bus_convert_us != 0 && left_us > 0) {
+            fan_hal_delay_ms((uint32_t)(left_us / 1000) + 1);
+        }
+        if (bus_convert_us != 0) {
+            bus_collect();
+        }
+
+        int index;
+        uint8_t zone, weight;
+        bool scan;
+        portENTER_CRITICAL(&bus_lock);
+        index = bus_assign_index;
+        zone = bus_assign_zone;
+        weight = bus_assign_weight;
+        scan = bus_scan_pending;
+        bus_assign_index = -1;
+        bus_scan_pending = false;
+        portEXIT_CRITICAL(&bus_lock);
+        if (index >= 0) {
+            bus_assign(index, zone, weight);
+        }
+        if (scan && bus_scan() != ESP_OK) {
+            ESP_LOGW(TAG, "Rescan failed, sensor table kept");
+        }
+        bus_convert();
+        fan_sched_done(SCHED_BUS_DONE);
+    }
+}
+
+esp_err_t fan_bus_init(void)
+{
+    esp_err_t ret = FAN_BUS_ENABLE ? fan_hal_bus_init() : ESP_ERR_NOT_SUPPORTED;
+
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        return ret;
+    }
+    ESP_RETURN_ON_ERROR(ret, TAG, "bus init failed");
+    ESP_RETURN_ON_ERROR(bus_scan(), TAG, "bus scan failed");
+    if (bus_stats.sensors == 0) {
+        ESP_LOGW(TAG, "No DS18B20 on the bus");
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_RETURN_ON_FALSE(xTaskCreate(bus_task, "bus_task", FAN_BUS_STACK, NULL, FAN_BUS_PRIO, NULL) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "bus task failed");
+    bus_running = true;
+    ESP_LOGI(TAG, "%d-bit conversions of the whole bus at every tick, %s of each zone", FAN_BUS_RESOLUTION,
+             FAN_BUS_FOLD == FAN_BUS_FOLD_MAX ? "hottest bay" : "weighted mean");
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        Control input
+---------------------------------------------------------------*/
+bool fan_bus_tzone(const fan_frame_t *frame, int zone, int64_t now_us, q16_t *tzone)
+{
+    int32_t age_ms = fan_frame_age_ms(frame, FAN_FIELD_TBUS(zone), now_us);
+    bool fresh;
+
+    *tzone = frame->field[FAN_FIELD_TBUS(zone)].value;
+    fresh = age_ms <= FAN_BUS_STALE_MS && *tzone != 0;
+    if (fresh != bus_fresh[zone]) {
+        bus_fresh[zone] = fresh;
+        if (fresh) {
+            ESP_LOGI(TAG, "%s: bay sensors in the loop", fan_zones[zone].name);
+        } else {
+            ESP_LOGW(TAG, "%s: no bay reading for %ds, NTC only", fan_zones[zone].name, (int)(age_ms / 1000));
+        }
+    }
+    return fresh;
+}
+
+esp_err_t fan_bus_assign(int index, int zone, int weight)
+{
+    esp_err_t ret = ESP_OK;
+
+    ESP_RETURN_ON_FALSE(bus_running, ESP_ERR_INVALID_STATE, TAG, "No bus");
+    ESP_RETURN_ON_FALSE(zone == FAN_BUS_UNASSIGNED || (zone >= 0 && zone < FAN_ZONE_NUM), ESP_ERR_INVALID_ARG, TAG,
+                        "No zone %d", zone);
+    ESP_RETURN_ON_FALSE(weight >= 1 && weight <= 100, ESP_ERR_INVALID_ARG, TAG, "Weight %d outside 1..100", weight);
+    portENTER_CRITICAL(&bus_lock);
+    if (index < 0 || index >= bus_stats.sensors) {
+        ret = ESP_ERR_NOT_FOUND;
+    } else {
+        bus_assign_index = index;
+        bus_assign_zone = zone;
+        bus_assign_weight = weight;
+    }
+    portEXIT_CRITICAL(&bus_lock);
+    return ret;
+}
+
+esp_err_t fan_bus_rescan(void)
+{
+    ESP_RETURN_ON_FALSE(bus_running, ESP_ERR_INVALID_STATE, TAG, "No bus");
+    portENTER_CRITICAL(&bus_lock);
+    bus_scan_pending = true;
+    portEXIT_CRITICAL(&bus_lock);
+    return ESP_OK;
+}
+
+int fan_bus_sensors(fan_bus_sensor_t *out, int max)
+{
+    portENTER_CRITICAL(&bus_lock);
+    int num = bus_stats.sensors < max ? bus_stats.sensors : max;
+    memcpy(out, bus_sensors, num * sizeof(out[0]));
+    portEXIT_CRITICAL(&bus_lock);
+    return num;
+}
+
+void fan_bus_get(fan_bus_stats_t *out)
+{
+    portENTER_CRITICAL(&bus_lock);
+    *out = bus_stats;
+    portEXIT_CRITICAL(&bus_lock);
+}
@@ -0,0 +1,92 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "fan_fixed.h"
+#include "fan_frame.h"
+#include "fan_sched.h"
+
+/*---------------------------------------------------------------
+        Sensor bus Macros
+
+        A chain of DS18B20 on one 1-Wire line (RMT on the target, a
+        model of the chips on the simulator), one per bay, telling
+        which drive of a cage runs hot where the cage NTC only sees
+        the air.
+
+        The bus converts in the background of the control ticks: at
+        every tick the bus task reads the scratchpads of the
+        conversion it started at the tick before, all of them in one
+        batch, and starts the next conversion for the whole bus with
+        one SKIP ROM broadcast. The chips convert while the CPU
+        sleeps, so the bus adds no wakeup; only a tick that comes
+        sooner than FAN_BUS_CONVERT_MS after the broadcast waits out
+        the rest. Readings are one tick old.
+
+        Every sensor carries its zone in the TH byte and its weight in
+        percent in the TL byte of its own EEPROM, written once with
+        'bus set'; a sensor whose TH names no zone is read but not
+        used. Per zone the readings fold into one temperature, the
+        hottest bay (FAN_BUS_FOLD_MAX) or the mean by weight
+        (FAN_BUS_FOLD_WEIGHTED), which the control loop takes in
+        place of the cage NTC when it is the hotter of the two.
+
+        Bus time of the batch read and CPU time of the decode land in
+        the bus_read and bus_cpu histograms of fan_perf.h, the ROM
+        search time is logged with every scan.
+---------------------------------------------------------------*/
+#define FAN_BUS_ENABLE          1       // The linux target has a bus with SIM_BUS of fan_hal_sim.c
+#define FAN_BUS_SENSORS_MAX     16
+#define FAN_BUS_RESOLUTION      11      // Bits, 9..12: 0.5 ℃ in 94 ms .. 0.0625 ℃ in 750 ms
+#define FAN_BUS_CONVERT_MS      (750 >> (12 - FAN_BUS_RESOLUTION))
+#define FAN_BUS_FOLD_MAX        0
+#define FAN_BUS_FOLD_WEIGHTED   1
+#define FAN_BUS_FOLD            FAN_BUS_FOLD_MAX
+#define FAN_BUS_STALE_MS        (2 * SCHED_PERIOD_MAX_MS)   // Two ticks missed at the longest period
+#define FAN_BUS_MISS_MAX        3       // Failed reads in a row that drop a sensor from the fold
+#define FAN_BUS_STACK           (3 * 1024)
+#define FAN_BUS_PRIO            2
+
+// DS18B20
+#define FAN_BUS_FAMILY          0x28
+#define FAN_BUS_CONVERT         0x44
+#define FAN_BUS_WRITE_PAD       0x4E
+#define FAN_BUS_READ_PAD        0xBE
+#define FAN_BUS_COPY_PAD        0x48
+#define FAN_BUS_PAD_LEN         9       // Temp LSB/MSB, TH, TL, config, 3 reserved, CRC8
+#define FAN_BUS_UNASSIGNED      0xFF    // Zone of a sensor whose TH names none
+
+typedef struct {
+    uint64_t rom;
+    uint8_t zone;           // From TH, FAN_BUS_UNASSIGNED for none
+    uint8_t weight;         // From TL, percent
+    q16_t temp;
+    bool valid;             // Last read good and recent
+    uint32_t reads;
+    uint32_t crc_errors;
+    uint32_t misses;        // No answer or power-on value
+} fan_bus_sensor_t;
+
+typedef struct {
+    int sensors;
+    uint32_t cycles;
+    uint32_t scan_us;       // Last ROM search
+    uint32_t read_us;       // Last batch read, bus time
+    int64_t last_us;        // Last batch
+} fan_bus_stats_t;
+
+// Scan, resolution, bus task; ESP_ERR_NOT_SUPPORTED without a bus, ESP_ERR_NOT_FOUND with an empty one
+esp_err_t fan_bus_init(void);
+// Control task: folded temperature of the zone's bays while fresh. False when stale or no sensor is assigned.
+bool fan_bus_tzone(const fan_frame_t *frame, int zone, int64_t now_us, q16_t *tzone);
+// Staged for the bus task, written to the sensor's EEPROM at the next tick
+esp_err_t fan_bus_assign(int index, int zone, int weight);
+// ROM search again at the next tick
+esp_err_t fan_bus_rescan(void);
+// Copies of the sensor table and the counters, any task
+int fan_bus_sensors(fan_bus_sensor_t *out, int max);
+void fan_bus_get(fan_bus_stats_t *out);
@@ -0,0 +1,511 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_bit_defs.h"
+#include "esp_console.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "fan_hal.h"
+#include "fan_perf.h"
+#include "fan_zone.h"
+#include "fan_tune.h"
+#include "fan_cycle.h"
+#include "fan_fault.h"
+#include "fan_host.h"
+#include "fan_bus.h"
+#include "fan_energy.h"
+#include "fan_profile.h"
+#include "fan_selftest.h"
+#include "fan_hist.h"
+#include "fan_console.h"
+
+const static char *TAG = "Fan-Console";
+
+static uint32_t console_per_hour(uint32_t count, int64_t since_us)
+{
+    int64_t ms = (fan_hal_now_us() - since_us) / 1000;
+    return ms > 0 ? (uint32_t)((uint64_t)count * 3600000 / ms) : 0;
+}
+
+/*---------------------------------------------------------------
+        perf [reset|hist]
+---------------------------------------------------------------*/
+static void console_perf_hist(const fan_perf_t *s)
+{
+    for (int id = 0; id < FAN_PERF_HIST_MAX; id++) {
+        const fan_perf_hist_t *h = &s->hist[id];
+        printf("%s (%s):\n", fan_perf_hist_name(id), fan_perf_hist_unit(id));
+        for (int b = 0; b < FAN_PERF_BUCKETS; b++) {
+            if (h->bucket[b] != 0) {
+                printf("  <= %10lu  %lu\n", b == 0 ? 0UL : (unsigned long)((1ULL << b) - 1), (unsigned long)h->bucket[b]);
+            }
+        }
+    }
+}
+
+static int console_perf(int argc, char **argv)
+{
+    static fan_perf_t s;    // Too large for the REPL stack
+
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        fan_perf_reset();
+        return 0;
+    }
+    fan_perf_snapshot(&s);
+    if (argc > 1 && strcmp(argv[1], "hist") == 0) {
+        console_perf_hist(&s);
+        return 0;
+    }
+    if (argc > 1) {
+        printf("usage: perf [reset|hist]\n");
+        return 1;
+    }
+
+    printf("Since %llds\n", (long long)((fan_hal_now_us() - s.since_us) / 1000000));
+    printf("%-18s %9s %7s %12s %12s  (%s)\n", "task", "wakeups", "/h", "busy mean", "busy max", FAN_HAL_BENCH_UNIT);
+    for (int task = 0; task < FAN_PERF_TASK_MAX; task++) {
+        const fan_perf_task_stats_t *t = &s.task[task];
+        printf("%-18s %9lu %7lu %12lu %12lu\n", fan_perf_task_name(task), (unsigned long)t->wakeups,
+               (unsigned long)console_per_hour(t->wakeups, s.since_us),
+               (unsigned long)(t->wakeups ? t->busy / t->wakeups : 0), (unsigned long)t->busy_max);
+    }
+    printf("%-18s %9s %10s %10s %10s %10s %10s\n", "histogram", "count", "mean", "p50", "p90", "p99", "max");
+    for (int id = 0; id < FAN_PERF_HIST_MAX; id++) {
+        const fan_perf_hist_t *h = &s.hist[id];
+        char name[24];
+        snprintf(name, sizeof(name), "%s (%s)", fan_perf_hist_name(id), fan_perf_hist_unit(id));
+        printf("%-18s %9lu %10lu %10lu %10lu %10lu %10lu\n", name, (unsigned long)h->count,
+               (unsigned long)(h->count ? h->sum / h->count : 0),
+               (unsigned long)fan_perf_percentile(h, 500), (unsigned long)fan_perf_percentile(h, 900),
+               (unsigned long)fan_perf_percentile(h, 990), (unsigned long)h->max);
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------
+        tasks
+---------------------------------------------------------------*/
+static int console_tasks(int argc, char **argv)
+{
+    static fan_perf_t s;
+
+    fan_perf_snapshot(&s);
+    printf("%-18s %7s %9s %5s\n", "task", "stack", "min free", "used");
+    for (int task = 0; task < FAN_PERF_TASK_MAX; task++) {
+        const fan_perf_task_stats_t *t = &s.task[task];
+        if (t->handle == NULL) {
+            continue;
+        }
+        uint32_t unused = uxTaskGetStackHighWaterMark(t->handle);
+        if (t->stack == 0) {
+            printf("%-18s %7s %9lu\n", fan_perf_task_name(task), "?", (unsigned long)unused);
+            continue;
+        }
+        printf("%-18s %7lu %9lu %4lu%%\n", fan_perf_task_name(task), (unsigned long)t->stack, (unsigned long)unused,
+               (unsigned long)(t->stack > unused ? (t->stack - unused) * 100 / t->stack : 0));
+    }
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    //-------------Every task, system ones included---------------//
+    UBaseType_t n = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t *status = malloc(n * sizeof(TaskStatus_t));
+    if (status == NULL) {
+        return 1;
+    }
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    n = uxTaskGetSystemState(status, n, &total);
+    printf("\n%-18s %4s %9s %6s\n", "all tasks", "prio", "min free", "cpu");
+    for (int i = 0; i < n; i++) {
+        unsigned permille = total ? (unsigned)((uint64_t)status[i].ulRunTimeCounter * 1000 / total) : 0;
+        printf("%-18s %4u %9lu %4u.%u%%\n", status[i].pcTaskName, (unsigned)status[i].uxCurrentPriority,
+               (unsigned long)status[i].usStackHighWaterMark, permille / 10, permille % 10);
+    }
+#else
+    n = uxTaskGetSystemState(status, n, NULL);
+    printf("\n%-18s %4s %9s\n", "all tasks", "prio", "min free");
+    for (int i = 0; i < n; i++) {
+        printf("%-18s %4u %9lu\n", status[i].pcTaskName, (unsigned)status[i].uxCurrentPriority,
+               (unsigned long)status[i].usStackHighWaterMark);
+    }
+#endif
+    free(status);
+#endif
+    return 0;
+}
+
+/*---------------------------------------------------------------
+        pm
+---------------------------------------------------------------*/
+static int console_pm(int argc, char **argv)
+{
+    int64_t now_us = fan_hal_now_us();
+    uint32_t wakeups = fan_hal_wakeup_count();
+    int64_t sleep_us = fan_hal_sleep_time_us();
+
+    printf("Up %llds, %lu wakeups from light sleep (%lu/h), asleep %d.%d%% of the time\n",
+           (long long)(now_us / 1000000), (unsigned long)wakeups, (unsigned long)console_per_hour(wakeups, 0),
+           now_us ? (int)(sleep_us * 100 / now_us) : 0, now_us ? (int)(sleep_us * 1000 / now_us % 10) : 0);
+    return fan_hal_pm_dump(stdout) == ESP_OK ? 0 : 1;
+}
+
+/*---------------------------------------------------------------
+        tune [start [zone]|stop|apply|ceiling <℃> [zone]]
+---------------------------------------------------------------*/
+// Zone by name, -1 for all when there is no name
+static int console_zone(int argc, char **argv, int arg)
+{
+    if (argc <= arg) {
+        return -1;
+    }
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        if (strcmp(argv[arg], fan_zones[zone].name) == 0) {
+            return zone;
+        }
+    }
+    return -2;
+}
+
+static void console_tune_show(void)
+{
+    printf("%-8s %7s %6s %7s %6s %6s %6s %6s %14s\n", "zone", "ceiling", "hist", "tau", "rise", "air", "base", "rms",
+           "fan RPM");
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        fan_tune_zone_t t;
+        fan_tune_get(zone, &t);
+        printf("%-8s %6.1fC %5.1fh", fan_zones[zone].name, t.ceiling, fan_tune_history_h(zone));
+        if (t.thermal.ok) {
+            printf(" %6.0fs %6.2f %6.2f %5.2fW %5.2fC", t.thermal.model.tau, t.thermal.model.rise, t.thermal.model.air,
+                   t.thermal.model.base_w, t.thermal.rms);
+        } else {
+            printf(" %7s %6s %6s %6s %6s", "-", "-", "-", "-", "-");
+        }
+        if (t.fan.ok) {
+            printf(" %5.0f+%4.0f*duty\n", t.fan.rpm0, t.fan.rpm_per_duty);
+        } else {
+            printf(" %14s\n", "-");
+        }
+    }
+}
+
+static int console_tune(int argc, char **argv)
+{
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    int zone;
+
+    if (argc == 1) {
+        console_tune_show();
+        return 0;
+    }
+    if (strcmp(argv[1], "start") == 0 && (zone = console_zone(argc, argv, 2)) >= -1) {
+        ret = fan_tune_start(zone < 0 ? BIT(FAN_ZONE_NUM) - 1 : BIT(zone));
+    } else if (strcmp(argv[1], "stop") == 0) {
+        ret = fan_tune_stop();
+    } else if (strcmp(argv[1], "apply") == 0) {
+        ret = fan_tune_apply();
+        if (ret == ESP_OK) {
+            printf("Search queued, it runs once %d h of history are in\n", FAN_TUNE_MIN_H);
+        }
+    } else if (strcmp(argv[1], "ceiling") == 0 && argc > 2 && (zone = console_zone(argc, argv, 3)) >= -1) {
+        float ceiling = strtof(argv[2], NULL);
+        ret = ESP_OK;
+        for (int z = 0; z < FAN_ZONE_NUM && ret == ESP_OK; z++) {
+            if (zone < 0 || zone == z) {
+                ret = fan_tune_set_ceiling(z, ceiling);
+            }
+        }
+    } else {
+        printf("usage: tune [start [zone]|stop|apply|ceiling <C> [zone]]\n");
+        return 1;
+    }
+    if (ret != ESP_OK) {
+        printf("%s\n", esp_err_to_name(ret));
+        return 1;
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------
+        cycle
+---------------------------------------------------------------*/
+static int console_cycle(int argc, char **argv)
+{
+    int64_t up_us = fan_hal_now_us();
+
+    printf("%-8s %5s %6s %5s %5s %7s %9s %6s %7s %8s\n", "zone", "state", "start", "floor", "stop", "starts", "lifetime",
+           "stalls", "on", "run duty");
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        fan_cycle_stats_t c;
+        fan_cycle_get(zone, &c);
+        printf("%-8s %5s %5d%% %4d%% %4d%% %7lu %9lu %6lu %6.1f%% %7.1f%%\n", fan_zones[zone].name,
+               fan_cycle_state_name(c.state), q16_to_scaled(c.start_at, 100), q16_to_scaled(c.floor, 100),
+               q16_to_scaled(c.stop_at, 100), (unsigned long)c.starts, (unsigned long)c.starts_total,
+               (unsigned long)c.restarts, c.on_share * 100, c.run_duty * 100);
+    }
+    printf("Up %.1f h\n", up_us / 3.6e9);
+    return 0;
+}
+
+/*---------------------------------------------------------------
+        selftest <zone>
+---------------------------------------------------------------*/
+static int console_selftest(int argc, char **argv)
+{
+    int zone = console_zone(argc, argv, 1);
+    esp_err_t ret;
+
+    if (argc != 2 || zone < 0) {
+        printf("usage: selftest <zone>\n");
+        return 1;
+    }
+    ret = fan_selftest_invalidate(zone);
+    if (ret != ESP_OK) {
+        printf("%s\n", esp_err_to_name(ret));
+        return 1;
+    }
+    printf("%s: cached start duty %d%% dropped, tested again the next tick the fan runs\n", fan_zones[zone].name,
+           q16_to_scaled(fan_selftest_result(zone)->start_duty, 100));
+    return 0;
+}
+
+/*---------------------------------------------------------------
+        energy
+---------------------------------------------------------------*/
+static int console_energy(int argc, char **argv)
+{
+    fan_energy_stats_t e;
+
+    printf("%-8s %5s %9s %7s %9s %9s %9s %9s %9s\n", "zone", "disks", "spin-ups", "W", "hour Wh", "last h",
+           "day Wh", "last day", "life kWh");
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        fan_energy_get(zone, &e);
+        printf("%-8s %2d/%-2d %4lu/%-4lu %7.2f %9.2f %9.2f %9.2f %9.2f %9.3f\n", fan_zones[zone].name, e.disks,
+               fan_zones[zone].disks.bays, (unsigned long)e.spinups, (unsigned long)e.spinups_total, e.power_w,
+               e.hour_wh, e.last_hour_wh, e.day_wh, e.last_day_wh, e.total_wh / 1000);
+    }
+    printf("Day %lu at %.1f h of metering\n", (unsigned long)e.days + 1, e.day_h);
+    return 0;
+}
+
+/*---------------------------------------------------------------
+        profile [show|set <field> <value>|reset]
+---------------------------------------------------------------*/
+static void console_profile_show(void)
+{
+    char name[32];
+    float value;
+
+    printf("Active profile, crc %08lx\n", (unsigned long)fan_profile_get()->crc);
+    for (size_t i = 0; fan_profile_field(i, name, sizeof(name), &value); i++) {
+        printf("  %-20s %g\n", name, value);
+    }
+}
+
+static int console_profile(int argc, char **argv)
+{
+    esp_err_t ret;
+    char *end = NULL;
+
+    if (argc == 1 || (argc == 2 && strcmp(argv[1], "show") == 0)) {
+        console_profile_show();
+        return 0;
+    }
+    if (argc == 4 && strcmp(argv[1], "set") == 0) {
+        float value = strtof(argv[3], &end);
+        if (end == argv[3] || *end != '\0') {
+            printf("%s is not a number\n", argv[3]);
+            return 1;
+        }
+        ret = fan_profile_set(argv[2], value);
+    } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        ret = fan_profile_reset();
+    } else {
+        printf("usage: profile [show|set <field> <value>|reset]\n");
+        return 1;
+    }
+    if (ret != ESP_OK) {
+        printf("%s\n", esp_err_to_name(ret));
+        return 1;
+    }
+    printf("Queued for the next tick\n");
+    return 0;
+}
+
+/*---------------------------------------------------------------
+        faults
+---------------------------------------------------------------*/
+static int console_faults(int argc, char **argv)
+{
+    int64_t now_us = fan_hal_now_us();
+    int shown = 0;
+
+    printf("%-8s %-12s %6s %6s %8s %9s %9s\n", "zone", "fault", "state", "raised", "bad", "detect", "last");
+    for (int zone = -1; zone < FAN_ZONE_NUM; zone++) {
+        for (int fault = 0; fault < FAN_FAULT_MAX; fault++) {
+            fan_fault_stats_t f;
+            fan_fault_get(fault, zone, &f);
+            if (f.raised == 0 && f.bad == 0) {
+                continue;
+            }
+            printf("%-8s %-12s %6s %6lu %8lu %7dms %7.1fh\n", zone < 0 ? "board" : fan_zones[zone].name,
+                   fan_fault_name(fault), f.active ? "active" : "ok", (unsigned long)f.raised, (unsigned long)f.bad,
+                   f.detect_ms, f.raised ? (now_us - f.raised_us) / 3.6e9 : 0.0);
+            shown++;
+        }
+    }
+    if (shown == 0) {
+        printf("No bad readings since boot\n");
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------
+        host
+---------------------------------------------------------------*/
+static int console_host(int argc, char **argv)
+{
+    static fan_host_disk_t disks[FAN_HOST_DISKS_MAX];
+    fan_host_stats_t h;
+    int num = fan_host_disks(disks, FAN_HOST_DISKS_MAX);
+
+    fan_host_get(&h);
+    if (h.frames == 0) {
+        printf("No disk temperatures from the host yet (%lu CRC errors, %lu rejected)\n",
+               (unsigned long)h.crc_errors, (unsigned long)h.rejected);
+        return 0;
+    }
+    printf("%-8s %4s %7s %8s\n", "zone", "disk", "temp", "state");
+    for (int i = 0; i < num; i++) {
+        printf("%-8s %4d %6.1f℃ %8s\n", fan_zones[disks[i].zone].name, disks[i].disk,
+               disks[i].temp / 65536.0, fan_host_state_name(disks[i].state));
+    }
+    printf("Every %ds, last %.1fs ago; %lu frames, %lu CRC errors, %lu rejected, %lu overruns\n", h.period_s,
+           (fan_hal_now_us() - h.last_us) / 1e6, (unsigned long)h.frames, (unsigned long)h.crc_errors,
+           (unsigned long)h.rejected, (unsigned long)h.overflows);
+    return 0;
+}
+
+/*---------------------------------------------------------------
+        bus [scan|set <index> <zone|none> [weight]]
+---------------------------------------------------------------*/
+static void console_bus_show(void)
+{
+    static fan_bus_sensor_t sensors[FAN_BUS_SENSORS_MAX];
+    fan_bus_stats_t b;
+    int num = fan_bus_sensors(sensors, FAN_BUS_SENSORS_MAX);
+
+    fan_bus_get(&b);
+    if (num == 0) {
+        printf("No DS18B20 on the bus\n");
+        return;
+    }
+    printf("%2s %-16s %-8s %6s %7s %8s %6s %6s\n", "#", "rom", "zone", "weight", "temp", "reads", "crc", "missed");
+    for (int i = 0; i < num; i++) {
+        const fan_bus_sensor_t *s = &sensors[i];
+        printf("%2d %016llx %-8s %5d%% ", i, (unsigned long long)s->rom,
+               s->zone == FAN_BUS_UNASSIGNED ? "-" : fan_zones[s->zone].name, s->weight);
+        if (s->valid) {
+            printf("%6.2f℃", s->temp / 65536.0);
+        } else {
+            printf("%7s", "-");
+        }
+        printf(" %8lu %6lu %6lu\n", (unsigned long)s->reads, (unsigned long)s->crc_errors, (unsigned long)s->misses);
+    }
+    printf("%lu cycles, last %.1fs ago; batch read %luus, ROM search %luus\n", (unsigned long)b.cycles,
+           b.cycles ? (fan_hal_now_us() - b.last_us) / 1e6 : 0.0, (unsigned long)b.read_us, (unsigned long)b.scan_us);
+}
+
+static int console_bus(int argc, char **argv)
+{
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    int zone;
+
+    if (argc == 1) {
+        console_bus_show();
+        return 0;
+    }
+    if (strcmp(argv[1], "scan") == 0) {
+        ret = fan_bus_rescan();
+    } else if (strcmp(argv[1], "set") == 0 && argc > 3 &&
+               ((zone = console_zone(argc, argv, 3)) >= 0 || strcmp(argv[3], "none") == 0)) {
+        ret = fan_bus_assign(atoi(argv[2]), zone >= 0 ? zone : FAN_BUS_UNASSIGNED, argc > 4 ? atoi(argv[4]) : 100);
+    } else {
+        printf("usage: bus [scan|set <index> <zone|none> [weight]]\n");
+        return 1;
+    }
+    if (ret != ESP_OK) {
+        printf("%s\n", esp_err_to_name(ret));
+        return 1;
+    }
+    printf("Queued for the next tick\n");
+    return 0;
+}
+
+/*---------------------------------------------------------------
+        hist flush
+---------------------------------------------------------------*/
+static int console_hist(int argc, char **argv)
+{
+    if (argc != 2 || strcmp(argv[1], "flush") != 0) {
+        printf("usage: hist flush\n");
+        return 1;
+    }
+    fan_hist_request_flush();
+    printf("Queued for the next tick\n");
+    return 0;
+}
+
+esp_err_t fan_console_init(void)
+{
+    static const esp_console_cmd_t cmds[] = {
+        { .command = "perf", .help = "Task wakeups, loop latency, jitter and acquisition times; 'reset' clears, 'hist' shows buckets",
+          .hint = "[reset|hist]", .func = console_perf },
+        { .command = "tasks", .help = "Stack high-water marks", .func = console_tasks },
+        { .command = "pm", .help = "Light sleep residency, wakeups and PM locks", .func = console_pm },
+        { .command = "tune", .help = "Fitted cage and fan per zone; 'start' runs the duty steps, 'apply' searches the curve, "
+          "'ceiling' sets the cell limit", .hint = "[start [zone]|stop|apply|ceiling <C> [zone]]", .func = console_tune },
+        { .command = "cycle", .help = "Fan state, start/stop duties, starts since boot and lifetime, running duty", .func = console_cycle },
+        { .command = "selftest", .help = "Drop the cached start duty of a zone and test its fan again",
+          .hint = "<zone>", .func = console_selftest },
+        { .command = "energy", .help = "12V rail energy per zone by minute, hour, day and lifetime; spinning disks and spin-ups",
+          .func = console_energy },
+        { .command = "profile", .help = "Control profile fields and values; 'set' stores one field, 'reset' drops the "
+          "stored profile for the defaults", .hint = "[show|set <field> <value>|reset]", .func = console_profile },
+        { .command = "faults", .help = "Faults with bad readings since boot: state, raises, detection time, last raise",
+          .func = console_faults },
+        { .command = "host", .help = "Disk temperatures and spin states pushed by the host, link counters",
+          .func = console_host },
+        { .command = "bus", .help = "DS18B20 bay sensors: zone, weight, reading and counters; 'set' stores a zone and "
+          "weight in the sensor, 'scan' searches the bus again", .hint = "[scan|set <index> <zone|none> [weight]]",
+          .func = console_bus },
+        { .command = "hist", .help = "Write the partial history pages to flash, before a partition dump",
+          .hint = "flush", .func = console_hist },
+    };
+#if FAN_CONSOLE_REPL
+    esp_console_repl_t *repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+
+    repl_config.prompt = FAN_CONSOLE_PROMPT;
+    repl_config.task_stack_size = FAN_CONSOLE_STACK;
+    ESP_RETURN_ON_ERROR(esp_console_new_repl_uart(&uart_config, &repl_config, &repl), TAG, "REPL init failed");
+#else
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    ESP_RETURN_ON_ERROR(esp_console_init(&console_config), TAG, "console init failed");
+#endif
+    ESP_RETURN_ON_ERROR(esp_console_register_help_command(), TAG, "help command failed");
+    for (int i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        ESP_RETURN_ON_ERROR(esp_console_cmd_register(&cmds[i]), TAG, "%s command failed", cmds[i].command);
+    }
+#if FAN_CONSOLE_REPL
+    ESP_RETURN_ON_ERROR(fan_hal_console_wakeup(), TAG, "console wakeup failed");
+    return esp_console_start_repl(repl);
+#else
+    return ESP_OK;
+#endif
+}
@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "fan_telem.h"
+
+/*---------------------------------------------------------------
+        Instrumentation console Macros
+
+        esp_console commands over the counters of fan_perf.h, the
+        auto-tuning of fan_tune.h, the starts of fan_cycle.h, the
+        faults of fan_fault.h, the host link of fan_host.h and the
+        sensor bus of fan_bus.h:
+
+            perf [reset|hist]   task wakeups and busy time, latency,
+                                jitter and acquisition percentiles
+            tasks               stack high-water marks (and CPU share
+                                with FreeRTOS run time stats)
+            pm                  CPU wakeups, light sleep residency and
+                                the PM locks
+            tune ...            fits per zone, duty steps, curve search
+                                and the cell ceiling
+            cycle               fan states, start/stop duties, starts
+                                and mean running duty
+            faults              faults seen since boot, their state,
+                                detection time and last raise
+            host                disk temperatures and spin states of
+                                the last push, link counters
+            bus [scan|set ...]  bay sensors with zone, weight, reading
+                                and counters; set stores the zone in
+                                the sensor, scan searches again
+
+        The REPL reads the console UART, so it stays off while binary
+        telemetry owns it. Light sleep stops the UART clock: the
+        first characters typed only wake the chip, press Enter once
+        before the command. The linux target registers the commands,
+        SIM_CONSOLE_CMD of fan_hal_sim.c types one on the virtual
+        clock.
+---------------------------------------------------------------*/
+#if CONFIG_IDF_TARGET_LINUX
+#define FAN_CONSOLE_REPL        0
+#else
+#define FAN_CONSOLE_REPL        (!FAN_TELEM_BINARY)
+#endif
+#define FAN_CONSOLE_PROMPT      "fan> "
+#define FAN_CONSOLE_STACK       (4 * 1024)
+
+// Register the commands and start the REPL, after fan_telem_init()
+esp_err_t fan_console_init(void);
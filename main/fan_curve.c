@@ -0,0 +1,284 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "fan_hal.h"
+#include "fan_curve.h"
+
+const static char *TAG = "Fan-Curve";
+/*---------------------------------------------------------------
+        NTC table, folded by the compiler from NTC_POLY
+---------------------------------------------------------------*/
+#define NTC_ROW(i)      Q16(NTC_POLY((double)((i) << NTC_STEP_SHIFT)))
+#define NTC_ROW5(i)     NTC_ROW(i), NTC_ROW((i) + 1), NTC_ROW((i) + 2), NTC_ROW((i) + 3), NTC_ROW((i) + 4)
+
+static const q16_t ntc_table[NTC_TABLE_LEN] = {
+    NTC_ROW5(0),  NTC_ROW5(5),  NTC_ROW5(10), NTC_ROW5(15), NTC_ROW5(20),
+    NTC_ROW5(25), NTC_ROW5(30), NTC_ROW5(35), NTC_ROW5(40), NTC_ROW5(45),
+    NTC_ROW5(50), NTC_ROW5(55), NTC_ROW5(60), NTC_ROW5(65), NTC_ROW5(70),
+    NTC_ROW5(75), NTC_ROW5(80), NTC_ROW5(85), NTC_ROW5(90), NTC_ROW5(95),
+    NTC_ROW5(100),
+};
+
+/*---------------------------------------------------------------
+        Profile dependent part, rebuilt when the profile changes
+---------------------------------------------------------------*/
+void fan_curve_build(fan_curve_t *curve, const fan_curve_param_t *param, const fan_curve_common_t *common)
+{
+    const float *off = common->offset;
+    const float *gain = common->gain;
+    float x = 0, y = off[0];
+
+    curve->t_zero = Q16(param->t_zero);
+    curve->inv_tspan = Q32(1.0 / (param->t_max - param->t_zero));
+    curve->termal_max = Q16(param->termal_max);
+    curve->inv_termal = Q32(1.0 / param->termal_max);
+    curve->i_scale = Q32(param->i_scale);
+    curve->start_duty = Q16(param->start_duty);
+    for (int seg = 0; seg < FAN_CURVE_SEGS; seg++) {
+        if (seg) {
+            y += gain[seg - 1] * (off[seg] - x);
+            x = off[seg];
+        }
+        curve->i2duty[seg] = (fan_curve_seg_t){ Q16(x), Q16(y), Q32(gain[seg]) };
+    }
+    curve->fusion_major = Q16(common->devide / common->devide);
+    curve->fusion_minor = Q16((1 - common->devide) / common->devide);
+    fan_est_build(&curve->model, &param->model);
+}
+
+/*---------------------------------------------------------------
+        Fixed point pipeline
+---------------------------------------------------------------*/
+q16_t ntc2temp_q(q16_t mv)
+{
+    const q16_t mv_max = q16_from_int((NTC_TABLE_LEN - 1) << NTC_STEP_SHIFT) - 1;
+
+    mv = q16_clamp(mv, 0, mv_max);
+    int idx = mv >> (Q16_SHIFT + NTC_STEP_SHIFT);
+    q16_t frac = (mv >> NTC_STEP_SHIFT) & (Q16_ONE - 1);
+    return ntc_table[idx] + q16_mul(ntc_table[idx + 1] - ntc_table[idx], frac);
+}
+
+q16_t i2duty_q(const fan_curve_t *curve, q16_t ma)
+{
+    int seg = 0;
+
+    ma = q16_mul_q32(ma, curve->i_scale);
+    while (seg + 1 < FAN_CURVE_SEGS && ma >= curve->i2duty[seg + 1].x0) {
+        seg++;
+    }
+    return curve->i2duty[seg].y0 + q16_mul_q32(ma - curve->i2duty[seg].x0, curve->i2duty[seg].slope);
+}
+
+q16_t tt2duty_q(const fan_curve_t *curve, q16_t troom, q16_t tcell)
+{
+    q16_t termal;
+
+    termal = tcell-troom;
+    if(termal > curve->termal_max)
+          return q16_mul_q32(tcell-curve->t_zero, curve->inv_tspan);
+    else
+        if(termal > 0)
+        {
+            termal = q16_mul_q32(termal, curve->inv_termal);
+            return q16_mul(termal, q16_mul_q32(tcell-curve->t_zero, curve->inv_tspan));
+        }
+        else
+            if(termal < Q16(-10.0))
+            {
+                // Cell sensor unhealthy, room temperature used; fan_fault.h reports it
+                return q16_mul_q32(troom-curve->t_zero, curve->inv_tspan);
+            }
+            else
+                return 0;
+}
+
+q16_t fusion_q(const fan_curve_t *curve, q16_t major, q16_t minor)
+{
+    q16_t merger = q16_mul(major, curve->fusion_major) + q16_mul(minor, curve->fusion_minor);
+    return q16_clamp(merger, 0, Q16_ONE);
+}
+
+/*---------------------------------------------------------------
+        Float reference, the pipeline as it was before Q16
+---------------------------------------------------------------*/
+float i2duty_f(float i)
+{
+    if(i < OFFSET1)
+        return OFFSET0+GAIN0*i;
+    else
+        if(i < OFFSET2)
+            return OFFSET0+GAIN0*OFFSET1-GAIN1*OFFSET1+GAIN1*i;
+        else
+            return OFFSET0+GAIN0*OFFSET1-GAIN1*OFFSET1+GAIN1*OFFSET2-GAIN2*OFFSET2+GAIN2*i;
+}
+
+float tt2duty_f(float troom, float tcell)
+{
+    float termal;
+
+    termal = tcell-troom;
+    if(termal > TERMAL_MAX)
+          return (tcell-T_ZERO)/(T_MAX-T_ZERO);
+    else
+        if(termal > 0)
+        {
+            termal /= TERMAL_MAX;
+            return termal*(tcell-T_ZERO)/(T_MAX-T_ZERO);
+        }
+        else
+            if(termal < -10.0)
+                return (troom-T_ZERO)/(T_MAX-T_ZERO);
+            else
+                return 0.0;
+}
+
+float fusion_f(float major,float minor)
+{
+    float merger;
+    merger = major*DEVIDE+minor*(1-DEVIDE);
+    merger *= SCALE;
+    if(merger > 1.0)
+        return 1.0;
+    else
+        if(merger < 0)
+            return 0;
+        else
+            return merger;
+}
+
+float ntc2temp_f(float voltage)
+{
+    float temp = 3.79e-5;
+
+    temp -= 6.76e-9*voltage;
+    temp *= voltage;
+    temp *= voltage;
+    temp -= 9.65e-2*voltage;
+    return temp + 116.0;
+}
+
+/*---------------------------------------------------------------
+        Equivalence check and benchmark
+---------------------------------------------------------------*/
+#define SELFTEST_ITERATIONS 20000
+#define SELFTEST_TOL_TEMP   0.05    // ℃, NTC table interpolation
+#define SELFTEST_TOL_DUTY   0.004   // Below one 8-bit PWM step
+
+typedef struct {
+    int current;    // mV
+    int ntc;        // mV
+    float tsens;    // ℃
+} selftest_input_t;
+
+typedef struct {
+    float current, troom, tcell;
+} pipeline_f_t;
+
+typedef struct {
+    q16_t current, troom, tcell;
+} pipeline_q_t;
+
+static uint32_t selftest_rand_state = 0x1234567u;
+
+static float selftest_max_abs(float max, float e)
+{
+    e = e < 0 ? -e : e;
+    return e > max ? e : max;
+}
+
+static int selftest_rand(int lo, int hi)
+{
+    selftest_rand_state = selftest_rand_state * 1664525u + 1013904223u;
+    return lo + (int)((selftest_rand_state >> 8) % (uint32_t)(hi - lo + 1));
+}
+
+static void selftest_next_input(selftest_input_t *in)
+{
+    // Random walk over the range seen in the cage
+    in->current = q16_clamp(in->current + selftest_rand(-60, 60), 0, 3000);
+    in->ntc = q16_clamp(in->ntc + selftest_rand(-20, 20), 600, 2400);
+    in->tsens += selftest_rand(-5, 5) / 100.0f;
+    in->tsens = in->tsens < 15 ? 15 : (in->tsens > 40 ? 40 : in->tsens);
+}
+
+static float pipeline_f(pipeline_f_t *st, const selftest_input_t *in)
+{
+    st->troom *= 1.0-TSENS_FILTFACTOR;
+    st->troom += (in->tsens-SELFHEAT)*TSENS_FILTFACTOR;
+    st->tcell *= 1.0-TCELL_FILTFACTOR;
+    st->tcell += ntc2temp_f(in->ntc)*TCELL_FILTFACTOR;
+    st->current *= 1.0-CURRENT_FILTFACTOR;
+    st->current += CURRENT_FILTFACTOR*in->current;
+    return fusion_f(tt2duty_f(st->troom, st->tcell), i2duty_f(st->current));
+}
+
+static fan_curve_t selftest_curve;
+
+static q16_t pipeline_q(pipeline_q_t *st, const selftest_input_t *in, q16_t tsens)
+{
+    st->troom = q16_ema(st->troom, tsens - Q16(SELFHEAT), Q16(TSENS_FILTFACTOR));
+    st->tcell = q16_ema(st->tcell, ntc2temp_q(q16_from_int(in->ntc)), Q16(TCELL_FILTFACTOR));
+    st->current = q16_ema(st->current, q16_from_int(in->current), Q16(CURRENT_FILTFACTOR));
+    return fusion_q(&selftest_curve, tt2duty_q(&selftest_curve, st->troom, st->tcell), i2duty_q(&selftest_curve, st->current));
+}
+
+esp_err_t fan_curve_selftest(void)
+{
+    float err_temp = 0, err_duty = 0;
+    int skipped = 0;
+    const fan_curve_param_t param = FAN_CURVE_PARAM_DEFAULT;
+    const fan_curve_common_t common = FAN_CURVE_COMMON_DEFAULT;
+
+    fan_curve_build(&selftest_curve, &param, &common);
+    //-------------Static curves---------------//
+    for (int mv = 0; mv <= 3300; mv++) {
+        err_temp = selftest_max_abs(err_temp, ntc2temp_q(q16_from_int(mv)) / 65536.0f - ntc2temp_f(mv));
+        err_duty = selftest_max_abs(err_duty, i2duty_q(&selftest_curve, q16_from_int(mv)) / 65536.0f - i2duty_f(mv));
+    }
+
+    //-------------Filtered pipeline---------------//
+    selftest_input_t in = { .current = 400, .ntc = 1500, .tsens = 30 };
+    pipeline_f_t st_f = { in.current, in.tsens - SELFHEAT, ntc2temp_f(in.ntc) };
+    pipeline_q_t st_q = { q16_from_int(in.current), Q16(30 - SELFHEAT), ntc2temp_q(q16_from_int(in.ntc)) };
+    for (int i = 0; i < SELFTEST_ITERATIONS; i++) {
+        selftest_next_input(&in);
+        float duty_f = pipeline_f(&st_f, &in);
+        q16_t duty_q = pipeline_q(&st_q, &in, (q16_t)(in.tsens * 65536));
+        // tt2duty steps at the unhealthy-sensor edge, both sides are valid there
+        float edge = st_f.tcell - st_f.troom + 10.0f;
+        if (edge > -0.05f && edge < 0.05f) {
+            skipped++;
+            continue;
+        }
+        err_duty = selftest_max_abs(err_duty, duty_q / 65536.0f - duty_f);
+    }
+    ESP_LOGI(TAG, "Fixed vs float: max Cell-T error %.4f℃, max duty error %.4f (%d edge samples skipped)",
+             err_temp, err_duty, skipped);
+
+    //-------------Cost per control iteration---------------//
+    volatile float sink_f = 0;
+    volatile q16_t sink_q = 0;
+    uint32_t start = fan_hal_bench_now();
+    for (int i = 0; i < SELFTEST_ITERATIONS; i++) {
+        sink_f += pipeline_f(&st_f, &in);
+    }
+    uint32_t cost_f = (fan_hal_bench_now() - start) / SELFTEST_ITERATIONS;
+    start = fan_hal_bench_now();
+    for (int i = 0; i < SELFTEST_ITERATIONS; i++) {
+        sink_q += pipeline_q(&st_q, &in, Q16(30));
+    }
+    uint32_t cost_q = (fan_hal_bench_now() - start) / SELFTEST_ITERATIONS;
+    ESP_LOGI(TAG, "Control iteration: float %lu %s, Q16 %lu %s",
+             (unsigned long)cost_f, FAN_HAL_BENCH_UNIT, (unsigned long)cost_q, FAN_HAL_BENCH_UNIT);
+
+    if (err_temp > SELFTEST_TOL_TEMP || err_duty > SELFTEST_TOL_DUTY) {
+        ESP_LOGE(TAG, "Fixed point pipeline out of tolerance");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
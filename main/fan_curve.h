@@ -0,0 +1,116 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include "esp_err.h"
+#include "fan_fixed.h"
+#include "fan_est.h"
+
+/*---------------------------------------------------------------
+        Fan control profile Macros
+---------------------------------------------------------------*/
+#define FAN_START_DUTY   0.23
+//#define FAN_STOP_DUTY    0.17
+#define FAN_SELFTEST_UPER    0.35
+
+#define OFFSET0     0
+#define OFFSET1     400
+#define OFFSET2     1500
+#define GAIN0       0.001000000
+#define GAIN1       0.000363636
+#define GAIN2       0.000100000
+
+#define TERMAL_MAX 10.0
+#define T_ZERO    25.0
+#define T_MAX    50.0
+
+#define DEVIDE      0.681
+#define SCALE       (1.0/DEVIDE)
+#define SELFHEAT    0.75
+
+#define TSENS_FILTFACTOR    0.03125
+//#define TCELL_FILTFACTOR    0.03125
+#define TCELL_FILTFACTOR    0.0625
+//#define CURRENT_FILTFACTOR  0.01953125
+#define CURRENT_FILTFACTOR  0.09375
+
+// NTC divider curve, temperature over millivolts
+#define NTC_POLY(v)     (((3.79e-5 - 6.76e-9 * (v)) * (v) * (v)) - 9.65e-2 * (v) + 116.0)
+#define NTC_STEP_SHIFT  5       // Table step 32 mV
+#define NTC_TABLE_LEN   105     // 0..3328 mV
+
+/*---------------------------------------------------------------
+        Tunable curve parameters
+
+        The Macros above are the compiled defaults. At run time the
+        curve comes from the control profile (fan_profile.h), which
+        holds these in float; fan_curve_build() turns them into the
+        fixed point form the pipeline runs on. Nothing is rebuilt per
+        tick.
+---------------------------------------------------------------*/
+#define FAN_CURVE_SEGS  3
+
+typedef struct {
+    float t_zero;       // ℃ where the temperature curve starts
+    float t_max;        // ℃ of full temperature demand
+    float termal_max;   // Cell over room rise for the full temperature curve
+    float i_scale;      // Rail current relative to the reference cage
+    float start_duty;   // Fan breaks away from standstill above this duty
+    fan_est_param_t model;  // Thermal model of the cage for the estimator
+} fan_curve_param_t;
+
+#define FAN_CURVE_PARAM_MODEL(t_zero, t_max, termal_max, i_scale, start_duty, model) \
+        { t_zero, t_max, termal_max, i_scale, start_duty, model }
+#define FAN_CURVE_PARAM(t_zero, t_max, termal_max, i_scale, start_duty) \
+        FAN_CURVE_PARAM_MODEL(t_zero, t_max, termal_max, i_scale, start_duty, FAN_EST_PARAM_DEFAULT)
+#define FAN_CURVE_PARAM_DEFAULT FAN_CURVE_PARAM(T_ZERO, T_MAX, TERMAL_MAX, 1.0, FAN_START_DUTY)
+
+// Shared by all zones
+typedef struct {
+    float offset[FAN_CURVE_SEGS];   // OFFSET0 is the duty at 0 mA, OFFSET1/2 are segment starts in mA
+    float gain[FAN_CURVE_SEGS];     // Duty per mA of each segment
+    float devide;                   // Weight of the temperature demand in the fusion
+} fan_curve_common_t;
+
+#define FAN_CURVE_COMMON_DEFAULT { { OFFSET0, OFFSET1, OFFSET2 }, { GAIN0, GAIN1, GAIN2 }, DEVIDE }
+
+typedef struct {
+    q16_t x0;
+    q16_t y0;
+    int64_t slope;      // Q32
+} fan_curve_seg_t;
+
+typedef struct {
+    q16_t t_zero;
+    int64_t inv_tspan;  // Q32, 1/(t_max - t_zero)
+    q16_t termal_max;
+    int64_t inv_termal; // Q32, 1/termal_max
+    int64_t i_scale;    // Q32
+    q16_t start_duty;
+    fan_curve_seg_t i2duty[FAN_CURVE_SEGS];
+    q16_t fusion_major; // devide/devide
+    q16_t fusion_minor; // (1 - devide)/devide
+    fan_est_model_t model;
+} fan_curve_t;
+
+void fan_curve_build(fan_curve_t *curve, const fan_curve_param_t *param, const fan_curve_common_t *common);
+
+/*---------------------------------------------------------------
+        Sensor-to-duty pipeline, Q16.16 (table driven)
+---------------------------------------------------------------*/
+q16_t ntc2temp_q(q16_t mv);
+q16_t i2duty_q(const fan_curve_t *curve, q16_t ma);
+q16_t tt2duty_q(const fan_curve_t *curve, q16_t troom, q16_t tcell);
+q16_t fusion_q(const fan_curve_t *curve, q16_t major, q16_t minor);
+
+/*---------------------------------------------------------------
+        Float reference of the same pipeline, compiled defaults only
+---------------------------------------------------------------*/
+float ntc2temp_f(float voltage);
+float i2duty_f(float i);
+float tt2duty_f(float troom, float tcell);
+float fusion_f(float major, float minor);
+
+// Bound the fixed point error against the float reference and time both
+esp_err_t fan_curve_selftest(void);
@@ -0,0 +1,298 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stddef.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "fan_hal.h"
+#include "fan_rpm.h"
+#include "fan_cycle.h"
+
+const static char *TAG = "Fan-Cycle";
+
+typedef struct {
+    uint32_t starts;
+    uint32_t restarts;
+    int64_t on_ms;
+    int64_t duty_ms;        // Q16 duty times ms while running
+    int64_t since_us;
+} cycle_count_t;
+
+typedef struct {
+    fan_cycle_state_t state;
+    q16_t start_at;
+    q16_t stop_at;
+    q16_t floor;            // Lowest running duty
+    q16_t start_duty;
+    int64_t state_us;       // Entered the current state
+    int64_t last_us;        // Last update
+    uint32_t starts_total;
+    q16_t floor_raised;     // Learned floor, 0 until the fan stalled at the default
+    cycle_count_t boot;
+    cycle_count_t period;   // Since the last statistics line
+} cycle_zone_t;
+
+typedef struct {
+    uint32_t starts_total;
+    q16_t floor_raised;
+} cycle_entry_t;
+
+typedef struct {
+    uint32_t version;
+    uint32_t size;
+    cycle_entry_t zone[FAN_ZONE_NUM];
+    uint32_t crc;
+} cycle_store_t;
+
+static portMUX_TYPE cycle_lock = portMUX_INITIALIZER_UNLOCKED;
+static cycle_zone_t cycle_zones[FAN_ZONE_NUM];
+static int64_t cycle_stats_us;
+static bool cycle_dirty;            // Store behind the counters
+
+/*---------------------------------------------------------------
+        Store
+---------------------------------------------------------------*/
+static uint32_t cycle_crc(const cycle_store_t *s)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)s, offsetof(cycle_store_t, crc));
+}
+
+static esp_err_t cycle_save(void)
+{
+    cycle_store_t s;
+
+    memset(&s, 0, sizeof(s));
+    s.version = FAN_CYCLE_VERSION;
+    s.size = sizeof(s);
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        s.zone[zone].starts_total = cycle_zones[zone].starts_total;
+        s.zone[zone].floor_raised = cycle_zones[zone].floor_raised;
+    }
+    s.crc = cycle_crc(&s);
+    return fan_hal_store_set(FAN_CYCLE_KEY, &s, sizeof(s));
+}
+
+esp_err_t fan_cycle_init(void)
+{
+    cycle_store_t s;
+    int64_t now_us = fan_hal_now_us();
+    esp_err_t ret = fan_hal_store_get(FAN_CYCLE_KEY, &s, sizeof(s));
+
+    if (ret == ESP_OK && (s.version != FAN_CYCLE_VERSION || s.size != sizeof(s) || s.crc != cycle_crc(&s))) {
+        ESP_LOGW(TAG, "Stored counters are for another build, starting over");
+        ret = ESP_ERR_INVALID_VERSION;
+    }
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        cycle_zone_t *z = &cycle_zones[zone];
+        memset(z, 0, sizeof(*z));
+        if (ret == ESP_OK) {
+            z->starts_total = s.zone[zone].starts_total;
+            z->floor_raised = s.zone[zone].floor_raised;
+        }
+        z->state_us = now_us - FAN_CYCLE_MIN_OFF_S * 1000000LL;     // Free to start at boot
+        z->last_us = now_us;
+        z->boot.since_us = now_us;
+        z->period.since_us = now_us;
+    }
+    cycle_stats_us = now_us;
+    return ret == ESP_OK || ret == ESP_ERR_NOT_FOUND || ret == ESP_ERR_INVALID_VERSION ? ESP_OK : ret;
+}
+
+/*---------------------------------------------------------------
+        Thresholds
+---------------------------------------------------------------*/
+static void cycle_thresholds(int zone)
+{
+    cycle_zone_t *z = &cycle_zones[zone];
+    q16_t floor = q16_mul(z->start_duty, Q16(FAN_CYCLE_FLOOR_SHARE));
+
+    z->start_at = z->start_duty + Q16(FAN_CYCLE_START_OVER);
+    z->stop_at = q16_mul(z->start_duty, Q16(FAN_CYCLE_STOP_SHARE));
+    z->floor = z->floor_raised > floor ? q16_clamp(z->floor_raised, floor, z->start_duty) : floor;
+    fan_rpm_floor(zone, z->floor);
+}
+
+void fan_cycle_set_start(int zone, q16_t start_duty, bool fresh)
+{
+    cycle_zone_t *z = &cycle_zones[zone];
+
+    portENTER_CRITICAL(&cycle_lock);
+    z->start_duty = start_duty;
+    if (fresh && z->floor_raised != 0) {
+        z->floor_raised = 0;
+        cycle_dirty = true;
+    }
+    cycle_thresholds(zone);
+    if (z->state != FAN_CYCLE_OFF) {
+        z->state = FAN_CYCLE_OFF;
+        z->state_us = fan_hal_now_us();
+    }
+    portEXIT_CRITICAL(&cycle_lock);
+    ESP_LOGI(TAG, "%s: start above %d%%, run at %d%% or more, stop below %d%%", fan_zones[zone].name,
+             q16_to_scaled(z->start_at, 100), q16_to_scaled(z->floor, 100), q16_to_scaled(z->stop_at, 100));
+}
+
+/*---------------------------------------------------------------
+        Statistics
+---------------------------------------------------------------*/
+static void cycle_count(cycle_count_t *c, q16_t applied, int64_t ms)
+{
+    c->on_ms += ms;
+    c->duty_ms += (int64_t)applied * ms;
+}
+
+// Starts per day over the count's time, in tenths
+static int cycle_per_day_x10(const cycle_count_t *c, int64_t now_us)
+{
+    int64_t ms = (now_us - c->since_us) / 1000;
+    return ms > 0 ? (int)((int64_t)c->starts * 864000000LL / ms) : 0;
+}
+
+static int cycle_run_pct(const cycle_count_t *c)
+{
+    return c->on_ms > 0 ? q16_to_scaled((q16_t)(c->duty_ms / c->on_ms), 100) : 0;
+}
+
+static void cycle_stats(int64_t now_us)
+{
+    if (now_us - cycle_stats_us < FAN_CYCLE_STATS_MS * 1000LL) {
+        return;
+    }
+    cycle_stats_us = now_us;
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        cycle_zone_t *z = &cycle_zones[zone];
+        int64_t span_ms = (now_us - z->period.since_us) / 1000;
+        int per_day = cycle_per_day_x10(&z->period, now_us);
+        int boot_day = cycle_per_day_x10(&z->boot, now_us);
+
+        ESP_LOGI(TAG, "%s: %lu starts (%d.%d/day, %d.%d/day since boot, %lu lifetime), %lu stall restarts, "
+                 "on %d%% of the time at %d%% mean duty, floor %d%%", fan_zones[zone].name,
+                 (unsigned long)z->period.starts, per_day / 10, per_day % 10, boot_day / 10, boot_day % 10,
+                 (unsigned long)z->starts_total, (unsigned long)z->period.restarts,
+                 span_ms > 0 ? (int)(z->period.on_ms * 100 / span_ms) : 0, cycle_run_pct(&z->period),
+                 q16_to_scaled(z->floor, 100));
+        portENTER_CRITICAL(&cycle_lock);
+        memset(&z->period, 0, sizeof(z->period));
+        z->period.since_us = now_us;
+        portEXIT_CRITICAL(&cycle_lock);
+    }
+    if (cycle_dirty) {
+        cycle_dirty = false;
+        if (cycle_save() != ESP_OK) {
+            ESP_LOGW(TAG, "Counters not stored");
+        }
+    }
+}
+
+/*---------------------------------------------------------------
+        State machine
+---------------------------------------------------------------*/
+static void cycle_enter(cycle_zone_t *z, fan_cycle_state_t state, int64_t now_us)
+{
+    z->state = state;
+    z->state_us = now_us;
+}
+
+fan_cycle_event_t fan_cycle_update(int zone, q16_t demand, q16_t applied, bool stalled, q16_t *duty)
+{
+    cycle_zone_t *z = &cycle_zones[zone];
+    int64_t now_us = fan_hal_now_us();
+    int64_t in_state_ms = (now_us - z->state_us) / 1000;
+    fan_cycle_event_t event;
+    q16_t kick = demand > Q16(FAN_CYCLE_KICK_DUTY) ? demand : Q16(FAN_CYCLE_KICK_DUTY);
+    q16_t run = demand > z->floor ? demand : z->floor;
+
+    cycle_stats(now_us);
+    portENTER_CRITICAL(&cycle_lock);
+    if (z->state != FAN_CYCLE_OFF) {
+        cycle_count(&z->boot, applied, (now_us - z->last_us) / 1000);
+        cycle_count(&z->period, applied, (now_us - z->last_us) / 1000);
+    }
+    z->last_us = now_us;
+
+    switch (z->state) {
+    case FAN_CYCLE_OFF:
+        if (demand > z->start_at && (in_state_ms >= FAN_CYCLE_MIN_OFF_S * 1000LL || demand >= Q16(FAN_CYCLE_URGENT))) {
+            cycle_enter(z, FAN_CYCLE_KICK, now_us);
+            z->boot.starts++;
+            z->period.starts++;
+            z->starts_total++;
+            cycle_dirty = true;
+            *duty = kick;
+            event = FAN_CYCLE_START;
+        } else {
+            *duty = 0;
+            event = FAN_CYCLE_IDLE;
+        }
+        break;
+    case FAN_CYCLE_KICK:
+        if (in_state_ms >= FAN_CYCLE_KICK_MS) {
+            cycle_enter(z, FAN_CYCLE_RUN, now_us);
+            *duty = run;
+            event = FAN_CYCLE_SPIN;
+        } else {
+            *duty = kick;
+            event = FAN_CYCLE_KICKING;
+        }
+        break;
+    default:
+        //-------------Under the stop threshold past the minimum on time---------------//
+        if (demand < z->stop_at && in_state_ms >= FAN_CYCLE_MIN_ON_S * 1000LL) {
+            cycle_enter(z, FAN_CYCLE_OFF, now_us);
+            *duty = 0;
+            event = FAN_CYCLE_STOP;
+        //-------------Stalled below the start duty: floor too low for this fan, raise and kick---------------//
+        } else if (stalled && applied < z->start_duty) {
+            q16_t floor = z->floor + Q16(FAN_CYCLE_STALL_STEP);
+            z->floor_raised = floor < z->start_duty ? floor : z->start_duty;
+            cycle_thresholds(zone);
+            cycle_enter(z, FAN_CYCLE_KICK, now_us);
+            z->boot.restarts++;
+            z->period.restarts++;
+            cycle_dirty = true;
+            *duty = kick;
+            event = FAN_CYCLE_RESTART;
+        } else {
+            *duty = run;
+            event = FAN_CYCLE_RUNNING;
+        }
+        break;
+    }
+    portEXIT_CRITICAL(&cycle_lock);
+    if (event == FAN_CYCLE_RESTART) {
+        ESP_LOGW(TAG, "%s: stalled at %d%%, floor raised to %d%%", fan_zones[zone].name,
+                 q16_to_scaled(applied, 100), q16_to_scaled(z->floor, 100));
+    }
+    return event;
+}
+
+fan_cycle_state_t fan_cycle_state(int zone)
+{
+    return cycle_zones[zone].state;
+}
+
+const char *fan_cycle_state_name(fan_cycle_state_t state)
+{
+    static const char *names[] = { "off", "kick", "run" };
+    return names[state];
+}
+
+void fan_cycle_get(int zone, fan_cycle_stats_t *out)
+{
+    const cycle_zone_t *z = &cycle_zones[zone];
+    int64_t now_us = fan_hal_now_us();
+
+    portENTER_CRITICAL(&cycle_lock);
+    out->state = z->state;
+    out->start_at = z->start_at;
+    out->stop_at = z->stop_at;
+    out->floor = z->floor;
+    out->starts = z->boot.starts;
+    out->starts_total = z->starts_total;
+    out->restarts = z->boot.restarts;
+    out->on_share = now_us > z->boot.since_us ? (float)z->boot.on_ms * 1000 / (now_us - z->boot.since_us) : 0;
+    out->run_duty = z->boot.on_ms > 0 ? (float)z->boot.duty_ms / z->boot.on_ms / Q16_ONE : 0;
+    portEXIT_CRITICAL(&cycle_lock);
+}
@@ -0,0 +1,90 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "fan_fixed.h"
+
+/*---------------------------------------------------------------
+        Start/stop Macros
+
+        Every fan goes through OFF -> KICK -> RUN -> OFF:
+
+            OFF     demand above the start duty of the self-test plus
+                    FAN_CYCLE_START_OVER, and off for FAN_CYCLE_MIN_OFF_S
+                    (a demand of FAN_CYCLE_URGENT starts at once)
+            KICK    FAN_CYCLE_KICK_DUTY, or the demand when higher, for
+                    FAN_CYCLE_KICK_MS: the fan breaks away however low
+                    its running duty will be
+            RUN     the demand, never below the floor. Demand under the
+                    stop threshold after FAN_CYCLE_MIN_ON_S of running
+                    turns the fan off.
+
+        A spinning fan keeps turning well below the duty it needs to
+        break away. The floor sits at FAN_CYCLE_FLOOR_SHARE of the
+        start duty, the stop threshold at FAN_CYCLE_STOP_SHARE: a cage
+        that needs less air than the start duty gives gets it slowly
+        and quietly instead of in bursts. A fan that stalls at the
+        floor is kicked again and its floor raised by
+        FAN_CYCLE_STALL_STEP, up to the start duty. The raised floor
+        and the lifetime starts are kept in NVS under FAN_CYCLE_KEY,
+        written with the statistics when they changed.
+---------------------------------------------------------------*/
+#define FAN_CYCLE_KEY           "cycle"
+#define FAN_CYCLE_VERSION       1
+#define FAN_CYCLE_KICK_DUTY     0.6
+#define FAN_CYCLE_KICK_MS       1500    // Ends on the first tick after this, the short period
+#define FAN_CYCLE_START_OVER    0.03    // Start hysteresis above the start duty
+#define FAN_CYCLE_FLOOR_SHARE   0.7     // Floor against the start duty, above the stall of common fans
+#define FAN_CYCLE_STOP_SHARE    0.35    // Stop threshold against the start duty
+#define FAN_CYCLE_STALL_STEP    0.02
+#define FAN_CYCLE_MIN_ON_S      300
+#define FAN_CYCLE_MIN_OFF_S     180
+#define FAN_CYCLE_URGENT        0.5     // Demand that skips the off time
+#define FAN_CYCLE_STATS_MS      (6 * 3600 * 1000)
+
+typedef enum {
+    FAN_CYCLE_OFF,
+    FAN_CYCLE_KICK,
+    FAN_CYCLE_RUN,
+} fan_cycle_state_t;
+
+// What the control task does with the fan this tick
+typedef enum {
+    FAN_CYCLE_IDLE,         // Stays off
+    FAN_CYCLE_START,        // Switch on at the kick duty
+    FAN_CYCLE_KICKING,      // Hold the kick duty
+    FAN_CYCLE_SPIN,         // Kick done, reset the RPM loop and run
+    FAN_CYCLE_RUNNING,      // Run the RPM loop
+    FAN_CYCLE_RESTART,      // Stalled at the floor, back to the kick duty
+    FAN_CYCLE_STOP,         // Switch off
+} fan_cycle_event_t;
+
+typedef struct {
+    fan_cycle_state_t state;
+    q16_t start_at;         // Demand that starts the fan
+    q16_t stop_at;          // Demand that stops the fan
+    q16_t floor;            // Lowest running duty
+    uint32_t starts;        // Since boot
+    uint32_t starts_total;  // Lifetime, NVS
+    uint32_t restarts;      // Stalls at the floor since boot
+    float on_share;         // Of the time since boot
+    float run_duty;         // Mean duty while running
+} fan_cycle_stats_t;
+
+// Load the stored floors and counters, before fan_cycle_set_start()
+esp_err_t fan_cycle_init(void);
+// Thresholds from the self-test start duty; a fresh test (not the cache) drops the learned floor.
+// The zone is taken as off.
+void fan_cycle_set_start(int zone, q16_t start_duty, bool fresh);
+// Control task, once per zone and tick: demand of the curve, duty on the PWM since the last
+// tick and the tach stall. *duty is the duty to apply (START, RESTART) or the demand for the
+// RPM loop (SPIN, RUNNING), at least the floor.
+fan_cycle_event_t fan_cycle_update(int zone, q16_t demand, q16_t applied, bool stalled, q16_t *duty);
+fan_cycle_state_t fan_cycle_state(int zone);
+const char *fan_cycle_state_name(fan_cycle_state_t state);
+// Copy of the zone's counters, any task
+void fan_cycle_get(int zone, fan_cycle_stats_t *out);
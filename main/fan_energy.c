@@ -0,0 +1,356 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stddef.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "fan_zone.h"
+#include "fan_pwm.h"
+#include "fan_perf.h"
+#include "fan_energy.h"
+
+const static char *TAG = "Fan-Energy";
+
+#define ENERGY_MINUTE_US    60000000LL
+#define ENERGY_HOUR_MIN     60
+#define ENERGY_DAY_H        24
+#define ENERGY_QUIET_NONE   INT32_MAX   // No block in the open minute yet
+
+// Counters are mA ms of the sensed rail, energy only on the way out
+typedef struct {
+    int64_t acc;            // Q16 mA ms not yet in the minute
+    q16_t last_ma;          // Block of the frame before, or the current at the boundary
+    uint64_t minute;
+    uint64_t last_minute;
+    uint64_t hour;
+    uint64_t last_hour;
+    uint64_t day;
+    uint64_t last_day;
+    uint64_t total;
+    uint64_t total_boot;    // Lifetime at boot
+    q16_t quiet;            // Quietest block of the open minute
+    int disks;
+    uint32_t spinups;
+    uint32_t spinups_total;
+} energy_zone_t;
+
+typedef struct {
+    uint64_t total;
+    uint64_t day;           // Open day up to its last closed hour
+    uint32_t spinups_total;
+    uint32_t reserved;
+} energy_entry_t;
+
+typedef struct {
+    uint32_t version;
+    uint32_t size;
+    uint32_t day_hours;     // Closed hours of the open day
+    uint32_t days;
+    energy_entry_t zone[FAN_ZONE_NUM];
+    uint32_t crc;
+} energy_store_t;
+
+static portMUX_TYPE energy_lock = portMUX_INITIALIZER_UNLOCKED;
+static energy_zone_t energy_zones[FAN_ZONE_NUM];
+static bool energy_started;         // First frame taken
+static int64_t energy_last_us;      // Frame before
+static int64_t energy_minute_end_us;
+static int energy_minutes;          // Closed minutes of the open hour
+static uint32_t energy_day_hours;   // Closed hours of the open day
+static uint32_t energy_days;
+static uint32_t energy_hours_closed;    // Since boot, the control task logs behind it
+
+//-------------Control task only---------------//
+static uint32_t energy_hours_logged;
+static uint32_t energy_days_logged;
+static int energy_disks_logged[FAN_ZONE_NUM];
+static int64_t energy_duty_ms[FAN_ZONE_NUM];    // Q16 duty times ms over the open hour
+static int64_t energy_duty_span_ms;
+static int64_t energy_report_us;
+
+/*---------------------------------------------------------------
+        Units
+---------------------------------------------------------------*/
+static uint64_t energy_mwh(uint64_t ma_ms)
+{
+    return ma_ms / 1000 * FAN_ENERGY_RAIL_MV / 3600000;
+}
+
+static float energy_wh(uint64_t ma_ms)
+{
+    return (float)ma_ms * FAN_ENERGY_RAIL_MV / 3.6e12f;
+}
+
+/*---------------------------------------------------------------
+        Store
+---------------------------------------------------------------*/
+static uint32_t energy_crc(const energy_store_t *s)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)s, offsetof(energy_store_t, crc));
+}
+
+static esp_err_t energy_save(void)
+{
+    energy_store_t s;
+
+    memset(&s, 0, sizeof(s));
+    s.version = FAN_ENERGY_VERSION;
+    s.size = sizeof(s);
+    portENTER_CRITICAL(&energy_lock);
+    s.day_hours = energy_day_hours;
+    s.days = energy_days;
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        s.zone[zone].total = energy_zones[zone].total;
+        s.zone[zone].day = energy_zones[zone].day;
+        s.zone[zone].spinups_total = energy_zones[zone].spinups_total;
+    }
+    portEXIT_CRITICAL(&energy_lock);
+    s.crc = energy_crc(&s);
+    return fan_hal_store_set(FAN_ENERGY_KEY, &s, sizeof(s));
+}
+
+esp_err_t fan_energy_init(void)
+{
+    energy_store_t s;
+    esp_err_t ret = fan_hal_store_get(FAN_ENERGY_KEY, &s, sizeof(s));
+
+    if (ret == ESP_OK && (s.version != FAN_ENERGY_VERSION || s.size != sizeof(s) || s.crc != energy_crc(&s)
+                       || s.day_hours >= ENERGY_DAY_H)) {
+        ESP_LOGW(TAG, "Stored counters are for another build, starting over");
+        ret = ESP_ERR_INVALID_VERSION;
+    }
+    memset(energy_zones, 0, sizeof(energy_zones));
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        energy_zone_t *z = &energy_zones[zone];
+        if (ret == ESP_OK) {
+            z->total = s.zone[zone].total;
+            z->total_boot = z->total;
+            z->day = s.zone[zone].day;
+            z->spinups_total = s.zone[zone].spinups_total;
+        }
+        z->quiet = ENERGY_QUIET_NONE;
+        energy_disks_logged[zone] = -1;
+    }
+    if (ret == ESP_OK) {
+        energy_day_hours = s.day_hours;
+        energy_days = s.days;
+        ESP_LOGI(TAG, "Day %lu goes on at hour %lu", (unsigned long)energy_days + 1, (unsigned long)energy_day_hours);
+    }
+    energy_days_logged = energy_days;
+    energy_report_us = fan_hal_now_us();
+    return ret == ESP_OK || ret == ESP_ERR_NOT_FOUND || ret == ESP_ERR_INVALID_VERSION ? ESP_OK : ret;
+}
+
+/*---------------------------------------------------------------
+        Metering, ADC task
+---------------------------------------------------------------*/
+// Spinning disks the rail level accounts for
+static int energy_level(int zone, q16_t level)
+{
+    const fan_zone_disks_t *d = &fan_zones[zone].disks;
+    int over = q16_to_scaled(level, 1) - d->base_ma;
+
+    if (d->bays <= 0 || d->spin_ma <= 0 || over <= 0) {
+        return 0;
+    }
+    over = (over + d->spin_ma / 2) / d->spin_ma;
+    return over < d->bays ? over : d->bays;
+}
+
+static void energy_count(energy_zone_t *z, int disks)
+{
+    if (disks > z->disks) {
+        z->spinups += disks - z->disks;
+        z->spinups_total += disks - z->disks;
+    }
+    z->disks = disks;
+}
+
+// Trapezoid between two currents dt_us apart into the open minute
+static void energy_add(energy_zone_t *z, q16_t from, q16_t to, int64_t dt_us)
+{
+    z->acc += ((int64_t)from + to) * dt_us / 2000;
+    int64_t whole = z->acc >> Q16_SHIFT;
+    z->acc -= whole << Q16_SHIFT;
+    z->minute += whole;
+}
+
+static void energy_close_minute(void)
+{
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        energy_zone_t *z = &energy_zones[zone];
+        z->last_minute = z->minute;
+        z->hour += z->minute;
+        z->day += z->minute;
+        z->total += z->minute;
+        z->minute = 0;
+        //-------------Level count---------------//
+        if (z->quiet != ENERGY_QUIET_NONE) {
+            energy_count(z, energy_level(zone, z->quiet));
+        }
+        z->quiet = ENERGY_QUIET_NONE;
+    }
+    if (++energy_minutes < ENERGY_HOUR_MIN) {
+        return;
+    }
+    energy_minutes = 0;
+    energy_hours_closed++;
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        energy_zones[zone].last_hour = energy_zones[zone].hour;
+        energy_zones[zone].hour = 0;
+    }
+    if (++energy_day_hours < ENERGY_DAY_H) {
+        return;
+    }
+    energy_day_hours = 0;
+    energy_days++;
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        energy_zones[zone].last_day = energy_zones[zone].day;
+        energy_zones[zone].day = 0;
+    }
+}
+
+void fan_energy_feed(const fan_hal_adc_frame_t *frame, int64_t now_us)
+{
+    uint32_t bench = fan_hal_bench_now();
+    q16_t ma[FAN_ZONE_NUM];
+
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        ma[zone] = frame->mv[zone][FAN_HAL_ADC_CURRENT] > 0 ? frame->mv[zone][FAN_HAL_ADC_CURRENT] : 0;
+    }
+    portENTER_CRITICAL(&energy_lock);
+    if (!energy_started) {
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            energy_zones[zone].last_ma = ma[zone];
+            energy_zones[zone].disks = energy_level(zone, ma[zone]);
+        }
+        energy_started = true;
+        energy_last_us = now_us;
+        energy_minute_end_us = now_us + ENERGY_MINUTE_US;
+    }
+
+    //-------------Split the segment at every minute boundary it crosses---------------//
+    while (now_us >= energy_minute_end_us) {
+        int64_t span_us = now_us - energy_last_us;
+        int64_t part_us = energy_minute_end_us - energy_last_us;
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            energy_zone_t *z = &energy_zones[zone];
+            q16_t at = z->last_ma + (q16_t)((int64_t)(ma[zone] - z->last_ma) * part_us / span_us);
+            energy_add(z, z->last_ma, at, part_us);
+            z->last_ma = at;
+        }
+        energy_last_us = energy_minute_end_us;
+        energy_minute_end_us += ENERGY_MINUTE_US;
+        energy_close_minute();
+    }
+
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        energy_zone_t *z = &energy_zones[zone];
+        energy_add(z, z->last_ma, ma[zone], now_us - energy_last_us);
+        z->last_ma = ma[zone];
+        if (ma[zone] < z->quiet) {
+            z->quiet = ma[zone];
+        }
+    }
+    energy_last_us = now_us;
+    portEXIT_CRITICAL(&energy_lock);
+    fan_perf_add(FAN_PERF_ENERGY_CPU, fan_hal_bench_now() - bench);
+}
+
+/*---------------------------------------------------------------
+        Reporting, control task
+---------------------------------------------------------------*/
+void fan_energy_report(void)
+{
+    int64_t now_us = fan_hal_now_us();
+    int64_t dt_ms = (now_us - energy_report_us) / 1000;
+    energy_zone_t z[FAN_ZONE_NUM];
+    uint32_t hours, days, day_hours;
+
+    energy_report_us = now_us;
+    energy_duty_span_ms += dt_ms;
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        energy_duty_ms[zone] += (int64_t)fan_pwm_duty(zone) * dt_ms;
+    }
+    portENTER_CRITICAL(&energy_lock);
+    memcpy(z, energy_zones, sizeof(z));
+    hours = energy_hours_closed;
+    days = energy_days;
+    day_hours = energy_day_hours;
+    portEXIT_CRITICAL(&energy_lock);
+
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        if (fan_zones[zone].disks.bays > 0 && z[zone].disks != energy_disks_logged[zone]) {
+            ESP_LOGI(TAG, "%s: %d of %d disks spinning", fan_zones[zone].name, z[zone].disks, fan_zones[zone].disks.bays);
+            energy_disks_logged[zone] = z[zone].disks;
+        }
+    }
+    if (hours == energy_hours_logged) {
+        return;
+    }
+    energy_hours_logged = hours;
+
+    //-------------Closed hour: energy against fan effort, then the day when it closed too---------------//
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        uint64_t mwh = energy_mwh(z[zone].last_hour);
+        uint64_t day_mwh = energy_mwh(z[zone].day);
+        int duty = energy_duty_span_ms > 0 ? q16_to_scaled((q16_t)(energy_duty_ms[zone] / energy_duty_span_ms), 100) : 0;
+
+        if (day_hours == 0) {
+            // The day line follows
+            ESP_LOGI(TAG, "%s: %lu.%02lu Wh last hour at %d%% mean fan duty, %d disks spinning", fan_zones[zone].name,
+                     (unsigned long)(mwh / 1000), (unsigned long)(mwh % 1000 / 10), duty, z[zone].disks);
+        } else {
+            ESP_LOGI(TAG, "%s: %lu.%02lu Wh last hour at %d%% mean fan duty, %d disks spinning, %lu.%02lu Wh in %lu h of the day",
+                     fan_zones[zone].name, (unsigned long)(mwh / 1000), (unsigned long)(mwh % 1000 / 10), duty,
+                     z[zone].disks, (unsigned long)(day_mwh / 1000), (unsigned long)(day_mwh % 1000 / 10),
+                     (unsigned long)day_hours);
+        }
+        energy_duty_ms[zone] = 0;
+    }
+    energy_duty_span_ms = 0;
+    if (days != energy_days_logged && day_hours == 0) {
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            uint64_t mwh = energy_mwh(z[zone].last_day);
+            uint64_t total_mwh = energy_mwh(z[zone].total);
+            ESP_LOGI(TAG, "%s: day %lu: %lu.%02lu Wh, %lu spin-ups since boot (%lu lifetime), %lu.%03lu kWh lifetime",
+                     fan_zones[zone].name, (unsigned long)days, (unsigned long)(mwh / 1000),
+                     (unsigned long)(mwh % 1000 / 10), (unsigned long)z[zone].spinups,
+                     (unsigned long)z[zone].spinups_total, (unsigned long)(total_mwh / 1000000),
+                     (unsigned long)(total_mwh % 1000000 / 1000));
+        }
+    }
+    energy_days_logged = days;
+    if (energy_save() != ESP_OK) {
+        ESP_LOGW(TAG, "Counters not stored");
+    }
+}
+
+int fan_energy_disks(int zone)
+{
+    return energy_zones[zone].disks;
+}
+
+void fan_energy_get(int zone, fan_energy_stats_t *out)
+{
+    energy_zone_t z;
+
+    portENTER_CRITICAL(&energy_lock);
+    z = energy_zones[zone];
+    out->day_h = energy_day_hours + energy_minutes / 60.0f;
+    out->days = energy_days;
+    portEXIT_CRITICAL(&energy_lock);
+    out->power_w = energy_wh(z.last_minute) * 60;
+    out->minute_wh = energy_wh(z.last_minute);
+    out->hour_wh = energy_wh(z.hour);
+    out->last_hour_wh = energy_wh(z.last_hour);
+    out->day_wh = energy_wh(z.day);
+    out->last_day_wh = energy_wh(z.last_day);
+    out->total_wh = energy_wh(z.total);
+    out->boot_wh = energy_wh(z.total - z.total_boot + z.minute);
+    out->disks = z.disks;
+    out->spinups = z.spinups;
+    out->spinups_total = z.spinups_total;
+}
@@ -0,0 +1,62 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "fan_hal.h"
+
+/*---------------------------------------------------------------
+        Rail energy Macros
+
+        Every ADC frame of the tick adds the 12V rail energy of each
+        zone since the frame before. A block is already the mean of
+        a whole DMA scan; between two blocks the current is taken as
+        the straight line joining them, and a window boundary splits
+        that segment where it falls. The AD8418 sense reads 1 mV per
+        mA (fan_hal.h), the rail is taken at FAN_ENERGY_RAIL_MV.
+
+        Energy adds up per minute, hour and day of metered time and
+        over the zone's life. Closed hours and days are logged by the
+        control task. Lifetime counters and the open day up to its
+        last full hour are kept in NVS under FAN_ENERGY_KEY, written
+        when an hour closes; after a reset the day goes on from there.
+
+        Spinning disks per zone, from fan_zones[].disks:
+            level   the quietest block of the last minute over the
+                    rail with every disk spun down, in idle disks and
+                    at most the bays. Seeks come in bursts and the
+                    quietest block sees past them.
+        Spin-ups are counted like fan starts.
+---------------------------------------------------------------*/
+#define FAN_ENERGY_KEY          "energy"
+#define FAN_ENERGY_VERSION      1
+#define FAN_ENERGY_RAIL_MV      12000
+
+typedef struct {
+    float power_w;          // Mean of the last closed minute
+    float minute_wh;        // Last closed minute
+    float hour_wh;          // Open hour
+    float last_hour_wh;
+    float day_wh;           // Open day
+    float last_day_wh;
+    float total_wh;         // Lifetime, NVS
+    float boot_wh;          // Since boot, the open minute included
+    float day_h;            // Metered time of the open day
+    uint32_t days;          // Closed days, lifetime
+    int disks;              // Spinning now
+    uint32_t spinups;       // Since boot
+    uint32_t spinups_total; // Lifetime, NVS
+} fan_energy_stats_t;
+
+// Load the stored counters, before the ADC task reads its first frame
+esp_err_t fan_energy_init(void);
+// ADC task, every frame
+void fan_energy_feed(const fan_hal_adc_frame_t *frame, int64_t now_us);
+// Control task, once per tick: logs count changes, closed hours and days, stores at the hour
+void fan_energy_report(void);
+int fan_energy_disks(int zone);
+// Copy of the zone's counters, any task
+void fan_energy_get(int zone, fan_energy_stats_t *out);
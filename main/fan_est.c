@@ -0,0 +1,336 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <math.h>
+#include <string.h>
+#include "esp_bit_defs.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "fan_hal.h"
+#include "fan_zone.h"
+#include "fan_est.h"
+
+const static char *TAG = "Fan-Est";
+
+/*---------------------------------------------------------------
+        Q8.24 covariance
+---------------------------------------------------------------*/
+#define KF_SHIFT        24
+#define KF_ONE          ((int32_t)1 << KF_SHIFT)
+#define KF(x)           ((int32_t)((x) * 16777216.0 + 0.5))
+
+#define EST_TC          FAN_EST_NTC         // State observed by each sensor
+#define EST_TA          FAN_EST_TSENS
+#define EST_H           FAN_EST_CURRENT
+#define EST_N           FAN_EST_SENSORS
+
+static inline int32_t kf_mul(int32_t a, int32_t b)
+{
+    return (int32_t)(((int64_t)a * b + (1 << (KF_SHIFT - 1))) >> KF_SHIFT);
+}
+
+// Q16 value times Q8.24 coefficient
+static inline q16_t kf_apply(int32_t k, q16_t v)
+{
+    return (q16_t)(((int64_t)k * v + (1 << (KF_SHIFT - 1))) >> KF_SHIFT);
+}
+
+static const int32_t est_r[EST_N] = {
+    KF(FAN_EST_R_NTC * FAN_EST_R_NTC),
+    KF(FAN_EST_R_TSENS * FAN_EST_R_TSENS),
+    KF((FAN_EST_R_CURRENT * FAN_EST_RAIL_V / 1000) * (FAN_EST_R_CURRENT * FAN_EST_RAIL_V / 1000)),    // W²
+};
+static const int32_t est_q[EST_N] = { KF(FAN_EST_Q_TCELL), KF(FAN_EST_Q_TAMB), KF(FAN_EST_Q_HEAT) };
+
+static const char *est_sensor_names[EST_N] = {
+    [FAN_EST_NTC]     = "NTC",
+    [FAN_EST_TSENS]   = "die sensor",
+    [FAN_EST_CURRENT] = "rail current",
+};
+
+typedef struct {
+    bool init;
+    q16_t x[EST_N];             // ℃, ℃, W on the rail
+    int32_t p[EST_N][EST_N];    // Q8.24
+    int64_t last_us;
+    uint32_t seq[EST_N];
+    uint8_t run[EST_N];         // Updates in a row that disagree with the suspect flag
+    uint8_t suspect;
+} est_zone_t;
+
+static est_zone_t est_zones[FAN_ZONE_NUM];
+
+void fan_est_build(fan_est_model_t *model, const fan_est_param_t *param)
+{
+    model->inv_tau = Q32(1.0 / param->tau);
+    model->rise = Q16(param->rise);
+    model->air = Q16(param->air);
+    model->base_w = Q16(param->base_w);
+}
+
+static q16_t est_watts(q16_t ma)
+{
+    return q16_mul_q32(ma, Q32(FAN_EST_RAIL_V / 1000));
+}
+
+static void est_start(est_zone_t *e, const fan_est_input_t *in)
+{
+    memset(e, 0, sizeof(*e));
+    e->x[EST_TC] = in->tcell;
+    e->x[EST_TA] = in->tamb;
+    e->x[EST_H] = est_watts(in->current);
+    for (int i = 0; i < EST_N; i++) {
+        e->p[i][i] = est_r[i];
+        e->seq[i] = in->seq[i];
+    }
+    e->last_us = in->stamp_us;
+    e->init = true;
+}
+
+//-------------Model step: only the cell row of F differs from identity---------------//
+static void est_predict(est_zone_t *e, const fan_est_model_t *m, int rpm, int64_t dt_us)
+{
+    int32_t a = (int32_t)((dt_us * m->inv_tau / 1000000) >> (32 - KF_SHIFT));     // dt/tau, Q8.24
+    q16_t c = Q16_ONE + q16_mul(m->air, q16_from_int(rpm) / 1000);
+    int32_t ac = (int32_t)(((int64_t)a * c) >> Q16_SHIFT);
+    int32_t ab = (int32_t)(((int64_t)a * m->rise) >> Q16_SHIFT);
+    int32_t g[EST_N];
+
+    ac = ac > KF_ONE ? KF_ONE : ac;     // Longer than the time constant lands on the equilibrium
+    int32_t f[EST_N] = { KF_ONE - ac, ac, ab };
+    e->x[EST_TC] += kf_apply(ab, e->x[EST_H] + m->base_w) - kf_apply(ac, e->x[EST_TC] - e->x[EST_TA]);
+
+    // P = F P F' + Q dt
+    for (int k = 0; k < EST_N; k++) {
+        g[k] = kf_mul(f[0], e->p[0][k]) + kf_mul(f[1], e->p[1][k]) + kf_mul(f[2], e->p[2][k]);
+    }
+    e->p[0][0] = kf_mul(g[0], f[0]) + kf_mul(g[1], f[1]) + kf_mul(g[2], f[2]);
+    for (int k = 1; k < EST_N; k++) {
+        e->p[0][k] = e->p[k][0] = g[k];
+    }
+    for (int i = 0; i < EST_N; i++) {
+        int64_t grow = (int64_t)est_q[i] * dt_us / 1000000;
+        int64_t v = e->p[i][i] + grow;
+        e->p[i][i] = v > KF(FAN_EST_P_MAX) ? KF(FAN_EST_P_MAX) : (int32_t)v;
+    }
+}
+
+static bool est_outside(const est_zone_t *e, int i, q16_t nu)
+{
+    int32_t s = e->p[i][i] + est_r[i];
+
+    // nu² > gate² * S, both sides Q32
+    return (int64_t)nu * nu > ((int64_t)FAN_EST_GATE * FAN_EST_GATE * s) << (2 * Q16_SHIFT - KF_SHIFT);
+}
+
+// Half again per held out reading: a model that drifted is taken back within a few ticks
+static void est_inflate(est_zone_t *e, int i)
+{
+    int32_t v = e->p[i][i] + e->p[i][i] / 2;
+    e->p[i][i] = v > KF(FAN_EST_P_MAX) ? KF(FAN_EST_P_MAX) : v;
+}
+
+// Scalar update of the state the sensor observes
+static void est_correct(est_zone_t *e, int i, q16_t nu)
+{
+    int32_t s = e->p[i][i] + est_r[i];
+    int32_t k[EST_N];
+    int32_t row[EST_N];
+
+    for (int j = 0; j < EST_N; j++) {
+        k[j] = (int32_t)(((int64_t)e->p[j][i] << KF_SHIFT) / s);
+        row[j] = e->p[i][j];
+    }
+    for (int j = 0; j < EST_N; j++) {
+        e->x[j] += kf_apply(k[j], nu);
+        for (int l = j; l < EST_N; l++) {
+            e->p[j][l] -= kf_mul(k[j], row[l]);
+            e->p[l][j] = e->p[j][l];
+        }
+    }
+}
+
+static void est_sensor(est_zone_t *e, int zone, int i, q16_t z, uint32_t seq)
+{
+    bool suspect = e->suspect & BIT(i);
+    q16_t nu = q16_clamp(z - e->x[i], Q16(-100), Q16(100));
+
+    if (seq == e->seq[i]) {
+        return;
+    }
+    e->seq[i] = seq;
+    bool outside = est_outside(e, i, nu);
+    if (outside && i == EST_H) {
+        //-------------Load steps are what the current does, take it as one---------------//
+        e->p[i][i] = KF(FAN_EST_P_MAX);
+        outside = false;
+    }
+    //-------------Temperatures cannot jump: hold the reading out and widen the gate---------------//
+    if (suspect) {
+        // Only the process noise widens it, a sensor comes back where the model is
+    } else if (outside) {
+        est_inflate(e, i);
+    } else {
+        est_correct(e, i, nu);
+    }
+    e->run[i] = outside != suspect ? e->run[i] + 1 : 0;
+    if (e->run[i] < FAN_EST_DIVERGE_N) {
+        return;
+    }
+    e->run[i] = 0;
+    e->suspect ^= BIT(i);
+    if (zone < 0) {
+        return;
+    }
+    if (!suspect) {
+        ESP_LOGW(TAG, "%s: %s diverges from the model, left out", fan_zones[zone].name, est_sensor_names[i]);
+    } else {
+        ESP_LOGI(TAG, "%s: %s agrees with the model again", fan_zones[zone].name, est_sensor_names[i]);
+    }
+}
+
+// zone < 0 for an instance outside est_zones[], stays quiet
+static void est_step(est_zone_t *e, int zone, const fan_est_model_t *model, const fan_est_input_t *in, fan_est_t *out)
+{
+    if (!e->init) {
+        est_start(e, in);
+    } else if (in->stamp_us > e->last_us) {
+        est_predict(e, model, in->rpm, in->stamp_us - e->last_us);
+        e->last_us = in->stamp_us;
+    }
+    //-------------A sensor the fault monitor took out runs on the model alone---------------//
+    if (!(in->skip & BIT(FAN_EST_NTC))) {
+        est_sensor(e, zone, FAN_EST_NTC, in->tcell, in->seq[FAN_EST_NTC]);
+    }
+    if (!(in->skip & BIT(FAN_EST_TSENS))) {
+        est_sensor(e, zone, FAN_EST_TSENS, in->tamb, in->seq[FAN_EST_TSENS]);
+    }
+    if (!(in->skip & BIT(FAN_EST_CURRENT))) {
+        est_sensor(e, zone, FAN_EST_CURRENT, est_watts(in->current), in->seq[FAN_EST_CURRENT]);
+    }
+    if (e->x[EST_H] < 0) {
+        e->x[EST_H] = 0;
+    }
+
+    out->tcell = e->x[EST_TC];
+    out->tamb = e->x[EST_TA];
+    out->current = q16_mul_q32(e->x[EST_H], Q32(1000 / FAN_EST_RAIL_V));
+    out->suspect = e->suspect;
+}
+
+void fan_est_update(int zone, const fan_est_model_t *model, const fan_est_input_t *in, fan_est_t *out)
+{
+    est_step(&est_zones[zone], zone, model, in, out);
+}
+
+const char *fan_est_sensor_name(fan_est_sensor_t sensor)
+{
+    return est_sensor_names[sensor];
+}
+
+/*---------------------------------------------------------------
+        Synthetic cage: the estimator and the EMA path on the same
+        noisy readings, the plant off the model by 20%
+---------------------------------------------------------------*/
+#define SELFTEST_TICK_S     2
+#define SELFTEST_HOURS      6
+#define SELFTEST_ITERATIONS 2000
+
+static uint32_t selftest_rand_state = 0x5eed5u;
+
+// Uniform with the given standard deviation
+static float selftest_noise(float sd)
+{
+    selftest_rand_state = selftest_rand_state * 1664525u + 1013904223u;
+    return sd * 1.732f * ((float)(selftest_rand_state >> 8) / 8388608.0f - 1.0f);
+}
+
+static int selftest_load_ma(int t_s)
+{
+    static const int loads[] = { 120, 1100, 380, 650, 900, 120 };
+    int slot = t_s / 3600;
+
+    // Spin-up surge at the start of the busy hour
+    if (slot == 1 && t_s % 3600 < 36) {
+        return 2200;
+    }
+    return loads[slot % (sizeof(loads) / sizeof(loads[0]))];
+}
+
+esp_err_t fan_est_selftest(void)
+{
+    const fan_est_param_t param = FAN_EST_PARAM_DEFAULT;
+    fan_est_model_t model;
+    est_zone_t e = { 0 };
+    fan_est_input_t in = { 0 };
+    fan_est_t out;
+    float cell = 30, room = 25, rpm = 0;
+    float ema_tcell = 0, ema_current = 0;
+    double se_est[2] = { 0 }, se_ema[2] = { 0 };
+    float max_est = 0, max_ema = 0;
+    int n = 0;
+
+    fan_est_build(&model, &param);
+    for (int t_s = 0; t_s < SELFTEST_HOURS * 3600; t_s += SELFTEST_TICK_S) {
+        //-------------Plant: slower, less rise per W, more base heat than the model---------------//
+        int load = selftest_load_ma(t_s);
+        float heat = FAN_EST_BASE_W * 1.2f + FAN_EST_RAIL_V * load / 1000;
+        cell += (heat * FAN_EST_RISE * 0.8f - (1 + FAN_EST_AIR * rpm / 1000) * (cell - room))
+              * SELFTEST_TICK_S / (FAN_EST_TAU * 1.2f);
+        rpm = cell > 36 ? 2000 : (cell < 34 ? 0 : rpm);
+
+        //-------------Readings---------------//
+        in.tcell = (q16_t)((cell + selftest_noise(FAN_EST_R_NTC)) * Q16_ONE);
+        in.tamb = (q16_t)((room + selftest_noise(FAN_EST_R_TSENS)) * Q16_ONE);
+        in.current = (q16_t)((load + selftest_noise(FAN_EST_R_CURRENT)) * Q16_ONE);
+        in.rpm = (int)rpm;
+        in.stamp_us = (int64_t)t_s * 1000000;
+        for (int i = 0; i < EST_N; i++) {
+            in.seq[i]++;
+        }
+        est_step(&e, -1, &model, &in, &out);
+        if (t_s == 0) {
+            ema_tcell = in.tcell / 65536.0f;
+            ema_current = in.current / 65536.0f;
+        }
+        ema_tcell += (in.tcell / 65536.0f - ema_tcell) * TCELL_FILTFACTOR;
+        ema_current += (in.current / 65536.0f - ema_current) * CURRENT_FILTFACTOR;
+
+        //-------------Error against the plant---------------//
+        float err_est = out.tcell / 65536.0f - cell, err_ema = ema_tcell - cell;
+        se_est[0] += err_est * err_est;
+        se_ema[0] += err_ema * err_ema;
+        max_est = err_est < 0 ? (-err_est > max_est ? -err_est : max_est) : (err_est > max_est ? err_est : max_est);
+        max_ema = err_ema < 0 ? (-err_ema > max_ema ? -err_ema : max_ema) : (err_ema > max_ema ? err_ema : max_ema);
+        err_est = out.current / 65536.0f - load;
+        err_ema = ema_current - load;
+        se_est[1] += err_est * err_est;
+        se_ema[1] += err_ema * err_ema;
+        n++;
+    }
+    float rms_est[2], rms_ema[2];
+    for (int i = 0; i < 2; i++) {
+        rms_est[i] = sqrtf(se_est[i] / n);
+        rms_ema[i] = sqrtf(se_ema[i] / n);
+    }
+    ESP_LOGI(TAG, "Cell-T error rms/max: EMA %.3f/%.2f℃, estimator %.3f/%.2f℃; rail current rms: EMA %.0fmA, estimator %.0fmA%s",
+             rms_ema[0], max_ema, rms_est[0], max_est, rms_ema[1], rms_est[1], e.suspect ? " (sensor flagged)" : "");
+
+    //-------------Cost of one zone update---------------//
+    uint32_t start = fan_hal_bench_now();
+    for (int i = 0; i < SELFTEST_ITERATIONS; i++) {
+        in.stamp_us += SELFTEST_TICK_S * 1000000;
+        for (int j = 0; j < EST_N; j++) {
+            in.seq[j]++;
+        }
+        est_step(&e, -1, &model, &in, &out);
+    }
+    uint32_t cost = (fan_hal_bench_now() - start) / SELFTEST_ITERATIONS;
+    ESP_LOGI(TAG, "Update: %lu %s per zone", (unsigned long)cost, FAN_HAL_BENCH_UNIT);
+
+    if (e.suspect || rms_est[0] >= rms_ema[0] || rms_est[1] >= rms_ema[1]) {
+        ESP_LOGE(TAG, "Estimator no better than the EMA filters");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,103 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "fan_fixed.h"
+
+/*---------------------------------------------------------------
+        Thermal state estimator Macros
+
+        A Kalman filter per zone over three states: cell temperature,
+        ambient temperature and heat input on the 12V rail. The cell
+        follows a first-order model of the cage,
+
+            dTc/dt = (rise * (H + base_w) - (1 + air * RPM/1000) * (Tc - Ta)) / tau
+
+        ambient and heat input are random walks. Each sensor observes
+        one state: the NTC the cell, the die sensor (minus self
+        heating) the ambient, the AD8418 the heat input. The updates
+        are scalar and sequential, nothing is inverted, and the whole
+        filter runs in integer arithmetic: states in Q16, covariance
+        in Q8.24 (FAN_EST_P_MAX keeps it in range).
+
+        A sensor whose innovation stays outside FAN_EST_GATE standard
+        deviations for FAN_EST_DIVERGE_N updates in a row is flagged
+        suspect and no longer corrects the state until it is back
+        inside the gate for as long. FAN_EST_ENABLE 0 runs the control
+        loop on the EMA filters of the sensor tasks as before.
+---------------------------------------------------------------*/
+#define FAN_EST_ENABLE      1
+
+// Sensor noise, standard deviation of one tick block
+#define FAN_EST_R_NTC       0.1     // ℃
+#define FAN_EST_R_TSENS     0.2     // ℃
+#define FAN_EST_R_CURRENT   10      // mA
+// Process noise, variance growth per second
+#define FAN_EST_Q_TCELL     0.00025 // ℃², what the cage model misses
+#define FAN_EST_Q_TAMB      0.00002 // ℃², room drift
+#define FAN_EST_Q_HEAT      0.05    // W², disk load changes
+#define FAN_EST_P_MAX       16.0    // Variance cap, ℃² or W²
+#define FAN_EST_GATE        5       // Standard deviations
+#define FAN_EST_DIVERGE_N   8       // Updates in a row outside (inside) the gate to flag (clear)
+#define FAN_EST_RAIL_V      12.0
+
+// Cage model defaults, the simulated cage of fan_hal_sim.c
+#define FAN_EST_TAU         6000.0  // s, cell time constant with the fan stopped
+#define FAN_EST_RISE        4.0     // ℃ per W with the fan stopped
+#define FAN_EST_AIR         2.13    // Cooling added per 1000 RPM, relative to still air
+#define FAN_EST_BASE_W      2.0     // Heat in the cage not drawn from the sensed rail
+
+typedef struct {
+    float tau;
+    float rise;
+    float air;
+    float base_w;
+} fan_est_param_t;
+
+#define FAN_EST_PARAM(tau, rise, air, base_w)   { tau, rise, air, base_w }
+#define FAN_EST_PARAM_DEFAULT   FAN_EST_PARAM(FAN_EST_TAU, FAN_EST_RISE, FAN_EST_AIR, FAN_EST_BASE_W)
+
+// Fixed point form, built with the rest of the curve
+typedef struct {
+    int64_t inv_tau;    // Q32, 1/s
+    q16_t rise;
+    q16_t air;
+    q16_t base_w;
+} fan_est_model_t;
+
+void fan_est_build(fan_est_model_t *model, const fan_est_param_t *param);
+
+typedef enum {
+    FAN_EST_NTC,            // Observes the cell temperature
+    FAN_EST_TSENS,          // Observes the ambient temperature
+    FAN_EST_CURRENT,        // Observes the heat input
+    FAN_EST_SENSORS,
+} fan_est_sensor_t;
+
+typedef struct {
+    q16_t tcell;            // ℃
+    q16_t tamb;             // ℃
+    q16_t current;          // mA on the rail, the heat input
+    uint8_t suspect;        // BIT(fan_est_sensor_t) of the sensors left out
+} fan_est_t;
+
+// Raw readings of one tick, a sensor with an unchanged seq since the last call is not new
+typedef struct {
+    q16_t tcell;            // ntc2temp of the NTC block
+    q16_t tamb;             // Die sensor minus self heating
+    q16_t current;          // mA
+    uint32_t seq[FAN_EST_SENSORS];
+    uint8_t skip;           // BIT(fan_est_sensor_t) of the sensors with an active fault, not read
+    int rpm;
+    int64_t stamp_us;       // Of the ADC block
+} fan_est_input_t;
+
+// Control task, once per zone and tick
+void fan_est_update(int zone, const fan_est_model_t *model, const fan_est_input_t *in, fan_est_t *out);
+const char *fan_est_sensor_name(fan_est_sensor_t sensor);
+// Estimator against the EMA path on a synthetic cage, and the cost of one update
+esp_err_t fan_est_selftest(void);
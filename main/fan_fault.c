@@ -0,0 +1,303 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_bit_defs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "fan_hal.h"
+#include "fan_est.h"
+#include "fan_fault.h"
+
+const static char *TAG = "Fan-Fault";
+
+#define FAULT_SLOTS         (FAN_ZONE_NUM + 1)  // The zones, then the board
+#define FAULT_ZONE_MASK     (BIT(FAN_FAULT_TSENS) - 1)
+
+typedef struct {
+    const char *name;
+    int confirm_ms;
+    int clear_ms;
+    const char *failsafe;
+} fault_desc_t;
+
+static const fault_desc_t fault_descs[FAN_FAULT_MAX] = {
+    [FAN_FAULT_STALL]       = { "stall", FAN_FAULT_STALL_MS, FAN_FAULT_CLEAR_MS, "full duty" },
+    [FAN_FAULT_NTC_OPEN]    = { "ntc-open", FAN_FAULT_SENSOR_MS, FAN_FAULT_CLEAR_MS,
+                                FAN_EST_ENABLE ? "cell from the model, degraded curve" : "room for the cell, degraded curve" },
+    [FAN_FAULT_NTC_SHORT]   = { "ntc-short", FAN_FAULT_SENSOR_MS, FAN_FAULT_CLEAR_MS,
+                                FAN_EST_ENABLE ? "cell from the model, degraded curve" : "room for the cell, degraded curve" },
+    [FAN_FAULT_CURRENT_SAT] = { "current-sat", FAN_FAULT_SENSOR_MS, FAN_FAULT_CLEAR_MS, "heat input held, degraded curve" },
+    [FAN_FAULT_DRIVER]      = { "driver", 0, 0, "retried next tick" },      // Calls are sparse, one success clears
+    [FAN_FAULT_TSENS]       = { "tsens", FAN_FAULT_SENSOR_MS, FAN_FAULT_CLEAR_MS, "ambient held" },
+    [FAN_FAULT_ADC]         = { "adc", FAN_FAULT_SENSOR_MS, FAN_FAULT_CLEAR_MS, "full duty on every zone" },
+};
+
+typedef struct {
+    bool active;
+    int64_t bad_since_us;       // First of the bad observations in a row, 0 after a good one
+    int64_t good_since_us;      // Same for good ones while active
+    int64_t report_us;          // Last log line
+    uint32_t raised;
+    uint32_t bad;
+    int64_t raised_us;
+    int detect_ms;
+} fault_slot_t;
+
+typedef enum {
+    FAULT_NONE,
+    FAULT_RAISED,
+    FAULT_REMIND,
+    FAULT_CLEARED,
+} fault_event_t;
+
+static portMUX_TYPE fault_lock = portMUX_INITIALIZER_UNLOCKED;
+static fault_slot_t fault_slots[FAN_FAULT_MAX][FAULT_SLOTS];
+static TaskHandle_t fault_blinker;
+
+static int fault_slot(int zone)
+{
+    return zone < 0 ? FAN_ZONE_NUM : zone;
+}
+
+static const char *fault_where(int zone)
+{
+    return zone < 0 ? "board" : fan_zones[zone].name;
+}
+
+/*---------------------------------------------------------------
+        Blink codes
+---------------------------------------------------------------*/
+static void fault_blink(int count, uint32_t ms)
+{
+    for (int i = 0; i < count; i++) {
+        fan_hal_led_set(1);
+        fan_hal_delay_ms(ms);
+        fan_hal_led_set(0);
+        fan_hal_delay_ms(ms);
+    }
+}
+
+// Sleeps without a timer while nothing is active, raising a fault wakes it
+static void fault_blink_task(void *arg)
+{
+    while (1) {
+        int shown = 0;
+
+        for (int slot = 0; slot < FAULT_SLOTS; slot++) {
+            for (int fault = 0; fault < FAN_FAULT_MAX; fault++) {
+                if (!fault_slots[fault][slot].active) {
+                    continue;
+                }
+                fault_blink(fault + 1, FAN_FAULT_BLINK_LONG_MS);
+                if (slot < FAN_ZONE_NUM) {
+                    fan_hal_delay_ms(FAN_FAULT_BLINK_GAP_MS);
+                    fault_blink(slot + 1, FAN_FAULT_BLINK_SHORT_MS);
+                }
+                fan_hal_delay_ms(FAN_FAULT_BLINK_PAUSE_MS);
+                shown++;
+            }
+        }
+        if (shown == 0) {
+            fan_hal_led_set(0);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
+esp_err_t fan_fault_init(void)
+{
+    fan_hal_led_set(0);
+    ESP_RETURN_ON_FALSE(xTaskCreate(fault_blink_task, "fault_blink", FAN_FAULT_STACK, NULL, FAN_FAULT_PRIO,
+                                    &fault_blinker) == pdPASS, ESP_ERR_NO_MEM, TAG, "blink task failed");
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        Observations
+---------------------------------------------------------------*/
+static void fault_log(fault_event_t event, fan_fault_t fault, int zone, const fault_slot_t *s, int64_t now_us)
+{
+    switch (event) {
+    case FAULT_RAISED:
+        ESP_LOGE(TAG, "%s: %s fault, confirmed %dms after the first bad reading; fail-safe: %s", fault_where(zone),
+                 fault_descs[fault].name, s->detect_ms, fault_descs[fault].failsafe);
+        break;
+    case FAULT_REMIND:
+        ESP_LOGW(TAG, "%s: %s fault active for %ds, %lu bad readings since boot", fault_where(zone),
+                 fault_descs[fault].name, (int)((now_us - s->raised_us) / 1000000), (unsigned long)s->bad);
+        break;
+    case FAULT_CLEARED:
+        ESP_LOGI(TAG, "%s: %s fault cleared after %ds", fault_where(zone), fault_descs[fault].name,
+                 (int)((now_us - s->raised_us) / 1000000));
+        break;
+    default:
+        break;
+    }
+}
+
+static fault_event_t fault_raise(fault_slot_t *s, int64_t now_us)
+{
+    s->active = true;
+    s->raised++;
+    s->raised_us = now_us;
+    s->report_us = now_us;
+    s->good_since_us = 0;
+    s->detect_ms = s->bad_since_us ? (int)((now_us - s->bad_since_us) / 1000) : 0;
+    return FAULT_RAISED;
+}
+
+void fan_fault_observe(fan_fault_t fault, int zone, bool bad)
+{
+    fault_slot_t *s = &fault_slots[fault][fault_slot(zone)];
+    int64_t now_us = fan_hal_now_us();
+    fault_event_t event = FAULT_NONE;
+
+    portENTER_CRITICAL(&fault_lock);
+    if (bad) {
+        s->bad++;
+        s->good_since_us = 0;
+        if (s->bad_since_us == 0) {
+            s->bad_since_us = now_us;
+        }
+        if (!s->active && now_us - s->bad_since_us >= fault_descs[fault].confirm_ms * 1000LL) {
+            event = fault_raise(s, now_us);
+        } else if (s->active && now_us - s->report_us >= FAN_FAULT_REPORT_MS * 1000LL) {
+            s->report_us = now_us;
+            event = FAULT_REMIND;
+        }
+    } else {
+        s->bad_since_us = 0;
+        if (s->active) {
+            if (s->good_since_us == 0) {
+                s->good_since_us = now_us;
+            }
+            if (now_us - s->good_since_us >= fault_descs[fault].clear_ms * 1000LL) {
+                s->active = false;
+                event = FAULT_CLEARED;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&fault_lock);
+    fault_log(event, fault, zone, s, now_us);
+    if (event == FAULT_RAISED && fault_blinker != NULL) {
+        xTaskNotifyGive(fault_blinker);
+    }
+}
+
+void fan_fault_raise(fan_fault_t fault, int zone)
+{
+    fault_slot_t *s = &fault_slots[fault][fault_slot(zone)];
+    int64_t now_us = fan_hal_now_us();
+    fault_event_t event = FAULT_NONE;
+
+    portENTER_CRITICAL(&fault_lock);
+    s->bad++;
+    s->bad_since_us = now_us;
+    if (!s->active) {
+        event = fault_raise(s, now_us);
+    }
+    portEXIT_CRITICAL(&fault_lock);
+    fault_log(event, fault, zone, s, now_us);
+    if (event == FAULT_RAISED && fault_blinker != NULL) {
+        xTaskNotifyGive(fault_blinker);
+    }
+}
+
+esp_err_t fan_fault_driver(esp_err_t ret, int zone, const char *what)
+{
+    if (ret != ESP_OK && !fan_fault_active(FAN_FAULT_DRIVER, zone)) {
+        ESP_LOGW(TAG, "%s: %s failed (%s)", fault_where(zone), what, esp_err_to_name(ret));
+    }
+    fan_fault_observe(FAN_FAULT_DRIVER, zone, ret != ESP_OK);
+    return ret;
+}
+
+void fan_fault_check_sensors(int zone, q16_t ntc_mv, q16_t current_mv, q16_t tcell, q16_t troom)
+{
+    fan_fault_observe(FAN_FAULT_NTC_OPEN, zone, ntc_mv > Q16(FAN_FAULT_NTC_OPEN_MV)
+                      || tcell < troom - Q16(FAN_FAULT_NTC_BELOW_ROOM));
+    fan_fault_observe(FAN_FAULT_NTC_SHORT, zone, ntc_mv < Q16(FAN_FAULT_NTC_SHORT_MV));
+    fan_fault_observe(FAN_FAULT_CURRENT_SAT, zone, current_mv > Q16(FAN_FAULT_CURRENT_SAT_MV));
+}
+
+bool fan_fault_check_tsens(esp_err_t ret, q16_t celsius)
+{
+    bool bad = ret != ESP_OK || celsius < Q16(FAN_FAULT_TSENS_MIN) || celsius > Q16(FAN_FAULT_TSENS_MAX);
+
+    fan_fault_observe(FAN_FAULT_TSENS, -1, bad);
+    return !bad;
+}
+
+/*---------------------------------------------------------------
+        State
+---------------------------------------------------------------*/
+bool fan_fault_active(fan_fault_t fault, int zone)
+{
+    return fault_slots[fault][fault_slot(zone)].active;
+}
+
+bool fan_fault_seen(fan_fault_t fault, int zone)
+{
+    const fault_slot_t *s = &fault_slots[fault][fault_slot(zone)];
+    return s->active || s->bad_since_us != 0;
+}
+
+bool fan_fault_pending(void)
+{
+    for (int fault = 0; fault < FAN_FAULT_MAX; fault++) {
+        for (int slot = 0; slot < FAULT_SLOTS; slot++) {
+            if (!fault_slots[fault][slot].active && fault_slots[fault][slot].bad_since_us != 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+uint32_t fan_fault_mask(int zone)
+{
+    uint32_t mask = 0;
+
+    for (int fault = 0; fault < FAN_FAULT_MAX; fault++) {
+        if (((BIT(fault) & FAULT_ZONE_MASK) && fault_slots[fault][fault_slot(zone)].active)
+         || (!(BIT(fault) & FAULT_ZONE_MASK) && fault_slots[fault][FAN_ZONE_NUM].active)) {
+            mask |= BIT(fault);
+        }
+    }
+    return mask;
+}
+
+q16_t fan_fault_failsafe(int zone, q16_t demand, bool *full)
+{
+    uint32_t mask = fan_fault_mask(zone);
+
+    *full = mask & (BIT(FAN_FAULT_STALL) | BIT(FAN_FAULT_ADC));
+    if (*full) {
+        return Q16_ONE;
+    }
+    if (mask & (BIT(FAN_FAULT_NTC_OPEN) | BIT(FAN_FAULT_NTC_SHORT) | BIT(FAN_FAULT_CURRENT_SAT))) {
+        return demand > Q16(FAN_FAULT_DEGRADED_DUTY) ? demand : Q16(FAN_FAULT_DEGRADED_DUTY);
+    }
+    return demand;
+}
+
+const char *fan_fault_name(fan_fault_t fault)
+{
+    return fault_descs[fault].name;
+}
+
+void fan_fault_get(fan_fault_t fault, int zone, fan_fault_stats_t *out)
+{
+    const fault_slot_t *s = &fault_slots[fault][fault_slot(zone)];
+
+    portENTER_CRITICAL(&fault_lock);
+    out->active = s->active;
+    out->raised = s->raised;
+    out->bad = s->bad;
+    out->raised_us = s->raised_us;
+    out->detect_ms = s->detect_ms;
+    portEXIT_CRITICAL(&fault_lock);
+}
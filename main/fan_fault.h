@@ -0,0 +1,108 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "fan_fixed.h"
+
+/*---------------------------------------------------------------
+        Fault monitor Macros
+
+        Sensor and driver paths report every observation, good or
+        bad. A fault is raised once its observations stay bad for the
+        confirmation time of the table below and cleared after
+        FAN_FAULT_CLEAR_MS of good ones:
+
+            fault        seen as                      confirm   fail-safe
+            stall        tach stalled, duty >= start  STALL_MS  full duty
+            ntc-open     NTC above OPEN_MV, or more   SENSOR_MS estimator model for the
+                         than BELOW_ROOM under room             cell, DEGRADED_DUTY floor
+            ntc-short    NTC under SHORT_MV           SENSOR_MS as ntc-open
+            current-sat  AD8418 above SAT_MV          SENSOR_MS heat input held,
+                                                                DEGRADED_DUTY floor
+            tsens        die sensor read failing or   SENSOR_MS ambient held (estimator
+                         outside TSENS_MIN/MAX                  or last good value)
+            adc          ADC frame read failing       SENSOR_MS full duty, every zone
+            driver       PWM/tach/timer call failing  0         retried next tick,
+                                                                cleared by one success
+
+        A bad observation keeps the tick at its shortest period until
+        the fault is confirmed or gone, so the detection latency is at
+        most one settled period (SCHED_PERIOD_MAX_MS) to the first bad
+        tick plus the confirmation time rounded up to
+        SCHED_PERIOD_MIN_MS; the stall adds FAN_TACH_TIMEOUT_MS before
+        the tach reads stalled. The fail-safe applies in the tick that
+        raises the fault. Failing sensor reads call the HAL recovery
+        (driver restart) before the next tick, no reboot.
+
+        Faults are logged when raised and cleared, and at most every
+        FAN_FAULT_REPORT_MS while they last. The status LED blinks
+        the code of each active fault in turn: the fault number in
+        long blinks, the zone number in short ones; it stays dark
+        while nothing is wrong.
+---------------------------------------------------------------*/
+#define FAN_FAULT_STALL_MS      4000
+#define FAN_FAULT_SENSOR_MS     1500    // Two ticks at the shortest period
+#define FAN_FAULT_CLEAR_MS      30000
+#define FAN_FAULT_REPORT_MS     (10 * 60 * 1000)
+#define FAN_FAULT_NTC_OPEN_MV   3000    // About -15℃ on the divider
+#define FAN_FAULT_NTC_SHORT_MV  100     // About 106℃
+#define FAN_FAULT_NTC_BELOW_ROOM 10.0   // ℃, the cell never runs this far under the room
+#define FAN_FAULT_CURRENT_SAT_MV 3100   // AD8418 output swing against the 3.3V rail
+#define FAN_FAULT_TSENS_MIN     -20.0   // ℃
+#define FAN_FAULT_TSENS_MAX     100.0
+#define FAN_FAULT_DEGRADED_DUTY 0.5     // Demand floor while a cell or current sensor is out
+#define FAN_FAULT_BLINK_LONG_MS 400
+#define FAN_FAULT_BLINK_SHORT_MS 150
+#define FAN_FAULT_BLINK_GAP_MS  1000    // Between fault and zone number
+#define FAN_FAULT_BLINK_PAUSE_MS 3000   // Between two codes
+#define FAN_FAULT_STACK         (2 * 1024)
+#define FAN_FAULT_PRIO          1
+
+typedef enum {
+    FAN_FAULT_STALL,        // Zone faults
+    FAN_FAULT_NTC_OPEN,
+    FAN_FAULT_NTC_SHORT,
+    FAN_FAULT_CURRENT_SAT,
+    FAN_FAULT_DRIVER,
+    FAN_FAULT_TSENS,        // Board faults, zone -1
+    FAN_FAULT_ADC,
+    FAN_FAULT_MAX,
+} fan_fault_t;
+
+typedef struct {
+    bool active;
+    uint32_t raised;        // Times raised since boot
+    uint32_t bad;           // Bad observations since boot
+    int64_t raised_us;      // Last raise
+    int detect_ms;          // First bad observation to the last raise
+} fan_fault_stats_t;
+
+// Blink task, before anything reports
+esp_err_t fan_fault_init(void);
+// One observation of the fault on the zone (-1 for the board faults)
+void fan_fault_observe(fan_fault_t fault, int zone, bool bad);
+// Raise at once, e.g. a self-test that saw no tach at all
+void fan_fault_raise(fan_fault_t fault, int zone);
+// Observe FAN_FAULT_DRIVER for the result of a driver call, returns ret
+esp_err_t fan_fault_driver(esp_err_t ret, int zone, const char *what);
+// Range checks of one tick's raw NTC and current readings, and the NTC against the room
+void fan_fault_check_sensors(int zone, q16_t ntc_mv, q16_t current_mv, q16_t tcell, q16_t troom);
+// Die sensor reading of the temperature task, ret of the read; true when the reading is usable
+bool fan_fault_check_tsens(esp_err_t ret, q16_t celsius);
+
+bool fan_fault_active(fan_fault_t fault, int zone);
+// A bad observation on the zone (or board) waits for confirmation, or the fault is active
+bool fan_fault_seen(fan_fault_t fault, int zone);
+// Any unconfirmed bad observation: keep the tick short
+bool fan_fault_pending(void);
+// Demand of the zone with the fail-safes applied; *full when the fan must run flat out now
+q16_t fan_fault_failsafe(int zone, q16_t demand, bool *full);
+// BIT(fan_fault_t) active on the zone, board faults included
+uint32_t fan_fault_mask(int zone);
+const char *fan_fault_name(fan_fault_t fault);
+// Copy of the fault's counters, any task
+void fan_fault_get(fan_fault_t fault, int zone, fan_fault_stats_t *out);
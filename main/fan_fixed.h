@@ -0,0 +1,67 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*---------------------------------------------------------------
+        Q16.16 fixed point
+
+        The ESP32-H2 core has no FPU, the control path stays in
+        integer arithmetic. Q16() is for constant expressions and the
+        profile rebuild, never for the per tick path.
+---------------------------------------------------------------*/
+typedef int32_t q16_t;
+
+#define Q16_SHIFT       16
+#define Q16_ONE         ((q16_t)1 << Q16_SHIFT)
+#define Q16(x)          ((q16_t)((x) * 65536.0 + ((x) < 0 ? -0.5 : 0.5)))
+#define Q32(x)          ((int64_t)((x) * 4294967296.0 + ((x) < 0 ? -0.5 : 0.5)))
+#define Q16_INT(x)      ((x) >> Q16_SHIFT)
+
+static inline q16_t q16_from_int(int v)
+{
+    return (q16_t)v << Q16_SHIFT;
+}
+
+static inline q16_t q16_mul(q16_t a, q16_t b)
+{
+    return (q16_t)(((int64_t)a * b + (1 << (Q16_SHIFT - 1))) >> Q16_SHIFT);
+}
+
+// Multiply by a Q32 coefficient, for small gains that lose precision in Q16
+static inline q16_t q16_mul_q32(q16_t a, int64_t b)
+{
+    return (q16_t)(((int64_t)a * b + ((int64_t)1 << 31)) >> 32);
+}
+
+static inline q16_t q16_div(q16_t a, q16_t b)
+{
+    return (q16_t)(((int64_t)a << Q16_SHIFT) / b);
+}
+
+static inline q16_t q16_clamp(q16_t v, q16_t lo, q16_t hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// First-order low pass: acc += (x - acc) * factor
+static inline q16_t q16_ema(q16_t acc, q16_t x, q16_t factor)
+{
+    return acc + q16_mul(x - acc, factor);
+}
+
+// Rounded value in units of 1/scale, e.g. scale 100 for percent
+static inline int q16_to_scaled(q16_t v, int scale)
+{
+    int64_t s = (int64_t)v * scale;
+    return (int)((s + (s < 0 ? -(Q16_ONE / 2) : Q16_ONE / 2)) / Q16_ONE);
+}
+
+/*---------------------------------------------------------------
+        Logging without float formatting: "%s%d.%d" + Q16_DEC1(v)
+---------------------------------------------------------------*/
+#define Q16_FMT1        "%s%d.%d"
+#define Q16_DEC1(v)     ((v) < 0 ? "-" : ""), abs(q16_to_scaled((v), 10)) / 10, abs(q16_to_scaled((v), 10)) % 10
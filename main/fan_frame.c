@@ -0,0 +1,82 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdatomic.h>
+#include <string.h>
+#include "fan_frame.h"
+
+typedef struct {
+    atomic_uint seq;        // Odd while the producer is writing
+    fan_sample_t field[FAN_FIELD_MAX];
+} fan_frame_slot_t;
+
+static const struct {
+    fan_field_t first;
+    int count;
+} frame_groups[FAN_FRAME_GROUP_MAX] = {
+    [FAN_FRAME_TSENS] = { FAN_FIELD_TROOM, 2 },
+    [FAN_FRAME_ADC]   = { FAN_FIELD_TCELL(0), 4 * FAN_ZONE_NUM },
+    [FAN_FRAME_HOST]  = { FAN_FIELD_TDISK(0), FAN_ZONE_NUM },
+    [FAN_FRAME_BUS]   = { FAN_FIELD_TBUS(0), FAN_ZONE_NUM },
+};
+
+static fan_frame_slot_t frame_slots[FAN_FRAME_GROUP_MAX];
+
+void fan_frame_publish(fan_frame_group_t group, const q16_t *values, int64_t stamp_us)
+{
+    fan_frame_slot_t *slot = &frame_slots[group];
+    unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int i = 0; i < frame_groups[group].count; i++) {
+        fan_sample_t *s = &slot->field[frame_groups[group].first + i];
+        int64_t dt_us = stamp_us - s->stamp_us;
+        s->slope = (s->seq > 0 && dt_us > 0) ? (q16_t)((int64_t)(values[i] - s->value) * 1000000 / dt_us) : 0;
+        s->value = values[i];
+        s->stamp_us = stamp_us;
+        s->seq++;
+    }
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+void fan_frame_read(fan_frame_t *frame)
+{
+    for (int group = 0; group < FAN_FRAME_GROUP_MAX; group++) {
+        fan_frame_slot_t *slot = &frame_slots[group];
+        fan_sample_t *dst = &frame->field[frame_groups[group].first];
+        size_t len = frame_groups[group].count * sizeof(fan_sample_t);
+        unsigned begin, end;
+
+        do {
+            begin = atomic_load_explicit(&slot->seq, memory_order_acquire);
+            memcpy(dst, &slot->field[frame_groups[group].first], len);
+            atomic_thread_fence(memory_order_acquire);
+            end = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+        } while ((begin & 1) || begin != end);
+    }
+}
+
+int32_t fan_frame_age_ms(const fan_frame_t *frame, fan_field_t field, int64_t now_us)
+{
+    const fan_sample_t *s = &frame->field[field];
+
+    if (s->seq == 0) {
+        return INT32_MAX;
+    }
+    return (int32_t)((now_us - s->stamp_us) / 1000);
+}
+
+q16_t fan_frame_value(const fan_frame_t *frame, fan_field_t field, int64_t now_us)
+{
+    const fan_sample_t *s = &frame->field[field];
+    int64_t age_us = now_us - s->stamp_us;
+
+    if (age_us <= 0) {
+        return s->value;
+    }
+    if (age_us > FAN_FRAME_EXTRAP_MS * 1000LL) {
+        age_us = FAN_FRAME_EXTRAP_MS * 1000LL;
+    }
+    return s->value + (q16_t)((int64_t)s->slope * age_us / 1000000);
+}
@@ -0,0 +1,62 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fan_fixed.h"
+#include "fan_zone.h"
+
+/*---------------------------------------------------------------
+        Sensor frame Macros
+
+        Every producer task owns one group of fields and publishes it
+        under its own sequence lock, so producers never wait for each
+        other or for the control loop. The reader retries a group
+        until it copied it without an update in between.
+---------------------------------------------------------------*/
+#define FAN_FRAME_STALE_MS      32000   // Older fields are rejected
+#define FAN_FRAME_EXTRAP_MS     2000    // Longest age bridged by the slope
+
+// Shared room temperature first, then the filtered and raw readings per zone, then the host's disks and the
+// bay sensors per zone.
+// Raw fields are the unfiltered sample of the tick, for telemetry.
+typedef int fan_field_t;
+#define FAN_FIELD_TROOM         0                       // ℃, die sensor minus self heating
+#define FAN_FIELD_TSENS_RAW     1                       // ℃, die sensor as read
+#define FAN_FIELD_TCELL(zone)   (2 + 4 * (zone))        // ℃, NTC in the disk cage
+#define FAN_FIELD_CURRENT(zone) (3 + 4 * (zone))        // mA on the 12V rail of the cage
+#define FAN_FIELD_NTC_MV(zone)  (4 + 4 * (zone))        // mV, NTC divider
+#define FAN_FIELD_CURRENT_MV(zone) (5 + 4 * (zone))     // mV, AD8418 output
+#define FAN_FIELD_TDISK(zone)   (2 + 4 * FAN_ZONE_NUM + (zone))  // ℃, disks of the cage folded, see fan_host_tdisk()
+#define FAN_FIELD_TBUS(zone)    (2 + 5 * FAN_ZONE_NUM + (zone))  // ℃, bay sensors of the cage folded, 0 for none
+#define FAN_FIELD_MAX           (2 + 6 * FAN_ZONE_NUM)
+
+typedef enum {
+    FAN_FRAME_TSENS,        // FAN_FIELD_TROOM, FAN_FIELD_TSENS_RAW
+    FAN_FRAME_ADC,          // FAN_FIELD_TCELL(0) .. FAN_FIELD_CURRENT_MV(0), ... of every zone
+    FAN_FRAME_HOST,         // FAN_FIELD_TDISK() of every zone
+    FAN_FRAME_BUS,          // FAN_FIELD_TBUS() of every zone
+    FAN_FRAME_GROUP_MAX,
+} fan_frame_group_t;
+
+typedef struct {
+    q16_t value;
+    q16_t slope;            // Change per second against the previous sample
+    int64_t stamp_us;       // Sample time, fan_hal_now_us()
+    uint32_t seq;           // Samples published for this field, 0 before the first
+} fan_sample_t;
+
+typedef struct {
+    fan_sample_t field[FAN_FIELD_MAX];
+} fan_frame_t;
+
+// Producer side: values[] holds the fields of the group in field order
+void fan_frame_publish(fan_frame_group_t group, const q16_t *values, int64_t stamp_us);
+// Reader side, never blocks the producers
+void fan_frame_read(fan_frame_t *frame);
+// Age of a field at now_us in ms, INT32_MAX before the first sample
+int32_t fan_frame_age_ms(const fan_frame_t *frame, fan_field_t field, int64_t now_us);
+// Field value projected to now_us along its slope, at most FAN_FRAME_EXTRAP_MS ahead
+q16_t fan_frame_value(const fan_frame_t *frame, fan_field_t field, int64_t now_us);
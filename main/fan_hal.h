@@ -0,0 +1,169 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "esp_err.h"
+#include "fan_fixed.h"
+#include "fan_zone.h"
+
+/*---------------------------------------------------------------
+        Fan controller hardware abstraction layer
+
+        fan_hal_esp.c drives the real LEDC/PCNT/ADC/TSENS peripherals,
+        fan_hal_sim.c (linux target) drives a thermal plant and fan model
+        on a virtual clock. Control code only talks to this interface.
+        PWM, tach and ADC are per zone, pins come from fan_zones[].
+---------------------------------------------------------------*/
+typedef enum {
+    FAN_HAL_ADC_CURRENT,    // AD8418 12V rail current sense, mV ~ mA
+    FAN_HAL_ADC_NTC,        // Cell NTC divider
+    FAN_HAL_ADC_MAX,
+} fan_hal_adc_chan_t;
+
+// Board bring-up: status LED and, on the simulator, the virtual clock
+esp_err_t fan_hal_init(void);
+// Dynamic frequency scaling and automatic light sleep
+esp_err_t fan_hal_pm_init(void);
+// Held PM locks and their counts, esp_pm_dump_locks() on the target
+esp_err_t fan_hal_pm_dump(FILE *out);
+// Let console UART input wake the chip from light sleep
+esp_err_t fan_hal_console_wakeup(void);
+// Run fn before a planned restart: esp_restart() on the target, the end of the replay on the simulator
+esp_err_t fan_hal_on_restart(void (*fn)(void));
+
+/*---------------------------------------------------------------
+        Time
+---------------------------------------------------------------*/
+// Block the calling task, in (virtual) milliseconds
+void fan_hal_delay_ms(uint32_t ms);
+// Monotonic (virtual) time since boot
+int64_t fan_hal_now_us(void);
+// One-shot timer driving the control tick, the callback runs in task context
+esp_err_t fan_hal_timer_init(void (*cb)(void *arg), void *arg);
+esp_err_t fan_hal_timer_start(uint32_t ms);
+// CPU wakeups from light sleep and time spent in it since boot
+uint32_t fan_hal_wakeup_count(void);
+int64_t fan_hal_sleep_time_us(void);
+// Free running counter for benchmarks, wraps. ISR safe.
+uint32_t fan_hal_bench_now(void);
+#if CONFIG_IDF_TARGET_LINUX
+#define FAN_HAL_BENCH_UNIT  "ns"
+#else
+#define FAN_HAL_BENCH_UNIT  "cycles"
+#endif
+
+/*---------------------------------------------------------------
+        Persistent store, NVS namespace on the target, a file next to
+        the binary on the simulator. Blobs are read back whole.
+---------------------------------------------------------------*/
+esp_err_t fan_hal_store_init(void);
+// ESP_ERR_NOT_FOUND when the key is missing or was written with another size
+esp_err_t fan_hal_store_get(const char *key, void *buf, size_t len);
+esp_err_t fan_hal_store_set(const char *key, const void *buf, size_t len);
+esp_err_t fan_hal_store_erase(const char *key);
+
+/*---------------------------------------------------------------
+        Telemetry link, binary packets on the console UART of the
+        target, a file next to the binary on the simulator
+---------------------------------------------------------------*/
+esp_err_t fan_hal_telem_init(void);
+// Returns once the bytes left the UART, so light sleep cannot cut a packet
+esp_err_t fan_hal_telem_write(const void *buf, size_t len);
+
+/*---------------------------------------------------------------
+        History partition, raw NOR semantics: an erase sets a whole
+        sector to 0xFF, a write only clears bits. A file next to the
+        binary on the simulator.
+---------------------------------------------------------------*/
+#define FAN_HAL_HIST_SECTOR 4096
+#define FAN_HAL_HIST_PAGE   256
+
+esp_err_t fan_hal_hist_init(size_t *size);
+esp_err_t fan_hal_hist_read(uint32_t offset, void *buf, size_t len);
+esp_err_t fan_hal_hist_write(uint32_t offset, const void *buf, size_t len);
+// One FAN_HAL_HIST_SECTOR at a sector aligned offset
+esp_err_t fan_hal_hist_erase(uint32_t offset);
+
+/*---------------------------------------------------------------
+        Status LED
+---------------------------------------------------------------*/
+esp_err_t fan_hal_led_set(uint32_t level);
+
+/*---------------------------------------------------------------
+        PWM, duty is the raw LEDC value of the inverted output stage,
+        0..fan_hal_pwm_max() at the finest resolution the timer clock
+        gives at FAN_HAL_PWM_FREQ. A fade ramps in hardware and
+        returns at once; set and stop cut a running fade short.
+---------------------------------------------------------------*/
+#define FAN_HAL_PWM_FREQ    25000   // Hz, Intel 4-wire fan spec
+
+esp_err_t fan_hal_pwm_init(void);
+uint32_t fan_hal_pwm_max(void);
+esp_err_t fan_hal_pwm_set(int zone, uint32_t duty);
+esp_err_t fan_hal_pwm_fade(int zone, uint32_t duty, uint32_t time_ms);
+esp_err_t fan_hal_pwm_stop(int zone, uint32_t idle_level);
+
+/*---------------------------------------------------------------
+        Tach, falling edges of the fan FG signal (2 per revolution)
+---------------------------------------------------------------*/
+esp_err_t fan_hal_tach_init(int zone);
+esp_err_t fan_hal_tach_enable(int zone);
+esp_err_t fan_hal_tach_disable(int zone);
+esp_err_t fan_hal_tach_start(int zone);
+esp_err_t fan_hal_tach_clear(int zone);
+// Edges accumulated since the last clear
+esp_err_t fan_hal_tach_get_count(int zone, int *count);
+
+#define FAN_HAL_TACH_WATCH  4   // Edges between two watch events
+
+typedef void (*fan_hal_tach_cb_t)(int64_t stamp_us, void *arg);
+// Call every FAN_HAL_TACH_WATCH edges from ISR context, register before enable
+esp_err_t fan_hal_tach_watch(int zone, fan_hal_tach_cb_t cb, void *arg);
+
+/*---------------------------------------------------------------
+        ADC, continuous scan of all channels of all zones, see adc_block.h
+---------------------------------------------------------------*/
+typedef struct {
+    q16_t mv[FAN_ZONE_NUM][FAN_HAL_ADC_MAX];    // Block filtered, calibrated millivolts
+    int samples;                                // Samples per channel behind this frame
+} fan_hal_adc_frame_t;
+
+esp_err_t fan_hal_adc_init(void);
+// Run one scan block and decimate it, the caller sleeps until the DMA is done
+esp_err_t fan_hal_adc_read_frame(fan_hal_adc_frame_t *frame);
+// Restart the driver after failed reads, calibration kept
+esp_err_t fan_hal_adc_recover(void);
+
+/*---------------------------------------------------------------
+        Host link, a UART of its own (see fan_host.h)
+---------------------------------------------------------------*/
+esp_err_t fan_hal_host_init(void);
+// Block until the driver reports received bytes, copy up to len of them; < 0 after an overrun dropped some
+int fan_hal_host_read(uint8_t *buf, size_t len);
+esp_err_t fan_hal_host_write(const void *buf, size_t len);
+
+/*---------------------------------------------------------------
+        Sensor bus, 1-Wire through RMT on the target, a model of the
+        DS18B20 chain on the simulator (see fan_bus.h). Every call is
+        one transaction from the reset pulse on; rom NULL addresses
+        every device (SKIP ROM), otherwise the one (MATCH ROM).
+---------------------------------------------------------------*/
+esp_err_t fan_hal_bus_init(void);
+// ROM search, returns the devices found or < 0 on a bus error
+int fan_hal_bus_scan(uint64_t *rom, int max);
+esp_err_t fan_hal_bus_write(const uint64_t *rom, const uint8_t *data, size_t len);
+// Function command to one device, then read len bytes back
+esp_err_t fan_hal_bus_read(uint64_t rom, uint8_t cmd, uint8_t *buf, size_t len);
+
+/*---------------------------------------------------------------
+        ESP die temperature sensor
+---------------------------------------------------------------*/
+esp_err_t fan_hal_tsens_init(void);
+esp_err_t fan_hal_tsens_read(q16_t *celsius);
+// Reinstall the sensor after failed reads
+esp_err_t fan_hal_tsens_recover(void);
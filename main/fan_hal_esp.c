@@ -0,0 +1,827 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include "driver/ledc.h"
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "soc/soc_caps.h"
+#include "esp_log.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "driver/temperature_sensor.h"
+#include "driver/pulse_cnt.h"
+#include "driver/uart.h"
+#include "driver/uart_vfs.h"
+#include "esp_cpu.h"
+#include "esp_clk_tree.h"
+/* power management */
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "nvs_flash.h"
+#include "esp_partition.h"
+#include "onewire_bus.h"
+#include "onewire_device.h"
+#include "onewire_cmd.h"
+#include "fan_hal.h"
+#include "fan_host.h"
+#include "adc_block.h"
+
+const static char *TAG = "Fan-HAL";
+/*---------------------------------------------------------------
+        GPIO Macros
+---------------------------------------------------------------*/
+#define GPIO_OUTPUT_LED_B    (13)
+#define GPIO_OUTPUT_PIN_SEL  (1ULL<<GPIO_OUTPUT_LED_B)
+/*---------------------------------------------------------------
+        LEDC Macros
+---------------------------------------------------------------*/
+#define LEDC_TIMER              LEDC_TIMER_0
+#define LEDC_MODE               LEDC_LOW_SPEED_MODE
+#define LEDC_CHANNEL(zone)      ((ledc_channel_t)(LEDC_CHANNEL_0 + (zone))) // Output GPIO from fan_zones[]
+#define LEDC_CLK_SRC            SOC_MOD_CLK_RC_FAST // Keeps running in light sleep, ~8 MHz: 8 bits at 25 kHz
+/*---------------------------------------------------------------
+        ADC General Macros
+---------------------------------------------------------------*/
+//ADC1 Channels come from fan_zones[], one pattern entry each
+#define ADC_PATTERN_NUM             (FAN_ZONE_NUM * FAN_HAL_ADC_MAX)
+#define EXAMPLE_ADC_ATTEN           ADC_ATTEN_DB_12
+#define ADC_FRAME_BYTES             (ADC_BLOCK_N * ADC_PATTERN_NUM * SOC_ADC_DIGI_RESULT_BYTES)
+#define ADC_FRAME_TIMEOUT_MS        (4 * ADC_BLOCK_MS + 100)
+#define ADC_CODE_MAX                ((1 << SOC_ADC_DIGI_MAX_BITWIDTH) - 1)
+/*---------------------------------------------------------------
+        PCNT Macros
+---------------------------------------------------------------*/
+#define PCNT_HIGH_LIMIT FAN_HAL_TACH_WATCH  // Watch event and wrap, the driver accumulates
+#define PCNT_LOW_LIMIT  -1024
+
+#define PCNT_GPIO_LEVEL -1     // Edge GPIO from fan_zones[]
+/*---------------------------------------------------------------
+        Telemetry UART Macros
+---------------------------------------------------------------*/
+#define TELEM_UART              CONFIG_ESP_CONSOLE_UART_NUM
+#define TELEM_RX_BUF            256     // Driver minimum, nothing is received
+#define TELEM_TX_BUF            1024
+#define TELEM_TX_TIMEOUT_MS     200     // 1 KiB takes 89 ms at 115200 baud
+#define CONSOLE_WAKEUP_EDGES    3       // RX edges that wake from light sleep, the chip minimum
+
+//-------------Host link---------------//
+#define HOST_UART               UART_NUM_1
+#define HOST_TX_GPIO            0
+#define HOST_RX_GPIO            14
+#define HOST_RX_BUF             512     // Driver ring, a few frames
+#define HOST_TX_BUF             0       // Acks are short, written straight to the FIFO
+#define HOST_QUEUE_LEN          8
+#define HOST_RX_TOUT_SYMBOLS    4       // Idle line after a frame, one interrupt per frame
+#define HOST_RX_FULL            96      // FIFO level that interrupts inside a long frame
+
+//-------------Sensor bus---------------//
+#define BUS_GPIO                4       // DQ, 4k7 to 3V3 on the board
+#define BUS_MAX_RX_BYTES        10      // Scratchpad and CRC, the largest read
+#define BUS_MAX_TX_BYTES        16      // MATCH ROM, address, command and its data
+/*---------------------------------------------------------------
+        History partition Macros, see partitions.csv
+---------------------------------------------------------------*/
+#define HIST_PARTITION_LABEL    "history"
+#define HIST_PARTITION_SUBTYPE  ((esp_partition_subtype_t)0x40)
+/*---------------------------------------------------------------
+        NVS Macros
+---------------------------------------------------------------*/
+#define STORE_NAMESPACE "fan"
+
+static adc_continuous_handle_t adc1_handle;
+static TaskHandle_t adc_reader;
+static uint8_t adc_frame_buf[ADC_FRAME_BYTES];
+static int adc_samples[ADC_PATTERN_NUM][ADC_BLOCK_N];
+static adc_channel_t adc_chan_map[ADC_PATTERN_NUM];     // Pattern entry zone * FAN_HAL_ADC_MAX + chan
+static adc_cali_handle_t adc_cali_handle[ADC_PATTERN_NUM];
+static bool adc_cali_done[ADC_PATTERN_NUM];
+
+static pcnt_unit_handle_t pcnt_unit[FAN_ZONE_NUM];
+static fan_hal_tach_cb_t tach_watch_cb[FAN_ZONE_NUM];
+static void *tach_watch_arg[FAN_ZONE_NUM];
+static temperature_sensor_handle_t temp_sensor;
+static QueueHandle_t host_queue;
+static onewire_bus_handle_t bus_handle;
+static esp_timer_handle_t tick_timer;
+static nvs_handle_t store_handle;
+static const esp_partition_t *hist_partition;
+static volatile uint32_t pm_wakeups;
+static volatile int64_t pm_sleep_us;
+
+static bool example_adc_calibration_init(adc_unit_t unit, adc_channel_t channel, adc_atten_t atten, adc_cali_handle_t *out_handle);
+
+esp_err_t fan_hal_init(void)
+{
+    //-------------GPIO Init---------------//
+    //zero-initialize the config structure.
+    gpio_config_t io_conf = {};
+    //disable interrupt
+    io_conf.intr_type = GPIO_INTR_DISABLE;
+    //set as output mode
+    io_conf.mode = GPIO_MODE_OUTPUT;
+    //bit mask of the pins that you want to set,e.g.GPIO18/19
+    io_conf.pin_bit_mask = GPIO_OUTPUT_PIN_SEL;
+    //disable pull-down mode
+    io_conf.pull_down_en = 0;
+    //disable pull-up mode
+    io_conf.pull_up_en = 0;
+    //configure GPIO with the given settings
+    ESP_RETURN_ON_ERROR(gpio_config(&io_conf), TAG, "LED gpio config failed");
+    ESP_LOGI(TAG, "GPIO initialized");
+    return gpio_set_level(GPIO_OUTPUT_LED_B, 0);
+}
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+static esp_err_t IRAM_ATTR pm_sleep_exit_cb(int64_t sleep_time_us, void *arg)
+{
+    pm_wakeups++;
+    pm_sleep_us += sleep_time_us;
+    return ESP_OK;
+}
+#endif
+
+esp_err_t fan_hal_pm_init(void)
+{
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+    esp_pm_sleep_cbs_register_config_t cbs_conf = {
+        .exit_cb = pm_sleep_exit_cb,
+    };
+    ESP_RETURN_ON_ERROR(esp_pm_light_sleep_register_cbs(&cbs_conf), TAG, "light sleep callback failed");
+#endif
+#if CONFIG_PM_ENABLE
+    // Configure dynamic frequency scaling:
+    // maximum and minimum frequencies are set in sdkconfig,
+    // automatic light sleep is enabled if tickless idle support is enabled.
+    esp_pm_config_t pm_config = {
+            .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+            .min_freq_mhz = CONFIG_XTAL_FREQ,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+            .light_sleep_enable = true
+#endif
+    };
+    return esp_pm_configure(&pm_config);
+#else
+    return ESP_OK;
+#endif // CONFIG_PM_ENABLE
+}
+
+esp_err_t fan_hal_pm_dump(FILE *out)
+{
+#if CONFIG_PM_ENABLE
+    return esp_pm_dump_locks(out);
+#else
+    fprintf(out, "Power management disabled\n");
+    return ESP_OK;
+#endif
+}
+
+esp_err_t fan_hal_console_wakeup(void)
+{
+    ESP_RETURN_ON_ERROR(uart_set_wakeup_threshold(CONFIG_ESP_CONSOLE_UART_NUM, CONSOLE_WAKEUP_EDGES), TAG, "UART wakeup threshold failed");
+    return esp_sleep_enable_uart_wakeup(CONFIG_ESP_CONSOLE_UART_NUM);
+}
+
+esp_err_t fan_hal_on_restart(void (*fn)(void))
+{
+    return esp_register_shutdown_handler(fn);
+}
+
+void fan_hal_delay_ms(uint32_t ms)
+{
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+int64_t fan_hal_now_us(void)
+{
+    return esp_timer_get_time();
+}
+
+esp_err_t fan_hal_timer_init(void (*cb)(void *arg), void *arg)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = cb,
+        .arg = arg,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "fan_tick",
+    };
+    return esp_timer_create(&timer_args, &tick_timer);
+}
+
+esp_err_t fan_hal_timer_start(uint32_t ms)
+{
+    return esp_timer_start_once(tick_timer, ms * 1000ULL);
+}
+
+uint32_t fan_hal_wakeup_count(void)
+{
+    return pm_wakeups;
+}
+
+int64_t fan_hal_sleep_time_us(void)
+{
+    return pm_sleep_us;
+}
+
+uint32_t IRAM_ATTR fan_hal_bench_now(void)
+{
+    return esp_cpu_get_cycle_count();
+}
+
+/*---------------------------------------------------------------
+        Persistent store
+---------------------------------------------------------------*/
+esp_err_t fan_hal_store_init(void)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_LOGW(TAG, "NVS partition truncated or outdated, erasing");
+        ESP_RETURN_ON_ERROR(nvs_flash_erase(), TAG, "nvs erase failed");
+        ret = nvs_flash_init();
+    }
+    ESP_RETURN_ON_ERROR(ret, TAG, "nvs init failed");
+    return nvs_open(STORE_NAMESPACE, NVS_READWRITE, &store_handle);
+}
+
+esp_err_t fan_hal_store_get(const char *key, void *buf, size_t len)
+{
+    size_t size = len;
+    esp_err_t ret = nvs_get_blob(store_handle, key, buf, &size);
+
+    if (ret == ESP_ERR_NVS_NOT_FOUND || ret == ESP_ERR_NVS_INVALID_LENGTH || (ret == ESP_OK && size != len)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ret;
+}
+
+esp_err_t fan_hal_store_set(const char *key, const void *buf, size_t len)
+{
+    ESP_RETURN_ON_ERROR(nvs_set_blob(store_handle, key, buf, len), TAG, "nvs set %s failed", key);
+    return nvs_commit(store_handle);
+}
+
+esp_err_t fan_hal_store_erase(const char *key)
+{
+    esp_err_t ret = nvs_erase_key(store_handle, key);
+
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(ret, TAG, "nvs erase %s failed", key);
+    return nvs_commit(store_handle);
+}
+
+/*---------------------------------------------------------------
+        History partition
+---------------------------------------------------------------*/
+esp_err_t fan_hal_hist_init(size_t *size)
+{
+    hist_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, HIST_PARTITION_SUBTYPE, HIST_PARTITION_LABEL);
+    ESP_RETURN_ON_FALSE(hist_partition != NULL, ESP_ERR_NOT_FOUND, TAG, "no %s partition", HIST_PARTITION_LABEL);
+    *size = hist_partition->size;
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_hist_read(uint32_t offset, void *buf, size_t len)
+{
+    return esp_partition_read(hist_partition, offset, buf, len);
+}
+
+esp_err_t fan_hal_hist_write(uint32_t offset, const void *buf, size_t len)
+{
+    return esp_partition_write(hist_partition, offset, buf, len);
+}
+
+esp_err_t fan_hal_hist_erase(uint32_t offset)
+{
+    return esp_partition_erase_range(hist_partition, offset, FAN_HAL_HIST_SECTOR);
+}
+
+/*---------------------------------------------------------------
+        Telemetry link
+---------------------------------------------------------------*/
+esp_err_t fan_hal_telem_init(void)
+{
+    ESP_RETURN_ON_ERROR(uart_driver_install(TELEM_UART, TELEM_RX_BUF, TELEM_TX_BUF, 0, NULL, 0),
+                        TAG, "telemetry uart install failed");
+    // Log text goes through the same driver, so it lands between packets, not inside them
+    uart_vfs_dev_use_driver(TELEM_UART);
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_telem_write(const void *buf, size_t len)
+{
+    ESP_RETURN_ON_FALSE(uart_write_bytes(TELEM_UART, buf, len) == (int)len, ESP_FAIL, TAG, "telemetry write failed");
+    return uart_wait_tx_done(TELEM_UART, pdMS_TO_TICKS(TELEM_TX_TIMEOUT_MS));
+}
+
+/*---------------------------------------------------------------
+        Host link
+---------------------------------------------------------------*/
+esp_err_t fan_hal_host_init(void)
+{
+    const uart_config_t uart_config = {
+        .baud_rate = FAN_HOST_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_XTAL,   // Steady across frequency scaling
+    };
+    ESP_RETURN_ON_ERROR(uart_driver_install(HOST_UART, HOST_RX_BUF, HOST_TX_BUF, HOST_QUEUE_LEN, &host_queue, 0),
+                        TAG, "host uart install failed");
+    ESP_RETURN_ON_ERROR(uart_param_config(HOST_UART, &uart_config), TAG, "host uart config failed");
+    ESP_RETURN_ON_ERROR(uart_set_pin(HOST_UART, HOST_TX_GPIO, HOST_RX_GPIO, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE),
+                        TAG, "host uart pins failed");
+    // An unplugged host must not read as edges
+    ESP_RETURN_ON_ERROR(gpio_pullup_en(HOST_RX_GPIO), TAG, "host rx pull-up failed");
+    ESP_RETURN_ON_ERROR(uart_set_rx_timeout(HOST_UART, HOST_RX_TOUT_SYMBOLS), TAG, "host rx timeout failed");
+    ESP_RETURN_ON_ERROR(uart_set_rx_full_threshold(HOST_UART, HOST_RX_FULL), TAG, "host rx threshold failed");
+    // The wake preamble of the host, its bytes are lost
+    ESP_RETURN_ON_ERROR(uart_set_wakeup_threshold(HOST_UART, CONSOLE_WAKEUP_EDGES), TAG, "host wakeup threshold failed");
+    return esp_sleep_enable_uart_wakeup(HOST_UART);
+}
+
+int fan_hal_host_read(uint8_t *buf, size_t len)
+{
+    uart_event_t event;
+
+    if (xQueueReceive(host_queue, &event, portMAX_DELAY) != pdTRUE) {
+        return 0;
+    }
+    switch (event.type) {
+    case UART_DATA:
+        return uart_read_bytes(HOST_UART, buf, len, 0);
+    case UART_FIFO_OVF:
+    case UART_BUFFER_FULL:
+        uart_flush_input(HOST_UART);
+        xQueueReset(host_queue);
+        return -1;
+    default:
+        return 0;
+    }
+}
+
+esp_err_t fan_hal_host_write(const void *buf, size_t len)
+{
+    ESP_RETURN_ON_FALSE(uart_write_bytes(HOST_UART, buf, len) == (int)len, ESP_FAIL, TAG, "host write failed");
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        Sensor bus
+---------------------------------------------------------------*/
+esp_err_t fan_hal_bus_init(void)
+{
+    const onewire_bus_config_t bus_config = {
+        .bus_gpio_num = BUS_GPIO,
+        .flags.en_pull_up = 1,      // Backs up the external pull-up, too weak on its own
+    };
+    const onewire_bus_rmt_config_t rmt_config = {
+        .max_rx_bytes = BUS_MAX_RX_BYTES,
+    };
+    return onewire_new_bus_rmt(&bus_config, &rmt_config, &bus_handle);
+}
+
+int fan_hal_bus_scan(uint64_t *rom, int max)
+{
+    onewire_device_iter_handle_t iter;
+    onewire_device_t dev;
+    esp_err_t ret;
+    int num = 0;
+
+    if (onewire_new_device_iter(bus_handle, &iter) != ESP_OK) {
+        return -1;
+    }
+    while (num < max && (ret = onewire_device_iter_get_next(iter, &dev)) != ESP_ERR_NOT_FOUND) {
+        if (ret == ESP_OK) {
+            rom[num++] = dev.address;
+        } else {
+            ESP_LOGD(TAG, "ROM search: %s", esp_err_to_name(ret));   // CRC of one address, the search goes on
+        }
+    }
+    onewire_del_device_iter(iter);
+    return num;
+}
+
+// Reset, then SKIP ROM or MATCH ROM and the address
+static esp_err_t bus_select(const uint64_t *rom, uint8_t *tx, size_t *len)
+{
+    ESP_RETURN_ON_ERROR(onewire_bus_reset(bus_handle), TAG, "no presence pulse");
+    tx[0] = rom == NULL ? ONEWIRE_CMD_SKIP_ROM : ONEWIRE_CMD_MATCH_ROM;
+    *len = 1;
+    if (rom != NULL) {
+        memcpy(&tx[1], rom, sizeof(*rom));      // LSB first, family code leads
+        *len += sizeof(*rom);
+    }
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_bus_write(const uint64_t *rom, const uint8_t *data, size_t len)
+{
+    uint8_t tx[BUS_MAX_TX_BYTES];
+    size_t n;
+
+    ESP_RETURN_ON_FALSE(len <= BUS_MAX_TX_BYTES - 1 - sizeof(*rom), ESP_ERR_INVALID_SIZE, TAG, "bus write too long");
+    ESP_RETURN_ON_ERROR(bus_select(rom, tx, &n), TAG, "bus select failed");
+    memcpy(&tx[n], data, len);
+    return onewire_bus_write_bytes(bus_handle, tx, n + len);
+}
+
+esp_err_t fan_hal_bus_read(uint64_t rom, uint8_t cmd, uint8_t *buf, size_t len)
+{
+    uint8_t tx[BUS_MAX_TX_BYTES];
+    size_t n;
+
+    ESP_RETURN_ON_FALSE(len <= BUS_MAX_RX_BYTES, ESP_ERR_INVALID_SIZE, TAG, "bus read too long");
+    ESP_RETURN_ON_ERROR(bus_select(&rom, tx, &n), TAG, "bus select failed");
+    tx[n++] = cmd;
+    ESP_RETURN_ON_ERROR(onewire_bus_write_bytes(bus_handle, tx, n), TAG, "bus command failed");
+    return onewire_bus_read_bytes(bus_handle, buf, len);
+}
+
+esp_err_t fan_hal_led_set(uint32_t level)
+{
+    return gpio_set_level(GPIO_OUTPUT_LED_B, level);
+}
+
+/*---------------------------------------------------------------
+        PWM
+---------------------------------------------------------------*/
+static uint32_t ledc_max;   // Highest count of the resolution in use
+
+esp_err_t fan_hal_pwm_init(void)
+{
+    uint32_t clk_hz = 0;
+
+    //-------------Finest resolution the clock allows at the fan frequency---------------//
+    ESP_RETURN_ON_ERROR(esp_clk_tree_src_get_freq_hz(LEDC_CLK_SRC, ESP_CLK_TREE_SRC_FREQ_PRECISION_APPROX, &clk_hz),
+                        TAG, "RC_FAST frequency unknown");
+    uint32_t bits = ledc_find_suitable_duty_resolution(clk_hz, FAN_HAL_PWM_FREQ);
+    ESP_RETURN_ON_FALSE(bits > 0, ESP_ERR_NOT_SUPPORTED, TAG, "No duty resolution at %d Hz", FAN_HAL_PWM_FREQ);
+    ledc_max = (1UL << bits) - 1;
+
+    // Prepare and then apply the LEDC PWM timer configuration
+    ledc_timer_config_t ledc_timer = {
+        .speed_mode       = LEDC_MODE,
+        .duty_resolution  = (ledc_timer_bit_t)bits,
+        .timer_num        = LEDC_TIMER,
+        .freq_hz          = FAN_HAL_PWM_FREQ,
+    //    .clk_cfg          = LEDC_AUTO_CLK
+        .clk_cfg          = LEDC_USE_RC_FAST_CLK
+    };
+    ESP_RETURN_ON_ERROR(ledc_timer_config(&ledc_timer), TAG, "LEDC timer config failed");
+
+    // Prepare and then apply the LEDC PWM channel configuration, one channel per zone
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        ledc_channel_config_t ledc_channel = {
+            .speed_mode     = LEDC_MODE,
+            .channel        = LEDC_CHANNEL(zone),
+            .timer_sel      = LEDC_TIMER,
+            .intr_type      = LEDC_INTR_DISABLE,
+            .gpio_num       = fan_zones[zone].pwm_gpio,
+            .duty           = ledc_max, // Lowest fan duty of the inverted stage
+            .hpoint         = 0,
+            .sleep_mode     = LEDC_SLEEP_MODE_KEEP_ALIVE
+//            .sleep_mode     = LEDC_SLEEP_MODE_NO_ALIVE_ALLOW_PD
+        };
+        ESP_RETURN_ON_ERROR(ledc_channel_config(&ledc_channel), TAG, "LEDC channel config failed");
+    }
+    //-------------Fades step in the LEDC, the ISR only runs at their end---------------//
+    ESP_RETURN_ON_ERROR(ledc_fade_func_install(0), TAG, "LEDC fade install failed");
+    ESP_LOGI(TAG, "PWM %lu-bit at %d Hz from RC_FAST (%lu kHz)", (unsigned long)bits, FAN_HAL_PWM_FREQ,
+             (unsigned long)(clk_hz / 1000));
+    return ESP_OK;
+}
+
+uint32_t fan_hal_pwm_max(void)
+{
+    return ledc_max;
+}
+
+esp_err_t fan_hal_pwm_set(int zone, uint32_t duty)
+{
+    ESP_RETURN_ON_ERROR(ledc_fade_stop(LEDC_MODE, LEDC_CHANNEL(zone)), TAG, "LEDC fade stop failed");
+    ESP_RETURN_ON_ERROR(ledc_set_duty(LEDC_MODE, LEDC_CHANNEL(zone), duty), TAG, "LEDC set duty failed");
+    return ledc_update_duty(LEDC_MODE, LEDC_CHANNEL(zone));
+}
+
+// Starts from where a running fade stands, the driver reads the duty back
+esp_err_t fan_hal_pwm_fade(int zone, uint32_t duty, uint32_t time_ms)
+{
+    ESP_RETURN_ON_ERROR(ledc_fade_stop(LEDC_MODE, LEDC_CHANNEL(zone)), TAG, "LEDC fade stop failed");
+    ESP_RETURN_ON_ERROR(ledc_set_fade_with_time(LEDC_MODE, LEDC_CHANNEL(zone), duty, time_ms), TAG, "LEDC fade failed");
+    return ledc_fade_start(LEDC_MODE, LEDC_CHANNEL(zone), LEDC_FADE_NO_WAIT);
+}
+
+esp_err_t fan_hal_pwm_stop(int zone, uint32_t idle_level)
+{
+    ESP_RETURN_ON_ERROR(ledc_fade_stop(LEDC_MODE, LEDC_CHANNEL(zone)), TAG, "LEDC fade stop failed");
+    return ledc_stop(LEDC_MODE, LEDC_CHANNEL(zone), idle_level);
+}
+
+/*---------------------------------------------------------------
+        Tach
+---------------------------------------------------------------*/
+esp_err_t fan_hal_tach_init(int zone)
+{
+    ESP_LOGI(TAG, "install pcnt unit %d", zone);
+    pcnt_unit_config_t unit_config = {
+        .high_limit = PCNT_HIGH_LIMIT,
+        .low_limit = PCNT_LOW_LIMIT,
+        .flags.accum_count = 1,
+    };
+    ESP_RETURN_ON_ERROR(pcnt_new_unit(&unit_config, &pcnt_unit[zone]), TAG, "pcnt unit install failed");
+    ESP_RETURN_ON_ERROR(pcnt_unit_add_watch_point(pcnt_unit[zone], PCNT_HIGH_LIMIT), TAG, "pcnt watch point failed");
+
+    ESP_LOGI(TAG, "set glitch filter");
+    pcnt_glitch_filter_config_t filter_config = {
+        .max_glitch_ns = 6000,
+    };
+    ESP_RETURN_ON_ERROR(pcnt_unit_set_glitch_filter(pcnt_unit[zone], &filter_config), TAG, "pcnt glitch filter failed");
+
+    ESP_LOGI(TAG, "install pcnt channels");
+    pcnt_chan_config_t chan_config = {
+        .edge_gpio_num = fan_zones[zone].tach_gpio,
+        .level_gpio_num = PCNT_GPIO_LEVEL,
+    };
+    pcnt_channel_handle_t pcnt_chan = NULL;
+    ESP_RETURN_ON_ERROR(pcnt_new_channel(pcnt_unit[zone], &chan_config, &pcnt_chan), TAG, "pcnt channel install failed");
+
+    // hold the counter on rising edge, increase the counter on falling edge
+    return pcnt_channel_set_edge_action(pcnt_chan, PCNT_CHANNEL_EDGE_ACTION_HOLD, PCNT_CHANNEL_EDGE_ACTION_INCREASE);
+}
+
+esp_err_t fan_hal_tach_enable(int zone)
+{
+    return pcnt_unit_enable(pcnt_unit[zone]);
+}
+
+esp_err_t fan_hal_tach_disable(int zone)
+{
+    return pcnt_unit_disable(pcnt_unit[zone]);
+}
+
+esp_err_t fan_hal_tach_start(int zone)
+{
+    return pcnt_unit_start(pcnt_unit[zone]);
+}
+
+esp_err_t fan_hal_tach_clear(int zone)
+{
+    return pcnt_unit_clear_count(pcnt_unit[zone]);
+}
+
+esp_err_t fan_hal_tach_get_count(int zone, int *count)
+{
+    return pcnt_unit_get_count(pcnt_unit[zone], count);
+}
+
+static bool IRAM_ATTR pcnt_reach_cb(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *user_ctx)
+{
+    int zone = (int)(intptr_t)user_ctx;
+
+    if (tach_watch_cb[zone]) {
+        tach_watch_cb[zone](esp_timer_get_time(), tach_watch_arg[zone]);
+    }
+    return false;
+}
+
+esp_err_t fan_hal_tach_watch(int zone, fan_hal_tach_cb_t cb, void *arg)
+{
+    pcnt_event_callbacks_t cbs = {
+        .on_reach = pcnt_reach_cb,
+    };
+    tach_watch_cb[zone] = cb;
+    tach_watch_arg[zone] = arg;
+    return pcnt_unit_register_event_callbacks(pcnt_unit[zone], &cbs, (void *)(intptr_t)zone);
+}
+
+/*---------------------------------------------------------------
+        ADC
+---------------------------------------------------------------*/
+static bool IRAM_ATTR adc_conv_done_cb(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+    BaseType_t must_yield = pdFALSE;
+
+    vTaskNotifyGiveFromISR(adc_reader, &must_yield);
+    return (must_yield == pdTRUE);
+}
+
+// Calibrate a decimated raw value, interpolating between neighbouring codes; never raw codes as millivolts
+static esp_err_t adc_raw_to_mv(int chan, q16_t raw, q16_t *mv)
+{
+    int code = Q16_INT(raw);
+    int mv_lo, mv_hi;
+
+    ESP_RETURN_ON_FALSE(adc_cali_done[chan], ESP_ERR_INVALID_STATE, TAG, "ADC1 channel %d not calibrated", adc_chan_map[chan]);
+    ESP_RETURN_ON_ERROR(adc_cali_raw_to_voltage(adc_cali_handle[chan], code, &mv_lo), TAG, "ADC1 calibration failed");
+    //-------------Full scale has no code above it, hold the top code's voltage---------------//
+    if (code >= ADC_CODE_MAX) {
+        *mv = q16_from_int(mv_lo);
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(adc_cali_raw_to_voltage(adc_cali_handle[chan], code + 1, &mv_hi), TAG, "ADC1 calibration failed");
+    *mv = q16_from_int(mv_lo) + (raw & (Q16_ONE - 1)) * (mv_hi - mv_lo);
+    return ESP_OK;
+}
+
+// Driver handle, scan pattern and callback; the calibration outlives a recovery
+static esp_err_t adc_install(void)
+{
+    //-------------ADC1 Init---------------//
+    adc_continuous_handle_cfg_t adc_config = {
+        .max_store_buf_size = 2 * ADC_FRAME_BYTES,
+        .conv_frame_size = ADC_FRAME_BYTES,
+    };
+    ESP_RETURN_ON_ERROR(adc_continuous_new_handle(&adc_config, &adc1_handle), TAG, "ADC1 continuous install failed");
+
+    //-------------ADC1 Config---------------//
+    adc_digi_pattern_config_t adc_pattern[ADC_PATTERN_NUM] = {0};
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        adc_chan_map[zone * FAN_HAL_ADC_MAX + FAN_HAL_ADC_CURRENT] = fan_zones[zone].adc_current;
+        adc_chan_map[zone * FAN_HAL_ADC_MAX + FAN_HAL_ADC_NTC] = fan_zones[zone].adc_ntc;
+    }
+    for (int i = 0; i < ADC_PATTERN_NUM; i++) {
+        adc_pattern[i].atten = EXAMPLE_ADC_ATTEN;
+        adc_pattern[i].channel = adc_chan_map[i];
+        adc_pattern[i].unit = ADC_UNIT_1;
+        adc_pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    }
+    adc_continuous_config_t dig_cfg = {
+        .pattern_num = ADC_PATTERN_NUM,
+        .adc_pattern = adc_pattern,
+        .sample_freq_hz = ADC_CHAN_RATE_HZ * ADC_PATTERN_NUM,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+    };
+    ESP_RETURN_ON_ERROR(adc_continuous_config(adc1_handle, &dig_cfg), TAG, "ADC1 scan config failed");
+
+    adc_continuous_evt_cbs_t cbs = {
+        .on_conv_done = adc_conv_done_cb,
+    };
+    ESP_RETURN_ON_ERROR(adc_continuous_register_event_callbacks(adc1_handle, &cbs, NULL), TAG, "ADC1 callback failed");
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_adc_init(void)
+{
+    ESP_RETURN_ON_ERROR(adc_install(), TAG, "ADC1 install failed");
+
+    //-------------ADC1 Calibration Init---------------//
+    //-------------Uncalibrated codes are no millivolts: the curves, the fault limits and the energy meter need them---------------//
+    for (int i = 0; i < ADC_PATTERN_NUM; i++) {
+        adc_cali_done[i] = example_adc_calibration_init(ADC_UNIT_1, adc_chan_map[i], EXAMPLE_ADC_ATTEN, &adc_cali_handle[i]);
+        ESP_RETURN_ON_FALSE(adc_cali_done[i], ESP_ERR_NOT_SUPPORTED, TAG, "ADC1 channel %d has no calibration scheme",
+                            adc_chan_map[i]);
+    }
+    ESP_LOGI(TAG, "ADC1 scan %d channels at %d Hz, %d samples per channel and frame",
+             ADC_PATTERN_NUM, ADC_CHAN_RATE_HZ * ADC_PATTERN_NUM, ADC_BLOCK_N);
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_adc_read_frame(fan_hal_adc_frame_t *frame)
+{
+    uint32_t length = 0;
+    int count[ADC_PATTERN_NUM] = {0};
+
+    // The converter only runs for one block, so the APB/sleep PM locks are released in between
+    adc_reader = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTake(pdTRUE, 0);
+    ESP_RETURN_ON_ERROR(adc_continuous_flush_pool(adc1_handle), TAG, "ADC1 flush failed");
+    ESP_RETURN_ON_ERROR(adc_continuous_start(adc1_handle), TAG, "ADC1 start failed");
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ADC_FRAME_TIMEOUT_MS)) == 0) {
+        adc_continuous_stop(adc1_handle);
+        return ESP_ERR_TIMEOUT;
+    }
+    esp_err_t ret = adc_continuous_read(adc1_handle, adc_frame_buf, ADC_FRAME_BYTES, &length, 0);
+    adc_continuous_stop(adc1_handle);
+    ESP_RETURN_ON_ERROR(ret, TAG, "ADC1 read failed");
+
+    for (int i = 0; i < length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        adc_digi_output_data_t *p = (adc_digi_output_data_t *)&adc_frame_buf[i];
+        for (int chan = 0; chan < ADC_PATTERN_NUM; chan++) {
+            if (ADC_GET_CHANNEL(p) == adc_chan_map[chan] && count[chan] < ADC_BLOCK_N) {
+                adc_samples[chan][count[chan]++] = ADC_GET_DATA(p);
+            }
+        }
+    }
+
+    frame->samples = ADC_BLOCK_N;
+    for (int chan = 0; chan < ADC_PATTERN_NUM; chan++) {
+        if (count[chan] == 0) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (count[chan] < frame->samples) {
+            frame->samples = count[chan];
+        }
+        ESP_RETURN_ON_ERROR(adc_raw_to_mv(chan, adc_block_decimate(adc_samples[chan], count[chan]),
+                                          &frame->mv[chan / FAN_HAL_ADC_MAX][chan % FAN_HAL_ADC_MAX]), TAG, "ADC1 conversion failed");
+    }
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_adc_recover(void)
+{
+    //-------------A wedged DMA or a lost conversion event: new driver handle---------------//
+    adc_continuous_stop(adc1_handle);
+    if (adc1_handle != NULL) {
+        ESP_RETURN_ON_ERROR(adc_continuous_deinit(adc1_handle), TAG, "ADC1 deinit failed");
+        adc1_handle = NULL;
+    }
+    ESP_RETURN_ON_ERROR(adc_install(), TAG, "ADC1 reinstall failed");
+    ESP_LOGW(TAG, "ADC1 driver restarted");
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        ESP die temperature sensor
+---------------------------------------------------------------*/
+esp_err_t fan_hal_tsens_init(void)
+{
+    temperature_sensor_config_t temp_sensor_config = TEMPERATURE_SENSOR_CONFIG_DEFAULT(-10, 80);
+    ESP_LOGI(TAG, "Install temperature sensor, expected temp ranger range: -10~80 ℃");
+    ESP_RETURN_ON_ERROR(temperature_sensor_install(&temp_sensor_config, &temp_sensor), TAG, "tsens install failed");
+    ESP_LOGI(TAG, "Enable temperature sensor");
+    return temperature_sensor_enable(temp_sensor);
+}
+
+esp_err_t fan_hal_tsens_recover(void)
+{
+    if (temp_sensor != NULL) {
+        temperature_sensor_disable(temp_sensor);
+        ESP_RETURN_ON_ERROR(temperature_sensor_uninstall(temp_sensor), TAG, "tsens uninstall failed");
+        temp_sensor = NULL;
+    }
+    return fan_hal_tsens_init();
+}
+
+esp_err_t fan_hal_tsens_read(q16_t *celsius)
+{
+    float tsens;
+
+    ESP_RETURN_ON_ERROR(temperature_sensor_get_celsius(temp_sensor, &tsens), TAG, "tsens read failed");
+    *celsius = (q16_t)(tsens * Q16_ONE);
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        ADC Calibration
+---------------------------------------------------------------*/
+static bool example_adc_calibration_init(adc_unit_t unit, adc_channel_t channel, adc_atten_t atten, adc_cali_handle_t *out_handle)
+{
+    adc_cali_handle_t handle = NULL;
+    esp_err_t ret = ESP_FAIL;
+    bool calibrated = false;
+
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    if (!calibrated) {
+        ESP_LOGI(TAG, "calibration scheme version is %s", "Curve Fitting");
+        adc_cali_curve_fitting_config_t cali_config = {
+            .unit_id = unit,
+            .chan = channel,
+            .atten = atten,
+            .bitwidth = ADC_BITWIDTH_DEFAULT,
+        };
+        ret = adc_cali_create_scheme_curve_fitting(&cali_config, &handle);
+        if (ret == ESP_OK) {
+            calibrated = true;
+        }
+    }
+#endif
+
+#if ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+    if (!calibrated) {
+        ESP_LOGI(TAG, "calibration scheme version is %s", "Line Fitting");
+        adc_cali_line_fitting_config_t cali_config = {
+            .unit_id = unit,
+            .atten = atten,
+            .bitwidth = ADC_BITWIDTH_DEFAULT,
+        };
+        ret = adc_cali_create_scheme_line_fitting(&cali_config, &handle);
+        if (ret == ESP_OK) {
+            calibrated = true;
+        }
+    }
+#endif
+
+    *out_handle = handle;
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Calibration Success");
+    } else if (ret == ESP_ERR_NOT_SUPPORTED || !calibrated) {
+        ESP_LOGW(TAG, "eFuse not burnt, skip software calibration");
+    } else {
+        ESP_LOGE(TAG, "Invalid arg or no memory");
+    }
+
+    return calibrated;
+}
@@ -0,0 +1,1639 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#define _GNU_SOURCE     // posix_openpt() and cfmakeraw() of the host link pty
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_console.h"
+#include "esp_bit_defs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "fan_hal.h"
+#include "fan_fault.h"
+#include "fan_bus.h"
+#include "fan_trace.h"
+#include "fan_perf.h"
+#include "fan_energy.h"
+#include "fan_curve.h"
+#include "fan_cycle.h"
+#include "fan_profile.h"
+#include "esp_rom_crc.h"
+#include "adc_block.h"
+
+/*---------------------------------------------------------------
+        Simulated backend for the linux target
+
+        Every blocking call of the control tasks goes through
+        fan_hal_delay_ms(), which parks the task on a virtual clock.
+        The clock task runs at idle priority, so it only gets the CPU
+        once every control task is parked; it then steps the plant up
+        to the earliest wake time and releases that task. Virtual time
+        therefore advances as fast as the control code can execute.
+---------------------------------------------------------------*/
+const static char *TAG = "Fan-SIM";
+/*---------------------------------------------------------------
+        Replay Macros
+---------------------------------------------------------------*/
+#define SIM_REPLAY_HOURS    24
+#define SIM_START_HOUR      0
+#define SIM_STEP_MS         100     // Plant integration step
+#define SIM_LOG_LEVEL       ESP_LOG_WARN    // Control task log level while replaying
+#define SIM_MAX_SLEEPERS    8
+#define SIM_SLEEP_MIN_MS    30      // Idle gaps shorter than this stay awake (3 ticks before light sleep)
+#define SIM_SEED            0x2f6b1d3u
+#define SIM_STORE_FILE      "fan_store.bin"     // NVS stand-in in the working directory, delete for a cold boot
+#define SIM_STORE_KEYS      16
+#define SIM_STORE_BLOB_MAX  256
+#define SIM_HIST_FILE       "fan_history.bin"   // History partition, decode with tools/fan_hist.py
+#define SIM_HIST_SIZE       0xF0000             // As in partitions.csv
+#define SIM_TELEM_FILE      "fan_telem.bin"     // Telemetry packets of the last run, decode with tools/fan_telem.py
+/*---------------------------------------------------------------
+        Fan model Macros
+---------------------------------------------------------------*/
+#define SIM_PWM_CLK_HZ      8000000 // RC_FAST of the H2, sets the LEDC resolution
+#define SIM_FAN_START_DUTY  0.20    // Duty needed to break away from standstill
+#define SIM_FAN_STALL_DUTY  0.12    // A spinning fan stalls below this duty
+#define SIM_FAN_MIN_RPM     500
+#define SIM_FAN_MAX_RPM     3000
+#define SIM_FAN_TAU_S       1.5
+#define SIM_FAN_FRICTION_RPM 100    // An undriven fan coasting below this stops dead
+#define SIM_FAN_PULSE_REV   2
+/*---------------------------------------------------------------
+        Thermal plant Macros (disk cage)
+---------------------------------------------------------------*/
+#define SIM_ROOM_MEAN       27.0
+#define SIM_ROOM_SWING      4.0     // Daily +/- swing, warmest at 15:00
+#define SIM_CELL_C          1500.0  // Heat capacity J/K
+#define SIM_CELL_G0         0.25    // Natural convection W/K
+#define SIM_CELL_G1         1.60    // Forced convection W/K at full RPM
+#define SIM_BASE_W          2.0     // Disk electronics on the 5V rail
+#define SIM_RAIL_V          12.0
+#define SIM_DIE_SELFHEAT    0.75
+#define SIM_NOISE_CURRENT   20.0    // mV peak, single conversion
+#define SIM_NOISE_NTC       8.0     // mV peak, single conversion
+#define SIM_NOISE_TSENS     0.3     // ℃ peak
+#define SIM_STEP_TRACK_MA   200     // Load rises this large get their Cell-T peak reported
+#define SIM_STEP_WINDOW_S   3600    // ... over this window
+#define SIM_CONSOLE_CMD     ""      // Console line typed at SIM_CONSOLE_AT_H, e.g. "tune start"
+#define SIM_CONSOLE_AT_H    0
+#define SIM_RESTART_HANDLERS 4      // fan_hal_on_restart() slots
+#define SIM_HOST_PTY        0       // 1 opens a pty for tools/fan_host.py and paces the replay to wall time
+#define SIM_HOST_POLL_MS    10      // Wall time between two looks at the pty, the UART interrupt stand-in
+#define SIM_FAULTS          0       // 1 injects sim_faults[] and reports detection and reaction latency
+#define SIM_BUS             0       // 1 puts sim_bays[] on a 1-Wire bus, 0 leaves the board without one
+#define SIM_BUS_RESET_US    960     // Reset pulse and presence window
+#define SIM_BUS_BYTE_US     520     // Eight 65 us time slots
+#define SIM_BUS_SEARCH_US   12500   // 64 triplets of the ROM search, per device
+#define SIM_BUS_GLITCH      2000    // One byte in this many reads back with a flipped bit
+#define SIM_TRACE_FILE      ""      // Capture holding fan_trace.h packets: its rail current and room drive the cages
+#define SIM_TRACE_ENV       "SIM_TRACE" // Environment variable naming a capture, over SIM_TRACE_FILE
+#define SIM_TRACE_GAP_S     60      // Longer holes in a trace are not scored
+#define SIM_BENCH_FILE      "fan_bench.json"    // Scores of the run, compare with tools/fan_bench.py
+#define SIM_BENCH_CEILING   38.0    // ℃ of cell the scores count the time above
+
+typedef struct {
+    float load_scale;   // Rail current and electronics heat against cage0
+    float hour_shift;   // Load profile runs this many hours later
+    float rpm_scale;    // Worn bearing or clogged filter, 1.0 is a new fan
+} sim_cage_cfg_t;
+
+// One entry per fan_zones[] entry
+static const sim_cage_cfg_t sim_cage_cfg[] = {
+    { 1.00,  0, 1.00 }, // cage0, the reference cage of the single zone replay
+    { 0.50,  0, 1.00 }, // cage1, half the disks
+    { 1.00, 12, 0.85 }, // cage2, backup target busy at night, aged fan
+    { 0.25,  3, 1.00 }, // ssd
+};
+_Static_assert(FAN_ZONE_NUM <= sizeof(sim_cage_cfg) / sizeof(sim_cage_cfg[0]), "sim_cage_cfg[] shorter than fan_zones[]");
+
+typedef struct {
+    float start_h;
+    int load_ma;
+} sim_load_t;
+
+// 12V rail load over a day: spun down, scrub, idle, office hours, evening
+static const sim_load_t sim_load_day[] = {
+    {  0.00,  120 },
+    {  2.00, 2200 },    // Spin-up surge of the whole cage
+    {  2.01, 1100 },    // Scrub
+    {  5.00,  380 },
+    {  8.00,  650 },
+    { 12.00,  380 },
+    { 13.00,  900 },
+    { 18.00,  650 },
+    { 23.00,  120 },
+};
+
+typedef enum {
+    SIM_FAULT_LOCKED,       // Rotor blocked, no tach edges at any duty
+    SIM_FAULT_NTC_OPEN,     // NTC lead off, divider at the rail
+    SIM_FAULT_NTC_SHORT,
+    SIM_FAULT_CURRENT_SAT,  // Shunt amplifier at its output swing
+    SIM_FAULT_TSENS,        // Die sensor reads fail
+    SIM_FAULT_ADC,          // DMA wedged, reads fail until the driver is restarted after the window
+} sim_fault_kind_t;
+
+typedef struct {
+    sim_fault_kind_t kind;
+    int zone;               // -1 for the board faults
+    float at_h;
+    int for_s;
+} sim_fault_t;
+
+static const sim_fault_t sim_faults[] = {
+    { SIM_FAULT_LOCKED,      1,  3.0, 600 },
+    { SIM_FAULT_NTC_OPEN,    0,  6.0, 600 },
+    { SIM_FAULT_NTC_SHORT,   2,  9.0, 300 },
+    { SIM_FAULT_CURRENT_SAT, 0, 12.0, 300 },
+    { SIM_FAULT_TSENS,      -1, 15.0, 300 },
+    { SIM_FAULT_ADC,        -1, 18.0, 120 },
+};
+#define SIM_FAULT_NUM       (sizeof(sim_faults) / sizeof(sim_faults[0]))
+
+typedef struct {
+    uint32_t serial;        // Low bits of the 48-bit serial, family and CRC are added
+    uint8_t zone;           // TH in the EEPROM as shipped
+    uint8_t weight;         // TL
+    float offset;           // ℃ above the cage air at full load, scaled down towards spun down
+} sim_bay_t;
+
+// DS18B20 taped to the drives, as 'bus set' would have left them
+static const sim_bay_t sim_bays[] = {
+    { 0x0a1f01, 0, 100, 2.0 },                  // cage0, front bay in the inlet air
+    { 0x0a1f02, 0, 100, 4.5 },                  // cage0, middle bay between two drives
+    { 0x0a1f03, 1, 100, 2.5 },
+    { 0x0a1f04, 2, 100, 3.0 },
+    { 0x0a1f05, 2,  50, 6.0 },                  // cage2, rear bay behind the fan hub
+    { 0x0a1f06, 3, 100, 1.5 },
+    { 0x0a1f07, FAN_BUS_UNASSIGNED, 100, 0.0 }, // spare on the chain, never assigned
+};
+#define SIM_BAY_NUM         (sizeof(sim_bays) / sizeof(sim_bays[0]))
+
+typedef struct {
+    TaskHandle_t task;
+    int64_t wake_us;
+} sim_sleeper_t;
+
+static sim_sleeper_t sim_sleepers[SIM_MAX_SLEEPERS];
+static int64_t sim_now_us;
+static int64_t sim_timer_us = INT64_MAX;
+static void (*sim_timer_cb)(void *arg);
+static void *sim_timer_arg;
+static uint32_t sim_wakeups;
+static int64_t sim_sleep_us;
+static bool sim_adc_busy;
+static uint32_t sim_rand_state = SIM_SEED;
+
+typedef struct {
+    float cell;
+    float rpm;
+    float pulse_acc;
+    int load;
+    uint32_t pwm_duty;      // Raw LEDC value, the end of a running fade
+    uint32_t pwm_from;      // Fade start value and time, end time
+    int64_t pwm_from_us;
+    int64_t pwm_end_us;
+    bool tach_enabled;
+    bool tach_started;
+    int tach_count;
+    fan_hal_tach_cb_t tach_cb;
+    void *tach_arg;
+    bool fan_driven;
+    double charge;          // Rail load over the run, mA s
+    double disks_right_s;   // fan_energy_disks() matched the plant
+    double disks_s;
+    double duty_sum;
+    float duty_peak;
+    double above_s;         // Cell over SIM_BENCH_CEILING
+    float cell_max;
+    int fan_starts;
+    int step_ma;            // Load rise being tracked, 0 when none
+    int64_t step_us;
+    float step_peak;
+    bool locked;
+    bool ntc_open;
+    bool ntc_short;
+    bool current_sat;
+} sim_cage_t;
+
+typedef struct {
+    char key[16];           // NVS key length limit
+    uint32_t len;
+    uint8_t blob[SIM_STORE_BLOB_MAX];
+} sim_store_entry_t;
+
+static sim_store_entry_t sim_store[SIM_STORE_KEYS];
+static FILE *sim_telem;
+static FILE *sim_hist;
+
+static float sim_room;
+static sim_cage_t sim_cages[FAN_ZONE_NUM];
+static bool sim_adc_ready;
+static int64_t sim_steps;
+static bool sim_tsens_dead;
+static bool sim_adc_wedged;
+static bool sim_adc_window;         // Wedge cause still there, a restart does not help yet
+static int64_t sim_fault_us[SIM_FAULT_NUM][4];  // Injected, detected, reacted, cleared
+static int sim_host_fd = -1;        // pty master
+static TaskHandle_t sim_host_reader;
+static uint8_t sim_host_buf[512];   // The driver ring
+static size_t sim_host_fill;
+static bool sim_host_rx;            // Bytes came in, notify the reader once the clock is there
+static void (*sim_on_restart[SIM_RESTART_HANDLERS])(void);
+
+typedef struct {
+    uint64_t rom;
+    uint8_t pad[FAN_BUS_PAD_LEN];   // Scratchpad, CRC filled in on read
+    uint8_t eeprom[3];              // TH, TL, config
+    int16_t latched;                // Conversion result, lands in the scratchpad when ready
+    int64_t ready_us;               // 0 when no conversion runs
+} sim_ds18b20_t;
+
+static sim_ds18b20_t sim_ds[SIM_BAY_NUM];
+
+typedef struct {
+    uint32_t ms;            // From the first record of the trace
+    int load_ma;
+    float room;
+    q16_t ntc_mv;           // As recorded, for the open loop
+    q16_t current_mv;
+    q16_t tsens;
+} sim_trace_pt_t;
+
+typedef struct {
+    double duty_sum;        // Duty seconds
+    float duty_peak;
+    int starts;
+    double above_s;
+    float cell_max;
+    double time_s;
+} sim_score_t;
+
+static sim_trace_pt_t *sim_trace[FAN_ZONE_NUM];
+static int sim_trace_room_zone;
+static int sim_trace_len[FAN_ZONE_NUM];
+static int sim_trace_pos[FAN_ZONE_NUM];
+static float sim_trace_cell[FAN_ZONE_NUM];      // Of the first record, the replay starts there
+static sim_score_t sim_recorded[FAN_ZONE_NUM];  // What the controller of the capture did
+static sim_score_t sim_open[FAN_ZONE_NUM];      // What the firmware's curves make of the recorded sensors
+static double sim_open_cpu;                     // Per zone evaluation
+static bool sim_traced;
+static const char *sim_trace_file = SIM_TRACE_FILE;
+static int64_t sim_end_us = SIM_REPLAY_HOURS * 3600LL * 1000000;
+
+static uint32_t sim_rand(void)
+{
+    sim_rand_state ^= sim_rand_state << 13;
+    sim_rand_state ^= sim_rand_state >> 17;
+    sim_rand_state ^= sim_rand_state << 5;
+    return sim_rand_state;
+}
+
+static float sim_noise(float peak)
+{
+    return peak * ((float)(sim_rand() & 0xffff) / 32768.0f - 1.0f);
+}
+
+static float sim_hour(void)
+{
+    return (float)fmod(SIM_START_HOUR + sim_now_us / 3600e6, 24.0);
+}
+
+static int sim_load_ma(int zone, float hour)
+{
+    int load = sim_load_day[0].load_ma;
+
+    if (sim_trace_len[zone] > 0) {
+        return sim_trace[zone][sim_trace_pos[zone]].load_ma;
+    }
+
+    hour = fmodf(hour + 24.0f - sim_cage_cfg[zone].hour_shift, 24.0f);
+    for (int i = 0; i < sizeof(sim_load_day) / sizeof(sim_load_day[0]); i++) {
+        if (hour >= sim_load_day[i].start_h) {
+            load = sim_load_day[i].load_ma;
+        }
+    }
+    return (int)(load * sim_cage_cfg[zone].load_scale);
+}
+
+static uint32_t sim_pwm_max;
+static int sim_pwm_bits;
+
+// Counts of the inverted stage along a running fade, the LEDC steps whole counts
+static uint32_t sim_pwm_raw(int zone)
+{
+    const sim_cage_t *c = &sim_cages[zone];
+
+    if (sim_now_us >= c->pwm_end_us) {
+        return c->pwm_duty;
+    }
+    int64_t span = (int64_t)c->pwm_duty - c->pwm_from;
+    return c->pwm_from + (int32_t)(span * (sim_now_us - c->pwm_from_us) / (c->pwm_end_us - c->pwm_from_us));
+}
+
+static float sim_fan_duty(int zone)
+{
+    return 1.0f - (float)sim_pwm_raw(zone) / (sim_pwm_max + 1);
+}
+
+// Same cubic as ntc2temp(), inverted by bisection (monotonic over the ADC range)
+static int sim_ntc_mv(float celsius)
+{
+    float lo = 0, hi = 3300;
+    for (int i = 0; i < 24; i++) {
+        float mid = (lo + hi) / 2;
+        float t = ((3.79e-5f - 6.76e-9f * mid) * mid * mid) - 9.65e-2f * mid + 116.0f;
+        if (t > celsius) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (int)lo;
+}
+
+static void sim_cage_step(int zone, float hour, float dt)
+{
+    sim_cage_t *c = &sim_cages[zone];
+    float duty = sim_fan_duty(zone);
+    float rpm_target = 0;
+
+    //-------------Fan---------------//
+    bool spinning = c->rpm > SIM_FAN_MIN_RPM / 2;
+    if ((spinning && duty >= SIM_FAN_STALL_DUTY) || duty >= SIM_FAN_START_DUTY) {
+        rpm_target = SIM_FAN_MIN_RPM + (SIM_FAN_MAX_RPM - SIM_FAN_MIN_RPM) * (duty - SIM_FAN_STALL_DUTY) / (1.0f - SIM_FAN_STALL_DUTY);
+        rpm_target *= sim_cage_cfg[zone].rpm_scale;
+    }
+    if (c->locked) {
+        rpm_target = 0;
+        c->rpm = 0;
+    }
+    if (!c->fan_driven && rpm_target > 0) {
+        c->fan_starts++;
+    }
+    c->fan_driven = rpm_target > 0;
+    c->rpm += (rpm_target - c->rpm) * dt / (SIM_FAN_TAU_S + dt);
+    if (rpm_target == 0 && c->rpm < SIM_FAN_FRICTION_RPM) {
+        c->rpm = 0;
+    }
+    if (c->tach_enabled && c->tach_started) {
+        float rate = c->rpm * SIM_FAN_PULSE_REV / 60.0f;
+        float edges = c->pulse_acc + rate * dt;
+        // Watch events carry the interpolated time of the edge inside the step
+        for (int k = 1; k <= (int)edges; k++) {
+            c->tach_count++;
+            if (c->tach_cb && c->tach_count % FAN_HAL_TACH_WATCH == 0) {
+                c->tach_cb(sim_now_us + (int64_t)((k - c->pulse_acc) / rate * 1e6f), c->tach_arg);
+            }
+        }
+        c->pulse_acc = edges - (int)edges;
+    }
+
+    //-------------Disk cage---------------//
+    int load = sim_load_ma(zone, hour);
+    if (load - c->load >= SIM_STEP_TRACK_MA && c->step_ma == 0) {
+        c->step_ma = load - c->load;
+        c->step_us = sim_now_us;
+        c->step_peak = c->cell;
+    }
+    c->load = load;
+    c->charge += c->load * dt;
+    //-------------The day spins whole cages: spun down at the base current, else every bay---------------//
+    const fan_zone_disks_t *disks = &fan_zones[zone].disks;
+    if (disks->bays > 0 && !sim_traced) {
+        int spinning = c->load > disks->base_ma + disks->spin_ma / 2 ? disks->bays : 0;
+        c->disks_right_s += fan_energy_disks(zone) == spinning ? dt : 0;
+        c->disks_s += dt;
+    }
+    float heat = SIM_BASE_W * sim_cage_cfg[zone].load_scale + SIM_RAIL_V * c->load / 1000.0f;
+    float g = SIM_CELL_G0 + SIM_CELL_G1 * c->rpm / SIM_FAN_MAX_RPM;
+    c->cell += (heat - g * (c->cell - sim_room)) * dt / SIM_CELL_C;
+
+    c->duty_sum += duty;
+    if (duty > c->duty_peak) {
+        c->duty_peak = duty;
+    }
+    if (c->cell > SIM_BENCH_CEILING) {
+        c->above_s += dt;
+    }
+    if (c->cell > c->cell_max) {
+        c->cell_max = c->cell;
+    }
+    if (c->step_ma != 0) {
+        if (c->cell > c->step_peak) {
+            c->step_peak = c->cell;
+        }
+        if (sim_now_us - c->step_us >= SIM_STEP_WINDOW_S * 1000000LL) {
+            ESP_LOGI(TAG, "%s: Load step %+dmA at %02d:%02d, Cell-T peak %.2f℃ in the next %d min", fan_zones[zone].name,
+                     c->step_ma, (int)(c->step_us / 3600000000LL + SIM_START_HOUR) % 24, (int)(c->step_us / 60000000LL % 60),
+                     c->step_peak, SIM_STEP_WINDOW_S / 60);
+            c->step_ma = 0;
+        }
+    }
+}
+
+static void sim_plant_step(float dt)
+{
+    float hour = sim_hour();
+
+    if (sim_traced) {
+        //-------------The trace point in force at this time, room from the die sensor of zone 0's records---------------//
+        uint32_t ms = (uint32_t)(sim_now_us / 1000);
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            while (sim_trace_pos[zone] + 1 < sim_trace_len[zone] && sim_trace[zone][sim_trace_pos[zone] + 1].ms <= ms) {
+                sim_trace_pos[zone]++;
+            }
+        }
+        sim_room = sim_trace[sim_trace_room_zone][sim_trace_pos[sim_trace_room_zone]].room;
+    } else {
+        sim_room = SIM_ROOM_MEAN + SIM_ROOM_SWING * sinf((hour - 9.0f) * (float)M_PI / 12.0f);
+    }
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        sim_cage_step(zone, hour, dt);
+    }
+    sim_steps++;
+}
+
+// EMA factor of a sensor task for a sample spacing, as fan_sched_factor() for the current period
+static q16_t sim_filt_factor(q16_t factor, uint32_t dt_ms, uint32_t base_ms)
+{
+    return q16_clamp((q16_t)((int64_t)factor * dt_ms / base_ms), 0, Q16_ONE);
+}
+
+// Open loop: the recorded sensors through the firmware's filters and curves with no plant in between, the
+// demand switched by the start/stop thresholds of fan_cycle.h. Duty, starts and compute cost of a firmware
+// change come from here; the fan itself (kick, RPM loop) and the cell it cools need the closed loop.
+static void sim_open_loop(void)
+{
+    const fan_tuning_t *tune = fan_tuning();
+    uint32_t evals = 0;
+    uint32_t begin = fan_hal_bench_now();
+
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        const fan_curve_t *curve = &tune->curve[zone];
+        const sim_trace_pt_t *pt = sim_trace[zone];
+        sim_score_t *s = &sim_open[zone];
+        fan_cycle_stats_t cycle;
+        q16_t troom, tcell, current, duty = 0;
+        uint32_t since_ms = 0;
+        bool on = false;
+
+        if (sim_trace_len[zone] == 0) {
+            continue;
+        }
+        fan_cycle_get(zone, &cycle);
+        troom = pt[0].tsens - tune->selfheat;
+        tcell = ntc2temp_q(pt[0].ntc_mv);
+        current = pt[0].current_mv;
+        for (int i = 0; i < sim_trace_len[zone]; i++) {
+            if (i > 0) {
+                //-------------The duty of a record holds until the next one, filters at the record spacing---------------//
+                uint32_t dt_ms = pt[i].ms - pt[i - 1].ms;
+                if (dt_ms <= SIM_TRACE_GAP_S * 1000) {
+                    s->time_s += dt_ms / 1000.0;
+                    s->duty_sum += dt_ms / 1000.0 * duty / Q16_ONE;
+                }
+                troom = q16_ema(troom, pt[i].tsens - tune->selfheat,
+                                sim_filt_factor(tune->tsens_filt, dt_ms, FAN_TSENS_FILT_BASE_MS));
+                tcell = q16_ema(tcell, ntc2temp_q(pt[i].ntc_mv), sim_filt_factor(tune->tcell_filt, dt_ms, FAN_ADC_FILT_BASE_MS));
+                current = q16_ema(current, pt[i].current_mv, sim_filt_factor(tune->current_filt, dt_ms, FAN_ADC_FILT_BASE_MS));
+            }
+            q16_t demand = fusion_q(curve, tt2duty_q(curve, troom, tcell), i2duty_q(curve, current));
+            evals++;
+            //-------------As fan_cycle_update(): start over start_at after the off time or when urgent, stop under stop_at---------------//
+            if (!on && demand > cycle.start_at
+             && (pt[i].ms - since_ms >= FAN_CYCLE_MIN_OFF_S * 1000 || demand >= Q16(FAN_CYCLE_URGENT))) {
+                on = true;
+                since_ms = pt[i].ms;
+                s->starts++;
+            } else if (on && demand < cycle.stop_at && pt[i].ms - since_ms >= FAN_CYCLE_MIN_ON_S * 1000) {
+                on = false;
+                since_ms = pt[i].ms;
+            }
+            duty = !on ? 0 : demand > cycle.floor ? demand : cycle.floor;
+            if ((float)duty / Q16_ONE > s->duty_peak) {
+                s->duty_peak = (float)duty / Q16_ONE;
+            }
+        }
+    }
+    sim_open_cpu = evals ? (uint32_t)(fan_hal_bench_now() - begin) / (double)evals : 0;
+}
+
+static void sim_bench_zone(FILE *f, const char *name, float mean, float peak, int starts, double above_s,
+                           float cell_max, bool last)
+{
+    fprintf(f, "    \"%s\": {\"mean_duty\": %.2f, \"peak_duty\": %.2f, \"starts\": %d, \"above_min\": %.1f, "
+            "\"cell_max\": %.2f}%s\n", name, mean, peak, starts, above_s / 60, cell_max, last ? "" : ",");
+}
+
+// Scores of the run for tools/fan_bench.py; with a trace also those of the recorded controller
+static void sim_bench(double hours, double ctl_cpu, uint32_t ctl_p99, double ticks_h)
+{
+    FILE *f = fopen(SIM_BENCH_FILE, "w");
+
+    if (f == NULL) {
+        ESP_LOGW(TAG, "%s not written", SIM_BENCH_FILE);
+        return;
+    }
+    //-------------The capture by file name, a base file compares across working directories---------------//
+    const char *trace = strrchr(sim_trace_file, '/');
+    fprintf(f, "{\n  \"trace\": \"%s\",\n  \"hours\": %.2f,\n  \"ceiling\": %.1f,\n",
+            trace ? trace + 1 : sim_trace_file, hours, SIM_BENCH_CEILING);
+    fprintf(f, "  \"wakeups_h\": %.0f,\n  \"ticks_h\": %.0f,\n  \"ctl_cpu\": %.0f,\n  \"ctl_cpu_p99\": %lu,\n"
+            "  \"cpu_unit\": \"%s\",\n", sim_wakeups / hours, ticks_h, ctl_cpu, (unsigned long)ctl_p99,
+            FAN_HAL_BENCH_UNIT);
+    fprintf(f, "  \"replayed\": {\n");
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        const sim_cage_t *c = &sim_cages[zone];
+        sim_bench_zone(f, fan_zones[zone].name, 100 * c->duty_sum / sim_steps, 100 * c->duty_peak, c->fan_starts,
+                       c->above_s, c->cell_max, zone == FAN_ZONE_NUM - 1);
+    }
+    fprintf(f, "  }%s\n", sim_traced ? "," : "");
+    if (sim_traced) {
+        fprintf(f, "  \"open_loop_cpu\": %.0f,\n  \"open_loop\": {\n", sim_open_cpu);
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            const sim_score_t *s = &sim_open[zone];
+            fprintf(f, "    \"%s\": {\"mean_duty\": %.2f, \"peak_duty\": %.2f, \"starts\": %d}%s\n", fan_zones[zone].name,
+                    s->time_s > 0 ? 100 * s->duty_sum / s->time_s : 0, 100 * s->duty_peak, s->starts,
+                    zone == FAN_ZONE_NUM - 1 ? "" : ",");
+        }
+        fprintf(f, "  },\n");
+        fprintf(f, "  \"recorded\": {\n");
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            const sim_score_t *r = &sim_recorded[zone];
+            sim_bench_zone(f, fan_zones[zone].name, r->time_s > 0 ? 100 * r->duty_sum / r->time_s : 0,
+                           100 * r->duty_peak, r->starts, r->above_s, r->cell_max, zone == FAN_ZONE_NUM - 1);
+        }
+        fprintf(f, "  }\n");
+    }
+    fprintf(f, "}\n");
+    fclose(f);
+}
+
+static void sim_report(double wall_s)
+{
+    double virt_s = sim_now_us / 1e6;
+    fan_perf_t perf;
+
+    ESP_LOGI(TAG, "Replay: %.1f h virtual in %.2f s wall => %.0fx real time",
+             virt_s / 3600, wall_s, virt_s / wall_s);
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        ESP_LOGI(TAG, "%s: Mean duty: %.1f%%, Cell-T max: %.1f℃, Fan starts: %d", fan_zones[zone].name,
+                 100 * sim_cages[zone].duty_sum / sim_steps, sim_cages[zone].cell_max, sim_cages[zone].fan_starts);
+    }
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        const sim_cage_t *c = &sim_cages[zone];
+        fan_energy_stats_t e;
+        fan_energy_get(zone, &e);
+        double plant_wh = c->charge * SIM_RAIL_V / 3.6e6;
+        ESP_LOGI(TAG, "%s: Rail energy: %.2f Wh metered, %.2f Wh in the plant (%+.2f%%), disk count right %.1f%% of the time",
+                 fan_zones[zone].name, e.boot_wh, plant_wh, plant_wh > 0 ? 100 * (e.boot_wh - plant_wh) / plant_wh : 0,
+                 c->disks_s > 0 ? 100 * c->disks_right_s / c->disks_s : 100);
+    }
+    ESP_LOGI(TAG, "Wakeups: %.0f/h, Light sleep: %.1f%%",
+             sim_wakeups / (virt_s / 3600), 100.0 * sim_sleep_us / sim_now_us);
+
+    //-------------Scores: peak duty, time over the ceiling, control cost per tick---------------//
+    fan_perf_snapshot(&perf);
+    const fan_perf_hist_t *cpu = &perf.hist[FAN_PERF_CTL_CPU];
+    double ctl_cpu = cpu->count ? (double)cpu->sum / cpu->count : 0;
+    double ticks_h = perf.task[FAN_PERF_CTL].wakeups / ((sim_now_us - perf.since_us) / 3.6e9);
+    if (sim_traced) {
+        sim_open_loop();
+    }
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        const sim_cage_t *c = &sim_cages[zone];
+        const sim_score_t *r = &sim_recorded[zone];
+        ESP_LOGI(TAG, "%s: Peak duty: %.0f%%, above %.1f℃ for %.0f min", fan_zones[zone].name, 100 * c->duty_peak,
+                 SIM_BENCH_CEILING, c->above_s / 60);
+        if (sim_traced) {
+            ESP_LOGI(TAG, "%s: recorded: Mean duty: %.1f%%, Peak duty: %.0f%%, Fan starts: %d, above %.1f℃ for %.0f min",
+                     fan_zones[zone].name, r->time_s > 0 ? 100 * r->duty_sum / r->time_s : 0, 100 * r->duty_peak,
+                     r->starts, SIM_BENCH_CEILING, r->above_s / 60);
+            ESP_LOGI(TAG, "%s: open loop: Mean duty: %.1f%%, Peak duty: %.0f%%, Fan starts: %d", fan_zones[zone].name,
+                     sim_open[zone].time_s > 0 ? 100 * sim_open[zone].duty_sum / sim_open[zone].time_s : 0,
+                     100 * sim_open[zone].duty_peak, sim_open[zone].starts);
+        }
+    }
+    ESP_LOGI(TAG, "Control: %.0f ticks/h, %.0f %s per tick (p99 %lu)", ticks_h, ctl_cpu, FAN_HAL_BENCH_UNIT,
+             (unsigned long)fan_perf_percentile(cpu, 990));
+    if (sim_traced) {
+        ESP_LOGI(TAG, "Open loop: %.0f %s per zone evaluation", sim_open_cpu, FAN_HAL_BENCH_UNIT);
+    }
+    sim_bench(virt_s / 3600, ctl_cpu, fan_perf_percentile(cpu, 990), ticks_h);
+}
+
+static void sim_hour_summary(void)
+{
+    char line[40 * FAN_ZONE_NUM];
+    int len = 0;
+
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        len += snprintf(line + len, sizeof(line) - len, ", %s %.1f℃ %dmA %d%%", fan_zones[zone].name,
+                        sim_cages[zone].cell, sim_cages[zone].load, (int)(sim_fan_duty(zone) * 100));
+    }
+    ESP_LOGI(TAG, "%02d:00 Room-T: %.1f℃%s", (int)(sim_hour() + 0.5f) % 24, sim_room, line);
+}
+
+/*---------------------------------------------------------------
+        Fault injection
+---------------------------------------------------------------*/
+static const fan_fault_t sim_fault_map[] = {
+    [SIM_FAULT_LOCKED]      = FAN_FAULT_STALL,
+    [SIM_FAULT_NTC_OPEN]    = FAN_FAULT_NTC_OPEN,
+    [SIM_FAULT_NTC_SHORT]   = FAN_FAULT_NTC_SHORT,
+    [SIM_FAULT_CURRENT_SAT] = FAN_FAULT_CURRENT_SAT,
+    [SIM_FAULT_TSENS]       = FAN_FAULT_TSENS,
+    [SIM_FAULT_ADC]         = FAN_FAULT_ADC,
+};
+
+static void sim_fault_set(const sim_fault_t *f, bool on)
+{
+    switch (f->kind) {
+    case SIM_FAULT_LOCKED:
+        sim_cages[f->zone].locked = on;
+        break;
+    case SIM_FAULT_NTC_OPEN:
+        sim_cages[f->zone].ntc_open = on;
+        break;
+    case SIM_FAULT_NTC_SHORT:
+        sim_cages[f->zone].ntc_short = on;
+        break;
+    case SIM_FAULT_CURRENT_SAT:
+        sim_cages[f->zone].current_sat = on;
+        break;
+    case SIM_FAULT_TSENS:
+        sim_tsens_dead = on;
+        break;
+    case SIM_FAULT_ADC:
+        sim_adc_wedged |= on;
+        sim_adc_window = on;
+        break;
+    }
+}
+
+// The fail-safe has taken the fan where it should be
+static bool sim_fault_reacted(const sim_fault_t *f)
+{
+    switch (f->kind) {
+    case SIM_FAULT_LOCKED:
+        return sim_fan_duty(f->zone) >= 0.99f;
+    case SIM_FAULT_ADC:
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            if (sim_fan_duty(zone) < 0.99f) {
+                return false;
+            }
+        }
+        return true;
+    case SIM_FAULT_TSENS:
+        return true;
+    default:
+        return sim_fan_duty(f->zone) >= FAN_FAULT_DEGRADED_DUTY - 0.01f;
+    }
+}
+
+static void sim_faults_step(void)
+{
+    for (int i = 0; i < SIM_FAULT_NUM; i++) {
+        const sim_fault_t *f = &sim_faults[i];
+        int64_t *t = sim_fault_us[i];
+        int64_t at_us = (int64_t)(f->at_h * 3600e6);
+        bool seen = fan_fault_mask(f->zone < 0 ? 0 : f->zone) & BIT(sim_fault_map[f->kind]);
+
+        if (t[0] == 0 && sim_now_us >= at_us) {
+            t[0] = sim_now_us;
+            sim_fault_set(f, true);
+            ESP_LOGI(TAG, "Fault %s injected on %s for %ds", fan_fault_name(sim_fault_map[f->kind]),
+                     f->zone < 0 ? "board" : fan_zones[f->zone].name, f->for_s);
+        }
+        if (t[0] == 0 || t[3] != 0) {
+            continue;
+        }
+        if (t[1] == 0 && seen) {
+            t[1] = sim_now_us;
+        }
+        if (t[1] != 0 && t[2] == 0 && sim_fault_reacted(f)) {
+            t[2] = sim_now_us;
+            ESP_LOGI(TAG, "Fault %s: detected after %dms, fail-safe in place after %dms",
+                     fan_fault_name(sim_fault_map[f->kind]), (int)((t[1] - t[0]) / 1000), (int)((t[2] - t[0]) / 1000));
+        }
+        if (sim_now_us >= at_us + f->for_s * 1000000LL) {
+            sim_fault_set(f, false);
+            if (t[1] != 0 && !seen) {
+                t[3] = sim_now_us;
+                ESP_LOGI(TAG, "Fault %s: cleared %ds after removal", fan_fault_name(sim_fault_map[f->kind]),
+                         (int)((t[3] - at_us) / 1000000 - f->for_s));
+            }
+        }
+    }
+}
+
+/*---------------------------------------------------------------
+        Host link on a pty, wall time paced
+---------------------------------------------------------------*/
+static int64_t sim_wall_us(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static bool sim_host_poll(void)
+{
+    ssize_t n = read(sim_host_fd, sim_host_buf + sim_host_fill, sizeof(sim_host_buf) - sim_host_fill);
+    if (n > 0) {
+        sim_host_fill += n;
+        sim_host_rx = true;
+    }
+    return n > 0;
+}
+
+// Sleep in wall time up to wake_us, or less when the host sends: the virtual clock then stops there
+static int64_t sim_host_pace(int64_t wake_us, const struct timespec *start)
+{
+    int64_t wall_us;
+
+    while ((wall_us = sim_wall_us(start)) < wake_us) {
+        int64_t slice_us = wake_us - wall_us < SIM_HOST_POLL_MS * 1000 ? wake_us - wall_us : SIM_HOST_POLL_MS * 1000;
+        usleep((useconds_t)slice_us);
+        if (sim_host_poll()) {
+            wall_us = sim_wall_us(start);
+            return wall_us > sim_now_us ? (wall_us < wake_us ? wall_us : wake_us) : sim_now_us;
+        }
+    }
+    sim_host_poll();
+    return wake_us;
+}
+
+static void sim_clock_task(void *arg)
+{
+    struct timespec wall_start, wall_now;
+    int64_t next_report_us = 3600LL * 1000000;
+    bool console_done = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    while (1) {
+        int64_t wake_us = INT64_MAX;
+
+        vTaskSuspendAll();
+        for (int i = 0; i < SIM_MAX_SLEEPERS; i++) {
+            if (sim_sleepers[i].task != NULL && sim_sleepers[i].wake_us < wake_us) {
+                wake_us = sim_sleepers[i].wake_us;
+            }
+        }
+        if (sim_timer_us < wake_us) {
+            wake_us = sim_timer_us;
+        }
+        xTaskResumeAll();
+        if (wake_us == INT64_MAX) {
+            // Control tasks still booting
+            vTaskDelay(1);
+            continue;
+        }
+
+        if (sim_host_fd >= 0) {
+            wake_us = sim_host_pace(wake_us, &wall_start);
+        }
+        // A parked CPU goes to light sleep unless a DMA scan holds it awake
+        if (!sim_adc_busy && wake_us - sim_now_us >= SIM_SLEEP_MIN_MS * 1000LL) {
+            sim_wakeups++;
+            sim_sleep_us += wake_us - sim_now_us;
+        }
+        while (sim_now_us < wake_us) {
+            int64_t step_us = wake_us - sim_now_us;
+            if (step_us > SIM_STEP_MS * 1000) {
+                step_us = SIM_STEP_MS * 1000;
+            }
+            sim_plant_step(step_us / 1e6f);
+            sim_now_us += step_us;
+        }
+
+        if (SIM_FAULTS) {
+            sim_faults_step();
+        }
+        if (SIM_CONSOLE_CMD[0] && !console_done && sim_now_us >= SIM_CONSOLE_AT_H * 3600LL * 1000000) {
+            int ret = 0;
+            console_done = true;
+            ESP_LOGI(TAG, "Console: %s => %s", SIM_CONSOLE_CMD,
+                     esp_console_run(SIM_CONSOLE_CMD, &ret) == ESP_OK && ret == 0 ? "ok" : "failed");
+        }
+        if (sim_now_us >= next_report_us) {
+            sim_hour_summary();
+            next_report_us += 3600LL * 1000000;
+        }
+        if (sim_now_us >= sim_end_us) {
+            //-------------The end of the replay is the planned restart---------------//
+            for (int i = 0; i < SIM_RESTART_HANDLERS && sim_on_restart[i] != NULL; i++) {
+                sim_on_restart[i]();
+            }
+            clock_gettime(CLOCK_MONOTONIC, &wall_now);
+            sim_report((wall_now.tv_sec - wall_start.tv_sec) + (wall_now.tv_nsec - wall_start.tv_nsec) / 1e9);
+            fflush(stdout);
+            exit(0);
+        }
+
+        if (sim_host_rx && sim_host_reader != NULL) {
+            // UART interrupt: the reader runs at once, above the clock
+            sim_host_rx = false;
+            xTaskNotifyGive(sim_host_reader);
+        }
+        if (sim_timer_us <= sim_now_us) {
+            // esp_timer task dispatch, higher priority tasks run right away
+            sim_timer_us = INT64_MAX;
+            sim_timer_cb(sim_timer_arg);
+        }
+        vTaskSuspendAll();
+        for (int i = 0; i < SIM_MAX_SLEEPERS; i++) {
+            if (sim_sleepers[i].task != NULL && sim_sleepers[i].wake_us <= sim_now_us) {
+                xTaskNotifyGive(sim_sleepers[i].task);
+                sim_sleepers[i].task = NULL;
+            }
+        }
+        xTaskResumeAll();
+    }
+}
+
+/*---------------------------------------------------------------
+        Trace replay
+---------------------------------------------------------------*/
+static float sim_ntc_celsius(float mv)
+{
+    return ((3.79e-5f - 6.76e-9f * mv) * mv * mv) - 9.65e-2f * mv + 116.0f;
+}
+
+// Load and room for the replay, and what the recorded controller did, from one record
+static void sim_trace_add(const fan_trace_rec_t *rec, uint32_t ms, int *cap)
+{
+    static float last_duty[FAN_ZONE_NUM], last_cell[FAN_ZONE_NUM];
+    int zone = rec->zone;
+    int n = sim_trace_len[zone];
+    sim_score_t *r = &sim_recorded[zone];
+    float cell = sim_ntc_celsius(rec->ntc_mv / 16.0f);
+    float duty = rec->duty / 65536.0f;
+
+    if (n == *cap) {
+        *cap = *cap ? 2 * *cap : 4096;
+        sim_trace[zone] = realloc(sim_trace[zone], *cap * sizeof(sim_trace_pt_t));
+        assert(sim_trace[zone] != NULL);
+    }
+    if (n == 0) {
+        sim_trace_cell[zone] = cell;
+        r->cell_max = cell;
+    } else {
+        //-------------The duty and cell of a record hold until the next one---------------//
+        double dt = (ms - sim_trace[zone][n - 1].ms) / 1000.0;
+        if (dt <= SIM_TRACE_GAP_S) {
+            r->time_s += dt;
+            r->duty_sum += dt * last_duty[zone];
+            r->above_s += last_cell[zone] > SIM_BENCH_CEILING ? dt : 0;
+        }
+    }
+    sim_trace[zone][n] = (sim_trace_pt_t){ ms, rec->current_mv / 16, rec->tsens / 256.0f - SIM_DIE_SELFHEAT,
+                                           rec->ntc_mv * 4096, rec->current_mv * 4096, rec->tsens * 256 };
+    sim_trace_len[zone]++;
+    last_duty[zone] = duty;
+    last_cell[zone] = cell;
+    r->duty_peak = duty > r->duty_peak ? duty : r->duty_peak;
+    r->starts += (rec->flags & FAN_TELEM_START) != 0;
+    r->cell_max = cell > r->cell_max ? cell : r->cell_max;
+}
+
+static esp_err_t sim_trace_load(void)
+{
+    FILE *f = fopen(sim_trace_file, "rb");
+    int cap[FAN_ZONE_NUM] = { 0 };
+    int packets = 0, crc_errors = 0;
+    bool first = true;
+    uint32_t t0 = 0;
+
+    if (f == NULL) {
+        ESP_LOGE(TAG, "%s: no such trace", sim_trace_file);
+        return ESP_ERR_NOT_FOUND;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    uint8_t *buf = malloc(size);
+    fseek(f, 0, SEEK_SET);
+    size = buf ? fread(buf, 1, size, f) : 0;
+    fclose(f);
+
+    //-------------Resync on the sync bytes as tools/fan_telem.py does, telemetry and log text in between are skipped---------------//
+    for (size_t pos = 0; pos + FAN_TELEM_HDR_LEN + FAN_TELEM_CRC_LEN <= size; ) {
+        const uint8_t *p = buf + pos;
+        if (p[0] != FAN_TELEM_SYNC0 || p[1] != FAN_TRACE_SYNC1 || p[2] != FAN_TRACE_VERSION || p[3] == 0) {
+            pos++;
+            continue;
+        }
+        size_t len = FAN_TELEM_HDR_LEN + p[3] * sizeof(fan_trace_rec_t) + FAN_TELEM_CRC_LEN;
+        if (pos + len > size) {
+            break;
+        }
+        uint32_t crc = p[len - 4] | p[len - 3] << 8 | p[len - 2] << 16 | (uint32_t)p[len - 1] << 24;
+        if (esp_rom_crc32_le(0, p, len - FAN_TELEM_CRC_LEN) != crc) {
+            crc_errors++;
+            pos++;
+            continue;
+        }
+        for (int i = 0; i < p[3]; i++) {
+            fan_trace_rec_t rec;
+            memcpy(&rec, p + FAN_TELEM_HDR_LEN + i * sizeof(rec), sizeof(rec));
+            if (rec.zone >= FAN_ZONE_NUM) {
+                continue;
+            }
+            if (first) {
+                t0 = rec.ms;
+                first = false;
+            }
+            sim_trace_add(&rec, rec.ms - t0, &cap[rec.zone]);
+        }
+        packets++;
+        pos += len;
+    }
+    free(buf);
+
+    int64_t end_us = 0;
+    sim_trace_room_zone = -1;
+    for (int zone = FAN_ZONE_NUM - 1; zone >= 0; zone--) {
+        if (sim_trace_len[zone] > 0) {
+            sim_trace_room_zone = zone;
+            int64_t us = sim_trace[zone][sim_trace_len[zone] - 1].ms * 1000LL;
+            end_us = us > end_us ? us : end_us;
+        }
+    }
+    if (sim_trace_room_zone < 0) {
+        ESP_LOGE(TAG, "%s: no trace records (%d CRC errors)", sim_trace_file, crc_errors);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    sim_traced = true;
+    sim_end_us = end_us;
+    ESP_LOGI(TAG, "%s: %d packets, %d CRC errors, %.1f h of load and room", sim_trace_file, packets, crc_errors,
+             end_us / 3.6e9);
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_init(void)
+{
+    esp_log_level_set("*", SIM_LOG_LEVEL);
+    esp_log_level_set(TAG, ESP_LOG_INFO);
+    esp_log_level_set("Fan-RPM", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Test", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Boot", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Profile", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Telem", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Hist", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Perf", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Cycle", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Fault", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Host", ESP_LOG_INFO);
+    esp_log_level_set("Fan-PWM", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Est", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Tune", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Bus", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Trace", ESP_LOG_INFO);
+    esp_log_level_set("Fan-Energy", ESP_LOG_INFO);
+
+    //-------------As ledc_find_suitable_duty_resolution(): whole bits of clock per PWM period---------------//
+    while ((SIM_PWM_CLK_HZ / FAN_HAL_PWM_FREQ) >> (sim_pwm_bits + 1)) {
+        sim_pwm_bits++;
+    }
+    sim_pwm_max = (1UL << sim_pwm_bits) - 1;
+    sim_room = SIM_ROOM_MEAN + SIM_ROOM_SWING * sinf((SIM_START_HOUR - 9.0f) * (float)M_PI / 12.0f);
+    if (getenv(SIM_TRACE_ENV) != NULL) {
+        sim_trace_file = getenv(SIM_TRACE_ENV);
+    }
+    if (sim_trace_file[0]) {
+        if (sim_trace_load() != ESP_OK) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        sim_room = sim_trace[sim_trace_room_zone][0].room;
+    }
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        sim_cages[zone].cell = sim_trace_len[zone] > 0 ? sim_trace_cell[zone] : sim_room + 5.0f;
+        sim_cages[zone].load = sim_load_ma(zone, SIM_START_HOUR);
+        sim_cages[zone].pwm_duty = sim_pwm_max;
+    }
+    if (sim_traced) {
+        ESP_LOGI(TAG, "Replaying %.1f h of recorded load and room over %d zones, plant step %d ms",
+                 sim_end_us / 3.6e9, FAN_ZONE_NUM, SIM_STEP_MS);
+    } else {
+        ESP_LOGI(TAG, "Replaying %d h from %02d:00 over %d zones, plant step %d ms",
+                 SIM_REPLAY_HOURS, SIM_START_HOUR, FAN_ZONE_NUM, SIM_STEP_MS);
+    }
+    if (xTaskCreate(sim_clock_task, "sim_clock", 4 * 1024, NULL, tskIDLE_PRIORITY, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_pm_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_pm_dump(FILE *out)
+{
+    fprintf(out, "No PM locks on the linux target, the DMA scan holds the CPU awake\n");
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_console_wakeup(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_on_restart(void (*fn)(void))
+{
+    for (int i = 0; i < SIM_RESTART_HANDLERS; i++) {
+        if (sim_on_restart[i] == NULL) {
+            sim_on_restart[i] = fn;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void fan_hal_delay_ms(uint32_t ms)
+{
+    int slot;
+
+    vTaskSuspendAll();
+    for (slot = 0; slot < SIM_MAX_SLEEPERS; slot++) {
+        if (sim_sleepers[slot].task == NULL) {
+            sim_sleepers[slot].task = xTaskGetCurrentTaskHandle();
+            sim_sleepers[slot].wake_us = sim_now_us + ms * 1000LL;
+            break;
+        }
+    }
+    xTaskResumeAll();
+    assert(slot < SIM_MAX_SLEEPERS);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+int64_t fan_hal_now_us(void)
+{
+    return sim_now_us;
+}
+
+esp_err_t fan_hal_timer_init(void (*cb)(void *arg), void *arg)
+{
+    sim_timer_cb = cb;
+    sim_timer_arg = arg;
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_timer_start(uint32_t ms)
+{
+    if (sim_timer_cb == NULL || sim_timer_us != INT64_MAX) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sim_timer_us = sim_now_us + ms * 1000LL;
+    return ESP_OK;
+}
+
+uint32_t fan_hal_wakeup_count(void)
+{
+    return sim_wakeups;
+}
+
+int64_t fan_hal_sleep_time_us(void)
+{
+    return sim_sleep_us;
+}
+
+uint32_t fan_hal_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*---------------------------------------------------------------
+        Persistent store, the whole table is rewritten on every change
+---------------------------------------------------------------*/
+static sim_store_entry_t *sim_store_find(const char *key)
+{
+    for (int i = 0; i < SIM_STORE_KEYS; i++) {
+        if (sim_store[i].len != 0 && strncmp(sim_store[i].key, key, sizeof(sim_store[i].key)) == 0) {
+            return &sim_store[i];
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t sim_store_flush(void)
+{
+    FILE *f = fopen(SIM_STORE_FILE, "wb");
+
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    size_t n = fwrite(sim_store, sizeof(sim_store), 1, f);
+    fclose(f);
+    return n == 1 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t fan_hal_store_init(void)
+{
+    FILE *f = fopen(SIM_STORE_FILE, "rb");
+
+    if (f == NULL) {
+        ESP_LOGI(TAG, "No %s, cold boot", SIM_STORE_FILE);
+        return ESP_OK;
+    }
+    if (fread(sim_store, sizeof(sim_store), 1, f) != 1) {
+        ESP_LOGW(TAG, "%s truncated, erasing", SIM_STORE_FILE);
+        memset(sim_store, 0, sizeof(sim_store));
+    }
+    fclose(f);
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_store_get(const char *key, void *buf, size_t len)
+{
+    sim_store_entry_t *e = sim_store_find(key);
+
+    if (e == NULL || e->len != len) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memcpy(buf, e->blob, len);
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_store_set(const char *key, const void *buf, size_t len)
+{
+    sim_store_entry_t *e = sim_store_find(key);
+
+    if (len == 0 || len > SIM_STORE_BLOB_MAX || strlen(key) >= sizeof(e->key)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (int i = 0; e == NULL && i < SIM_STORE_KEYS; i++) {
+        if (sim_store[i].len == 0) {
+            e = &sim_store[i];
+        }
+    }
+    if (e == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    strcpy(e->key, key);
+    e->len = len;
+    memcpy(e->blob, buf, len);
+    return sim_store_flush();
+}
+
+esp_err_t fan_hal_store_erase(const char *key)
+{
+    sim_store_entry_t *e = sim_store_find(key);
+
+    if (e == NULL) {
+        return ESP_OK;
+    }
+    memset(e, 0, sizeof(*e));
+    return sim_store_flush();
+}
+
+/*---------------------------------------------------------------
+        History partition, NOR rules enforced on the file
+---------------------------------------------------------------*/
+esp_err_t fan_hal_hist_init(size_t *size)
+{
+    sim_hist = fopen(SIM_HIST_FILE, "r+b");
+    if (sim_hist == NULL) {
+        uint8_t blank[FAN_HAL_HIST_SECTOR];
+        memset(blank, 0xff, sizeof(blank));
+        sim_hist = fopen(SIM_HIST_FILE, "w+b");
+        for (int i = 0; sim_hist != NULL && i < SIM_HIST_SIZE / FAN_HAL_HIST_SECTOR; i++) {
+            fwrite(blank, sizeof(blank), 1, sim_hist);
+        }
+    }
+    *size = SIM_HIST_SIZE;
+    return sim_hist != NULL ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t fan_hal_hist_read(uint32_t offset, void *buf, size_t len)
+{
+    if (offset + len > SIM_HIST_SIZE || fseek(sim_hist, offset, SEEK_SET) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return fread(buf, len, 1, sim_hist) == 1 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t fan_hal_hist_write(uint32_t offset, const void *buf, size_t len)
+{
+    uint8_t cells[FAN_HAL_HIST_PAGE];
+    const uint8_t *src = buf;
+
+    if (len > sizeof(cells) || fan_hal_hist_read(offset, cells, len) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < len; i++) {
+        cells[i] &= src[i];
+    }
+    fseek(sim_hist, offset, SEEK_SET);
+    if (fwrite(cells, len, 1, sim_hist) != 1) {
+        return ESP_FAIL;
+    }
+    return fflush(sim_hist) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t fan_hal_hist_erase(uint32_t offset)
+{
+    uint8_t blank[FAN_HAL_HIST_SECTOR];
+
+    if (offset % FAN_HAL_HIST_SECTOR != 0 || offset >= SIM_HIST_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(blank, 0xff, sizeof(blank));
+    fseek(sim_hist, offset, SEEK_SET);
+    return fwrite(blank, sizeof(blank), 1, sim_hist) == 1 ? ESP_OK : ESP_FAIL;
+}
+
+/*---------------------------------------------------------------
+        Telemetry link
+---------------------------------------------------------------*/
+esp_err_t fan_hal_telem_init(void)
+{
+    sim_telem = fopen(SIM_TELEM_FILE, "wb");
+    return sim_telem != NULL ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t fan_hal_telem_write(const void *buf, size_t len)
+{
+    if (fwrite(buf, len, 1, sim_telem) != 1) {
+        return ESP_FAIL;
+    }
+    // The replay ends with exit(), keep the file whole
+    return fflush(sim_telem) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t fan_hal_led_set(uint32_t level)
+{
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        PWM
+---------------------------------------------------------------*/
+esp_err_t fan_hal_pwm_init(void)
+{
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        sim_cages[zone].pwm_duty = sim_pwm_max;
+        sim_cages[zone].pwm_end_us = 0;
+    }
+    ESP_LOGI(TAG, "PWM %d-bit at %d Hz from %d kHz", sim_pwm_bits, FAN_HAL_PWM_FREQ, SIM_PWM_CLK_HZ / 1000);
+    return ESP_OK;
+}
+
+uint32_t fan_hal_pwm_max(void)
+{
+    return sim_pwm_max;
+}
+
+esp_err_t fan_hal_pwm_set(int zone, uint32_t duty)
+{
+    return fan_hal_pwm_fade(zone, duty, 0);
+}
+
+esp_err_t fan_hal_pwm_fade(int zone, uint32_t duty, uint32_t time_ms)
+{
+    sim_cage_t *c = &sim_cages[zone];
+
+    if (duty > sim_pwm_max) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    c->pwm_from = sim_pwm_raw(zone);
+    c->pwm_from_us = sim_now_us;
+    c->pwm_end_us = sim_now_us + time_ms * 1000LL;
+    c->pwm_duty = duty;
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_pwm_stop(int zone, uint32_t idle_level)
+{
+    // Inverted output stage: idle high keeps the fan off
+    sim_cages[zone].pwm_duty = idle_level ? sim_pwm_max + 1 : 0;
+    sim_cages[zone].pwm_end_us = 0;
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        Tach
+---------------------------------------------------------------*/
+esp_err_t fan_hal_tach_init(int zone)
+{
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_tach_enable(int zone)
+{
+    if (sim_cages[zone].tach_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sim_cages[zone].tach_enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_tach_disable(int zone)
+{
+    if (!sim_cages[zone].tach_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sim_cages[zone].tach_enabled = false;
+    sim_cages[zone].tach_started = false;
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_tach_start(int zone)
+{
+    if (!sim_cages[zone].tach_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sim_cages[zone].tach_started = true;
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_tach_clear(int zone)
+{
+    sim_cages[zone].tach_count = 0;
+    sim_cages[zone].pulse_acc = 0;
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_tach_get_count(int zone, int *count)
+{
+    *count = sim_cages[zone].tach_count;
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_tach_watch(int zone, fan_hal_tach_cb_t cb, void *arg)
+{
+    if (sim_cages[zone].tach_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sim_cages[zone].tach_cb = cb;
+    sim_cages[zone].tach_arg = arg;
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        ADC
+---------------------------------------------------------------*/
+esp_err_t fan_hal_adc_init(void)
+{
+    if (sim_adc_ready) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sim_adc_ready = true;
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_adc_read_frame(fan_hal_adc_frame_t *frame)
+{
+    static int samples[FAN_HAL_ADC_MAX][ADC_BLOCK_N];
+
+    if (!sim_adc_ready) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // The scan block takes real time on the target as well, awake for the DMA
+    sim_adc_busy = true;
+    fan_hal_delay_ms(ADC_BLOCK_MS);
+    sim_adc_busy = false;
+    if (sim_adc_wedged) {
+        return ESP_ERR_TIMEOUT;
+    }
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        const sim_cage_t *c = &sim_cages[zone];
+        int ntc_mv = c->ntc_open ? 3300 : c->ntc_short ? 0 : sim_ntc_mv(c->cell);
+        int current_mv = c->current_sat ? 3300 : c->load;
+        for (int i = 0; i < ADC_BLOCK_N; i++) {
+            samples[FAN_HAL_ADC_CURRENT][i] = (int)(current_mv + sim_noise(SIM_NOISE_CURRENT));
+            samples[FAN_HAL_ADC_NTC][i] = (int)(ntc_mv + sim_noise(SIM_NOISE_NTC));
+        }
+        for (int chan = 0; chan < FAN_HAL_ADC_MAX; chan++) {
+            frame->mv[zone][chan] = adc_block_decimate(samples[chan], ADC_BLOCK_N);
+        }
+    }
+    frame->samples = ADC_BLOCK_N;
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_adc_recover(void)
+{
+    if (sim_adc_window) {
+        return ESP_ERR_TIMEOUT;
+    }
+    sim_adc_wedged = false;
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        Host link
+---------------------------------------------------------------*/
+esp_err_t fan_hal_host_init(void)
+{
+    struct termios raw;
+    int slave;
+
+    if (!SIM_HOST_PTY) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    sim_host_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (sim_host_fd < 0 || grantpt(sim_host_fd) != 0 || unlockpt(sim_host_fd) != 0) {
+        return ESP_FAIL;
+    }
+    // Held open, so the master survives the host daemon closing and reopening its end
+    slave = open(ptsname(sim_host_fd), O_RDWR | O_NOCTTY);
+    if (slave < 0 || tcgetattr(slave, &raw) != 0) {
+        return ESP_FAIL;
+    }
+    cfmakeraw(&raw);
+    tcsetattr(slave, TCSANOW, &raw);
+    fcntl(sim_host_fd, F_SETFL, fcntl(sim_host_fd, F_GETFL) | O_NONBLOCK);
+    ESP_LOGI(TAG, "Host link on %s, replay paced to wall time", ptsname(sim_host_fd));
+    return ESP_OK;
+}
+
+int fan_hal_host_read(uint8_t *buf, size_t len)
+{
+    sim_host_reader = xTaskGetCurrentTaskHandle();
+    while (sim_host_fill == 0) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    size_t n = sim_host_fill < len ? sim_host_fill : len;
+    memcpy(buf, sim_host_buf, n);
+    memmove(sim_host_buf, sim_host_buf + n, sim_host_fill - n);
+    sim_host_fill -= n;
+    return (int)n;
+}
+
+esp_err_t fan_hal_host_write(const void *buf, size_t len)
+{
+    return write(sim_host_fd, buf, len) == (ssize_t)len ? ESP_OK : ESP_FAIL;
+}
+
+/*---------------------------------------------------------------
+        Sensor bus, the DS18B20 of sim_bays[] on a 1-Wire line whose
+        time slots cost virtual time
+---------------------------------------------------------------*/
+static uint8_t sim_crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0x8C : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+// Bus time of a transaction, the task holds the line meanwhile
+static void sim_bus_time(uint32_t us)
+{
+    fan_hal_delay_ms((us + 999) / 1000);
+}
+
+static int sim_ds_convert_ms(const sim_ds18b20_t *d)
+{
+    return 750 >> (3 - ((d->pad[4] >> 5) & 3));
+}
+
+// The pending conversion lands in the scratchpad once its time is up
+static void sim_ds_update(sim_ds18b20_t *d)
+{
+    if (d->ready_us != 0 && sim_now_us >= d->ready_us) {
+        d->pad[0] = d->latched & 0xFF;
+        d->pad[1] = (uint16_t)d->latched >> 8;
+        d->ready_us = 0;
+    }
+}
+
+static void sim_ds_command(sim_ds18b20_t *d, const uint8_t *data, size_t len)
+{
+    switch (data[0]) {
+    case FAN_BUS_CONVERT: {
+        int zone = sim_bays[d - sim_ds].zone < FAN_ZONE_NUM ? sim_bays[d - sim_ds].zone : 0;
+        float load = sim_cages[zone].load / 1000.0f;
+        float t = sim_cages[zone].cell + sim_bays[d - sim_ds].offset * (0.3f + 0.7f * (load > 1 ? 1 : load));
+        int drop = 3 - ((d->pad[4] >> 5) & 3);      // Undefined low bits of a coarser resolution read as 0
+        d->latched = (int16_t)lrintf(t * 16) & ~((1 << drop) - 1);
+        d->ready_us = sim_now_us + sim_ds_convert_ms(d) * 1000LL;
+        break;
+    }
+    case FAN_BUS_WRITE_PAD:
+        if (len >= 4) {
+            memcpy(&d->pad[2], &data[1], 3);
+            d->pad[4] |= 0x1F;
+        }
+        break;
+    case FAN_BUS_COPY_PAD:
+        memcpy(d->eeprom, &d->pad[2], 3);
+        break;
+    default:
+        break;
+    }
+}
+
+esp_err_t fan_hal_bus_init(void)
+{
+    if (!SIM_BUS) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    for (int i = 0; i < SIM_BAY_NUM; i++) {
+        sim_ds18b20_t *d = &sim_ds[i];
+        uint8_t rom[8] = { FAN_BUS_FAMILY };
+
+        for (int b = 0; b < 3; b++) {
+            rom[1 + b] = sim_bays[i].serial >> (8 * b);
+        }
+        rom[7] = sim_crc8(rom, 7);
+        memcpy(&d->rom, rom, sizeof(d->rom));
+        d->eeprom[0] = sim_bays[i].zone;
+        d->eeprom[1] = sim_bays[i].weight;
+        d->eeprom[2] = 0x7F;                    // 12 bits as shipped
+        //-------------Power-on: 85 ℃ in the register, the EEPROM copied into the scratchpad---------------//
+        d->pad[0] = 0x50;
+        d->pad[1] = 0x05;
+        memcpy(&d->pad[2], d->eeprom, 3);
+        d->pad[5] = 0xFF;
+        d->pad[6] = 0x0C;
+        d->pad[7] = 0x10;
+    }
+    ESP_LOGI(TAG, "Sensor bus with %d DS18B20", (int)SIM_BAY_NUM);
+    return ESP_OK;
+}
+
+int fan_hal_bus_scan(uint64_t *rom, int max)
+{
+    int num = 0;
+
+    sim_bus_time(SIM_BUS_RESET_US + SIM_BAY_NUM * (SIM_BUS_RESET_US + SIM_BUS_SEARCH_US));
+    for (int i = 0; i < SIM_BAY_NUM && num < max; i++) {
+        rom[num++] = sim_ds[i].rom;
+    }
+    return num;
+}
+
+esp_err_t fan_hal_bus_write(const uint64_t *rom, const uint8_t *data, size_t len)
+{
+    sim_bus_time(SIM_BUS_RESET_US + (1 + (rom ? 8 : 0) + len) * SIM_BUS_BYTE_US);
+    for (int i = 0; i < SIM_BAY_NUM; i++) {
+        if (rom == NULL || *rom == sim_ds[i].rom) {
+            sim_ds_update(&sim_ds[i]);
+            sim_ds_command(&sim_ds[i], data, len);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_bus_read(uint64_t rom, uint8_t cmd, uint8_t *buf, size_t len)
+{
+    sim_bus_time(SIM_BUS_RESET_US + (1 + 8 + 1 + len) * SIM_BUS_BYTE_US);
+    //-------------Nobody answers a ROM that is not there, the pull-up reads as ones---------------//
+    memset(buf, 0xFF, len);
+    for (int i = 0; i < SIM_BAY_NUM; i++) {
+        sim_ds18b20_t *d = &sim_ds[i];
+
+        if (rom != d->rom || cmd != FAN_BUS_READ_PAD) {
+            continue;
+        }
+        sim_ds_update(d);
+        d->pad[8] = sim_crc8(d->pad, 8);
+        memcpy(buf, d->pad, len < FAN_BUS_PAD_LEN ? len : FAN_BUS_PAD_LEN);
+        if (sim_rand() % SIM_BUS_GLITCH < len) {
+            buf[sim_rand() % len] ^= 1 << (sim_rand() % 8);
+        }
+    }
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        ESP die temperature sensor
+---------------------------------------------------------------*/
+esp_err_t fan_hal_tsens_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_tsens_read(q16_t *celsius)
+{
+    if (sim_tsens_dead) {
+        return ESP_FAIL;
+    }
+    *celsius = (q16_t)((sim_room + SIM_DIE_SELFHEAT + sim_noise(SIM_NOISE_TSENS)) * Q16_ONE);
+    return ESP_OK;
+}
+
+esp_err_t fan_hal_tsens_recover(void)
+{
+    return sim_tsens_dead ? ESP_FAIL : ESP_OK;
+}
@@ -0,0 +1,365 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "fan_hal.h"
+#include "fan_hist.h"
+
+const static char *TAG = "Fan-Hist";
+
+#define HIST_PAGE           FAN_HAL_HIST_PAGE
+#define HIST_SECTOR_PAGES   (FAN_HAL_HIST_SECTOR / FAN_HAL_HIST_PAGE)
+#define HIST_HDR_LEN        sizeof(fan_hist_page_hdr_t)
+#define HIST_CRC_OFFSET     offsetof(fan_hist_page_hdr_t, crc)
+#define HIST_FLASH_CYCLES   100000  // Sector erase endurance of the SPI NOR
+
+_Static_assert(sizeof(fan_hist_page_hdr_t) == 16, "fan_hist_page_hdr_t layout is shared with tools/fan_hist.py");
+_Static_assert(sizeof(fan_hist_tick_t) == 16, "fan_hist_tick_t layout is shared with tools/fan_hist.py");
+_Static_assert(sizeof(fan_hist_agg_t) == 32, "fan_hist_agg_t layout is shared with tools/fan_hist.py");
+
+typedef struct {
+    const char *name;
+    uint16_t sectors;
+    uint16_t rec_size;
+    uint32_t sync_s;        // Partial page written after this long, 0 for full pages only
+    //-------------Ring state---------------//
+    uint32_t base;          // Partition offset
+    uint32_t pages;
+    uint32_t next;          // Page index written next
+    uint32_t seq;
+    int count;              // Records in the RAM page
+    int per_page;
+    uint32_t first_s;       // Oldest record in the RAM page
+    uint8_t page[HIST_PAGE];
+    //-------------Statistics since boot---------------//
+    uint32_t written;
+    uint32_t erases;
+} hist_tier_t;
+
+// A period being aggregated, min/max live in agg, averages are sums until the period closes
+typedef struct {
+    fan_hist_agg_t agg;
+    int64_t troom, tcell, current, duty, rpm;
+    uint32_t period;
+} hist_acc_t;
+
+static hist_tier_t hist_tiers[FAN_HIST_TIER_MAX] = {
+    [FAN_HIST_TICK]   = { "tick",   FAN_HIST_TICK_SECTORS, sizeof(fan_hist_tick_t), 0 },
+    [FAN_HIST_MINUTE] = { "minute", FAN_HIST_MIN_SECTORS,  sizeof(fan_hist_agg_t),  FAN_HIST_MIN_SYNC_S },
+    [FAN_HIST_HOUR]   = { "hour",   FAN_HIST_HOUR_SECTORS, sizeof(fan_hist_agg_t),  FAN_HIST_HOUR_SYNC_S },
+};
+static hist_acc_t hist_minute[FAN_ZONE_NUM];
+static hist_acc_t hist_hour[FAN_ZONE_NUM];
+static uint16_t hist_boot;
+static bool hist_ready;
+static atomic_bool hist_flush_req;
+static int64_t hist_start_us;
+static int64_t hist_stats_us;
+
+/*---------------------------------------------------------------
+        Page ring
+---------------------------------------------------------------*/
+static uint32_t hist_crc(const uint8_t *page)
+{
+    uint32_t crc = esp_rom_crc32_le(0, page, HIST_CRC_OFFSET);
+    return esp_rom_crc32_le(crc, page + HIST_HDR_LEN, HIST_PAGE - HIST_HDR_LEN);
+}
+
+static bool hist_blank(const uint8_t *page)
+{
+    for (int i = 0; i < HIST_PAGE; i++) {
+        if (page[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Continue after the newest valid page of the tier, boot collects the highest boot number seen
+static void hist_scan(fan_hist_tier_t id, bool *found_boot, uint16_t *boot)
+{
+    hist_tier_t *t = &hist_tiers[id];
+    const fan_hist_page_hdr_t *hdr = (const fan_hist_page_hdr_t *)t->page;
+    bool found = false;
+    uint32_t head = 0;
+    int valid = 0;
+
+    for (uint32_t p = 0; p < t->pages; p++) {
+        if (fan_hal_hist_read(t->base + p * HIST_PAGE, t->page, HIST_PAGE) != ESP_OK
+         || hdr->magic != FAN_HIST_MAGIC || hdr->tier != id || hdr->crc != hist_crc(t->page)) {
+            continue;
+        }
+        valid++;
+        if (!found || (int32_t)(hdr->seq - t->seq) > 0) {
+            head = p;
+            t->seq = hdr->seq;
+            found = true;
+        }
+        if (!*found_boot || (int16_t)(hdr->boot - *boot) > 0) {
+            *boot = hdr->boot;
+            *found_boot = true;
+        }
+    }
+    t->next = 0;
+    t->seq = found ? t->seq + 1 : 0;
+    if (found) {
+        t->next = (head + 1) % t->pages;
+        // A torn or foreign page right after the head: start over in the next sector
+        if (t->next % HIST_SECTOR_PAGES != 0
+         && (fan_hal_hist_read(t->base + t->next * HIST_PAGE, t->page, HIST_PAGE) != ESP_OK || !hist_blank(t->page))) {
+            t->next = (t->next / HIST_SECTOR_PAGES + 1) * HIST_SECTOR_PAGES % t->pages;
+        }
+    }
+    memset(t->page, 0xff, HIST_PAGE);
+    ESP_LOGI(TAG, "%s: %d valid pages, writing at %lu/%lu", t->name, valid,
+             (unsigned long)t->next, (unsigned long)t->pages);
+}
+
+static esp_err_t hist_write(hist_tier_t *t, fan_hist_tier_t id)
+{
+    fan_hist_page_hdr_t *hdr = (fan_hist_page_hdr_t *)t->page;
+    uint32_t offset = t->base + t->next * HIST_PAGE;
+    esp_err_t ret = ESP_OK;
+
+    //-------------Erase only when the ring enters a sector---------------//
+    if (t->next % HIST_SECTOR_PAGES == 0) {
+        ret = fan_hal_hist_erase(offset);
+        t->erases++;
+    }
+    hdr->magic = FAN_HIST_MAGIC;
+    hdr->tier = id;
+    hdr->count = t->count;
+    hdr->seq = t->seq;
+    hdr->boot = hist_boot;
+    hdr->reserved = 0xffff;
+    hdr->crc = hist_crc(t->page);
+    if (ret == ESP_OK) {
+        ret = fan_hal_hist_write(offset, t->page, HIST_PAGE);
+    }
+    // Failed or not the page is used up, cells are never programmed twice
+    t->next = (t->next + 1) % t->pages;
+    t->seq++;
+    t->count = 0;
+    t->written++;
+    memset(t->page, 0xff, HIST_PAGE);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "%s page write failed: %s", t->name, esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+static void hist_append(fan_hist_tier_t id, const void *rec, uint32_t now_s)
+{
+    hist_tier_t *t = &hist_tiers[id];
+
+    if (t->count == 0) {
+        t->first_s = now_s;
+    }
+    memcpy(t->page + HIST_HDR_LEN + t->count * t->rec_size, rec, t->rec_size);
+    if (++t->count == t->per_page) {
+        hist_write(t, id);
+    }
+}
+
+/*---------------------------------------------------------------
+        Aggregation, a tick is a period of its own with ticks = 1
+---------------------------------------------------------------*/
+static void hist_acc_add(hist_acc_t *a, const fan_hist_agg_t *r, uint32_t period)
+{
+    fan_hist_agg_t *g = &a->agg;
+
+    if (g->ticks == 0) {
+        *g = *r;
+        a->troom = a->tcell = a->current = a->duty = a->rpm = 0;
+        a->period = period;
+    } else {
+        g->tcell_min = r->tcell_min < g->tcell_min ? r->tcell_min : g->tcell_min;
+        g->tcell_max = r->tcell_max > g->tcell_max ? r->tcell_max : g->tcell_max;
+        g->current_min = r->current_min < g->current_min ? r->current_min : g->current_min;
+        g->current_max = r->current_max > g->current_max ? r->current_max : g->current_max;
+        g->duty_min = r->duty_min < g->duty_min ? r->duty_min : g->duty_min;
+        g->duty_max = r->duty_max > g->duty_max ? r->duty_max : g->duty_max;
+        g->rpm_max = r->rpm_max > g->rpm_max ? r->rpm_max : g->rpm_max;
+        g->starts += r->starts;
+        g->ticks += r->ticks;
+    }
+    a->troom += (int64_t)r->troom_avg * r->ticks;
+    a->tcell += (int64_t)r->tcell_avg * r->ticks;
+    a->current += (int64_t)r->current_avg * r->ticks;
+    a->duty += (int64_t)r->duty_avg * r->ticks;
+    a->rpm += (int64_t)r->rpm_avg * r->ticks;
+}
+
+// Fill in the averages and empty the accumulator, false when it was empty
+static bool hist_acc_close(hist_acc_t *a, fan_hist_agg_t *out)
+{
+    fan_hist_agg_t *g = &a->agg;
+
+    if (g->ticks == 0) {
+        return false;
+    }
+    g->troom_avg = a->troom / g->ticks;
+    g->tcell_avg = a->tcell / g->ticks;
+    g->current_avg = a->current / g->ticks;
+    g->duty_avg = a->duty / g->ticks;
+    g->rpm_avg = a->rpm / g->ticks;
+    *out = *g;
+    g->ticks = 0;
+    return true;
+}
+
+static void hist_minute_closed(int zone, const fan_hist_agg_t *minute, uint32_t now_s)
+{
+    hist_acc_t *hour = &hist_hour[zone];
+    uint32_t period = minute->s / 3600;
+    fan_hist_agg_t closed;
+
+    hist_append(FAN_HIST_MINUTE, minute, now_s);
+    if (hour->agg.ticks != 0 && hour->period != period && hist_acc_close(hour, &closed)) {
+        hist_append(FAN_HIST_HOUR, &closed, now_s);
+    }
+    hist_acc_add(hour, minute, period);
+    hour->agg.s = period * 3600;
+}
+
+static void hist_stats(int64_t now_us)
+{
+    if (now_us - hist_stats_us < FAN_HIST_STATS_MS * 1000LL) {
+        return;
+    }
+    hist_stats_us = now_us;
+    int64_t hours_x1000 = (now_us - hist_start_us) / 3600000;
+    const hist_tier_t *tick = &hist_tiers[FAN_HIST_TICK];
+    uint32_t pages = 0;
+    for (int id = 0; id < FAN_HIST_TIER_MAX; id++) {
+        pages += hist_tiers[id].written;
+    }
+    if (hours_x1000 <= 0 || tick->erases == 0) {
+        return;
+    }
+    // The tick ring wears fastest, every sector of it is erased once per lap
+    uint64_t erases_per_year = (uint64_t)tick->erases * 8760 * 1000 / hours_x1000 / tick->sectors;
+    ESP_LOGI(TAG, "Pages tick/minute/hour %lu/%lu/%lu, %lu B/h to flash, %lu erases/h, tick ring %lu min deep, %lu years to %d cycles",
+             (unsigned long)tick->written, (unsigned long)hist_tiers[FAN_HIST_MINUTE].written,
+             (unsigned long)hist_tiers[FAN_HIST_HOUR].written,
+             (unsigned long)((uint64_t)pages * HIST_PAGE * 1000 / hours_x1000),
+             (unsigned long)((uint64_t)(tick->erases + hist_tiers[FAN_HIST_MINUTE].erases + hist_tiers[FAN_HIST_HOUR].erases)
+                             * 1000 / hours_x1000),
+             (unsigned long)((uint64_t)(tick->pages - HIST_SECTOR_PAGES) * hours_x1000 * 60 / 1000 / tick->written),
+             (unsigned long)(erases_per_year ? HIST_FLASH_CYCLES / erases_per_year : 0), HIST_FLASH_CYCLES);
+}
+
+static void hist_on_restart(void)
+{
+    fan_hist_flush();
+}
+
+esp_err_t fan_hist_init(void)
+{
+    uint32_t base = 0;
+    size_t size;
+    bool found_boot = false;
+
+    ESP_RETURN_ON_ERROR(fan_hal_hist_init(&size), TAG, "No history partition, history off");
+    for (int id = 0; id < FAN_HIST_TIER_MAX; id++) {
+        hist_tier_t *t = &hist_tiers[id];
+        t->base = base;
+        t->pages = t->sectors * HIST_SECTOR_PAGES;
+        t->per_page = (HIST_PAGE - HIST_HDR_LEN) / t->rec_size;
+        base += t->sectors * FAN_HAL_HIST_SECTOR;
+    }
+    ESP_RETURN_ON_FALSE(base <= size, ESP_ERR_INVALID_SIZE, TAG, "History partition holds %u of %lu bytes, history off",
+                        (unsigned)size, (unsigned long)base);
+    for (int id = 0; id < FAN_HIST_TIER_MAX; id++) {
+        hist_scan(id, &found_boot, &hist_boot);
+    }
+    hist_boot = found_boot ? hist_boot + 1 : 0;
+    hist_start_us = fan_hal_now_us();
+    hist_stats_us = hist_start_us;
+    hist_ready = true;
+    if (fan_hal_on_restart(hist_on_restart) != ESP_OK) {
+        ESP_LOGW(TAG, "No restart hook, partial pages are lost on a restart");
+    }
+    ESP_LOGI(TAG, "Boot %u", hist_boot);
+    return ESP_OK;
+}
+
+void fan_hist_record(int zone, const fan_telem_sample_t *s)
+{
+    int64_t now_us = fan_hal_now_us();
+    uint32_t now_s = (uint32_t)(now_us / 1000000);
+    hist_acc_t *minute = &hist_minute[zone];
+    uint32_t period = now_s / 60;
+    fan_hist_agg_t closed;
+
+    if (!hist_ready) {
+        return;
+    }
+    const fan_hist_tick_t tick = {
+        .ms = (uint32_t)(now_us / 1000),
+        .zone = zone,
+        .flags = s->flags,
+        .troom = q16_clamp(s->troom >> 8, INT16_MIN, INT16_MAX),
+        .tcell = q16_clamp(s->tcell >> 8, INT16_MIN, INT16_MAX),
+        .current = q16_clamp(Q16_INT(s->current), 0, UINT16_MAX),
+        .duty = q16_clamp(s->duty_out, 0, UINT16_MAX),
+        .rpm = s->rpm < 0 ? 0 : (s->rpm > UINT16_MAX ? UINT16_MAX : s->rpm),
+    };
+    hist_append(FAN_HIST_TICK, &tick, now_s);
+
+    //-------------Minute closes on the first tick of the next one---------------//
+    if (minute->agg.ticks != 0 && minute->period != period && hist_acc_close(minute, &closed)) {
+        hist_minute_closed(zone, &closed, now_s);
+    }
+    const fan_hist_agg_t unit = {
+        .s = period * 60, .zone = zone, .starts = (s->flags & FAN_TELEM_START) ? 1 : 0, .ticks = 1,
+        .troom_avg = tick.troom,
+        .tcell_min = tick.tcell, .tcell_avg = tick.tcell, .tcell_max = tick.tcell,
+        .current_min = tick.current, .current_avg = tick.current, .current_max = tick.current,
+        .duty_min = tick.duty, .duty_avg = tick.duty, .duty_max = tick.duty,
+        .rpm_avg = tick.rpm, .rpm_max = tick.rpm,
+    };
+    hist_acc_add(minute, &unit, period);
+
+    //-------------Slow tiers do not sit in RAM for days---------------//
+    for (int id = FAN_HIST_MINUTE; id < FAN_HIST_TIER_MAX; id++) {
+        hist_tier_t *t = &hist_tiers[id];
+        if (t->count > 0 && now_s - t->first_s >= t->sync_s) {
+            hist_write(t, id);
+        }
+    }
+    if (atomic_exchange(&hist_flush_req, false)) {
+        fan_hist_flush();
+    }
+    hist_stats(now_us);
+}
+
+esp_err_t fan_hist_flush(void)
+{
+    esp_err_t ret = ESP_OK;
+    int pages = 0;
+
+    for (int id = 0; hist_ready && id < FAN_HIST_TIER_MAX; id++) {
+        if (hist_tiers[id].count == 0) {
+            continue;
+        }
+        if (hist_write(&hist_tiers[id], id) != ESP_OK) {
+            ret = ESP_FAIL;
+        }
+        pages++;
+    }
+    ESP_LOGI(TAG, "Flushed %d partial pages", pages);
+    return ret;
+}
+
+void fan_hist_request_flush(void)
+{
+    atomic_store(&hist_flush_req, true);
+}
@@ -0,0 +1,92 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "fan_telem.h"
+
+/*---------------------------------------------------------------
+        History log Macros
+
+        Three tiers in the "history" data partition, each a ring of
+        flash sectors written append only:
+
+            tick    every control tick per zone, about the last hour
+            minute  min/avg/max per zone and minute, days
+            hour    the same per hour, months
+
+        Records gather in a RAM page per tier and reach flash as one
+        256 byte page program; a sector is erased only when the ring
+        enters it, so every sector of a tier wears at the same rate.
+        Each page carries a header with tier, a sequence number that
+        survives reboots, the boot number and a CRC32. The write
+        position is found again at boot from the highest sequence.
+
+        There is no wall clock, times are seconds since the boot the
+        page header names; they come from the 64 bit microsecond
+        timer, so they do not wrap. The tick tier also keeps the
+        milliseconds, modulo 2^32 (49.7 days): the ring holds about an
+        hour, and the decoder unwraps them against the seconds of the
+        newest minute or hour record of the same boot. tools/fan_hist.py decodes a partition dump
+        (parttool.py read_partition --partition-name history) to CSV.
+---------------------------------------------------------------*/
+#define FAN_HIST_TICK_SECTORS   32      // 7680 records, 1 h of 2 s ticks for 4 zones
+#define FAN_HIST_MIN_SECTORS    144     // 16128 records, 11 days for 1 zone
+#define FAN_HIST_HOUR_SECTORS   64      // 7168 records, 10 months for 1 zone
+
+#define FAN_HIST_MAGIC          0x4846  // "FH"
+#define FAN_HIST_MIN_SYNC_S     3600            // A partial minute page waits at most this long
+#define FAN_HIST_HOUR_SYNC_S    (24 * 3600)     // ... and a partial hour page this long
+#define FAN_HIST_STATS_MS       (6 * 3600 * 1000)
+
+typedef enum {
+    FAN_HIST_TICK,
+    FAN_HIST_MINUTE,
+    FAN_HIST_HOUR,
+    FAN_HIST_TIER_MAX,
+} fan_hist_tier_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t tier;
+    uint8_t count;          // Records in the page
+    uint32_t seq;           // Per tier, continues across boots
+    uint16_t boot;
+    uint16_t reserved;      // 0xFFFF
+    uint32_t crc;           // CRC32 of the header before it and the whole payload
+} fan_hist_page_hdr_t;
+
+// Temperatures ℃/256, current mA, duties 1/65536 as in fan_telem.h
+typedef struct __attribute__((packed)) {
+    uint32_t ms;            // Since boot, wraps after 49.7 days
+    uint8_t zone;
+    uint8_t flags;          // FAN_TELEM_* flags
+    int16_t troom;
+    int16_t tcell;
+    uint16_t current;
+    uint16_t duty;          // On the PWM
+    uint16_t rpm;
+} fan_hist_tick_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t s;             // Period start, seconds since boot
+    uint8_t zone;
+    uint8_t starts;         // Fan starts in the period
+    uint16_t ticks;         // Control ticks behind the record
+    int16_t troom_avg;
+    int16_t tcell_min, tcell_avg, tcell_max;
+    uint16_t current_min, current_avg, current_max;
+    uint16_t duty_min, duty_avg, duty_max;
+    uint16_t rpm_avg, rpm_max;
+} fan_hist_agg_t;
+
+// Finds the write position of every tier, history stays off without the partition
+esp_err_t fan_hist_init(void);
+// Control task only, the sample of fan_telem_record()
+void fan_hist_record(int zone, const fan_telem_sample_t *sample);
+// Write the partial pages, control task only; fan_hist_init() also hooks it to a planned restart
+esp_err_t fan_hist_flush(void);
+// Any task: fan_hist_flush() on the next tick, before a dump
+void fan_hist_request_flush(void);
@@ -0,0 +1,281 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_rom_crc.h"
+#include "esp_bit_defs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "fan_hal.h"
+#include "fan_host.h"
+
+const static char *TAG = "Fan-Host";
+
+typedef struct __attribute__((packed)) {
+    uint8_t sync[2];
+    uint8_t version;
+    uint8_t type;
+    uint8_t seq;
+    uint8_t len;
+} host_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t zone;
+    uint8_t disk;
+    int16_t temp;           // ℃/256
+    uint8_t state;
+} host_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t period_s;
+    uint8_t count;
+    host_entry_t entry[];
+} host_disks_t;
+
+typedef struct __attribute__((packed)) {
+    host_header_t header;
+    uint8_t status;
+    uint8_t disks;
+    uint32_t crc;
+} host_ack_t;
+
+#define HOST_CRC_LEN        4
+#define HOST_FRAME_MAX      (sizeof(host_header_t) + 255 + HOST_CRC_LEN)
+#define HOST_RX_BUF         (2 * HOST_FRAME_MAX)    // A partial frame plus a whole one
+
+static portMUX_TYPE host_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t host_rx[HOST_RX_BUF];
+static fan_host_disk_t host_disks[FAN_HOST_DISKS_MAX];
+static int host_disk_num;
+static fan_host_stats_t host_stats;
+static atomic_uint host_valid;           // Zones with a disk in the last fold
+static bool host_fresh[FAN_ZONE_NUM];   // Control task only
+
+/*---------------------------------------------------------------
+        Frames
+---------------------------------------------------------------*/
+static void host_ack(uint8_t seq, uint8_t status, uint8_t disks)
+{
+    host_ack_t ack = {
+        .header = { { FAN_HOST_SYNC0, FAN_HOST_SYNC1 }, FAN_HOST_VERSION, FAN_HOST_ACK, seq, 2 },
+        .status = status,
+        .disks = disks,
+    };
+
+    ack.crc = esp_rom_crc32_le(0, (const uint8_t *)&ack, offsetof(host_ack_t, crc));
+    if (fan_hal_host_write(&ack, sizeof(ack)) != ESP_OK) {
+        ESP_LOGD(TAG, "Ack %u not sent", seq);
+    }
+}
+
+// Fold of every zone, published as one group: mean plus a share of the way to the hottest disk
+static void host_fold(const fan_host_disk_t *disks, int num)
+{
+    q16_t tdisk[FAN_ZONE_NUM];
+    unsigned valid = 0;
+
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        int64_t sum = 0;
+        q16_t hottest = INT32_MIN;
+        int n = 0;
+
+        for (int i = 0; i < num; i++) {
+            if (disks[i].zone != zone || disks[i].state == FAN_HOST_STANDBY) {
+                continue;
+            }
+            sum += disks[i].temp;
+            hottest = disks[i].temp > hottest ? disks[i].temp : hottest;
+            n++;
+        }
+        if (n == 0) {
+            tdisk[zone] = 0;
+            continue;
+        }
+        q16_t mean = (q16_t)(sum / n);
+        tdisk[zone] = mean + q16_mul(hottest - mean, Q16(FAN_HOST_HOT_WEIGHT));
+        valid |= BIT(zone);
+    }
+    atomic_store(&host_valid, valid);
+    fan_frame_publish(FAN_FRAME_HOST, tdisk, fan_hal_now_us());
+}
+
+static uint8_t host_take_disks(const host_disks_t *p, size_t len, int *taken)
+{
+    static fan_host_disk_t disks[FAN_HOST_DISKS_MAX];
+    uint8_t status = FAN_HOST_OK;
+    int num = 0;
+
+    *taken = 0;
+    if (len < sizeof(host_disks_t) || p->count > FAN_HOST_DISKS_MAX || p->period_s == 0
+     || len != sizeof(host_disks_t) + p->count * sizeof(host_entry_t)) {
+        return FAN_HOST_BAD_LENGTH;
+    }
+    //-------------Entries read where they lie, implausible ones skipped, overheating ones clamped---------------//
+    for (int i = 0; i < p->count; i++) {
+        const host_entry_t *e = &p->entry[i];
+        q16_t temp = (q16_t)e->temp * 256;
+
+        if (e->zone >= FAN_ZONE_NUM || e->state > FAN_HOST_STANDBY
+         || temp < Q16(FAN_HOST_TEMP_MIN) || temp > Q16(FAN_HOST_TEMP_LIMIT)) {
+            status = FAN_HOST_BAD_ENTRY;
+            continue;
+        }
+        if (temp > Q16(FAN_HOST_TEMP_MAX)) {
+            ESP_LOGW(TAG, "%s: disk %u at " Q16_FMT1 "℃, taken as %.0f℃", fan_zones[e->zone].name, e->disk,
+                     Q16_DEC1(temp), FAN_HOST_TEMP_MAX);
+            temp = Q16(FAN_HOST_TEMP_MAX);
+        }
+        disks[num].zone = e->zone;
+        disks[num].disk = e->disk;
+        disks[num].temp = temp;
+        disks[num].state = e->state;
+        num++;
+    }
+    host_fold(disks, num);
+
+    portENTER_CRITICAL(&host_lock);
+    memcpy(host_disks, disks, num * sizeof(disks[0]));
+    host_disk_num = num;
+    host_stats.period_s = p->period_s;
+    host_stats.last_us = fan_hal_now_us();
+    host_stats.frames++;
+    portEXIT_CRITICAL(&host_lock);
+    *taken = num;
+    return status;
+}
+
+static void host_frame(const host_header_t *h)
+{
+    int taken = 0;
+    uint8_t status;
+
+    if (h->type != FAN_HOST_DISKS) {
+        host_stats.rejected++;
+        return;
+    }
+    status = host_take_disks((const host_disks_t *)(h + 1), h->len, &taken);
+    if (status != FAN_HOST_OK) {
+        host_stats.rejected++;
+    }
+    host_ack(h->seq, status, taken);
+}
+
+// Frames in buf[0..len), returns the bytes consumed; a partial frame stays for the next read
+static size_t host_parse(const uint8_t *buf, size_t len)
+{
+    size_t pos = 0;
+
+    while (pos < len) {
+        const uint8_t *sync = memchr(buf + pos, FAN_HOST_SYNC0, len - pos);
+        if (sync == NULL) {
+            return len;
+        }
+        pos = sync - buf;
+        if (len - pos < sizeof(host_header_t)) {
+            return pos;
+        }
+        const host_header_t *h = (const host_header_t *)sync;
+        if (h->sync[1] != FAN_HOST_SYNC1 || h->version != FAN_HOST_VERSION) {
+            pos++;
+            continue;
+        }
+        size_t size = sizeof(host_header_t) + h->len + HOST_CRC_LEN;
+        if (len - pos < size) {
+            return pos;
+        }
+        uint32_t crc;
+        memcpy(&crc, sync + size - HOST_CRC_LEN, sizeof(crc));
+        if (crc != esp_rom_crc32_le(0, sync, size - HOST_CRC_LEN)) {
+            host_stats.crc_errors++;
+            pos++;
+            continue;
+        }
+        host_frame(h);
+        pos += size;
+    }
+    return pos;
+}
+
+// Blocks on the driver events, no timer: a quiet host costs no wakeups
+static void host_task(void *arg)
+{
+    size_t fill = 0;
+
+    while (1) {
+        int n = fan_hal_host_read(host_rx + fill, sizeof(host_rx) - fill);
+        if (n < 0) {
+            host_stats.overflows++;
+            fill = 0;
+            continue;
+        }
+        fill += n;
+        size_t used = host_parse(host_rx, fill);
+        memmove(host_rx, host_rx + used, fill - used);
+        fill -= used;
+        //-------------Garbage that never completes a frame---------------//
+        if (fill == sizeof(host_rx)) {
+            fill = 0;
+        }
+    }
+}
+
+esp_err_t fan_host_init(void)
+{
+    esp_err_t ret = FAN_HOST_ENABLE ? fan_hal_host_init() : ESP_ERR_NOT_SUPPORTED;
+
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        return ret;
+    }
+    ESP_RETURN_ON_ERROR(ret, TAG, "host link init failed");
+    ESP_RETURN_ON_FALSE(xTaskCreate(host_task, "host_rx", FAN_HOST_STACK, NULL, FAN_HOST_PRIO, NULL) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "host task failed");
+    ESP_LOGI(TAG, "Waiting for disk temperatures at %d baud", FAN_HOST_BAUD);
+    return ESP_OK;
+}
+
+/*---------------------------------------------------------------
+        Control input
+---------------------------------------------------------------*/
+bool fan_host_tdisk(const fan_frame_t *frame, int zone, int64_t now_us, q16_t *tdisk)
+{
+    int period_s = host_stats.period_s;
+    int32_t age_ms = fan_frame_age_ms(frame, FAN_FIELD_TDISK(zone), now_us);
+    bool fresh = period_s > 0 && age_ms <= FAN_HOST_STALE_PERIODS * period_s * 1000;
+
+    if (fresh != host_fresh[zone]) {
+        host_fresh[zone] = fresh;
+        if (fresh) {
+            ESP_LOGI(TAG, "%s: disk temperatures from the host, every %ds", fan_zones[zone].name, period_s);
+        } else {
+            ESP_LOGW(TAG, "%s: host data %ds old, NTC only", fan_zones[zone].name, (int)(age_ms / 1000));
+        }
+    }
+    *tdisk = frame->field[FAN_FIELD_TDISK(zone)].value;
+    return fresh && (atomic_load(&host_valid) & BIT(zone));
+}
+
+int fan_host_disks(fan_host_disk_t *out, int max)
+{
+    portENTER_CRITICAL(&host_lock);
+    int num = host_disk_num < max ? host_disk_num : max;
+    memcpy(out, host_disks, num * sizeof(out[0]));
+    portEXIT_CRITICAL(&host_lock);
+    return num;
+}
+
+void fan_host_get(fan_host_stats_t *out)
+{
+    portENTER_CRITICAL(&host_lock);
+    *out = host_stats;
+    portEXIT_CRITICAL(&host_lock);
+}
+
+const char *fan_host_state_name(fan_host_state_t state)
+{
+    static const char *names[] = { "unknown", "active", "idle", "standby" };
+    return names[state];
+}
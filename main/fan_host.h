@@ -0,0 +1,107 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "fan_fixed.h"
+#include "fan_frame.h"
+
+/*---------------------------------------------------------------
+        Host link Macros
+
+        The NAS pushes the SMART temperature and spin state of every
+        disk over a second UART (tools/fan_host.py). One frame per
+        push, both directions:
+
+            sync 0xFA 0xDE, version, type, seq, len, len payload
+            bytes, CRC32 (esp_rom_crc32_le) of all before it
+
+            DISKS  host -> controller: period_s, count, then count
+                   entries { zone, disk, temp ℃/256 (i16), state }
+            ACK    controller -> host: status, disks taken
+
+        All fields little endian. The host sends FAN_HOST_WAKE_BYTES
+        of 0x55 and waits FAN_HOST_WAKE_MS before each frame: the
+        edges wake the chip from light sleep, the bytes themselves are
+        lost and skipped by the sync search.
+
+        The driver interrupts once per frame (RX idle timeout) and the
+        receive task blocks on its event queue, so the link adds one
+        wakeup per push and none while the host is quiet. Frames are
+        checked and decoded in the receive buffer where the driver put
+        them; only the folded temperature per zone is published, as
+        the FAN_FRAME_HOST group of the sensor frame.
+
+        Per zone the fold takes the mean of the disks that are not in
+        standby plus FAN_HOST_HOT_WEIGHT of the way to the hottest one
+        (1 takes the hottest disk, 0 the mean). The control loop feeds
+        it to tt2duty in place of the cage NTC when it is the hotter of
+        the two. Data older than FAN_HOST_STALE_PERIODS push periods
+        of the host falls back to NTC-only control, and so does a zone
+        whose disks are all in standby (a bit per zone, published with
+        the fold; 0 ℃ is a reading like any other).
+
+        A reading above FAN_HOST_TEMP_MAX but below FAN_HOST_TEMP_LIMIT
+        is an overheating disk, not noise: it enters the fold at
+        FAN_HOST_TEMP_MAX, which the curve maps to full duty.
+---------------------------------------------------------------*/
+#define FAN_HOST_ENABLE         1       // The linux target has a link with SIM_HOST_PTY of fan_hal_sim.c
+#define FAN_HOST_VERSION        1
+#define FAN_HOST_SYNC0          0xFA
+#define FAN_HOST_SYNC1          0xDE
+#define FAN_HOST_BAUD           115200
+#define FAN_HOST_WAKE_BYTES     4
+#define FAN_HOST_WAKE_MS        5
+#define FAN_HOST_DISKS_MAX      16      // Per frame
+#define FAN_HOST_HOT_WEIGHT     1.0
+#define FAN_HOST_STALE_PERIODS  3
+#define FAN_HOST_TEMP_MIN       0.0     // ℃, SMART readings below or above FAN_HOST_TEMP_LIMIT are dropped
+#define FAN_HOST_TEMP_MAX       90.0    // ℃, readings above are clamped to it
+#define FAN_HOST_TEMP_LIMIT     120.0
+#define FAN_HOST_STACK          (3 * 1024)
+#define FAN_HOST_PRIO           2
+
+// Frame types
+#define FAN_HOST_DISKS          0x01
+#define FAN_HOST_ACK            0x81
+
+// ACK status
+#define FAN_HOST_OK             0
+#define FAN_HOST_BAD_LENGTH     1
+#define FAN_HOST_BAD_ENTRY      2       // Zone out of range or temperature implausible, rest taken
+
+typedef enum {
+    FAN_HOST_UNKNOWN,
+    FAN_HOST_ACTIVE,
+    FAN_HOST_IDLE,
+    FAN_HOST_STANDBY,       // Spun down, left out of the fold
+} fan_host_state_t;
+
+typedef struct {
+    uint8_t zone;
+    uint8_t disk;           // Host numbering, for the console
+    q16_t temp;
+    fan_host_state_t state;
+} fan_host_disk_t;
+
+typedef struct {
+    uint32_t frames;        // Taken
+    uint32_t crc_errors;
+    uint32_t rejected;      // Bad version, length or entries
+    uint32_t overflows;     // Driver buffer overruns
+    int period_s;           // Of the host, 0 before the first frame
+    int64_t last_us;        // Last frame taken
+} fan_host_stats_t;
+
+// Receive task on the link; ESP_ERR_NOT_SUPPORTED without one
+esp_err_t fan_host_init(void);
+// Control task: folded disk temperature of the zone while the host data is fresh. False falls
+// back to the NTC: stale, no frame yet, or every disk of the zone in standby.
+bool fan_host_tdisk(const fan_frame_t *frame, int zone, int64_t now_us, q16_t *tdisk);
+// Copies of the last disk table and the counters, any task
+int fan_host_disks(fan_host_disk_t *out, int max);
+void fan_host_get(fan_host_stats_t *out);
+const char *fan_host_state_name(fan_host_state_t state);
@@ -0,0 +1,207 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "fan_hal.h"
+#include "fan_perf.h"
+
+const static char *TAG = "Fan-Perf";
+
+static const struct {
+    const char *name;
+    bool bench;             // FAN_HAL_BENCH_UNIT, else µs
+} perf_hist_info[FAN_PERF_HIST_MAX] = {
+    [FAN_PERF_LATENCY]   = { "latency", false },
+    [FAN_PERF_JITTER]    = { "jitter", false },
+    [FAN_PERF_CTL_CPU]   = { "ctl_cpu", true },
+    [FAN_PERF_ADC_ACQ]   = { "adc_acq", false },
+    [FAN_PERF_TSENS_ACQ] = { "tsens_acq", false },
+    [FAN_PERF_TACH_ISR]  = { "tach_isr", true },
+    [FAN_PERF_EST_CPU]   = { "est_cpu", true },
+    [FAN_PERF_BUS_READ]  = { "bus_read", false },
+    [FAN_PERF_BUS_CPU]   = { "bus_cpu", true },
+    [FAN_PERF_ENERGY_CPU] = { "energy_cpu", true },
+};
+
+static const char *perf_task_names[FAN_PERF_TASK_MAX] = {
+    [FAN_PERF_TEMP] = "tempread_task",
+    [FAN_PERF_ADC]  = "adc_regular_task",
+    [FAN_PERF_CTL]  = "main",
+    [FAN_PERF_BUS]  = "bus_task",
+};
+
+static portMUX_TYPE perf_lock = portMUX_INITIALIZER_UNLOCKED;
+static fan_perf_t perf;
+static int64_t perf_tick_us;        // Tick timer fired, 0 once the control loop parked
+static int64_t perf_stats_us;
+
+static void IRAM_ATTR perf_hist_add(fan_perf_hist_t *h, uint32_t value)
+{
+    int b = value == 0 ? 0 : 32 - __builtin_clz(value);
+
+    h->bucket[b < FAN_PERF_BUCKETS ? b : FAN_PERF_BUCKETS - 1]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+static uint32_t perf_us(int64_t us)
+{
+    return us < 0 ? 0 : (us > UINT32_MAX ? UINT32_MAX : (uint32_t)us);
+}
+
+// One line every FAN_PERF_STATS_MS, control task
+static void perf_stats(int64_t now_us)
+{
+    fan_perf_t s;
+
+    if (now_us - perf_stats_us < FAN_PERF_STATS_MS * 1000LL) {
+        return;
+    }
+    perf_stats_us = now_us;
+    fan_perf_snapshot(&s);
+    int64_t hours_x1000 = (now_us - s.since_us) / 3600000;
+    const fan_perf_task_stats_t *ctl = &s.task[FAN_PERF_CTL];
+    if (hours_x1000 <= 0 || ctl->wakeups == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "Control %lu/h, %lu %s mean; latency p50 %lu p99 %lu max %lu us, jitter p99 %lu us, "
+             "ADC block p99 %lu us, tach ISR p99 %lu %s",
+             (unsigned long)((uint64_t)ctl->wakeups * 1000 / hours_x1000),
+             (unsigned long)(ctl->busy / ctl->wakeups), FAN_HAL_BENCH_UNIT,
+             (unsigned long)fan_perf_percentile(&s.hist[FAN_PERF_LATENCY], 500),
+             (unsigned long)fan_perf_percentile(&s.hist[FAN_PERF_LATENCY], 990),
+             (unsigned long)s.hist[FAN_PERF_LATENCY].max,
+             (unsigned long)fan_perf_percentile(&s.hist[FAN_PERF_JITTER], 990),
+             (unsigned long)fan_perf_percentile(&s.hist[FAN_PERF_ADC_ACQ], 990),
+             (unsigned long)fan_perf_percentile(&s.hist[FAN_PERF_TACH_ISR], 990), FAN_HAL_BENCH_UNIT);
+}
+
+void fan_perf_task_register(fan_perf_task_t task, uint32_t stack)
+{
+    portENTER_CRITICAL(&perf_lock);
+    perf.task[task].handle = xTaskGetCurrentTaskHandle();
+    perf.task[task].stack = stack;
+    if (perf.since_us == 0) {
+        perf.since_us = fan_hal_now_us();
+        perf_stats_us = perf.since_us;
+    }
+    portEXIT_CRITICAL(&perf_lock);
+}
+
+void fan_perf_wake(fan_perf_task_t task)
+{
+    uint32_t now = fan_hal_bench_now();
+
+    portENTER_CRITICAL(&perf_lock);
+    perf.task[task].wakeups++;
+    perf.task[task].wake_at = now ? now : 1;
+    portEXIT_CRITICAL(&perf_lock);
+}
+
+void fan_perf_park(fan_perf_task_t task)
+{
+    uint32_t now = fan_hal_bench_now();
+    int64_t now_us = fan_hal_now_us();
+    fan_perf_task_stats_t *t = &perf.task[task];
+
+    portENTER_CRITICAL(&perf_lock);
+    if (t->wake_at != 0) {
+        uint32_t busy = now - t->wake_at;
+        t->busy += busy;
+        if (busy > t->busy_max) {
+            t->busy_max = busy;
+        }
+        t->wake_at = 0;
+        if (task == FAN_PERF_CTL) {
+            perf_hist_add(&perf.hist[FAN_PERF_CTL_CPU], busy);
+        }
+    }
+    if (task == FAN_PERF_CTL && perf_tick_us != 0) {
+        perf_hist_add(&perf.hist[FAN_PERF_LATENCY], perf_us(now_us - perf_tick_us));
+        perf_tick_us = 0;
+    }
+    portEXIT_CRITICAL(&perf_lock);
+    if (task == FAN_PERF_CTL) {
+        perf_stats(now_us);
+    }
+}
+
+void fan_perf_tick(int64_t due_us)
+{
+    int64_t now_us = fan_hal_now_us();
+
+    portENTER_CRITICAL(&perf_lock);
+    perf_tick_us = now_us;
+    perf_hist_add(&perf.hist[FAN_PERF_JITTER], perf_us(now_us - due_us));
+    portEXIT_CRITICAL(&perf_lock);
+}
+
+void IRAM_ATTR fan_perf_add(fan_perf_hist_id_t id, uint32_t value)
+{
+    portENTER_CRITICAL_SAFE(&perf_lock);
+    perf_hist_add(&perf.hist[id], value);
+    portEXIT_CRITICAL_SAFE(&perf_lock);
+}
+
+void fan_perf_snapshot(fan_perf_t *out)
+{
+    portENTER_CRITICAL(&perf_lock);
+    memcpy(out, &perf, sizeof(perf));
+    portEXIT_CRITICAL(&perf_lock);
+}
+
+void fan_perf_reset(void)
+{
+    int64_t now_us = fan_hal_now_us();
+
+    portENTER_CRITICAL(&perf_lock);
+    for (int task = 0; task < FAN_PERF_TASK_MAX; task++) {
+        fan_perf_task_stats_t *t = &perf.task[task];
+        t->wakeups = 0;
+        t->busy = 0;
+        t->busy_max = 0;
+    }
+    memset(perf.hist, 0, sizeof(perf.hist));
+    perf.since_us = now_us;
+    portEXIT_CRITICAL(&perf_lock);
+}
+
+const char *fan_perf_hist_name(fan_perf_hist_id_t id)
+{
+    return perf_hist_info[id].name;
+}
+
+const char *fan_perf_hist_unit(fan_perf_hist_id_t id)
+{
+    return perf_hist_info[id].bench ? FAN_HAL_BENCH_UNIT : "us";
+}
+
+const char *fan_perf_task_name(fan_perf_task_t task)
+{
+    return perf_task_names[task];
+}
+
+uint32_t fan_perf_percentile(const fan_perf_hist_t *hist, int permille)
+{
+    uint64_t need = ((uint64_t)hist->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+    for (int b = 0; b < FAN_PERF_BUCKETS; b++) {
+        seen += hist->bucket[b];
+        if (seen >= need) {
+            uint32_t bound = b == 0 ? 0 : (b >= 32 ? UINT32_MAX : (uint32_t)((1ULL << b) - 1));
+            return bound < hist->max ? bound : hist->max;
+        }
+    }
+    return hist->max;
+}
@@ -0,0 +1,85 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*---------------------------------------------------------------
+        Performance counter Macros
+
+        Always on: a hook is two counter reads and a few adds under a
+        short critical section, about a dozen hooks per tick. Tasks
+        count wakeups and the time from wake to park (fan_sched.c
+        places the hooks). Durations land in log2 histograms, bucket
+        b holds values from 2^(b-1) to 2^b - 1, so percentiles read
+        as upper bounds within a factor of two.
+
+        Times are µs of fan_hal_now_us() (virtual on the simulator),
+        CPU costs are FAN_HAL_BENCH_UNIT. fan_console.c prints them.
+---------------------------------------------------------------*/
+#define FAN_PERF_BUCKETS    32
+#define FAN_PERF_STATS_MS   (6 * 3600 * 1000)
+
+typedef enum {
+    FAN_PERF_TEMP,          // tempread_task
+    FAN_PERF_ADC,           // adc_regular_task, wake to park includes the DMA block
+    FAN_PERF_CTL,           // Control loop in app_main
+    FAN_PERF_BUS,           // bus_task, wake to park includes the batch read
+    FAN_PERF_TASK_MAX,
+} fan_perf_task_t;
+
+typedef enum {
+    FAN_PERF_LATENCY,       // µs, tick timer fired to control loop parked
+    FAN_PERF_JITTER,        // µs, tick timer fired after it was due
+    FAN_PERF_CTL_CPU,       // Bench, control loop wake to park
+    FAN_PERF_ADC_ACQ,       // µs, one ADC scan block
+    FAN_PERF_TSENS_ACQ,     // µs, one die temperature read
+    FAN_PERF_TACH_ISR,      // Bench, one tach watch event, sampled
+    FAN_PERF_EST_CPU,       // Bench, one zone of the state estimator
+    FAN_PERF_BUS_READ,      // µs, scratchpads of every bay sensor
+    FAN_PERF_BUS_CPU,       // Bench, decode and fold of one batch
+    FAN_PERF_ENERGY_CPU,    // Bench, one ADC frame into the rail energy meter
+    FAN_PERF_HIST_MAX,
+} fan_perf_hist_id_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t bucket[FAN_PERF_BUCKETS];
+} fan_perf_hist_t;
+
+typedef struct {
+    TaskHandle_t handle;    // NULL until the task registered
+    uint32_t stack;         // Bytes given to xTaskCreate
+    uint32_t wakeups;
+    uint64_t busy;          // Bench, wake to park
+    uint32_t busy_max;
+    uint32_t wake_at;       // Bench at the last wake, 0 while parked
+} fan_perf_task_stats_t;
+
+typedef struct {
+    int64_t since_us;       // Last reset
+    fan_perf_task_stats_t task[FAN_PERF_TASK_MAX];
+    fan_perf_hist_t hist[FAN_PERF_HIST_MAX];
+} fan_perf_t;
+
+// From the task itself, stack as passed to xTaskCreate
+void fan_perf_task_register(fan_perf_task_t task, uint32_t stack);
+void fan_perf_wake(fan_perf_task_t task);
+void fan_perf_park(fan_perf_task_t task);
+// Tick timer callback, due_us is when fan_sched_next() asked for it
+void fan_perf_tick(int64_t due_us);
+// Any context including ISRs
+void fan_perf_add(fan_perf_hist_id_t id, uint32_t value);
+// Consistent copy for printing
+void fan_perf_snapshot(fan_perf_t *out);
+void fan_perf_reset(void);
+const char *fan_perf_hist_name(fan_perf_hist_id_t id);
+const char *fan_perf_hist_unit(fan_perf_hist_id_t id);
+const char *fan_perf_task_name(fan_perf_task_t task);
+// Smallest bucket bound with at least permille of the samples at or below it
+uint32_t fan_perf_percentile(const fan_perf_hist_t *hist, int permille);
@@ -0,0 +1,302 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "fan_hal.h"
+#include "fan_profile.h"
+#include "fan_pwm.h"
+
+const static char *TAG = "Fan-Profile";
+
+typedef struct {
+    const char *name;
+    size_t offset;      // Float within fan_profile_t, or within fan_curve_param_t for zone fields
+    float min;
+    float max;
+} profile_field_t;
+
+static const profile_field_t profile_fields[] = {
+    { "offset0",      offsetof(fan_profile_t, common.offset[0]), 0,     1     },
+    { "offset1",      offsetof(fan_profile_t, common.offset[1]), 1,     20000 },
+    { "offset2",      offsetof(fan_profile_t, common.offset[2]), 1,     20000 },
+    { "gain0",        offsetof(fan_profile_t, common.gain[0]),   0,     0.01  },
+    { "gain1",        offsetof(fan_profile_t, common.gain[1]),   0,     0.01  },
+    { "gain2",        offsetof(fan_profile_t, common.gain[2]),   0,     0.01  },
+    { "devide",       offsetof(fan_profile_t, common.devide),    0.05,  1     },
+    { "selfheat",     offsetof(fan_profile_t, selfheat),         -5,    10    },
+    { "tsens_filt",   offsetof(fan_profile_t, tsens_filt),       0.001, 1     },
+    { "tcell_filt",   offsetof(fan_profile_t, tcell_filt),       0.001, 1     },
+    { "current_filt", offsetof(fan_profile_t, current_filt),     0.001, 1     },
+    { "slew_up",      offsetof(fan_profile_t, slew_up),          0.005, 10    },
+    { "slew_down",    offsetof(fan_profile_t, slew_down),        0.005, 10    },
+};
+
+static const profile_field_t profile_zone_fields[] = {
+    { "t_zero",       offsetof(fan_curve_param_t, t_zero),       0,     80    },
+    { "t_max",        offsetof(fan_curve_param_t, t_max),        1,     100   },
+    { "termal_max",   offsetof(fan_curve_param_t, termal_max),   0.5,   40    },
+    { "i_scale",      offsetof(fan_curve_param_t, i_scale),      0.01,  16    },
+    { "start_duty",   offsetof(fan_curve_param_t, start_duty),   0.05,  FAN_SELFTEST_UPER },
+    { "tau",          offsetof(fan_curve_param_t, model.tau),    60,    100000 },
+    { "rise",         offsetof(fan_curve_param_t, model.rise),   0.1,   50    },
+    { "air",          offsetof(fan_curve_param_t, model.air),    0,     20    },
+    { "base_w",       offsetof(fan_curve_param_t, model.base_w), 0,     50    },
+};
+
+#define PROFILE_FIELDS(t)   (sizeof(t) / sizeof((t)[0]))
+
+//-------------Double buffer, the control task flips it between ticks---------------//
+static fan_profile_t profiles[2];
+static fan_tuning_t tunings[2];
+static atomic_int profile_active;
+
+//-------------Staged by any task, taken by fan_profile_apply()---------------//
+static portMUX_TYPE profile_lock = portMUX_INITIALIZER_UNLOCKED;
+static fan_profile_t profile_pending;
+static bool profile_staged;
+
+static uint32_t profile_crc(const fan_profile_t *profile)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)profile, offsetof(fan_profile_t, crc));
+}
+
+// Like strchr(), the caller decides whether the field may be written
+static float *profile_value(const void *base, const profile_field_t *field)
+{
+    return (float *)((const char *)base + field->offset);
+}
+
+static const profile_field_t *profile_find(const profile_field_t *fields, size_t count, const char *name)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(fields[i].name, name) == 0) {
+            return &fields[i];
+        }
+    }
+    return NULL;
+}
+
+// "name" or "zone.name", NULL when there is no such field
+static float *profile_lookup(fan_profile_t *profile, const char *name, const profile_field_t **field)
+{
+    const char *dot = strchr(name, '.');
+
+    if (dot == NULL) {
+        *field = profile_find(profile_fields, PROFILE_FIELDS(profile_fields), name);
+        return *field ? profile_value(profile, *field) : NULL;
+    }
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        const char *zone_name = fan_zones[zone].name;
+        if (strlen(zone_name) == (size_t)(dot - name) && strncmp(zone_name, name, dot - name) == 0) {
+            *field = profile_find(profile_zone_fields, PROFILE_FIELDS(profile_zone_fields), dot + 1);
+            return *field ? profile_value(&profile->zone[zone], *field) : NULL;
+        }
+    }
+    return NULL;
+}
+
+static bool profile_in_range(const profile_field_t *field, float value)
+{
+    // Written this way round so NaN fails too
+    return value >= field->min && value <= field->max;
+}
+
+static void profile_build(fan_tuning_t *tuning, const fan_profile_t *profile)
+{
+    tuning->selfheat = Q16(profile->selfheat);
+    tuning->tsens_filt = Q16(profile->tsens_filt);
+    tuning->tcell_filt = Q16(profile->tcell_filt);
+    tuning->current_filt = Q16(profile->current_filt);
+    tuning->slew_up = Q16(profile->slew_up);
+    tuning->slew_down = Q16(profile->slew_down);
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        fan_curve_build(&tuning->curve[zone], &profile->zone[zone], &profile->common);
+    }
+}
+
+static esp_err_t profile_load(fan_profile_t *profile)
+{
+    esp_err_t ret = fan_hal_store_get(FAN_PROFILE_KEY, profile, sizeof(*profile));
+
+    if (ret == ESP_ERR_NOT_FOUND) {
+        ESP_LOGI(TAG, "No stored profile for this build, compiled defaults");
+        return ret;
+    }
+    ESP_RETURN_ON_ERROR(ret, TAG, "Profile read failed");
+    if (profile->version != FAN_PROFILE_VERSION || profile->size != sizeof(*profile)) {
+        ESP_LOGW(TAG, "Stored profile version %d, expected %d", profile->version, FAN_PROFILE_VERSION);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (profile->crc != profile_crc(profile)) {
+        ESP_LOGW(TAG, "Stored profile CRC mismatch");
+        return ESP_ERR_INVALID_CRC;
+    }
+    return fan_profile_validate(profile);
+}
+
+static void profile_queue(const fan_profile_t *profile)
+{
+    portENTER_CRITICAL(&profile_lock);
+    profile_pending = *profile;
+    profile_staged = true;
+    portEXIT_CRITICAL(&profile_lock);
+}
+
+esp_err_t fan_profile_init(void)
+{
+    fan_profile_t *profile = &profiles[0];
+
+    if (profile_load(profile) != ESP_OK) {
+        fan_profile_defaults(profile);
+    } else {
+        ESP_LOGI(TAG, "Stored profile loaded (crc %08lx)", (unsigned long)profile->crc);
+    }
+    profile_build(&tunings[0], profile);
+    atomic_store(&profile_active, 0);
+    return ESP_OK;
+}
+
+const fan_profile_t *fan_profile_get(void)
+{
+    return &profiles[atomic_load(&profile_active)];
+}
+
+const fan_tuning_t *fan_tuning(void)
+{
+    return &tunings[atomic_load(&profile_active)];
+}
+
+void fan_profile_defaults(fan_profile_t *profile)
+{
+    const fan_curve_common_t common = FAN_CURVE_COMMON_DEFAULT;
+
+    memset(profile, 0, sizeof(*profile));
+    profile->version = FAN_PROFILE_VERSION;
+    profile->size = sizeof(*profile);
+    profile->common = common;
+    profile->selfheat = SELFHEAT;
+    profile->tsens_filt = TSENS_FILTFACTOR;
+    profile->tcell_filt = TCELL_FILTFACTOR;
+    profile->current_filt = CURRENT_FILTFACTOR;
+    profile->slew_up = FAN_PWM_SLEW_UP;
+    profile->slew_down = FAN_PWM_SLEW_DOWN;
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        profile->zone[zone] = fan_zones[zone].curve;
+    }
+    profile->crc = profile_crc(profile);
+}
+
+esp_err_t fan_profile_validate(const fan_profile_t *profile)
+{
+    for (size_t i = 0; i < PROFILE_FIELDS(profile_fields); i++) {
+        const profile_field_t *f = &profile_fields[i];
+        ESP_RETURN_ON_FALSE(profile_in_range(f, *profile_value(profile, f)), ESP_ERR_INVALID_ARG, TAG,
+                            "%s out of range", f->name);
+    }
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        for (size_t i = 0; i < PROFILE_FIELDS(profile_zone_fields); i++) {
+            const profile_field_t *f = &profile_zone_fields[i];
+            ESP_RETURN_ON_FALSE(profile_in_range(f, *profile_value(&profile->zone[zone], f)), ESP_ERR_INVALID_ARG, TAG,
+                                "%s.%s out of range", fan_zones[zone].name, f->name);
+        }
+        ESP_RETURN_ON_FALSE(profile->zone[zone].t_max >= profile->zone[zone].t_zero + 1, ESP_ERR_INVALID_ARG, TAG,
+                            "%s: t_max must be 1℃ above t_zero", fan_zones[zone].name);
+    }
+    ESP_RETURN_ON_FALSE(profile->common.offset[2] > profile->common.offset[1], ESP_ERR_INVALID_ARG, TAG,
+                        "offset2 must lie above offset1");
+    return ESP_OK;
+}
+
+esp_err_t fan_profile_stage(const fan_profile_t *profile)
+{
+    fan_profile_t p = *profile;
+
+    p.version = FAN_PROFILE_VERSION;
+    p.size = sizeof(p);
+    p.crc = profile_crc(&p);
+    ESP_RETURN_ON_ERROR(fan_profile_validate(&p), TAG, "Profile rejected");
+    ESP_RETURN_ON_ERROR(fan_hal_store_set(FAN_PROFILE_KEY, &p, sizeof(p)), TAG, "Profile not stored");
+    profile_queue(&p);
+    return ESP_OK;
+}
+
+void fan_profile_latest(fan_profile_t *out)
+{
+    portENTER_CRITICAL(&profile_lock);
+    *out = profile_staged ? profile_pending : *fan_profile_get();
+    portEXIT_CRITICAL(&profile_lock);
+}
+
+esp_err_t fan_profile_set(const char *name, float value)
+{
+    const profile_field_t *field;
+    fan_profile_t p;
+    float *v;
+
+    fan_profile_latest(&p);
+    v = profile_lookup(&p, name, &field);
+    ESP_RETURN_ON_FALSE(v != NULL, ESP_ERR_NOT_FOUND, TAG, "No profile field %s", name);
+    *v = value;
+    return fan_profile_stage(&p);
+}
+
+bool fan_profile_field(size_t index, char *name, size_t len, float *value)
+{
+    const fan_profile_t *p = fan_profile_get();
+
+    if (index < PROFILE_FIELDS(profile_fields)) {
+        snprintf(name, len, "%s", profile_fields[index].name);
+        *value = *profile_value(p, &profile_fields[index]);
+        return true;
+    }
+    index -= PROFILE_FIELDS(profile_fields);
+    if (index >= FAN_ZONE_NUM * PROFILE_FIELDS(profile_zone_fields)) {
+        return false;
+    }
+    int zone = index / PROFILE_FIELDS(profile_zone_fields);
+    const profile_field_t *f = &profile_zone_fields[index % PROFILE_FIELDS(profile_zone_fields)];
+    snprintf(name, len, "%s.%s", fan_zones[zone].name, f->name);
+    *value = *profile_value(&p->zone[zone], f);
+    return true;
+}
+
+esp_err_t fan_profile_reset(void)
+{
+    fan_profile_t p;
+
+    ESP_RETURN_ON_ERROR(fan_hal_store_erase(FAN_PROFILE_KEY), TAG, "Stored profile not erased");
+    fan_profile_defaults(&p);
+    profile_queue(&p);
+    return ESP_OK;
+}
+
+bool fan_profile_apply(void)
+{
+    int active = atomic_load(&profile_active);
+    int idle = !active;
+    bool staged;
+
+    portENTER_CRITICAL(&profile_lock);
+    staged = profile_staged;
+    if (staged) {
+        profiles[idle] = profile_pending;
+        profile_staged = false;
+    }
+    portEXIT_CRITICAL(&profile_lock);
+    if (!staged || memcmp(&profiles[idle], &profiles[active], sizeof(fan_profile_t)) == 0) {
+        return false;
+    }
+    //-------------Only a changed profile is rebuilt, the tick path reads the result---------------//
+    profile_build(&tunings[idle], &profiles[idle]);
+    atomic_store(&profile_active, idle);
+    ESP_LOGI(TAG, "Profile applied (crc %08lx)", (unsigned long)profiles[idle].crc);
+    return true;
+}
@@ -0,0 +1,78 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "fan_fixed.h"
+#include "fan_curve.h"
+#include "fan_zone.h"
+
+/*---------------------------------------------------------------
+        Control profile
+
+        Every tuning value of fan_curve.h, the PWM slew rates and the
+        zone table in one versioned blob, stored in NVS under
+        FAN_PROFILE_KEY and read once at boot. A blob with another version or size, a bad CRC
+        or a value out of range is ignored and the compiled defaults
+        run instead.
+
+        A new profile is staged from any task and takes effect at the
+        next control tick boundary, when the sensor tasks are parked:
+        the fixed point tuning is rebuilt into the idle half of a
+        double buffer and swapped in whole. A tick runs on one profile
+        from the first sample to the PWM update.
+---------------------------------------------------------------*/
+#define FAN_PROFILE_VERSION     3
+#define FAN_PROFILE_KEY         "profile"
+#define FAN_TSENS_FILT_BASE_MS  6000    // Sample spacing the filter factors were tuned for
+#define FAN_ADC_FILT_BASE_MS    2000
+
+typedef struct {
+    uint16_t version;
+    uint16_t size;                  // sizeof(fan_profile_t), changes with FAN_ZONE_NUM
+    fan_curve_common_t common;      // OFFSET0-2, GAIN0-2, DEVIDE
+    float selfheat;                 // ESP die over room, ℃
+    float tsens_filt;               // EMA factors at their base sample spacing
+    float tcell_filt;
+    float current_filt;
+    float slew_up;                  // PWM fades, duty per second (fan_pwm.h)
+    float slew_down;
+    fan_curve_param_t zone[FAN_ZONE_NUM];   // T_ZERO, T_MAX, TERMAL_MAX, current scale, FAN_START_DUTY, cage model
+    uint32_t crc;                   // CRC32 of everything above
+} fan_profile_t;
+
+// Fixed point form of the active profile, what the control path reads
+typedef struct {
+    q16_t selfheat;
+    q16_t tsens_filt;
+    q16_t tcell_filt;
+    q16_t current_filt;
+    q16_t slew_up;
+    q16_t slew_down;
+    fan_curve_t curve[FAN_ZONE_NUM];
+} fan_tuning_t;
+
+// Load the stored profile or the defaults, after fan_hal_store_init()
+esp_err_t fan_profile_init(void);
+const fan_profile_t *fan_profile_get(void);
+// Valid for the current tick, do not keep across fan_sched_wait()
+const fan_tuning_t *fan_tuning(void);
+void fan_profile_defaults(fan_profile_t *profile);
+// Range and consistency check, version, size and CRC are filled in by fan_profile_stage()
+esp_err_t fan_profile_validate(const fan_profile_t *profile);
+// Active profile, or the staged one while it waits for the next tick; start a change from here
+void fan_profile_latest(fan_profile_t *out);
+// Validate, store and queue for the next tick boundary
+esp_err_t fan_profile_stage(const fan_profile_t *profile);
+// One field by name ("gain1", "selfheat", "cage0.t_max", ...) on top of the active or already staged profile
+esp_err_t fan_profile_set(const char *name, float value);
+// Name and active value of the index-th field, zone fields by "zone.name"; false past the last
+bool fan_profile_field(size_t index, char *name, size_t len, float *value);
+// Drop the stored profile and stage the defaults
+esp_err_t fan_profile_reset(void);
+// Control task only, between ticks. True when a staged profile took effect.
+bool fan_profile_apply(void);
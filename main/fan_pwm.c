@@ -0,0 +1,112 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "fan_hal.h"
+#include "fan_zone.h"
+#include "fan_profile.h"
+#include "fan_pwm.h"
+
+const static char *TAG = "Fan-PWM";
+
+// Counts are of fan duty here, the inverted stage flips them at the HAL call
+typedef struct {
+    int32_t from;           // Where the fade started
+    int32_t to;             // Where it ends, or stands
+    int64_t from_us;
+    int64_t end_us;
+    bool off;
+} pwm_zone_t;
+
+static pwm_zone_t pwm_zones[FAN_ZONE_NUM];
+static int32_t pwm_max;     // Counts of full duty, 2^bits - 1; Q16 products fit up to 15 bits
+
+static int32_t pwm_now(const pwm_zone_t *p, int64_t now_us)
+{
+    if (now_us >= p->end_us) {
+        return p->to;
+    }
+    return p->from + (int32_t)((int64_t)(p->to - p->from) * (now_us - p->from_us) / (p->end_us - p->from_us));
+}
+
+// Nearest count of duty
+static int32_t pwm_counts(q16_t duty)
+{
+    return Q16_INT(q16_clamp(duty, 0, Q16_ONE) * pwm_max + Q16_ONE / 2);
+}
+
+esp_err_t fan_pwm_init(void)
+{
+    pwm_max = fan_hal_pwm_max();
+    ESP_RETURN_ON_FALSE(pwm_max > 0, ESP_ERR_INVALID_STATE, TAG, "PWM not initialized");
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        ESP_RETURN_ON_ERROR(fan_pwm_stop(zone), TAG, "%s: PWM stop failed", fan_zones[zone].name);
+    }
+    int step = q16_to_scaled(fan_pwm_step(), 10000);
+    ESP_LOGI(TAG, "%ld counts of %d.%02d%%", (long)pwm_max + 1, step / 100, step % 100);
+    return ESP_OK;
+}
+
+esp_err_t fan_pwm_set(int zone, q16_t duty)
+{
+    pwm_zone_t *p = &pwm_zones[zone];
+    const fan_tuning_t *tune = fan_tuning();
+    int64_t now_us = fan_hal_now_us();
+
+    //-------------A stopped fan starts with a kick, never with a ramp from the stale register---------------//
+    if (p->off) {
+        return fan_pwm_jump(zone, duty);
+    }
+    int32_t now = pwm_now(p, now_us);
+    int32_t to = pwm_counts(duty);
+    if (to == p->to) {
+        return ESP_OK;      // A running fade already ends there
+    }
+    q16_t slew = to > now ? tune->slew_up : tune->slew_down;
+    uint32_t time_ms = (uint32_t)((int64_t)abs(to - now) * 1000 * Q16_ONE / ((int64_t)slew * pwm_max));
+
+    //-------------A move of a count or two still fades, slower than the slew rate, never as a step---------------//
+    if (time_ms < FAN_PWM_FADE_MIN_MS) {
+        time_ms = FAN_PWM_FADE_MIN_MS;
+    }
+    p->from = now;
+    p->to = to;
+    p->from_us = now_us;
+    p->end_us = now_us + time_ms * 1000LL;
+    return fan_hal_pwm_fade(zone, pwm_max - to, time_ms);
+}
+
+esp_err_t fan_pwm_jump(int zone, q16_t duty)
+{
+    pwm_zone_t *p = &pwm_zones[zone];
+
+    p->to = p->from = pwm_counts(duty);
+    p->end_us = fan_hal_now_us();
+    p->off = false;
+    return fan_hal_pwm_set(zone, pwm_max - p->to);
+}
+
+esp_err_t fan_pwm_stop(int zone)
+{
+    pwm_zone_t *p = &pwm_zones[zone];
+
+    p->to = p->from = 0;
+    p->end_us = 0;
+    p->off = true;
+    return fan_hal_pwm_stop(zone, 1);
+}
+
+q16_t fan_pwm_duty(int zone)
+{
+    const pwm_zone_t *p = &pwm_zones[zone];
+
+    return p->off ? 0 : q16_from_int(pwm_now(p, fan_hal_now_us())) / pwm_max;
+}
+
+q16_t fan_pwm_step(void)
+{
+    return Q16_ONE / pwm_max;
+}
@@ -0,0 +1,44 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "fan_fixed.h"
+
+/*---------------------------------------------------------------
+        PWM output Macros
+
+        Duty here is the fan's share of full speed (0..1); the inverted
+        output stage and the LEDC counts stay behind this module. The
+        HAL runs the timer at the finest resolution its clock allows at
+        FAN_HAL_PWM_FREQ. That clock is RC_FAST, the one that keeps the
+        PWM alive in light sleep: about 8 MHz, 320 clocks per 25 kHz
+        period, so 8 bits and a 0.4% step on the H2. Duty rounds to
+        the nearest count; the RPM loop (fan_rpm.h) takes out what the
+        rounding leaves on the measured speed.
+
+        A change of duty is a hardware fade at the slew rate of the
+        control profile (slew_up, slew_down, duty per second). The
+        control task only sets where the fade ends, the LEDC ramps
+        there with the CPU asleep. A move shorter than
+        FAN_PWM_FADE_MIN_MS fades over that time instead. Kicks,
+        fail-safes and stops jump.
+---------------------------------------------------------------*/
+#define FAN_PWM_SLEW_UP         0.15    // Profile defaults, duty per second; the only limit on the RPM loop
+#define FAN_PWM_SLEW_DOWN       0.05    // Slower on the way down, a fan winding down is heard
+#define FAN_PWM_FADE_MIN_MS     50      // Shortest hardware fade, a few LEDC cycles per count
+
+// After fan_hal_pwm_init(), every fan stopped
+esp_err_t fan_pwm_init(void);
+// Fade to duty at the slew rate of the profile, from where a running fade stands
+esp_err_t fan_pwm_set(int zone, q16_t duty);
+// Straight to duty: kick, fail-safe, self-test probe
+esp_err_t fan_pwm_jump(int zone, q16_t duty);
+// Output idle, fan off
+esp_err_t fan_pwm_stop(int zone);
+// Duty on the pin now, along a running fade
+q16_t fan_pwm_duty(int zone);
+// Duty of one LEDC count
+q16_t fan_pwm_step(void);
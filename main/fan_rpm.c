@@ -0,0 +1,217 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdlib.h>
+#include "esp_log.h"
+#include "fan_hal.h"
+#include "fan_pwm.h"
+#include "fan_rpm.h"
+
+const static char *TAG = "Fan-RPM";
+
+#define RPM_STEP_WINDOW_US  (30 * 1000000LL)    // Step response observed this long
+
+typedef struct {
+    q16_t start_duty;
+    q16_t floor;            // Lowest running duty
+    bool fitted;            // Feed-forward on the measured fan line, not the nominal fan
+    int fit_rpm0;
+    int64_t fit_inv;        // Q32, duty per RPM
+    q16_t integ;
+    int target;
+    bool settled;
+    int64_t on_us;
+
+    //-------------Step response in progress---------------//
+    bool step_open;
+    int step_dir;
+    int step_size;
+    int64_t step_us;
+    int64_t settle_us;      // First in-band sample after the last excursion, 0 while out
+    int step_peak;          // RPM past the target in the step direction
+
+    //-------------Statistics since boot---------------//
+    int steps;
+    int steps_settled;
+    int64_t settle_sum_ms;
+    int settle_max_ms;
+    int overshoot_max_pct;
+    int64_t err_sum;
+    int err_n;
+} rpm_zone_t;
+
+static rpm_zone_t rpm_zones[FAN_ZONE_NUM];
+static int64_t rpm_stats_us;
+
+// Nominal fan: FAN_RPM_MIN at the start duty, FAN_RPM_MAX at full duty
+static int rpm_nominal(const rpm_zone_t *z, q16_t duty)
+{
+    q16_t f = q16_div(duty - z->start_duty, Q16_ONE - z->start_duty);
+    int rpm = FAN_RPM_MIN + q16_to_scaled(f, FAN_RPM_MAX - FAN_RPM_MIN);
+    return rpm < 0 ? 0 : (rpm > FAN_RPM_MAX ? FAN_RPM_MAX : rpm);
+}
+
+#if FAN_RPM_CLOSED_LOOP
+static q16_t rpm_feed_forward(const rpm_zone_t *z, int rpm)
+{
+    if (z->fitted) {
+        return q16_clamp(q16_mul_q32(q16_from_int(rpm - z->fit_rpm0), z->fit_inv), z->start_duty, Q16_ONE);
+    }
+    q16_t f = q16_from_int(rpm - FAN_RPM_MIN) / (FAN_RPM_MAX - FAN_RPM_MIN);
+    return z->start_duty + q16_mul(Q16_ONE - z->start_duty, f);
+}
+#endif
+
+static void rpm_step_close(rpm_zone_t *z)
+{
+    if (z->settle_us != 0) {
+        int ms = (int)((z->settle_us - z->step_us) / 1000);
+        z->steps_settled++;
+        z->settle_sum_ms += ms;
+        if (ms > z->settle_max_ms) {
+            z->settle_max_ms = ms;
+        }
+    }
+    int pct = z->step_peak * 100 / z->step_size;
+    if (pct > z->overshoot_max_pct) {
+        z->overshoot_max_pct = pct;
+    }
+    z->step_open = false;
+}
+
+static void rpm_track(rpm_zone_t *z, int target, int rpm, int64_t now_us)
+{
+    int band = target * FAN_RPM_BAND > FAN_RPM_BAND_MIN ? (int)(target * FAN_RPM_BAND) : FAN_RPM_BAND_MIN;
+    int err = rpm - target;
+
+    z->settled = abs(err) <= band;
+    //-------------The first target after a reset meets the fan coming down from its kick, no step response---------------//
+    if (z->target != 0 && abs(target - z->target) >= FAN_RPM_STEP) {
+        if (z->step_open) {
+            rpm_step_close(z);
+        }
+        z->step_open = true;
+        z->step_dir = target > z->target ? 1 : -1;
+        z->step_size = abs(target - z->target);
+        z->step_us = now_us;
+        z->settle_us = 0;
+        z->step_peak = 0;
+        z->steps++;
+    }
+    if (z->step_open) {
+        if (err * z->step_dir > z->step_peak) {
+            z->step_peak = err * z->step_dir;
+        }
+        if (!z->settled) {
+            z->settle_us = 0;
+        } else if (z->settle_us == 0) {
+            z->settle_us = now_us;
+        }
+        if (now_us - z->step_us >= RPM_STEP_WINDOW_US) {
+            rpm_step_close(z);
+        }
+    } else if (now_us - z->on_us >= FAN_RPM_SPINUP_MS * 1000LL) {
+        z->err_sum += abs(err);
+        z->err_n++;
+    }
+}
+
+static void rpm_stats(int64_t now_us)
+{
+    if (now_us - rpm_stats_us < FAN_RPM_STATS_MS * 1000LL) {
+        return;
+    }
+    rpm_stats_us = now_us;
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        const rpm_zone_t *z = &rpm_zones[zone];
+        ESP_LOGI(TAG, "%s %s: %d steps, %d settled in %dms mean %dms max, overshoot %d%% max, tracking error %dRPM mean",
+                 fan_zones[zone].name, FAN_RPM_CLOSED_LOOP ? "PI" : "open loop", z->steps, z->steps_settled,
+                 z->steps_settled ? (int)(z->settle_sum_ms / z->steps_settled) : 0, z->settle_max_ms,
+                 z->overshoot_max_pct, z->err_n ? (int)(z->err_sum / z->err_n) : 0);
+    }
+}
+
+void fan_rpm_init(int zone, q16_t start_duty)
+{
+    rpm_zones[zone].start_duty = q16_clamp(start_duty, 0, Q16(0.9));
+    rpm_stats_us = fan_hal_now_us();
+    fan_rpm_reset(zone);
+}
+
+void fan_rpm_fan(int zone, float rpm0, float rpm_per_duty)
+{
+    rpm_zone_t *z = &rpm_zones[zone];
+
+    z->fitted = rpm_per_duty > 0;
+    if (z->fitted) {
+        z->fit_rpm0 = (int)rpm0;
+        z->fit_inv = Q32(1.0 / rpm_per_duty);
+    }
+}
+
+void fan_rpm_floor(int zone, q16_t floor)
+{
+    rpm_zones[zone].floor = floor;
+}
+
+void fan_rpm_reset(int zone)
+{
+    rpm_zone_t *z = &rpm_zones[zone];
+
+    if (z->step_open) {
+        rpm_step_close(z);
+    }
+    z->integ = 0;
+    z->target = 0;
+    z->settled = false;
+    z->on_us = fan_hal_now_us();
+}
+
+q16_t fan_rpm_update(int zone, q16_t demand, int rpm)
+{
+    rpm_zone_t *z = &rpm_zones[zone];
+    int64_t now_us = fan_hal_now_us();
+    int target = rpm_nominal(z, demand);
+    q16_t duty;
+
+    rpm_stats(now_us);
+    //-------------Below the start duty the model has nothing to anchor on, run open loop---------------//
+    if (demand <= z->start_duty) {
+        z->target = target;
+        z->settled = true;
+        return demand > z->floor ? demand : z->floor;
+    }
+    rpm_track(z, target, rpm, now_us);
+    z->target = target;
+#if FAN_RPM_CLOSED_LOOP
+    int err = target - rpm;
+    q16_t ff = rpm_feed_forward(z, target);
+    q16_t p = q16_mul_q32(q16_from_int(err), Q32(FAN_RPM_KP));
+    q16_t integ = z->integ;
+    if (now_us - z->on_us >= FAN_RPM_SPINUP_MS * 1000LL) {
+        integ = q16_clamp(integ + q16_mul_q32(q16_from_int(err), Q32(FAN_RPM_KI)), -Q16(0.5), Q16(0.5));
+    }
+    duty = q16_clamp(ff + p + integ, z->floor, Q16_ONE);
+
+    //-------------Anti-windup: hold the integrator while the pin is off the output by more than a count---------------//
+    //-------------Pinned at the floor or full duty, or a fan_pwm fade still on its way at the slew rate---------------//
+    q16_t lag = ff + p + integ - fan_pwm_duty(zone);
+    if ((lag > fan_pwm_step() && err > 0) || (lag < -fan_pwm_step() && err < 0)) {
+        integ = z->integ;
+    }
+    z->integ = integ;
+#else
+    duty = q16_clamp(demand, z->floor, Q16_ONE);
+#endif
+    return duty;
+}
+
+int fan_rpm_target(int zone)
+{
+    return rpm_zones[zone].target;
+}
+
+bool fan_rpm_settled(int zone)
+{
+    return !FAN_RPM_CLOSED_LOOP || rpm_zones[zone].settled;
+}
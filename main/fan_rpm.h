@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fan_fixed.h"
+
+/*---------------------------------------------------------------
+        RPM control Macros
+
+        The fused demand (0..1) becomes a target RPM on a linear fan
+        model anchored at the start duty found by the self-test. The
+        inverse of that model is the feed-forward duty, a PI term on
+        the measured RPM takes out what the model gets wrong (ageing,
+        rail sag, dust). Below the start duty, and everywhere with
+        FAN_RPM_CLOSED_LOOP 0, the demand drives the PWM directly as
+        before and only the tracking is measured. Once the auto-tuning
+        has measured the fan, the feed-forward inverts that line
+        instead; the target stays on the nominal model. The output
+        is not rate limited here, fan_pwm.h fades to it at the slew
+        rates of the profile.
+---------------------------------------------------------------*/
+#define FAN_RPM_CLOSED_LOOP     1
+
+#define FAN_RPM_MIN             500     // Nominal speed at the start duty
+#define FAN_RPM_MAX             3000    // Nominal speed at full duty
+// The fan settles well inside one control tick, so the PI runs per tick, not per second
+#define FAN_RPM_KP              0.00004 // Duty per RPM of error
+#define FAN_RPM_KI              0.0001  // Duty per RPM of error and tick
+#define FAN_RPM_SPINUP_MS       3000    // No integration while the fan spins up
+
+// Tracking statistics
+#define FAN_RPM_STEP            200     // Target change that counts as a step
+#define FAN_RPM_BAND            0.05    // Settled within this fraction of the target
+#define FAN_RPM_BAND_MIN        50      // ... but never tighter than this many RPM
+#define FAN_RPM_STATS_MS        (6 * 3600 * 1000)
+
+// Start duty from the self-test, or the curve value when it failed
+void fan_rpm_init(int zone, q16_t start_duty);
+// Measured fan line from the auto-tuning (fan_tune.h) for the feed-forward, a slope of 0 drops it
+void fan_rpm_fan(int zone, float rpm0, float rpm_per_duty);
+// Lowest duty of a running fan, the floor of fan_cycle.h; the PI never pulls below it
+void fan_rpm_floor(int zone, q16_t floor);
+// Fan switched on or off, drop the integrator
+void fan_rpm_reset(int zone);
+// Duty for this tick from the demand and the measured RPM
+q16_t fan_rpm_update(int zone, q16_t demand, int rpm);
+int fan_rpm_target(int zone);
+// Within the band of the current target, always when running open loop
+bool fan_rpm_settled(int zone);
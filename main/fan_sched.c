@@ -0,0 +1,112 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "fan_hal.h"
+#include "fan_sched.h"
+#include "fan_perf.h"
+
+const static char *TAG = "Fan-Sched";
+
+#define SCHED_STATS_US      (3600LL * 1000000)
+
+static EventGroupHandle_t sched_events;
+static uint32_t sched_period_ms = SCHED_PERIOD_MIN_MS;
+static uint32_t sched_ticks;
+static int64_t sched_stats_us;
+static uint32_t sched_stats_wakeups;
+static int64_t sched_stats_sleep_us;
+static bool sched_running;
+static int64_t sched_due_us;
+
+static void sched_tick_cb(void *arg)
+{
+    sched_ticks++;
+    fan_perf_tick(sched_due_us);
+    xEventGroupSetBits(sched_events, SCHED_TEMP_TICK | SCHED_ADC_TICK | SCHED_BUS_TICK);
+}
+
+static void sched_stats(void)
+{
+    int64_t now = fan_hal_now_us();
+    uint32_t wakeups = fan_hal_wakeup_count();
+    int64_t sleep_us = fan_hal_sleep_time_us();
+
+    if (now - sched_stats_us < SCHED_STATS_US) {
+        return;
+    }
+    ESP_LOGI(TAG, "Ticks: %u, Wakeups: %u, Light sleep: %d%% in the last hour, period %ums",
+             (unsigned)sched_ticks, (unsigned)(wakeups - sched_stats_wakeups),
+             (int)((sleep_us - sched_stats_sleep_us) * 100 / (now - sched_stats_us)), (unsigned)sched_period_ms);
+    sched_ticks = 0;
+    sched_stats_us = now;
+    sched_stats_wakeups = wakeups;
+    sched_stats_sleep_us = sleep_us;
+}
+
+esp_err_t fan_sched_init(void)
+{
+    sched_events = xEventGroupCreate();
+    if (sched_events == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    sched_stats_us = fan_hal_now_us();
+    return fan_hal_timer_init(sched_tick_cb, NULL);
+}
+
+static fan_perf_task_t sched_task(EventBits_t bits)
+{
+    return bits & (SCHED_TEMP_TICK | SCHED_TEMP_DONE) ? FAN_PERF_TEMP
+         : bits & (SCHED_BUS_TICK | SCHED_BUS_DONE) ? FAN_PERF_BUS : FAN_PERF_ADC;
+}
+
+void fan_sched_wait(EventBits_t tick)
+{
+    xEventGroupWaitBits(sched_events, tick, pdTRUE, pdTRUE, portMAX_DELAY);
+    fan_perf_wake(sched_task(tick));
+}
+
+void fan_sched_done(EventBits_t done)
+{
+    fan_perf_park(sched_task(done));
+    xEventGroupSetBits(sched_events, done);
+}
+
+void fan_sched_wait_batch(void)
+{
+    xEventGroupWaitBits(sched_events, SCHED_TEMP_DONE | SCHED_ADC_DONE, pdTRUE, pdTRUE, portMAX_DELAY);
+    fan_perf_wake(FAN_PERF_CTL);
+}
+
+esp_err_t fan_sched_next(bool settled)
+{
+    //-------------First tick right away, control starts on the boot frame---------------//
+    if (!sched_running) {
+        sched_running = true;
+        sched_due_us = fan_hal_now_us();
+        return fan_hal_timer_start(0);
+    }
+    fan_perf_park(FAN_PERF_CTL);
+    sched_stats();
+    if (!settled) {
+        sched_period_ms = SCHED_PERIOD_MIN_MS;
+    } else if (sched_period_ms < SCHED_PERIOD_MAX_MS) {
+        sched_period_ms *= 2;
+        ESP_LOGD(TAG, "Settled, period %ums", (unsigned)sched_period_ms);
+    }
+    sched_due_us = fan_hal_now_us() + sched_period_ms * 1000LL;
+    return fan_hal_timer_start(sched_period_ms);
+}
+
+uint32_t fan_sched_period_ms(void)
+{
+    return sched_period_ms;
+}
+
+q16_t fan_sched_factor(q16_t factor, uint32_t base_ms)
+{
+    return q16_clamp((q16_t)((int64_t)factor * sched_period_ms / base_ms), 0, Q16_ONE);
+}
@@ -0,0 +1,47 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_bit_defs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "fan_fixed.h"
+
+/*---------------------------------------------------------------
+        Control tick scheduler Macros
+
+        One one-shot timer wakes the CPU once per period and releases
+        the temperature, ADC and control work together. The period
+        doubles while the readings are settled and drops back to the
+        minimum as soon as anything moves. The wait and done calls
+        double as the wake and park hooks of fan_perf.h. The bay
+        sensor bus ticks along but the batch does not wait for it.
+---------------------------------------------------------------*/
+#define SCHED_PERIOD_MIN_MS     2000
+#define SCHED_PERIOD_MAX_MS     16000
+
+#define SCHED_DELTA_TCELL       0.2     // ℃ per tick
+#define SCHED_DELTA_CURRENT     30      // mA per tick
+#define SCHED_DELTA_DUTY        0.02    // Duty per tick
+
+#define SCHED_TEMP_TICK         BIT0
+#define SCHED_ADC_TICK          BIT1
+#define SCHED_TEMP_DONE         BIT2
+#define SCHED_ADC_DONE          BIT3
+#define SCHED_BUS_TICK          BIT4
+#define SCHED_BUS_DONE          BIT5
+
+esp_err_t fan_sched_init(void);
+// Block a sensor task until the next tick, then report its work done
+void fan_sched_wait(EventBits_t tick);
+void fan_sched_done(EventBits_t done);
+// Control side: block until every sensor task finished this tick
+void fan_sched_wait_batch(void);
+// Arm the next tick, settled lets the period grow. The first call ticks at once.
+esp_err_t fan_sched_next(bool settled);
+uint32_t fan_sched_period_ms(void);
+// EMA factor tuned for base_ms, rescaled to the current period
+q16_t fan_sched_factor(q16_t factor, uint32_t base_ms);
@@ -0,0 +1,449 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_bit_defs.h"
+#include "fan_hal.h"
+#include "fan_pwm.h"
+#include "fan_curve.h"
+#include "fan_tach.h"
+#include "fan_selftest.h"
+#include "fan_profile.h"
+#include "fan_fault.h"
+
+const static char *TAG = "Fan-Test";
+
+#define SELFTEST_LEDC_MAX   255     // Probe grid and cached count, 8 bits whatever the LEDC runs at
+#define SELFTEST_VERSION    1
+
+typedef struct {
+    uint8_t version;
+    int8_t pwm_gpio;        // Wiring the entry was measured on
+    int8_t tach_gpio;
+    uint8_t start_count;    // LEDC counts
+    uint16_t rpm_start;
+} selftest_rec_t;
+
+typedef struct {
+    int lo;                 // Highest count that did not break away
+    int hi;                 // Lowest count that did
+} selftest_bracket_t;
+
+typedef enum {
+    RETEST_IDLE,
+    RETEST_STILL,           // PWM stopped, waiting for standstill
+    RETEST_PROBE,           // Driven at count since since_us
+} retest_phase_t;
+
+// Re-test of one zone while the others are controlled, the same search a probe per tick
+typedef struct {
+    retest_phase_t phase;
+    bool coarse;            // Still stepping up
+    int count;
+    int base;               // Tach pulses when the probe began
+    selftest_bracket_t bracket;
+    int64_t since_us;       // Phase start
+    int64_t begin_us;
+    int64_t held_us;        // Last put off, 0 for never
+} selftest_retest_t;
+
+static fan_selftest_result_t selftest_results[FAN_ZONE_NUM];
+static int selftest_count[FAN_ZONE_NUM];    // Start threshold in LEDC counts
+static int selftest_strikes[FAN_ZONE_NUM];  // Consecutive ticks that did not match
+static int selftest_near[FAN_ZONE_NUM];     // Consecutive ticks near the threshold, before the RPM is known
+static atomic_uint selftest_retest;         // Zones dropped by fan_selftest_invalidate(), any task
+static selftest_retest_t selftest_retests[FAN_ZONE_NUM];    // Control task only
+
+static void selftest_key(int zone, char *key, size_t len)
+{
+    snprintf(key, len, "test%d", zone);
+}
+
+static esp_err_t selftest_load(int zone)
+{
+    const fan_zone_t *z = &fan_zones[zone];
+    selftest_rec_t rec;
+    char key[16];
+
+    selftest_key(zone, key, sizeof(key));
+    ESP_RETURN_ON_ERROR(fan_hal_store_get(key, &rec, sizeof(rec)), TAG, "%s: no cached self-test", z->name);
+    if (rec.version != SELFTEST_VERSION || rec.pwm_gpio != z->pwm_gpio || rec.tach_gpio != z->tach_gpio) {
+        ESP_LOGW(TAG, "%s: cached self-test is for other wiring", z->name);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    selftest_count[zone] = rec.start_count;
+    selftest_results[zone].start_duty = q16_from_int(rec.start_count) / SELFTEST_LEDC_MAX;
+    selftest_results[zone].rpm_start = rec.rpm_start;
+    selftest_results[zone].ok = true;
+    selftest_results[zone].cached = true;
+    return ESP_OK;
+}
+
+static esp_err_t selftest_save(int zone)
+{
+    const fan_zone_t *z = &fan_zones[zone];
+    selftest_rec_t rec = {
+        .version = SELFTEST_VERSION,
+        .pwm_gpio = z->pwm_gpio,
+        .tach_gpio = z->tach_gpio,
+        .start_count = selftest_count[zone],
+        .rpm_start = selftest_results[zone].rpm_start,
+    };
+    char key[16];
+
+    selftest_key(zone, key, sizeof(key));
+    return fan_hal_store_set(key, &rec, sizeof(rec));
+}
+
+static void selftest_pwm_stop(uint32_t mask)
+{
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        if (mask & BIT(zone)) {
+            fan_pwm_stop(zone);
+        }
+    }
+}
+
+// PWM already stopped, since is the earliest a fan may count as still.
+// Returns the zones that kept turning, they cannot be tested.
+static uint32_t selftest_wait_still(uint32_t mask, int64_t since_us)
+{
+    int64_t begin_us = fan_hal_now_us();
+
+    while (1) {
+        int64_t now_us = fan_hal_now_us();
+        uint32_t moving = 0;
+
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            int64_t last_us = fan_tach_last_event_us(zone);
+            if (last_us < since_us) {
+                last_us = since_us;
+            }
+            if ((mask & BIT(zone)) && now_us - last_us < FAN_SELFTEST_STILL_MS * 1000LL) {
+                moving |= BIT(zone);
+            }
+        }
+        if (moving == 0) {
+            return 0;
+        }
+        if (now_us - begin_us > FAN_SELFTEST_STOP_MS * 1000LL) {
+            ESP_LOGE(TAG, "Fans 0x%x keep turning with the PWM stopped", (unsigned)moving);
+            return moving;
+        }
+        fan_hal_delay_ms(FAN_SELFTEST_POLL_MS);
+    }
+}
+
+// Drive each zone of the mask at its count, returns the zones that broke away.
+// A fan is stopped as soon as it proved the start, the others when the probe ends.
+static uint32_t selftest_probe(uint32_t mask, const int count[FAN_ZONE_NUM])
+{
+    int64_t begin_us = fan_hal_now_us();
+    int base[FAN_ZONE_NUM];
+    uint32_t started = 0;
+
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        if (mask & BIT(zone)) {
+            base[zone] = fan_tach_pulses(zone);
+            fan_pwm_jump(zone, q16_from_int(count[zone]) / SELFTEST_LEDC_MAX);
+        }
+    }
+    fan_hal_led_set(1);
+    while (started != mask && fan_hal_now_us() - begin_us < FAN_SELFTEST_PROBE_MS * 1000LL) {
+        fan_hal_delay_ms(FAN_SELFTEST_POLL_MS);
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            if ((mask & BIT(zone)) && fan_tach_last_event_us(zone) > begin_us
+             && fan_tach_pulses(zone) - base[zone] >= FAN_SELFTEST_EVENTS * FAN_HAL_TACH_WATCH) {
+                fan_pwm_stop(zone);
+                started |= BIT(zone);
+            }
+        }
+    }
+    fan_hal_led_set(0);
+    selftest_pwm_stop(mask);
+    return started;
+}
+
+// Result of a finished search, ok with the threshold in count; the fan is left off
+static esp_err_t selftest_finish(int zone, bool ok, int count)
+{
+    fan_selftest_result_t *r = &selftest_results[zone];
+
+    selftest_strikes[zone] = 0;
+    selftest_near[zone] = 0;
+    r->rpm_start = 0;
+    r->cached = false;
+    r->ok = ok;
+    if (r->ok) {
+        selftest_count[zone] = count;
+        r->start_duty = q16_from_int(selftest_count[zone]) / SELFTEST_LEDC_MAX;
+        ESP_LOGI(TAG, "%s: Startup duty cycle detected at: %d%%", fan_zones[zone].name,
+                 selftest_count[zone] * 100 / SELFTEST_LEDC_MAX);
+        if (selftest_save(zone) != ESP_OK) {
+            ESP_LOGW(TAG, "%s: self-test not cached", fan_zones[zone].name);
+        }
+    } else {
+        r->start_duty = fan_tuning()->curve[zone].start_duty;
+        ESP_LOGE(TAG, "%s: Fan Self-testing fail due to missing FG signal!", fan_zones[zone].name);
+        fan_fault_raise(FAN_FAULT_STALL, zone);
+    }
+    return fan_tach_stop(zone);
+}
+
+esp_err_t fan_selftest_run(uint32_t mask)
+{
+    selftest_bracket_t bracket[FAN_ZONE_NUM];
+    int count[FAN_ZONE_NUM];
+    int64_t begin_us = fan_hal_now_us();
+    uint32_t pending = mask;
+    uint32_t found = 0;
+
+    ESP_LOGI(TAG, "Fan Self-testing processing...");
+    atomic_fetch_and(&selftest_retest, ~mask);
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        if ((mask & BIT(zone)) && !fan_tach_running(zone)) {
+            ESP_RETURN_ON_ERROR(fan_tach_start(zone), TAG, "tach start failed");
+        }
+    }
+    selftest_pwm_stop(mask);
+    ESP_LOGI(TAG, "waiting for Fan stop rotation...");
+    pending &= ~selftest_wait_still(mask, begin_us);
+
+    //-------------Coarse: step up until each fan breaks away, a fan that stays still needs no spin-down---------------//
+    for (int c = FAN_SELFTEST_COARSE; pending != 0 && c <= (int)(FAN_SELFTEST_UPER * SELFTEST_LEDC_MAX); c += FAN_SELFTEST_COARSE) {
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            count[zone] = c;
+        }
+        uint32_t started = selftest_probe(pending, count);
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            if (started & BIT(zone)) {
+                bracket[zone].lo = c - FAN_SELFTEST_COARSE;
+                bracket[zone].hi = c;
+            }
+        }
+        pending &= ~started;
+        found |= started;
+    }
+
+    //-------------Fine: bisect the bracket, every probe from standstill---------------//
+    while (1) {
+        uint32_t open = 0;
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            if ((found & BIT(zone)) && bracket[zone].hi - bracket[zone].lo > FAN_SELFTEST_FINE) {
+                open |= BIT(zone);
+                count[zone] = (bracket[zone].lo + bracket[zone].hi) / 2;
+            }
+        }
+        if (open == 0) {
+            break;
+        }
+        uint32_t moving = selftest_wait_still(open, 0);
+        found &= ~moving;
+        open &= ~moving;
+        uint32_t started = selftest_probe(open, count);
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+            if (started & BIT(zone)) {
+                bracket[zone].hi = count[zone];
+            } else if (open & BIT(zone)) {
+                bracket[zone].lo = count[zone];
+            }
+        }
+    }
+
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        if (mask & BIT(zone)) {
+            ESP_RETURN_ON_ERROR(selftest_finish(zone, found & BIT(zone), bracket[zone].hi), TAG, "tach stop failed");
+        }
+    }
+    ESP_LOGI(TAG, "Self-test of 0x%x took %dms", (unsigned)mask, (int)((fan_hal_now_us() - begin_us) / 1000));
+    return ESP_OK;
+}
+
+esp_err_t fan_selftest_boot(void)
+{
+    uint32_t mask = 0;
+
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        if (FAN_SELFTEST_FORCE || selftest_load(zone) != ESP_OK) {
+            mask |= BIT(zone);
+            continue;
+        }
+        fan_pwm_stop(zone);
+        ESP_LOGI(TAG, "%s: Startup duty cycle %d%% from cache, %d RPM there", fan_zones[zone].name,
+                 q16_to_scaled(selftest_results[zone].start_duty, 100), selftest_results[zone].rpm_start);
+    }
+    return mask ? fan_selftest_run(mask) : ESP_OK;
+}
+
+const fan_selftest_result_t *fan_selftest_result(int zone)
+{
+    return &selftest_results[zone];
+}
+
+esp_err_t fan_selftest_invalidate(int zone)
+{
+    char key[16];
+
+    selftest_key(zone, key, sizeof(key));
+    selftest_results[zone].cached = false;
+    atomic_fetch_or(&selftest_retest, BIT(zone));
+    return fan_hal_store_erase(key);
+}
+
+bool fan_selftest_observe(int zone, q16_t duty, int rpm, bool stalled)
+{
+    fan_selftest_result_t *r = &selftest_results[zone];
+    bool near = !stalled && rpm > 0 && abs(duty - r->start_duty) <= Q16(FAN_SELFTEST_NEAR);
+    bool mismatch;
+
+    //-------------Dropped from the console: test again now rather than at the next boot---------------//
+    if (atomic_load(&selftest_retest) & BIT(zone)) {
+        selftest_strikes[zone] = 0;
+        return true;
+    }
+    if (!r->ok) {
+        return false;
+    }
+    //-------------First steady ticks near the threshold complete the entry---------------//
+    if (r->rpm_start == 0) {
+        selftest_near[zone] = near ? selftest_near[zone] + 1 : 0;
+        if (selftest_near[zone] >= FAN_SELFTEST_STRIKES) {
+            r->rpm_start = rpm;
+            ESP_LOGI(TAG, "%s: %d RPM at the start duty %d%%", fan_zones[zone].name, rpm, q16_to_scaled(duty, 100));
+            if (selftest_save(zone) != ESP_OK) {
+                ESP_LOGW(TAG, "%s: self-test not cached", fan_zones[zone].name);
+            }
+        }
+    }
+    if (stalled) {
+        mismatch = duty >= r->start_duty;   // No longer breaks away at the threshold
+    } else if (near && r->rpm_start != 0) {
+        mismatch = abs(rpm - r->rpm_start) > r->rpm_start * FAN_SELFTEST_RPM_TOL;
+    } else {
+        mismatch = false;
+    }
+    selftest_strikes[zone] = mismatch ? selftest_strikes[zone] + 1 : 0;
+    if (selftest_strikes[zone] < FAN_SELFTEST_STRIKES) {
+        return false;
+    }
+    ESP_LOGW(TAG, "%s: fan no longer matches its self-test (%d RPM at %d%%, cached %d RPM at %d%%)", fan_zones[zone].name,
+             rpm, q16_to_scaled(duty, 100), r->rpm_start, q16_to_scaled(r->start_duty, 100));
+    selftest_strikes[zone] = 0;
+    fan_selftest_invalidate(zone);
+    return true;
+}
+
+/*---------------------------------------------------------------
+        Re-test while controlling, a probe per tick
+---------------------------------------------------------------*/
+static void retest_probe(int zone, selftest_retest_t *t, int64_t now_us)
+{
+    t->base = fan_tach_pulses(zone);
+    fan_pwm_jump(zone, q16_from_int(t->count) / SELFTEST_LEDC_MAX);
+    t->phase = RETEST_PROBE;
+    t->since_us = now_us;
+}
+
+static void retest_still(int zone, selftest_retest_t *t, int64_t now_us)
+{
+    fan_pwm_stop(zone);
+    t->phase = RETEST_STILL;
+    t->since_us = now_us;
+}
+
+// The search ended, ok or not the result is in and the fan is left off
+static fan_selftest_step_t retest_done(int zone, selftest_retest_t *t, bool ok)
+{
+    fan_pwm_stop(zone);
+    t->phase = RETEST_IDLE;
+    if (selftest_finish(zone, ok, t->bracket.hi) != ESP_OK) {
+        ESP_LOGW(TAG, "%s: tach stop failed", fan_zones[zone].name);
+    }
+    ESP_LOGI(TAG, "%s: re-test took %dms", fan_zones[zone].name, (int)((fan_hal_now_us() - t->begin_us) / 1000));
+    return FAN_SELFTEST_DONE;
+}
+
+fan_selftest_step_t fan_selftest_step(int zone, bool start, bool hold)
+{
+    selftest_retest_t *t = &selftest_retests[zone];
+    int64_t now_us = fan_hal_now_us();
+
+    if (t->phase == RETEST_IDLE) {
+        if (!start || hold || !(atomic_load(&selftest_retest) & BIT(zone))
+         || (t->held_us != 0 && now_us - t->held_us < FAN_SELFTEST_RETRY_MS * 1000LL)) {
+            return FAN_SELFTEST_IDLE;
+        }
+        //-------------Same search as at boot: stop, step up until it breaks away, bisect from standstill---------------//
+        atomic_fetch_and(&selftest_retest, ~BIT(zone));
+        if (!fan_tach_running(zone) && fan_tach_start(zone) != ESP_OK) {
+            return retest_done(zone, t, false);
+        }
+        t->coarse = true;
+        t->count = FAN_SELFTEST_COARSE;
+        t->begin_us = now_us;
+        retest_still(zone, t, now_us);
+        ESP_LOGI(TAG, "%s: re-test, a probe per tick", fan_zones[zone].name);
+        return FAN_SELFTEST_BUSY;
+    }
+    //-------------The cage needs its fan or a fault is open: give it back, test again later---------------//
+    if (hold) {
+        fan_pwm_stop(zone);
+        fan_tach_stop(zone);
+        t->phase = RETEST_IDLE;
+        t->held_us = now_us;
+        atomic_fetch_or(&selftest_retest, BIT(zone));
+        ESP_LOGW(TAG, "%s: re-test put off for %d min, the cage needs its fan", fan_zones[zone].name,
+                 FAN_SELFTEST_RETRY_MS / 60000);
+        return FAN_SELFTEST_ABORTED;
+    }
+
+    if (t->phase == RETEST_STILL) {
+        int64_t last_us = fan_tach_last_event_us(zone);
+        if (last_us < t->since_us) {
+            last_us = t->since_us;
+        }
+        if (now_us - last_us >= FAN_SELFTEST_STILL_MS * 1000LL) {
+            retest_probe(zone, t, now_us);
+        } else if (now_us - t->since_us > FAN_SELFTEST_STOP_MS * 1000LL) {
+            ESP_LOGE(TAG, "%s: fan keeps turning with the PWM stopped", fan_zones[zone].name);
+            return retest_done(zone, t, false);
+        }
+        return FAN_SELFTEST_BUSY;
+    }
+
+    //-------------Probe: proved a start, or the probe time ran out---------------//
+    bool started = fan_tach_last_event_us(zone) > t->since_us
+                && fan_tach_pulses(zone) - t->base >= FAN_SELFTEST_EVENTS * FAN_HAL_TACH_WATCH;
+    if (!started && now_us - t->since_us < FAN_SELFTEST_PROBE_MS * 1000LL) {
+        return FAN_SELFTEST_BUSY;
+    }
+    if (t->coarse) {
+        if (started) {
+            t->coarse = false;
+            t->bracket.lo = t->count - FAN_SELFTEST_COARSE;
+            t->bracket.hi = t->count;
+        } else if (t->count + FAN_SELFTEST_COARSE > (int)(FAN_SELFTEST_UPER * SELFTEST_LEDC_MAX)) {
+            return retest_done(zone, t, false);
+        } else {
+            //-------------Still standing, the next step right away---------------//
+            t->count += FAN_SELFTEST_COARSE;
+            retest_probe(zone, t, now_us);
+            return FAN_SELFTEST_BUSY;
+        }
+    } else if (started) {
+        t->bracket.hi = t->count;
+    } else {
+        t->bracket.lo = t->count;
+    }
+    if (t->bracket.hi - t->bracket.lo <= FAN_SELFTEST_FINE) {
+        return retest_done(zone, t, true);
+    }
+    t->count = (t->bracket.lo + t->bracket.hi) / 2;
+    retest_still(zone, t, now_us);
+    return FAN_SELFTEST_BUSY;
+}
@@ -0,0 +1,85 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "fan_fixed.h"
+
+/*---------------------------------------------------------------
+        Fan self-test Macros
+
+        The start threshold is the lowest duty that breaks a fan away
+        from standstill. A coarse upward sweep brackets it without
+        stopping any fan, a binary search from standstill narrows the
+        bracket to FAN_SELFTEST_FINE counts. A probe ends on the
+        second PCNT watch event (one may come from a fan coasting
+        out) or after FAN_SELFTEST_PROBE_MS. All zones are searched
+        together and a fan is stopped as soon as it proves a start,
+        spin-down dominates the test time.
+
+        Threshold and wiring are cached in NVS, a warm boot with a
+        valid entry skips the test for that zone. The RPM the fan
+        holds near its threshold joins the entry the first time
+        control keeps it there; a fan that stops matching either is
+        tested again.
+
+        That re-test runs inside the control loop: the same search,
+        one standstill check or probe per tick, while the other zones
+        keep their control. It starts only while the fan runs, the
+        demand is under FAN_CYCLE_URGENT and no fault is open or
+        pending; when one of these comes up it is put off, the fan
+        goes back to control on the old threshold and the test starts
+        over once the cage is quiet again, FAN_SELFTEST_RETRY_MS later
+        at the earliest so a demand around the limit does not cycle
+        the fan.
+---------------------------------------------------------------*/
+#define FAN_SELFTEST_FORCE      0       // Ignore the cache, test on every boot
+#define FAN_SELFTEST_COARSE     16      // LEDC counts per coarse step, up to FAN_SELFTEST_UPER
+#define FAN_SELFTEST_FINE       4       // Bisect down to this bracket, the upper end is the result
+#define FAN_SELFTEST_PROBE_MS   1500    // A fan at its threshold turns 4 times within this
+#define FAN_SELFTEST_EVENTS     2       // Watch events that prove a start
+#define FAN_SELFTEST_POLL_MS    50
+#define FAN_SELFTEST_STILL_MS   1000    // No watch event for this long is standstill (< 60 RPM)
+#define FAN_SELFTEST_STOP_MS    15000   // Give up waiting for standstill
+
+// Cache checks while controlling
+#define FAN_SELFTEST_NEAR       0.03    // RPM taken or compared when the duty is this close to the threshold
+#define FAN_SELFTEST_RPM_TOL    0.35    // Mismatch beyond this fraction of the cached RPM
+#define FAN_SELFTEST_STRIKES    3       // Consecutive ticks before the RPM is taken or a mismatch counts
+#define FAN_SELFTEST_RETRY_MS   (10 * 60 * 1000)    // A re-test put off waits this long
+
+// What the control task does with the zone this tick
+typedef enum {
+    FAN_SELFTEST_IDLE,      // No re-test, control the fan
+    FAN_SELFTEST_BUSY,      // The re-test drives the fan, leave it alone
+    FAN_SELFTEST_DONE,      // Finished, fan off on the new result
+    FAN_SELFTEST_ABORTED,   // Put off, fan off on the old result, tried again later
+} fan_selftest_step_t;
+
+typedef struct {
+    q16_t start_duty;   // Curve start duty when the test failed
+    int rpm_start;      // Held near the start duty, 0 until control kept the fan there
+    bool ok;            // Measured or cached, not the curve fallback
+    bool cached;        // Loaded from NVS, not measured this boot
+} fan_selftest_result_t;
+
+// Load the cache and test the zones without a valid entry, fans are left off
+esp_err_t fan_selftest_boot(void);
+// Test the zones in the mask now and cache the results, fans are left off. Blocks for
+// seconds, before control starts only.
+esp_err_t fan_selftest_run(uint32_t mask);
+const fan_selftest_result_t *fan_selftest_result(int zone);
+// Drop the cached entry, any task. The zone is tested again the next tick its fan runs, or at the next boot.
+esp_err_t fan_selftest_invalidate(int zone);
+// Called every tick the fan is on, with the duty it ran at since the last tick. Takes the
+// RPM near the threshold once; true when the fan no longer matches for FAN_SELFTEST_STRIKES
+// ticks in a row, the entry is then dropped and fan_selftest_step() re-tests. Also true once
+// the entry was dropped by fan_selftest_invalidate().
+bool fan_selftest_observe(int zone, q16_t duty, int rpm, bool stalled);
+// Control task, once per zone and tick. A dropped entry is re-tested when start (the fan
+// runs and is not stalled) and not hold (urgent demand or a fault); hold puts a running
+// re-test off.
+fan_selftest_step_t fan_selftest_step(int zone, bool start, bool hold);
@@ -0,0 +1,160 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "fan_hal.h"
+#include "fan_tach.h"
+#include "fan_perf.h"
+
+const static char *TAG = "Fan-Tach";
+
+// Edges * 60s / edges per revolution, over a period in us
+#define TACH_RPM_US(edges)  ((int64_t)(edges) * 60000000LL / FAN_TACH_PULSE_REV)
+#define TACH_PERF_EVERY     16      // Time one watch event in this many for fan_perf.h
+
+typedef struct {
+    int64_t period_us[FAN_TACH_AVG_N];
+    int periods;            // Valid entries, up to FAN_TACH_AVG_N
+    int head;
+    int64_t last_us;        // Latest watch event, 0 before the first one
+    int64_t start_us;
+    uint32_t events;
+    bool running;
+} tach_zone_t;
+
+static portMUX_TYPE tach_lock = portMUX_INITIALIZER_UNLOCKED;
+static tach_zone_t tach_zones[FAN_ZONE_NUM];
+
+static void IRAM_ATTR tach_watch_cb(int64_t stamp_us, void *arg)
+{
+    tach_zone_t *t = arg;
+    bool timed = ++t->events % TACH_PERF_EVERY == 0;
+    uint32_t start = timed ? fan_hal_bench_now() : 0;
+
+    portENTER_CRITICAL_SAFE(&tach_lock);
+    if (t->last_us != 0) {
+        t->period_us[t->head] = stamp_us - t->last_us;
+        t->head = (t->head + 1) % FAN_TACH_AVG_N;
+        if (t->periods < FAN_TACH_AVG_N) {
+            t->periods++;
+        }
+    }
+    t->last_us = stamp_us;
+    portEXIT_CRITICAL_SAFE(&tach_lock);
+    if (timed) {
+        fan_perf_add(FAN_PERF_TACH_ISR, fan_hal_bench_now() - start);
+    }
+}
+
+esp_err_t fan_tach_init(void)
+{
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        ESP_RETURN_ON_ERROR(fan_hal_tach_init(zone), TAG, "tach init failed");
+        ESP_RETURN_ON_ERROR(fan_hal_tach_watch(zone, tach_watch_cb, &tach_zones[zone]), TAG, "tach watch failed");
+    }
+    return ESP_OK;
+}
+
+esp_err_t fan_tach_start(int zone)
+{
+    tach_zone_t *t = &tach_zones[zone];
+
+    if (t->running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ESP_RETURN_ON_ERROR(fan_hal_tach_enable(zone), TAG, "tach enable failed");
+    ESP_RETURN_ON_ERROR(fan_hal_tach_clear(zone), TAG, "tach clear failed");
+    portENTER_CRITICAL(&tach_lock);
+    t->periods = 0;
+    t->head = 0;
+    t->last_us = 0;
+    t->start_us = fan_hal_now_us();
+    t->running = true;
+    portEXIT_CRITICAL(&tach_lock);
+    return fan_hal_tach_start(zone);
+}
+
+esp_err_t fan_tach_stop(int zone)
+{
+    if (!tach_zones[zone].running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    tach_zones[zone].running = false;
+    return fan_hal_tach_disable(zone);
+}
+
+bool fan_tach_running(int zone)
+{
+    return tach_zones[zone].running;
+}
+
+static int tach_rpm(int zone, int n)
+{
+    tach_zone_t *t = &tach_zones[zone];
+    int64_t sum_us = 0;
+    int64_t idle_us;
+
+    portENTER_CRITICAL(&tach_lock);
+    if (n > t->periods) {
+        n = t->periods;
+    }
+    for (int i = 1; i <= n; i++) {
+        sum_us += t->period_us[(t->head + FAN_TACH_AVG_N - i) % FAN_TACH_AVG_N];
+    }
+    idle_us = fan_hal_now_us() - t->last_us;
+    portEXIT_CRITICAL(&tach_lock);
+
+    if (!t->running || n == 0 || idle_us > FAN_TACH_TIMEOUT_MS * 1000LL) {
+        return 0;
+    }
+    int rpm = (int)(TACH_RPM_US(n * FAN_HAL_TACH_WATCH) / sum_us);
+    // The next event is overdue, the fan turns at most this fast
+    if (idle_us > 0) {
+        int bound = (int)(TACH_RPM_US(FAN_HAL_TACH_WATCH) / idle_us);
+        if (bound < rpm) {
+            rpm = bound;
+        }
+    }
+    return rpm;
+}
+
+int fan_tach_rpm(int zone)
+{
+    return tach_rpm(zone, 1);
+}
+
+int fan_tach_rpm_avg(int zone)
+{
+    return tach_rpm(zone, FAN_TACH_AVG_N);
+}
+
+bool fan_tach_stalled(int zone)
+{
+    return tach_zones[zone].running
+        && fan_hal_now_us() - tach_zones[zone].start_us >= FAN_TACH_TIMEOUT_MS * 1000LL
+        && fan_tach_rpm(zone) < FAN_TACH_STALL_RPM;
+}
+
+int64_t fan_tach_last_event_us(int zone)
+{
+    int64_t last_us;
+
+    portENTER_CRITICAL(&tach_lock);
+    last_us = tach_zones[zone].last_us;
+    portEXIT_CRITICAL(&tach_lock);
+    return last_us;
+}
+
+int fan_tach_pulses(int zone)
+{
+    int count = 0;
+
+    if (tach_zones[zone].running) {
+        fan_hal_tach_get_count(zone, &count);
+    }
+    return count;
+}
@@ -0,0 +1,38 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/*---------------------------------------------------------------
+        Tach engine Macros
+
+        The PCNT watch event fires every FAN_HAL_TACH_WATCH edges and
+        is timestamped in the ISR, RPM comes from the period between
+        two events. Readers never wait for edges: without a new event
+        the RPM decays to the bound the elapsed time still allows.
+---------------------------------------------------------------*/
+#define FAN_TACH_PULSE_REV      2       // FG edges per revolution
+#define FAN_TACH_AVG_N          8       // Watch periods in the rolling average
+#define FAN_TACH_TIMEOUT_MS     2000    // No event for this long reads as 0 RPM
+#define FAN_TACH_STALL_RPM      180     // 12 pulses in 2s of the former fixed window
+
+esp_err_t fan_tach_init(void);  // Every zone of fan_zones[]
+// Enable, clear and start the counter, measurement restarts from scratch
+esp_err_t fan_tach_start(int zone);
+esp_err_t fan_tach_stop(int zone);
+bool fan_tach_running(int zone);
+
+// Latest watch period, bounded by the time since the last event
+int fan_tach_rpm(int zone);
+// Over the last FAN_TACH_AVG_N watch periods, same bound
+int fan_tach_rpm_avg(int zone);
+// Started at least FAN_TACH_TIMEOUT_MS ago and below FAN_TACH_STALL_RPM
+bool fan_tach_stalled(int zone);
+// Stamp of the latest watch event, 0 when none arrived since the last start
+int64_t fan_tach_last_event_us(int zone);
+// Edges since the last start
+int fan_tach_pulses(int zone);
@@ -0,0 +1,262 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "fan_hal.h"
+#include "fan_telem.h"
+
+const static char *TAG = "Fan-Telem";
+
+#define TELEM_PACKET_MAX    (FAN_TELEM_HDR_LEN + FAN_TELEM_BATCH * sizeof(fan_telem_rec_t) + FAN_TELEM_CRC_LEN)
+#define TELEM_SELFTEST_N    2000
+#define TELEM_INIT_N        16      // Text records formatted at init for the statistics
+
+_Static_assert(sizeof(fan_telem_rec_t) == 30, "fan_telem_rec_t layout is shared with tools/fan_telem.py");
+
+static fan_telem_rec_t telem_ring[FAN_TELEM_RING];
+static int telem_head;              // Oldest record
+static int telem_count;
+static uint16_t telem_seq;
+static uint16_t telem_dropped;      // Since the last packet
+static uint8_t telem_packet[TELEM_PACKET_MAX];
+
+//-------------Statistics since boot---------------//
+static uint32_t telem_records;
+static uint32_t telem_packets;
+static uint32_t telem_lost;
+static uint64_t telem_bytes;
+static uint64_t telem_cost;         // FAN_HAL_BENCH_UNIT in record and packet building, UART excluded
+static uint32_t telem_text_bytes;   // Per record, measured by fan_telem_init()
+static uint32_t telem_text_cost;    // FAN_HAL_BENCH_UNIT per record as text, measured by fan_telem_init()
+static int64_t telem_start_us;
+static int64_t telem_stats_us;
+
+static int16_t telem_temp(q16_t c)
+{
+    return (int16_t)q16_clamp(c >> 8, INT16_MIN, INT16_MAX);
+}
+
+static uint16_t telem_uint(q16_t v)
+{
+    return (uint16_t)q16_clamp(Q16_INT(v), 0, UINT16_MAX);
+}
+
+static uint16_t telem_duty(q16_t d)
+{
+    return (uint16_t)q16_clamp(d, 0, UINT16_MAX);
+}
+
+static void telem_pack(fan_telem_rec_t *rec, int zone, const fan_telem_sample_t *s, uint32_t ms)
+{
+    rec->ms = ms;
+    rec->zone = zone;
+    rec->flags = s->flags;
+    rec->tsens = telem_temp(s->tsens);
+    rec->troom = telem_temp(s->troom);
+    rec->ntc_mv = telem_uint(s->ntc_mv);
+    rec->tcell = telem_temp(s->tcell);
+    rec->current_mv = telem_uint(s->current_mv);
+    rec->current = telem_uint(s->current);
+    rec->tdc = telem_duty(s->tdc);
+    rec->idc = telem_duty(s->idc);
+    rec->duty = telem_duty(s->duty);
+    rec->duty_out = telem_duty(s->duty_out);
+    rec->rpm = s->rpm < 0 ? 0 : (s->rpm > UINT16_MAX ? UINT16_MAX : s->rpm);
+    rec->target = s->target < 0 ? 0 : (s->target > UINT16_MAX ? UINT16_MAX : s->target);
+}
+
+static void telem_put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+// Header of a packet, returns where its records go
+static uint8_t *telem_frame(uint8_t *p, uint8_t sync1, uint8_t version, int count, uint16_t seq, uint16_t dropped)
+{
+    p[0] = FAN_TELEM_SYNC0;
+    p[1] = sync1;
+    p[2] = version;
+    p[3] = count;
+    telem_put16(&p[4], seq);
+    telem_put16(&p[6], dropped);
+    return p + FAN_TELEM_HDR_LEN;
+}
+
+// CRC behind the records at end, returns the packet length
+static size_t telem_seal(uint8_t *packet, uint8_t *end)
+{
+    uint32_t crc = esp_rom_crc32_le(0, packet, end - packet);
+    telem_put16(end, crc & 0xffff);
+    telem_put16(end + 2, crc >> 16);
+    return end + FAN_TELEM_CRC_LEN - packet;
+}
+
+// Oldest count records of the ring as one packet, returns its length
+static size_t telem_build(int count)
+{
+    uint8_t *p = telem_frame(telem_packet, FAN_TELEM_SYNC1, FAN_TELEM_VERSION, count, telem_seq, telem_dropped);
+
+    for (int i = 0; i < count; i++) {
+        memcpy(p, &telem_ring[(telem_head + i) % FAN_TELEM_RING], sizeof(fan_telem_rec_t));
+        p += sizeof(fan_telem_rec_t);
+    }
+    return telem_seal(telem_packet, p);
+}
+
+size_t fan_telem_packet(uint8_t *out, uint8_t sync1, uint8_t version, uint16_t seq, uint16_t dropped,
+                        const void *recs, int count, size_t rec_len)
+{
+    uint8_t *p = telem_frame(out, sync1, version, count, seq, dropped);
+
+    memcpy(p, recs, count * rec_len);
+    return telem_seal(out, p + count * rec_len);
+}
+
+// Send whole batches, or everything when flush. A failed write keeps the records for the next tick.
+static void telem_drain(bool flush, uint32_t *cost)
+{
+    while (telem_count >= FAN_TELEM_BATCH || (flush && telem_count > 0)) {
+        int count = telem_count < FAN_TELEM_BATCH ? telem_count : FAN_TELEM_BATCH;
+        uint32_t start = fan_hal_bench_now();
+        size_t len = telem_build(count);
+        *cost += fan_hal_bench_now() - start;
+        if (fan_hal_telem_write(telem_packet, len) != ESP_OK) {
+            return;
+        }
+        telem_head = (telem_head + count) % FAN_TELEM_RING;
+        telem_count -= count;
+        telem_seq++;
+        telem_dropped = 0;
+        telem_packets++;
+        telem_bytes += len;
+    }
+}
+
+/*---------------------------------------------------------------
+        Record against text, same sample both ways
+---------------------------------------------------------------*/
+// The three INFO lines app_main prints per zone and tick, with the esp_log prefix
+static int telem_text(char *buf, size_t len, const char *name, const fan_telem_sample_t *s, uint32_t ms)
+{
+    int n = 0;
+
+    n += snprintf(buf + n, len - n, "I (%lu) Fan-CTL: %s: Room-T: " Q16_FMT1 "℃, Cell-T: " Q16_FMT1 "℃, Current: %dmA\n",
+                  (unsigned long)ms, name, Q16_DEC1(s->troom), Q16_DEC1(s->tcell), q16_to_scaled(s->current, 1));
+    n += snprintf(buf + n, len - n, "I (%lu) Fan-CTL: %s: T->duty: %d%%,I->duty: %d%% =>Merger: %d%%\n",
+                  (unsigned long)ms, name, q16_to_scaled(s->tdc, 100), q16_to_scaled(s->idc, 100),
+                  q16_to_scaled(s->duty, 100));
+    n += snprintf(buf + n, len - n, "I (%lu) Fan-CTL: %s: Duty: %d%%, RPM=%d (avg %d, target %d)\n",
+                  (unsigned long)ms, name, Q16_INT(s->duty_out * 100), s->rpm, s->rpm, s->target);
+    return n;
+}
+
+static const fan_telem_sample_t telem_ref_sample = {
+    .tsens = Q16(28.1), .troom = Q16(27.4), .ntc_mv = Q16(1482), .tcell = Q16(34.6),
+    .current_mv = Q16(1215), .current = Q16(1197), .tdc = Q16(0.38), .idc = Q16(0.52),
+    .duty = Q16(0.61), .duty_out = Q16(0.59), .rpm = 1712, .target = 1745,
+    .flags = FAN_TELEM_ON | FAN_TELEM_SETTLED,
+};
+
+// Formats the reference sample count times, returns the bytes per record and sets cost per record.
+// Formatting only; the UART then carries every byte.
+static uint32_t telem_text_measure(int count, uint32_t *cost)
+{
+    char text[384];
+    volatile int sink = 0;
+    uint32_t bytes = 0;
+
+    uint32_t start = fan_hal_bench_now();
+    for (int i = 0; i < count; i++) {
+        int n = telem_text(text, sizeof(text), "cage0", &telem_ref_sample, 3600000 + i * 2000);
+        bytes += n;
+        sink += text[n - 1];
+    }
+    *cost = (fan_hal_bench_now() - start) / count;
+    return bytes / count;
+}
+
+static void telem_stats(int64_t now_us)
+{
+    if (now_us - telem_stats_us < FAN_TELEM_STATS_MS * 1000LL) {
+        return;
+    }
+    telem_stats_us = now_us;
+    int64_t hours_x1000 = (now_us - telem_start_us) / 3600000;
+    if (hours_x1000 <= 0 || telem_records == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "%lu records in %lu packets, %lu lost: %lu B/h binary, %lu B/h as text, %lu %s per record (text %lu %s)",
+             (unsigned long)telem_records, (unsigned long)telem_packets, (unsigned long)telem_lost,
+             (unsigned long)(telem_bytes * 1000 / hours_x1000),
+             (unsigned long)((uint64_t)telem_records * telem_text_bytes * 1000 / hours_x1000),
+             (unsigned long)(telem_cost / telem_records), FAN_HAL_BENCH_UNIT,
+             (unsigned long)telem_text_cost, FAN_HAL_BENCH_UNIT);
+}
+
+esp_err_t fan_telem_init(void)
+{
+    telem_start_us = fan_hal_now_us();
+    telem_stats_us = telem_start_us;
+    telem_text_bytes = telem_text_measure(TELEM_INIT_N, &telem_text_cost);
+    if (!FAN_TELEM_BINARY) {
+        return ESP_OK;
+    }
+    return fan_hal_telem_init();
+}
+
+void fan_telem_record(int zone, const fan_telem_sample_t *sample)
+{
+    int64_t now_us = fan_hal_now_us();
+    uint32_t now_ms = (uint32_t)(now_us / 1000);
+
+    if (!FAN_TELEM_BINARY) {
+        return;
+    }
+    uint32_t start = fan_hal_bench_now();
+    if (telem_count == FAN_TELEM_RING) {
+        telem_head = (telem_head + 1) % FAN_TELEM_RING;
+        telem_count--;
+        telem_dropped++;
+        telem_lost++;
+    }
+    telem_pack(&telem_ring[(telem_head + telem_count) % FAN_TELEM_RING], zone, sample, now_ms);
+    telem_count++;
+    telem_records++;
+    uint32_t cost = fan_hal_bench_now() - start;
+
+    telem_drain(now_ms - telem_ring[telem_head].ms >= FAN_TELEM_FLUSH_MS, &cost);
+    telem_cost += cost;
+    telem_stats(now_us);
+}
+
+esp_err_t fan_telem_selftest(void)
+{
+    volatile int sink = 0;
+    fan_telem_rec_t rec;
+    uint32_t cost_text;
+    uint32_t text_bytes = telem_text_measure(TELEM_SELFTEST_N, &cost_text);
+
+    //-------------Binary, packing plus the share of header and CRC---------------//
+    uint32_t start = fan_hal_bench_now();
+    for (int i = 0; i < TELEM_SELFTEST_N; i++) {
+        telem_pack(&rec, 0, &telem_ref_sample, 3600000 + i * 2000);
+        memcpy(&telem_ring[i % FAN_TELEM_RING], &rec, sizeof(rec));
+        if (i % FAN_TELEM_BATCH == FAN_TELEM_BATCH - 1) {
+            sink += telem_build(FAN_TELEM_BATCH);
+        }
+    }
+    uint32_t cost_bin = (fan_hal_bench_now() - start) / TELEM_SELFTEST_N;
+    memset(telem_ring, 0, sizeof(telem_ring));
+
+    ESP_LOGI(TAG, "Per record: text %lu B in %lu %s, binary %u B in %lu %s (packet of %d: %u B)",
+             (unsigned long)text_bytes, (unsigned long)cost_text, FAN_HAL_BENCH_UNIT,
+             (unsigned)sizeof(fan_telem_rec_t), (unsigned long)cost_bin, FAN_HAL_BENCH_UNIT,
+             FAN_TELEM_BATCH, (unsigned)TELEM_PACKET_MAX);
+    return ESP_OK;
+}
@@ -0,0 +1,88 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "fan_fixed.h"
+
+/*---------------------------------------------------------------
+        Binary telemetry Macros
+
+        With FAN_TELEM_BINARY the per tick INFO text of the control
+        loop is muted and every zone of every tick becomes one fixed
+        size record in a RAM ring instead. Records leave in batches
+        as one packet:
+
+            sync 0xFA 0xCE, version, count, seq (u16), dropped (u16),
+            count records, CRC32 (esp_rom_crc32_le) of all before it
+
+        All fields little endian. tools/fan_telem.py resyncs on the
+        sync bytes, checks the CRC and writes CSV. The link stays
+        quiet between batches, so UART and CPU can sleep through most
+        ticks. The sensor trace of fan_trace.h rides the same link in
+        the same framing, told apart by its second sync byte.
+---------------------------------------------------------------*/
+#if CONFIG_IDF_TARGET_LINUX
+#define FAN_TELEM_BINARY        1
+#else
+#define FAN_TELEM_BINARY        0       // Set to 1 and decode the console with tools/fan_telem.py
+#endif
+#define FAN_TELEM_VERSION       1
+#define FAN_TELEM_SYNC0         0xFA
+#define FAN_TELEM_SYNC1         0xCE
+#define FAN_TELEM_RING          64      // Records, oldest dropped when the link falls behind
+#define FAN_TELEM_BATCH         32      // Records per packet
+#define FAN_TELEM_FLUSH_MS      (5 * 60 * 1000)     // Oldest record waits at most this long
+#define FAN_TELEM_STATS_MS      (6 * 3600 * 1000)
+#define FAN_TELEM_HDR_LEN       8
+#define FAN_TELEM_CRC_LEN       4
+
+// Record flags
+#define FAN_TELEM_ON            0x01    // Fan on after this tick
+#define FAN_TELEM_STALLED       0x02
+#define FAN_TELEM_SETTLED       0x04    // RPM in the band of its target
+#define FAN_TELEM_START         0x08    // Started this tick
+#define FAN_TELEM_STOP          0x10    // Stopped this tick
+#define FAN_TELEM_RETEST        0x20    // Self-test ran again this tick
+#define FAN_TELEM_SUSPECT       0x80    // A sensor diverges from the estimator model
+
+// Temperatures ℃/256, millivolts and milliamps whole, duties 1/65536 (0xFFFF is full)
+typedef struct __attribute__((packed)) {
+    uint32_t ms;            // Since boot
+    uint8_t zone;
+    uint8_t flags;
+    int16_t tsens;          // Die sensor as read
+    int16_t troom;          // Filtered, self heating removed
+    uint16_t ntc_mv;
+    int16_t tcell;
+    uint16_t current_mv;
+    uint16_t current;       // Filtered
+    uint16_t tdc;           // Temperature demand
+    uint16_t idc;           // Current demand
+    uint16_t duty;          // Fused demand
+    uint16_t duty_out;      // On the PWM
+    uint16_t rpm;           // Rolling average
+    uint16_t target;
+} fan_telem_rec_t;
+
+// What the control loop has at hand, converted in fan_telem_record()
+typedef struct {
+    q16_t tsens, troom, ntc_mv, tcell, current_mv, current;
+    q16_t tdc, idc, duty, duty_out;
+    int rpm, target;
+    uint8_t flags;
+} fan_telem_sample_t;
+
+esp_err_t fan_telem_init(void);
+// Control task only
+void fan_telem_record(int zone, const fan_telem_sample_t *sample);
+// Packet of another record stream on the same link, out holds FAN_TELEM_HDR_LEN + count * rec_len + FAN_TELEM_CRC_LEN
+size_t fan_telem_packet(uint8_t *out, uint8_t sync1, uint8_t version, uint16_t seq, uint16_t dropped,
+                        const void *recs, int count, size_t rec_len);
+// Time and size of a record against the INFO lines it replaces
+esp_err_t fan_telem_selftest(void);
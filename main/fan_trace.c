@@ -0,0 +1,114 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "fan_hal.h"
+#include "fan_tach.h"
+#include "fan_pwm.h"
+#include "fan_trace.h"
+
+const static char *TAG = "Fan-Trace";
+
+#define TRACE_PACKET_MAX    (FAN_TELEM_HDR_LEN + FAN_TRACE_BATCH * sizeof(fan_trace_rec_t) + FAN_TELEM_CRC_LEN)
+
+_Static_assert(sizeof(fan_trace_rec_t) == 16, "fan_trace_rec_t layout is shared with tools/fan_telem.py and fan_hal_sim.c");
+_Static_assert(!FAN_TRACE_CAPTURE || FAN_TELEM_BINARY, "FAN_TRACE_CAPTURE sends on the binary telemetry link");
+
+static fan_trace_rec_t trace_batch[FAN_TRACE_BATCH];
+static int trace_count;
+static uint16_t trace_seq;
+static uint16_t trace_dropped;      // Since the last packet
+static int trace_pulses[FAN_ZONE_NUM];
+static uint8_t trace_packet[TRACE_PACKET_MAX];
+
+//-------------Statistics since boot---------------//
+static uint32_t trace_records;
+static uint32_t trace_lost;
+static uint64_t trace_bytes;
+static uint64_t trace_cost;
+static int64_t trace_start_us;
+static int64_t trace_stats_us;
+
+static uint16_t trace_mv(q16_t mv)
+{
+    return (uint16_t)q16_clamp(mv >> 12, 0, UINT16_MAX);
+}
+
+// Edges since the record before; a restarted counter begins at 0 again
+static uint16_t trace_edges(int zone)
+{
+    int pulses = fan_tach_pulses(zone);
+    int edges = pulses >= trace_pulses[zone] ? pulses - trace_pulses[zone] : pulses;
+
+    trace_pulses[zone] = pulses;
+    return (uint16_t)(edges > UINT16_MAX ? UINT16_MAX : edges);
+}
+
+static void trace_stats(int64_t now_us)
+{
+    if (now_us - trace_stats_us < FAN_TELEM_STATS_MS * 1000LL) {
+        return;
+    }
+    trace_stats_us = now_us;
+    int64_t hours_x1000 = (now_us - trace_start_us) / 3600000;
+    if (hours_x1000 <= 0 || trace_records == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "%lu records, %lu lost: %lu B/h, %lu %s per record", (unsigned long)trace_records,
+             (unsigned long)trace_lost, (unsigned long)(trace_bytes * 1000 / hours_x1000),
+             (unsigned long)(trace_cost / trace_records), FAN_HAL_BENCH_UNIT);
+}
+
+esp_err_t fan_trace_init(void)
+{
+    if (!FAN_TRACE_CAPTURE) {
+        return ESP_OK;
+    }
+    trace_start_us = fan_hal_now_us();
+    trace_stats_us = trace_start_us;
+    ESP_LOGI(TAG, "Capturing every tick at the shortest period, %u B per zone and tick",
+             (unsigned)sizeof(fan_trace_rec_t));
+    return ESP_OK;
+}
+
+void fan_trace_record(int zone, const fan_frame_t *frame, uint8_t flags)
+{
+    int64_t now_us = fan_hal_now_us();
+
+    if (!FAN_TRACE_CAPTURE) {
+        return;
+    }
+    uint32_t start = fan_hal_bench_now();
+    fan_trace_rec_t *rec = &trace_batch[trace_count++];
+    rec->ms = (uint32_t)(now_us / 1000);
+    rec->zone = zone;
+    rec->flags = flags;
+    rec->ntc_mv = trace_mv(frame->field[FAN_FIELD_NTC_MV(zone)].value);
+    rec->current_mv = trace_mv(frame->field[FAN_FIELD_CURRENT_MV(zone)].value);
+    rec->tsens = (int16_t)q16_clamp(frame->field[FAN_FIELD_TSENS_RAW].value >> 8, INT16_MIN, INT16_MAX);
+    rec->pulses = trace_edges(zone);
+    rec->duty = (uint16_t)q16_clamp(fan_pwm_duty(zone), 0, UINT16_MAX);
+    trace_records++;
+
+    //-------------A full batch goes out at once, a failed write drops it: a trace has no use for late records---------------//
+    if (trace_count == FAN_TRACE_BATCH) {
+        size_t len = fan_telem_packet(trace_packet, FAN_TRACE_SYNC1, FAN_TRACE_VERSION, trace_seq, trace_dropped,
+                                      trace_batch, trace_count, sizeof(fan_trace_rec_t));
+        trace_cost += fan_hal_bench_now() - start;
+        if (fan_hal_telem_write(trace_packet, len) == ESP_OK) {
+            trace_dropped = 0;
+            trace_bytes += len;
+        } else {
+            trace_dropped += trace_count;
+            trace_lost += trace_count;
+        }
+        trace_seq++;
+        trace_count = 0;
+    } else {
+        trace_cost += fan_hal_bench_now() - start;
+    }
+    trace_stats(now_us);
+}
@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "fan_frame.h"
+#include "fan_telem.h"
+
+/*---------------------------------------------------------------
+        Sensor trace Macros
+
+        With FAN_TRACE_CAPTURE the control loop never stretches its
+        period (every tick comes SCHED_PERIOD_MIN_MS after the last)
+        and every zone of every tick records what the hardware gave
+        it, ahead of every filter and estimator: the block mean of
+        both ADC channels, the die sensor as read, the tach edges
+        counted since the tick before and the duty on the PWM output.
+        Records leave in packets of FAN_TRACE_BATCH on the telemetry
+        link, framed as in fan_telem.h with the second sync byte
+        FAN_TRACE_SYNC1, so the capture needs FAN_TELEM_BINARY.
+
+        tools/fan_telem.py --trace writes a capture as CSV. The
+        simulator replays one named by SIM_TRACE: open loop, the
+        recorded sensors through the firmware's filters and curves,
+        and closed loop, the recorded rail current and room driving
+        its cages while the firmware controls them. The run is scored
+        against a base run or what the recorded controller did
+        (fan_hal_sim.c, tools/fan_bench.py).
+---------------------------------------------------------------*/
+#define FAN_TRACE_CAPTURE       0       // Set to 1 with FAN_TELEM_BINARY and capture the UART
+#define FAN_TRACE_VERSION       1
+#define FAN_TRACE_SYNC1         0xCF
+#define FAN_TRACE_BATCH         32      // Records per packet, 8 ticks of 4 zones
+
+// Millivolts 1/16, temperature ℃/256, duty 1/65536 (0xFFFF is full)
+typedef struct __attribute__((packed)) {
+    uint32_t ms;            // Since boot
+    uint8_t zone;
+    uint8_t flags;          // FAN_TELEM_ON, FAN_TELEM_START, ... of the tick
+    uint16_t ntc_mv;
+    uint16_t current_mv;
+    int16_t tsens;
+    uint16_t pulses;        // Tach edges since the record before
+    uint16_t duty;          // On the PWM output as the record is taken
+} fan_trace_rec_t;
+
+esp_err_t fan_trace_init(void);
+// Control task, once per zone and tick after the PWM is set
+void fan_trace_record(int zone, const fan_frame_t *frame, uint8_t flags);
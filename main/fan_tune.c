@@ -0,0 +1,801 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_bit_defs.h"
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "fan_hal.h"
+#include "fan_zone.h"
+#include "fan_curve.h"
+#include "fan_profile.h"
+#include "fan_rpm.h"
+#include "fan_selftest.h"
+#include "fan_tune.h"
+
+const static char *TAG = "Fan-Tune";
+
+#define TUNE_PARAMS     4           // a, b, c, d of the linear model
+#define TUNE_GAP_MS     60000       // No sample for this long breaks the slope chain
+#define TUNE_SUBSTEPS   4           // Model steps per window, tau with the fan at full is ~800 s
+
+static const float tune_steps[] = FAN_TUNE_STEPS;
+#define TUNE_STEP_NUM   (int)(sizeof(tune_steps) / sizeof(tune_steps[0]))
+
+//-------------Search grid around the ceiling---------------//
+static const float tune_grid_tmax[] = { -5, -2.5, 0, 2.5, 5, 7.5, 10, 12.5, 15, 17.5, 20 };  // ℃ from the ceiling
+static const float tune_grid_span[] = { 10, 15, 20, 25, 30 };                               // t_max - t_zero
+static const float tune_grid_iscale[] = { 0.1, 0.25, 0.5, 0.75, 1.0, 1.5 };                 // Of the current i_scale
+
+#define TUNE_GRID(a)    (int)(sizeof(a) / sizeof((a)[0]))
+
+// One window as the search replays it, temperatures ℃/256 as in the telemetry records
+typedef struct {
+    int16_t tcell;
+    int16_t tamb;
+    uint16_t ma;
+    uint16_t rpm;
+} tune_hist_t;
+
+typedef struct {
+    float tcell, tamb, heat, rpm;
+} tune_win_t;
+
+typedef struct {
+    //-------------Window being averaged, sums of value * ms---------------//
+    int64_t win_us;
+    int64_t last_us;
+    int64_t ms;
+    int64_t tcell, tamb, ma, rpm;
+
+    //-------------Least squares over the windows---------------//
+    tune_win_t prev[2];         // Two windows before the current one
+    int chain;                  // Consecutive windows without a gap, up to 2
+    double ata[TUNE_PARAMS][TUNE_PARAMS];
+    double aty[TUNE_PARAMS];
+    double windows;             // Weight behind the sums
+    double fan_windows;         // ... of windows with the fan turning
+    int64_t bins[FAN_TUNE_FAN_BINS][3]; // ms, Q16 duty * ms and RPM * ms
+
+    //-------------History for the search---------------//
+    tune_hist_t hist[FAN_TUNE_HISTORY];
+    int hist_head;
+    int hist_len;
+
+    //-------------Duty steps---------------//
+    int step;                   // Index into tune_steps while the zone is in tune_mask
+    int64_t step_us;
+} tune_rt_t;
+
+typedef struct {
+    uint16_t version;
+    uint16_t size;
+    fan_tune_zone_t zone[FAN_ZONE_NUM];
+    uint32_t crc;
+} tune_store_t;
+
+static portMUX_TYPE tune_lock = portMUX_INITIALIZER_UNLOCKED;
+static tune_rt_t tune_rt[FAN_ZONE_NUM];
+static fan_tune_zone_t tune_zones[FAN_ZONE_NUM];
+static uint32_t tune_mask;          // Zones held at the duty steps
+static bool tune_pending;           // Search asked for
+static bool tune_searching;         // Search task running
+static int64_t tune_stats_us;
+
+/*---------------------------------------------------------------
+        Store
+---------------------------------------------------------------*/
+static uint32_t tune_crc(const tune_store_t *s)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)s, offsetof(tune_store_t, crc));
+}
+
+static esp_err_t tune_save(void)
+{
+    static tune_store_t s;
+
+    memset(&s, 0, sizeof(s));
+    s.version = FAN_TUNE_VERSION;
+    s.size = sizeof(s);
+    portENTER_CRITICAL(&tune_lock);
+    memcpy(s.zone, tune_zones, sizeof(s.zone));
+    portEXIT_CRITICAL(&tune_lock);
+    s.crc = tune_crc(&s);
+    return fan_hal_store_set(FAN_TUNE_KEY, &s, sizeof(s));
+}
+
+esp_err_t fan_tune_init(void)
+{
+    static tune_store_t s;
+    int fitted = 0;
+    esp_err_t ret = fan_hal_store_get(FAN_TUNE_KEY, &s, sizeof(s));
+
+    if (ret == ESP_OK && (s.version != FAN_TUNE_VERSION || s.size != sizeof(s) || s.crc != tune_crc(&s))) {
+        ESP_LOGW(TAG, "Stored fits are for another build, starting over");
+        ret = ESP_ERR_INVALID_VERSION;
+    }
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        if (ret == ESP_OK) {
+            tune_zones[zone] = s.zone[zone];
+        } else {
+            memset(&tune_zones[zone], 0, sizeof(tune_zones[zone]));
+            tune_zones[zone].ceiling = FAN_TUNE_CEILING;
+        }
+        if (tune_zones[zone].fan.ok) {
+            fan_rpm_fan(zone, tune_zones[zone].fan.rpm0, tune_zones[zone].fan.rpm_per_duty);
+        }
+        fitted += tune_zones[zone].thermal.ok;
+    }
+    tune_stats_us = fan_hal_now_us();
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Stored fits loaded, %d of %d zones", fitted, FAN_ZONE_NUM);
+    }
+    return ret == ESP_OK || ret == ESP_ERR_NOT_FOUND || ret == ESP_ERR_INVALID_VERSION ? ESP_OK : ret;
+}
+
+/*---------------------------------------------------------------
+        Cage model, float: window rate and the search task only
+---------------------------------------------------------------*/
+static float tune_watts(float ma)
+{
+    return ma * (float)(FAN_EST_RAIL_V / 1000);
+}
+
+static float tune_model_step(const fan_est_param_t *m, float tcell, float tamb, float heat, float rpm)
+{
+    const float dt = (float)FAN_TUNE_WINDOW_S / TUNE_SUBSTEPS;
+    float cool = 1 + m->air * rpm / 1000;
+
+    for (int i = 0; i < TUNE_SUBSTEPS; i++) {
+        tcell += (m->rise * (heat + m->base_w) - cool * (tcell - tamb)) * dt / m->tau;
+    }
+    return tcell;
+}
+
+// Nominal target of fan_rpm.c for a demand, capped by what the fan was seen to reach
+static float tune_rpm(float demand, float start_duty, float rpm_cap)
+{
+    if (demand <= start_duty) {
+        return 0;
+    }
+    float rpm = FAN_RPM_MIN + (demand - start_duty) / (1 - start_duty) * (FAN_RPM_MAX - FAN_RPM_MIN);
+    return rpm < rpm_cap ? rpm : rpm_cap;
+}
+
+static float tune_rpm_cap(const fan_tune_zone_t *t)
+{
+    float full = t->fan.rpm0 + t->fan.rpm_per_duty;
+    return t->fan.ok && full < FAN_RPM_MAX ? full : FAN_RPM_MAX;
+}
+
+static float tune_hist_temp(int16_t v)
+{
+    return v / 256.0f;
+}
+
+// Oldest first, returns the number of windows copied
+static int tune_hist_copy(int zone, tune_hist_t *out)
+{
+    const tune_rt_t *t = &tune_rt[zone];
+    int n;
+
+    portENTER_CRITICAL(&tune_lock);
+    n = t->hist_len;
+    for (int i = 0; i < n; i++) {
+        out[i] = t->hist[(t->hist_head - n + i + FAN_TUNE_HISTORY) % FAN_TUNE_HISTORY];
+    }
+    portEXIT_CRITICAL(&tune_lock);
+    return n;
+}
+
+/*---------------------------------------------------------------
+        Fits, control task
+---------------------------------------------------------------*/
+// First n normal equations by elimination on unit diagonal scaling, false when a column is not seen
+static bool tune_solve(int n, const double ata[TUNE_PARAMS][TUNE_PARAMS], const double aty[TUNE_PARAMS], double x[TUNE_PARAMS])
+{
+    double a[TUNE_PARAMS][TUNE_PARAMS + 1];
+    double scale[TUNE_PARAMS];
+
+    for (int i = 0; i < n; i++) {
+        if (ata[i][i] <= 0) {
+            return false;
+        }
+        scale[i] = 1 / sqrt(ata[i][i]);
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            a[i][j] = ata[i][j] * scale[i] * scale[j];
+        }
+        a[i][n] = aty[i] * scale[i];
+    }
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < n; row++) {
+            if (fabs(a[row][col]) > fabs(a[pivot][col])) {
+                pivot = row;
+            }
+        }
+        // Correlation scale: a pivot this small is a column the others explain
+        if (fabs(a[pivot][col]) < 1e-3) {
+            return false;
+        }
+        for (int j = 0; j <= n; j++) {
+            double tmp = a[col][j];
+            a[col][j] = a[pivot][j];
+            a[pivot][j] = tmp;
+        }
+        for (int row = col + 1; row < n; row++) {
+            double f = a[row][col] / a[col][col];
+            for (int j = col; j <= n; j++) {
+                a[row][j] -= f * a[col][j];
+            }
+        }
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        double sum = a[i][n];
+        for (int j = i + 1; j < n; j++) {
+            sum -= a[i][j] * x[j];
+        }
+        x[i] = sum / a[i][i];
+    }
+    for (int i = 0; i < n; i++) {
+        x[i] *= scale[i];
+    }
+    return true;
+}
+
+// Model run free over the history on the measured RPM, ℃ rms against the NTC. Control task, the ring's writer.
+static float tune_free_run(const fan_est_param_t *m, const tune_rt_t *t)
+{
+    const tune_hist_t *h = &t->hist[(t->hist_head - t->hist_len + FAN_TUNE_HISTORY) % FAN_TUNE_HISTORY];
+    float tcell = tune_hist_temp(h->tcell);
+    double sum = 0;
+
+    for (int i = 1; i < t->hist_len; i++) {
+        tcell = tune_model_step(m, tcell, tune_hist_temp(h->tamb), tune_watts(h->ma), h->rpm);
+        h = &t->hist[(t->hist_head - t->hist_len + i + FAN_TUNE_HISTORY) % FAN_TUNE_HISTORY];
+        float err = tcell - tune_hist_temp(h->tcell);
+        sum += err * err;
+    }
+    return t->hist_len > 1 ? (float)sqrt(sum / (t->hist_len - 1)) : 0;
+}
+
+static void tune_fit_thermal(int zone, fan_tune_thermal_t *fit)
+{
+    const tune_rt_t *t = &tune_rt[zone];
+    double x[TUNE_PARAMS];
+
+    fit->ok = false;
+    if (t->windows < FAN_TUNE_MIN_WINDOWS) {
+        return;
+    }
+    if (t->fan_windows < t->windows * FAN_TUNE_MIN_FAN) {
+        ESP_LOGI(TAG, "%s: fan seldom on, airflow not identified, last fit kept", fan_zones[zone].name);
+        return;
+    }
+    if (tune_solve(TUNE_PARAMS, t->ata, t->aty, x) && x[0] > 0 && x[2] > 0 && x[3] >= 0) {
+        fit->model.tau = (float)(1 / x[2]);
+        fit->model.rise = (float)(x[0] / x[2]);
+        fit->model.air = (float)(x[3] / x[2]);
+        fit->model.base_w = x[1] > 0 ? (float)(x[1] / x[0]) : 0;
+    } else {
+        //-------------Steady load: a and b are one column, hold base_w at the profile's---------------//
+        double base = fan_profile_get()->zone[zone].model.base_w;
+        double ata[TUNE_PARAMS][TUNE_PARAMS], aty[TUNE_PARAMS];
+        static const int cols[3] = { 0, 2, 3 };
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                int r = cols[i], c = cols[j];
+                ata[i][j] = t->ata[r][c] + (r == 0 ? base * t->ata[1][c] : 0) + (c == 0 ? base * t->ata[r][1] : 0)
+                          + (r == 0 && c == 0 ? base * base * t->ata[1][1] : 0);
+            }
+            aty[i] = t->aty[cols[i]] + (cols[i] == 0 ? base * t->aty[1] : 0);
+        }
+        if (!tune_solve(3, ata, aty, x) || x[0] <= 0 || x[1] <= 0 || x[2] < 0) {
+            ESP_LOGW(TAG, "%s: airflow did not vary enough to fit the cage", fan_zones[zone].name);
+            return;
+        }
+        fit->model.tau = (float)(1 / x[1]);
+        fit->model.rise = (float)(x[0] / x[1]);
+        fit->model.air = (float)(x[2] / x[1]);
+        fit->model.base_w = (float)base;
+        ESP_LOGI(TAG, "%s: load held steady, base %.2fW kept from the profile", fan_zones[zone].name, base);
+    }
+
+    //-------------Same bounds as the profile fields---------------//
+    fan_profile_t p = *fan_profile_get();
+    p.zone[zone].model = fit->model;
+    if (fan_profile_validate(&p) != ESP_OK) {
+        ESP_LOGW(TAG, "%s: fitted cage out of range", fan_zones[zone].name);
+        return;
+    }
+    fit->rms = tune_free_run(&fit->model, t);
+    fit->hours = fan_tune_history_h(zone);
+    fit->ok = true;
+}
+
+// Line through the occupied bin means, each bin one point
+static void tune_fit_fan(int zone, fan_tune_fan_t *fit, int *bins)
+{
+    const tune_rt_t *t = &tune_rt[zone];
+    double n = 0, sd = 0, sr = 0, sdd = 0, sdr = 0;
+
+    *bins = 0;
+    for (int b = 0; b < FAN_TUNE_FAN_BINS; b++) {
+        if (t->bins[b][0] <= 0) {
+            continue;
+        }
+        double d = (double)t->bins[b][1] / t->bins[b][0] / 65536;
+        double r = (double)t->bins[b][2] / t->bins[b][0];
+        n++;
+        sd += d;
+        sr += r;
+        sdd += d * d;
+        sdr += d * r;
+        (*bins)++;
+    }
+    double det = n * sdd - sd * sd;
+    if (*bins < FAN_TUNE_FAN_MIN_BINS || det <= 0) {
+        fit->ok = false;
+        return;
+    }
+    fit->rpm_per_duty = (float)((n * sdr - sd * sr) / det);
+    fit->rpm0 = (float)((sr - fit->rpm_per_duty * sd) / n);
+    fit->ok = fit->rpm_per_duty > 0;
+}
+
+// Fits made this time, a zone that kept its last ones stays quiet
+static void tune_log(int zone, const fan_tune_zone_t *tz, bool thermal, bool fan, int bins)
+{
+    const fan_tune_thermal_t *th = &tz->thermal;
+    float start = fan_selftest_result(zone)->start_duty / 65536.0f;
+    char gain[64];
+    int len = 0;
+
+    if (!thermal) {
+        return;
+    }
+    //-------------Steady-state cell rise per watt against duty---------------//
+    for (int pct = 0; pct <= 100; pct += 25) {
+        float duty = pct / 100.0f;
+        float rpm = 0;
+        if (duty > start) {
+            rpm = tz->fan.ok ? tz->fan.rpm0 + tz->fan.rpm_per_duty * duty : tune_rpm(duty, start, FAN_RPM_MAX);
+        }
+        len += snprintf(gain + len, sizeof(gain) - len, "%s%.2f", pct ? "/" : "", th->model.rise / (1 + th->model.air * rpm / 1000));
+    }
+    ESP_LOGI(TAG, "%s: tau %.0fs, rise %.2f℃/W, air %.2f per 1000RPM, base %.2fW; free run %.2f℃ rms over %.1fh; "
+             "℃/W at 0/25/50/75/100%% duty %s", fan_zones[zone].name, th->model.tau, th->model.rise, th->model.air,
+             th->model.base_w, th->rms, th->hours, gain);
+    if (fan) {
+        ESP_LOGI(TAG, "%s: fan %.0f RPM + %.0f per duty, %d of %d bins", fan_zones[zone].name,
+                 tz->fan.rpm0, tz->fan.rpm_per_duty, bins, FAN_TUNE_FAN_BINS);
+    }
+}
+
+// Refit every zone, push the fan lines into the feed-forward and store
+static void tune_fit_all(void)
+{
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        fan_tune_zone_t tz = tune_zones[zone];
+        int bins;
+        tune_fit_thermal(zone, &tz.thermal);
+        tune_fit_fan(zone, &tz.fan, &bins);
+        bool thermal = tz.thermal.ok, fan = tz.fan.ok;
+        // A fit that failed this time keeps the last good one
+        portENTER_CRITICAL(&tune_lock);
+        if (tz.thermal.ok) {
+            tune_zones[zone].thermal = tz.thermal;
+        }
+        if (tz.fan.ok) {
+            tune_zones[zone].fan = tz.fan;
+        }
+        tz = tune_zones[zone];
+        portEXIT_CRITICAL(&tune_lock);
+        if (tz.fan.ok) {
+            fan_rpm_fan(zone, tz.fan.rpm0, tz.fan.rpm_per_duty);
+        }
+        tune_log(zone, &tz, thermal, fan, bins);
+    }
+    if (tune_save() != ESP_OK) {
+        ESP_LOGW(TAG, "Fits not stored");
+    }
+}
+
+/*---------------------------------------------------------------
+        Search task
+---------------------------------------------------------------*/
+typedef struct {
+    fan_est_param_t model;
+    float start_duty;
+    float rpm_cap;
+    float limit;            // Ceiling less the margin
+} tune_plant_t;
+
+typedef struct {
+    float rpm;              // Mean
+    float peak;             // ℃
+} tune_score_t;
+
+// The fitted cage under a candidate curve, replayed over the history
+static tune_score_t tune_eval(const fan_curve_t *curve, const tune_plant_t *plant, const tune_hist_t *hist, int n)
+{
+    float tcell = tune_hist_temp(hist[0].tcell);
+    tune_score_t score = { 0, tcell };
+    double rpm_sum = 0;
+
+    for (int i = 0; i < n; i++) {
+        q16_t tamb = (q16_t)hist[i].tamb << 8;
+        q16_t idc = i2duty_q(curve, q16_from_int(hist[i].ma));
+        q16_t tdc = tt2duty_q(curve, tamb, (q16_t)(tcell * 65536));
+        float demand = fusion_q(curve, tdc, idc) / 65536.0f;
+        float rpm = tune_rpm(demand, plant->start_duty, plant->rpm_cap);
+        tcell = tune_model_step(&plant->model, tcell, tune_hist_temp(hist[i].tamb), tune_watts(hist[i].ma), rpm);
+        rpm_sum += rpm;
+        if (tcell > score.peak) {
+            score.peak = tcell;
+        }
+        // Early out, nothing above the ceiling can win
+        if (score.peak > plant->limit + FAN_TUNE_MARGIN) {
+            break;
+        }
+    }
+    score.rpm = (float)(rpm_sum / n);
+    return score;
+}
+
+// Best t_zero, t_max and i_scale of one zone, written into the profile. False when nothing changed.
+static bool tune_search_zone(int zone, fan_profile_t *p, const tune_hist_t *hist, int n)
+{
+    const fan_tune_zone_t *tz = &tune_zones[zone];
+    fan_curve_param_t *param = &p->zone[zone];
+    fan_curve_param_t cand = *param;
+    fan_curve_param_t best = *param;
+    tune_plant_t plant = {
+        .model = tz->thermal.model,
+        .start_duty = fan_selftest_result(zone)->start_duty / 65536.0f,
+        .rpm_cap = tune_rpm_cap(tz),
+        .limit = tz->ceiling - FAN_TUNE_MARGIN,
+    };
+    fan_curve_t curve;
+
+    cand.model = tz->thermal.model;
+    fan_curve_build(&curve, &cand, &p->common);
+    tune_score_t now = tune_eval(&curve, &plant, hist, n);
+    tune_score_t top = { INFINITY, 0 };
+
+    for (int a = 0; a < TUNE_GRID(tune_grid_tmax); a++) {
+        for (int b = 0; b < TUNE_GRID(tune_grid_span); b++) {
+            for (int c = 0; c < TUNE_GRID(tune_grid_iscale); c++) {
+                cand.t_max = tz->ceiling + tune_grid_tmax[a];
+                cand.t_zero = cand.t_max - tune_grid_span[b];
+                cand.i_scale = param->i_scale * tune_grid_iscale[c];
+                if (cand.t_zero < 0 || cand.t_max > 100 || cand.i_scale < 0.01f) {
+                    continue;
+                }
+                fan_curve_build(&curve, &cand, &p->common);
+                tune_score_t s = tune_eval(&curve, &plant, hist, n);
+                if (s.peak <= plant.limit && s.rpm < top.rpm) {
+                    top = s;
+                    best = cand;
+                }
+            }
+        }
+    }
+    param->model = tz->thermal.model;
+    if (top.rpm == INFINITY) {
+        ESP_LOGW(TAG, "%s: no candidate keeps the cell under %.1f℃, curve kept (now %.0f RPM mean, %.1f℃ peak)",
+                 fan_zones[zone].name, plant.limit, now.rpm, now.peak);
+        return false;
+    }
+    if (now.peak <= plant.limit && now.rpm <= top.rpm) {
+        ESP_LOGI(TAG, "%s: curve already at the minimum, %.0f RPM mean, %.1f℃ peak", fan_zones[zone].name, now.rpm, now.peak);
+        return false;
+    }
+    ESP_LOGI(TAG, "%s: t_zero %.1f->%.1f, t_max %.1f->%.1f, i_scale %.2f->%.2f: %.0f->%.0f RPM mean, "
+             "Cell-T peak %.1f->%.1f℃ (ceiling %.1f℃) over %.1fh", fan_zones[zone].name, param->t_zero, best.t_zero,
+             param->t_max, best.t_max, param->i_scale, best.i_scale, now.rpm, top.rpm, now.peak, top.peak,
+             tz->ceiling, n * FAN_TUNE_WINDOW_S / 3600.0f);
+    param->t_zero = best.t_zero;
+    param->t_max = best.t_max;
+    param->i_scale = best.i_scale;
+    return true;
+}
+
+// The searched fields of the tuned zones on top of the latest profile, so a profile set made
+// while the search ran survives. A zone whose ceiling changed meanwhile is left out.
+static void tune_search_stage(fan_profile_t *search, const float *ceiling, const bool *searched, const bool *changed)
+{
+    static fan_profile_t p;
+    int staged = 0;
+
+    fan_profile_latest(&p);
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        if (!searched[zone]) {
+            continue;
+        }
+        if (tune_zones[zone].ceiling != ceiling[zone]) {
+            ESP_LOGW(TAG, "%s: ceiling changed during the search, not staged; tune apply again", fan_zones[zone].name);
+            continue;
+        }
+        p.zone[zone].model = search->zone[zone].model;
+        if (changed[zone]) {
+            p.zone[zone].t_zero = search->zone[zone].t_zero;
+            p.zone[zone].t_max = search->zone[zone].t_max;
+            p.zone[zone].i_scale = search->zone[zone].i_scale;
+        }
+        staged++;
+    }
+    if (staged > 0 && fan_profile_stage(&p) == ESP_OK) {
+        ESP_LOGI(TAG, "Tuned profile staged");
+    }
+}
+
+static void tune_search_task(void *arg)
+{
+    static fan_profile_t p;
+    tune_hist_t *hist = malloc(FAN_TUNE_HISTORY * sizeof(tune_hist_t));
+    int64_t begin_us = fan_hal_now_us();
+    float ceiling[FAN_ZONE_NUM];
+    bool searched[FAN_ZONE_NUM] = { 0 };
+    bool changed[FAN_ZONE_NUM] = { 0 };
+
+    p = *fan_profile_get();
+    for (int zone = 0; hist != NULL && zone < FAN_ZONE_NUM; zone++) {
+        int n = tune_hist_copy(zone, hist);
+        ceiling[zone] = tune_zones[zone].ceiling;
+        if (!tune_zones[zone].thermal.ok || n < 2) {
+            ESP_LOGW(TAG, "%s: no fitted cage, not tuned", fan_zones[zone].name);
+            continue;
+        }
+        changed[zone] = tune_search_zone(zone, &p, hist, n);
+        searched[zone] = true;
+    }
+    if (hist == NULL) {
+        ESP_LOGE(TAG, "No memory for the search");
+    } else {
+        ESP_LOGI(TAG, "Search done after %dms", (int)((fan_hal_now_us() - begin_us) / 1000));
+        tune_search_stage(&p, ceiling, searched, changed);
+    }
+    free(hist);
+    portENTER_CRITICAL(&tune_lock);
+    tune_searching = false;
+    portEXIT_CRITICAL(&tune_lock);
+    vTaskDelete(NULL);
+}
+
+static bool tune_history_full(void)
+{
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        if (fan_tune_history_h(zone) < FAN_TUNE_MIN_H) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Control task, at a window boundary
+static void tune_search_start(void)
+{
+    if (!tune_pending || tune_mask != 0 || !tune_history_full()) {
+        return;
+    }
+    tune_fit_all();
+    portENTER_CRITICAL(&tune_lock);
+    tune_pending = false;
+    tune_searching = true;
+    portEXIT_CRITICAL(&tune_lock);
+    if (xTaskCreate(tune_search_task, "tune_task", FAN_TUNE_STACK, NULL, FAN_TUNE_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Search task not created");
+        tune_searching = false;
+    }
+}
+
+/*---------------------------------------------------------------
+        Observation, control task
+---------------------------------------------------------------*/
+static void tune_window(tune_rt_t *t)
+{
+    tune_win_t w = {
+        .tcell = (float)(t->tcell / t->ms) / 65536,
+        .tamb = (float)(t->tamb / t->ms) / 65536,
+        .heat = tune_watts((float)(t->ma / t->ms) / 65536),
+        .rpm = (float)t->rpm / t->ms,
+    };
+    tune_hist_t h = {
+        .tcell = (int16_t)(w.tcell * 256),
+        .tamb = (int16_t)(w.tamb * 256),
+        .ma = (uint16_t)q16_clamp((q16_t)(t->ma / t->ms) >> 16, 0, UINT16_MAX),
+        .rpm = (uint16_t)w.rpm,
+    };
+
+    //-------------Slope across the neighbours, regressors of the middle window---------------//
+    if (t->chain >= 2) {
+        const tune_win_t *m = &t->prev[1];
+        double dt = m->tcell - m->tamb;
+        double phi[TUNE_PARAMS] = { m->heat, 1, -dt, -m->rpm / 1000 * dt };
+        double y = (w.tcell - t->prev[0].tcell) / (2.0 * FAN_TUNE_WINDOW_S);
+        double keep = 1 - (double)FAN_TUNE_WINDOW_S / FAN_TUNE_MEMORY_S;
+        for (int i = 0; i < TUNE_PARAMS; i++) {
+            for (int j = 0; j < TUNE_PARAMS; j++) {
+                t->ata[i][j] = t->ata[i][j] * keep + phi[i] * phi[j];
+            }
+            t->aty[i] = t->aty[i] * keep + phi[i] * y;
+        }
+        t->windows = t->windows * keep + 1;
+        t->fan_windows = t->fan_windows * keep + (m->rpm > 0);
+    }
+    t->prev[0] = t->prev[1];
+    t->prev[1] = w;
+    t->chain = t->chain < 2 ? t->chain + 1 : 2;
+
+    portENTER_CRITICAL(&tune_lock);
+    t->hist[t->hist_head] = h;
+    t->hist_head = (t->hist_head + 1) % FAN_TUNE_HISTORY;
+    if (t->hist_len < FAN_TUNE_HISTORY) {
+        t->hist_len++;
+    }
+    portEXIT_CRITICAL(&tune_lock);
+    t->ms = t->tcell = t->tamb = t->ma = t->rpm = 0;
+}
+
+void fan_tune_observe(int zone, const fan_telem_sample_t *sample)
+{
+    tune_rt_t *t = &tune_rt[zone];
+    int64_t now_us = fan_hal_now_us();
+    int64_t ms = (now_us - t->last_us) / 1000;
+
+    t->last_us = now_us;
+    if (t->win_us == 0 || ms > TUNE_GAP_MS) {
+        //-------------First sample or a gap (self-test), start the chain again---------------//
+        t->win_us = now_us;
+        t->chain = 0;
+        t->ms = t->tcell = t->tamb = t->ma = t->rpm = 0;
+        return;
+    }
+    //-------------Each sample stands for the time since the previous one---------------//
+    t->ms += ms;
+    t->tcell += (int64_t)ntc2temp_q(sample->ntc_mv) * ms;
+    t->tamb += (int64_t)(sample->tsens - fan_tuning()->selfheat) * ms;
+    t->ma += (int64_t)sample->current_mv * ms;
+    t->rpm += (int64_t)sample->rpm * ms;
+
+    //-------------Settled RPM against the duty it ran at, closed loop only (open loop is always "settled")---------------//
+    if ((sample->flags & (FAN_TELEM_ON | FAN_TELEM_SETTLED | FAN_TELEM_STALLED)) == (FAN_TELEM_ON | FAN_TELEM_SETTLED)
+     && sample->duty_out > fan_selftest_result(zone)->start_duty && sample->rpm > 0) {
+        int b = q16_to_scaled(sample->duty_out, FAN_TUNE_FAN_BINS * 16) / 16;
+        int64_t *bin = t->bins[b < FAN_TUNE_FAN_BINS ? b : FAN_TUNE_FAN_BINS - 1];
+        bin[0] += ms;
+        bin[1] += sample->duty_out * ms;
+        bin[2] += sample->rpm * ms;
+    }
+
+    if (now_us - t->win_us < FAN_TUNE_WINDOW_S * 1000000LL) {
+        return;
+    }
+    t->win_us += FAN_TUNE_WINDOW_S * 1000000LL;
+    if (t->ms < FAN_TUNE_WINDOW_S * 500) {
+        t->chain = 0;
+        t->ms = t->tcell = t->tamb = t->ma = t->rpm = 0;
+        return;
+    }
+    tune_window(t);
+
+    //-------------Once per window of the last zone---------------//
+    if (zone == FAN_ZONE_NUM - 1) {
+        if (now_us - tune_stats_us >= FAN_TUNE_STATS_MS * 1000LL) {
+            tune_stats_us = now_us;
+            tune_fit_all();
+        }
+        tune_search_start();
+    }
+}
+
+q16_t fan_tune_demand(int zone, q16_t demand, q16_t tcell)
+{
+    tune_rt_t *t = &tune_rt[zone];
+    int64_t now_us = fan_hal_now_us();
+    bool done = false;
+    q16_t step;
+
+    if (!(tune_mask & BIT(zone))) {
+        return demand;
+    }
+    portENTER_CRITICAL(&tune_lock);
+    if (t->step_us == 0) {
+        t->step_us = now_us;
+    } else if (now_us - t->step_us >= FAN_TUNE_STEP_S * 1000000LL) {
+        t->step++;
+        t->step_us = now_us;
+    }
+    if (t->step >= TUNE_STEP_NUM) {
+        tune_mask &= ~BIT(zone);
+        done = tune_mask == 0;
+    }
+    int idx = t->step;
+    portEXIT_CRITICAL(&tune_lock);
+
+    if (idx >= TUNE_STEP_NUM) {
+        ESP_LOGI(TAG, "%s: duty steps done", fan_zones[zone].name);
+        if (done) {
+            tune_fit_all();
+        }
+        return demand;
+    }
+    step = Q16(tune_steps[idx]);
+    //-------------The controller keeps the cell under the ceiling---------------//
+    if (tcell >= Q16(tune_zones[zone].ceiling - FAN_TUNE_MARGIN) && demand > step) {
+        return demand;
+    }
+    return step;
+}
+
+/*---------------------------------------------------------------
+        Commands, any task
+---------------------------------------------------------------*/
+esp_err_t fan_tune_start(uint32_t mask)
+{
+    mask &= BIT(FAN_ZONE_NUM) - 1;
+    ESP_RETURN_ON_FALSE(mask != 0, ESP_ERR_INVALID_ARG, TAG, "No such zone");
+    portENTER_CRITICAL(&tune_lock);
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++) {
+        if (mask & BIT(zone)) {
+            tune_rt[zone].step = 0;
+            tune_rt[zone].step_us = 0;
+        }
+    }
+    tune_mask |= mask;
+    tune_pending = true;
+    portEXIT_CRITICAL(&tune_lock);
+    ESP_LOGI(TAG, "Duty steps on 0x%x, %d x %ds, search after %dh of history", (unsigned)mask, TUNE_STEP_NUM,
+             FAN_TUNE_STEP_S, FAN_TUNE_MIN_H);
+    return ESP_OK;
+}
+
+esp_err_t fan_tune_stop(void)
+{
+    portENTER_CRITICAL(&tune_lock);
+    tune_mask = 0;
+    tune_pending = false;
+    portEXIT_CRITICAL(&tune_lock);
+    return ESP_OK;
+}
+
+esp_err_t fan_tune_apply(void)
+{
+    ESP_RETURN_ON_FALSE(!tune_searching, ESP_ERR_INVALID_STATE, TAG, "Search already running");
+    portENTER_CRITICAL(&tune_lock);
+    tune_pending = true;
+    portEXIT_CRITICAL(&tune_lock);
+    return ESP_OK;
+}
+
+esp_err_t fan_tune_set_ceiling(int zone, float ceiling)
+{
+    ESP_RETURN_ON_FALSE(zone >= 0 && zone < FAN_ZONE_NUM, ESP_ERR_INVALID_ARG, TAG, "No such zone");
+    ESP_RETURN_ON_FALSE(ceiling >= 20 && ceiling <= 90, ESP_ERR_INVALID_ARG, TAG, "Ceiling out of range");
+    portENTER_CRITICAL(&tune_lock);
+    tune_zones[zone].ceiling = ceiling;
+    portEXIT_CRITICAL(&tune_lock);
+    return tune_save();
+}
+
+void fan_tune_get(int zone, fan_tune_zone_t *out)
+{
+    portENTER_CRITICAL(&tune_lock);
+    *out = tune_zones[zone];
+    portEXIT_CRITICAL(&tune_lock);
+}
+
+float fan_tune_history_h(int zone)
+{
+    return tune_rt[zone].hist_len * FAN_TUNE_WINDOW_S / 3600.0f;
+}
@@ -0,0 +1,105 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "fan_fixed.h"
+#include "fan_est.h"
+#include "fan_telem.h"
+
+/*---------------------------------------------------------------
+        Auto-tuning Macros
+
+        Identification runs all the time on what the control loop
+        sees. Every FAN_TUNE_WINDOW_S the raw cell, ambient, rail
+        current and RPM of a zone are averaged into one window, and
+        the cage model of fan_est.h, rewritten linear in its
+        parameters,
+
+            dTc/dt = a*H + b - c*(Tc - Ta) - d*RPM/1000*(Tc - Ta)
+
+            tau = 1/c   rise = a/c   base_w = b/a   air = d/c
+
+        is fitted by least squares over the windows, the slope taken
+        across the two neighbouring windows. Old windows fade out
+        over FAN_TUNE_MEMORY_S. Settled RPM against the applied duty
+        goes into FAN_TUNE_FAN_BINS bins, a line through the bin means
+        is the fan's duty-to-RPM curve; it replaces the nominal fan of
+        the RPM feed-forward (fan_rpm.h).
+
+        Normal operation may not move a parameter enough to be seen.
+        'tune start' holds the demand of the zones at the
+        FAN_TUNE_STEPS for FAN_TUNE_STEP_S each (the controller takes
+        over again whenever the cell comes within FAN_TUNE_MARGIN of
+        its ceiling), then fits.
+
+        The controller parameters come from a search, not a formula:
+        each candidate t_zero, t_max and i_scale of a zone drives the
+        fitted cage through the last FAN_TUNE_HISTORY windows of
+        measured load and ambient, with the real fusion pipeline of
+        fan_curve.h. The candidate with the lowest mean RPM whose cell
+        stays FAN_TUNE_MARGIN under the ceiling wins and is staged as
+        the new profile, with the fitted model for the estimator. The
+        search needs FAN_TUNE_MIN_H of history; asked earlier it waits
+        for it. It runs in its own low priority task in float, some
+        240k model steps per zone, seconds on the target.
+
+        The fits, ceilings and fan curves are stored in NVS under
+        FAN_TUNE_KEY, the parameters in the profile.
+---------------------------------------------------------------*/
+#define FAN_TUNE_KEY            "tune"
+#define FAN_TUNE_VERSION        1
+#define FAN_TUNE_CEILING        45.0    // ℃, cell ceiling until 'tune ceiling' sets one
+#define FAN_TUNE_MARGIN         2.0     // ℃ kept under the ceiling by the search
+#define FAN_TUNE_WINDOW_S       120
+#define FAN_TUNE_HISTORY        720     // Windows kept for the search, 24 h
+#define FAN_TUNE_MIN_H          24      // History the search needs, a whole day of load
+#define FAN_TUNE_MEMORY_S       (7 * 24 * 3600)     // Time constant of the fit's forgetting
+#define FAN_TUNE_MIN_WINDOWS    24      // Before the first fit, the duty steps give 30
+#define FAN_TUNE_MIN_FAN        0.05    // Share of windows with the fan on, else air is not seen
+#define FAN_TUNE_FAN_BINS       10      // Duty bins of the fan curve
+#define FAN_TUNE_FAN_MIN_BINS   3       // Occupied bins before the curve is fitted
+#define FAN_TUNE_STEP_S         900
+#define FAN_TUNE_STEPS          { 1.0, 0.6, 0.35, 0.0 }
+#define FAN_TUNE_STATS_MS       (6 * 3600 * 1000)   // Fit logged and stored this often
+#define FAN_TUNE_STACK          (4 * 1024)
+#define FAN_TUNE_PRIO           1
+
+typedef struct {
+    bool ok;                // Fitted, in range
+    fan_est_param_t model;
+    float rms;              // ℃, model run free over the history against the NTC
+    float hours;            // History behind the fit
+} fan_tune_thermal_t;
+
+typedef struct {
+    bool ok;
+    float rpm0;             // RPM = rpm0 + rpm_per_duty * duty, above the start duty
+    float rpm_per_duty;
+} fan_tune_fan_t;
+
+typedef struct {
+    float ceiling;          // ℃
+    fan_tune_thermal_t thermal;
+    fan_tune_fan_t fan;
+} fan_tune_zone_t;
+
+// Load the stored fits and ceilings, after fan_rpm_init() of every zone
+esp_err_t fan_tune_init(void);
+// Control task, once per zone and tick with the record of fan_telem_record()
+void fan_tune_observe(int zone, const fan_telem_sample_t *sample);
+// Control task: the demand to run, the step demand while identification holds the zone
+q16_t fan_tune_demand(int zone, q16_t demand, q16_t tcell);
+// Run the duty steps on the zones of the mask, then fit and search
+esp_err_t fan_tune_start(uint32_t mask);
+esp_err_t fan_tune_stop(void);
+// Search now, or as soon as FAN_TUNE_MIN_H of history is in
+esp_err_t fan_tune_apply(void);
+esp_err_t fan_tune_set_ceiling(int zone, float ceiling);
+// Copy of the zone's fits, any task
+void fan_tune_get(int zone, fan_tune_zone_t *out);
+// Hours of history behind the search
+float fan_tune_history_h(int zone);
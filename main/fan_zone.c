@@ -0,0 +1,22 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "fan_zone.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+// Pins are unused by the simulator, cage loads differ in fan_hal_sim.c
+const fan_zone_t fan_zones[FAN_ZONE_NUM] = {
+    { "cage0", -1, -1, 0, 1, FAN_CURVE_PARAM_DEFAULT, FAN_ZONE_DISKS(4, 65, 120) },
+    { "cage1", -1, -1, 2, 3, FAN_CURVE_PARAM_MODEL(T_ZERO, T_MAX, TERMAL_MAX, 2.0, FAN_START_DUTY,
+                             FAN_EST_PARAM(FAN_EST_TAU, FAN_EST_RISE, FAN_EST_AIR, 1.0)), FAN_ZONE_DISKS(2, 65, 60) },   // Half the disks
+    { "cage2", -1, -1, 4, 5, FAN_CURVE_PARAM_DEFAULT, FAN_ZONE_DISKS(4, 65, 120) },
+    { "ssd",   -1, -1, 6, 7, FAN_CURVE_PARAM_MODEL(30.0, 55.0, TERMAL_MAX, 4.0, FAN_START_DUTY,
+                             FAN_EST_PARAM(FAN_EST_TAU, FAN_EST_RISE, FAN_EST_AIR, 0.5)), FAN_ZONE_DISKS(0, 0, 0) },  // SSD sled, runs warmer
+};
+#else
+const fan_zone_t fan_zones[FAN_ZONE_NUM] = {
+    // name   PWM  tach current NTC
+    { "cage0", 12, 11,  0,      1,  FAN_CURVE_PARAM_DEFAULT, FAN_ZONE_DISKS(4, 65, 120) },
+//    { "cage1", 10, 22,  2,      3,  FAN_CURVE_PARAM_DEFAULT, FAN_ZONE_DISKS(4, 65, 120) },
+};
+#endif
@@ -0,0 +1,42 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include "sdkconfig.h"
+#include "fan_curve.h"
+
+/*---------------------------------------------------------------
+        Zone table
+
+        A zone is one disk cage with its own fan, tach, rail current
+        sense and NTC. LEDC channels and PCNT units are handed out in
+        table order; all zones share the LEDC timer, one ADC scan and
+        one control tick.
+---------------------------------------------------------------*/
+#if CONFIG_IDF_TARGET_LINUX
+#define FAN_ZONE_NUM    4       // Simulated chassis, cage models in fan_hal_sim.c
+#else
+#define FAN_ZONE_NUM    1       // ESP32-H2: up to 2 (5 ADC channels, 4 PCNT units)
+#endif
+
+// Disks whose motors draw from the zone's sensed rail, for fan_energy.h
+typedef struct {
+    int bays;           // Disks with a spindle, 0 for a zone of SSDs
+    int spin_ma;        // Rail current of one spinning, idle disk
+    int base_ma;        // Rail current with every disk spun down
+} fan_zone_disks_t;
+
+#define FAN_ZONE_DISKS(bays, spin_ma, base_ma)  { bays, spin_ma, base_ma }
+
+typedef struct {
+    const char *name;
+    int pwm_gpio;
+    int tach_gpio;
+    int adc_current;    // ADC1 channel of the AD8418 rail current sense
+    int adc_ntc;        // ADC1 channel of the cell NTC divider
+    fan_curve_param_t curve;    // Compiled default, the control profile may override it
+    fan_zone_disks_t disks;
+} fan_zone_t;
+
+extern const fan_zone_t fan_zones[FAN_ZONE_NUM];
@@ -6,232 +6,86 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "driver/ledc.h"
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "soc/soc_caps.h"
 #include "esp_log.h"
-#include "esp_adc/adc_oneshot.h"
-#include "esp_adc/adc_cali.h"
-#include "esp_adc/adc_cali_scheme.h"
-#include "driver/temperature_sensor.h"
-#include "driver/pulse_cnt.h"
-/* power management */
-#include "esp_pm.h"
-//#include "esp_sleep.h"
-//#include "console/console.h"
+#include "sdkconfig.h"
+#include "fan_hal.h"
+#include "fan_curve.h"
+#include "fan_sched.h"
+#include "fan_frame.h"
+#include "fan_tach.h"
+#include "fan_rpm.h"
+#include "fan_pwm.h"
+#include "fan_cycle.h"
+#include "fan_selftest.h"
+#include "fan_profile.h"
+#include "fan_telem.h"
+#include "fan_trace.h"
+#include "fan_hist.h"
+#include "fan_perf.h"
+#include "fan_console.h"
+#include "fan_est.h"
+#include "fan_tune.h"
+#include "fan_fault.h"
+#include "fan_host.h"
+#include "fan_bus.h"
+#include "fan_energy.h"
 
 const static char *TAG = "Fan-CTL";
-/*---------------------------------------------------------------
-        GPIO Macros
----------------------------------------------------------------*/
-#define GPIO_OUTPUT_LED_B    (13)
-#define GPIO_OUTPUT_PIN_SEL  (1ULL<<GPIO_OUTPUT_LED_B)
-/*---------------------------------------------------------------
-        LEDC Macros
----------------------------------------------------------------*/
-#define LEDC_TIMER              LEDC_TIMER_0
-#define LEDC_MODE               LEDC_LOW_SPEED_MODE
-#define LEDC_OUTPUT_IO          (12) // Define the output GPIO
-#define LEDC_CHANNEL            LEDC_CHANNEL_0
-#define LEDC_DUTY_RES           LEDC_TIMER_8_BIT // Set duty resolution to 8 bits
-#define LEDC_DUTY               (255) // Set duty to 99%. (2 ** 8) * 99% = 255
-#define LEDC_FREQUENCY          (25000) // Frequency in Hertz. Set frequency at 25 kHz
-/*---------------------------------------------------------------
-        ADC General Macros
----------------------------------------------------------------*/
-//ADC1 Channels
-#if CONFIG_IDF_TARGET_ESP32
-#define EXAMPLE_ADC1_CHAN0          ADC_CHANNEL_4
-//#define EXAMPLE_ADC1_CHAN1          ADC_CHANNEL_5
+#if CONFIG_IDF_TARGET_LINUX
+#define FAN_CURVE_SELFTEST  1
 #else
-#define EXAMPLE_ADC1_CHAN0          ADC_CHANNEL_0
-#define EXAMPLE_ADC1_CHAN1          ADC_CHANNEL_1
+#define FAN_CURVE_SELFTEST  0   // Set to 1 to time float vs Q16 pipeline on the target
 #endif
-
-#if (SOC_ADC_PERIPH_NUM >= 2) && !CONFIG_IDF_TARGET_ESP32C3
-/**
- * On ESP32C3, ADC2 is no longer supported, due to its HW limitation.
- * Search for errata on espressif website for more details.
- */
-#define EXAMPLE_USE_ADC2            1
-#endif
-
-#if EXAMPLE_USE_ADC2
-//ADC2 Channels
-#if CONFIG_IDF_TARGET_ESP32
-#define EXAMPLE_ADC2_CHAN0          ADC_CHANNEL_0
+#define SENSOR_TASK_STACK   (4 * 1024)
+#if CONFIG_IDF_TARGET_LINUX
+#define MAIN_TASK_STACK     0       // A host thread, no FreeRTOS stack to watch
 #else
-#define EXAMPLE_ADC2_CHAN0          ADC_CHANNEL_0
+#define MAIN_TASK_STACK     CONFIG_ESP_MAIN_TASK_STACK_SIZE
 #endif
-#endif  //#if EXAMPLE_USE_ADC2
-
-#define EXAMPLE_ADC_ATTEN           ADC_ATTEN_DB_12
-/*---------------------------------------------------------------
-        PCNT Macros
----------------------------------------------------------------*/
-#define PCNT_HIGH_LIMIT 1024
-#define PCNT_LOW_LIMIT  -1024
-
-#define PCNT_GPIO_EDGE 11
-#define PCNT_GPIO_LEVEL -1
-/*---------------------------------------------------------------
-        Fan control profile Macros
----------------------------------------------------------------*/
-#define FAN_START_DUTY   0.23
-//#define FAN_STOP_DUTY    0.17
-#define FAN_SELFTEST_UPER    0.35
-
-#define OFFSET0     0
-#define OFFSET1     400
-#define OFFSET2     1500
-#define GAIN0       0.001000000
-#define GAIN1       0.000363636
-#define GAIN2       0.000100000
 
-#define TERMAL_MAX 10.0
-#define T_ZERO    25.0
-#define T_MAX    50.0
-
-#define DEVIDE      0.681
-#define SCALE       (1.0/DEVIDE)
-#define SELFHEAT    0.75
-
-#define TSENS_FILTFACTOR    0.03125
-//#define TCELL_FILTFACTOR    0.03125
-#define TCELL_FILTFACTOR    0.0625
-//#define CURRENT_FILTFACTOR  0.01953125
-#define CURRENT_FILTFACTOR  0.09375
-
-adc_oneshot_unit_handle_t adc1_handle;
-adc_oneshot_unit_init_cfg_t init_config1 = {
-    .unit_id = ADC_UNIT_1,
-};
-
-static float current_filted;
-static float troom_filted;
-static float tcell_filted;
-static bool FAN_ON = true;
-static bool ON_SYNC = false;
-static bool example_adc_calibration_init(adc_unit_t unit, adc_channel_t channel, adc_atten_t atten, adc_cali_handle_t *out_handle);
+static bool FAN_ON[FAN_ZONE_NUM];
 //static bool MODE = FAN_STOP;
-static void example_adc_calibration_deinit(adc_cali_handle_t handle);
-
-
-static void fan_pwm_init(void)
-{
-    // Prepare and then apply the LEDC PWM timer configuration
-    ledc_timer_config_t ledc_timer = {
-        .speed_mode       = LEDC_MODE,
-        .duty_resolution  = LEDC_DUTY_RES,
-        .timer_num        = LEDC_TIMER,
-        .freq_hz          = LEDC_FREQUENCY,  // Set output frequency at 25 kHz
-    //    .clk_cfg          = LEDC_AUTO_CLK
-        .clk_cfg          = LEDC_USE_RC_FAST_CLK
-    };
-    ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
-
-    // Prepare and then apply the LEDC PWM channel configuration
-    ledc_channel_config_t ledc_channel = {
-        .speed_mode     = LEDC_MODE,
-        .channel        = LEDC_CHANNEL,
-        .timer_sel      = LEDC_TIMER,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = LEDC_OUTPUT_IO,
-        .duty           = LEDC_DUTY, // Set duty to 99%
-        .hpoint         = 0,
-        .sleep_mode     = LEDC_SLEEP_MODE_KEEP_ALIVE
-//        .sleep_mode     = LEDC_SLEEP_MODE_NO_ALIVE_ALLOW_PD
-    };
-    ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
-}
-
-static float i2duty(float i)
-{
-    if(i < OFFSET1)
-        return OFFSET0+GAIN0*i;
-    else
-        if(i < OFFSET2)
-            return OFFSET0+GAIN0*OFFSET1-GAIN1*OFFSET1+GAIN1*i;
-        else
-            return OFFSET0+GAIN0*OFFSET1-GAIN1*OFFSET1+GAIN1*OFFSET2-GAIN2*OFFSET2+GAIN2*i;
-}
-
-static float tt2duty(float troom, float tcell)
-{
-    float termal;
-
-    termal = tcell-troom;
-    if(termal > TERMAL_MAX)
-          return (tcell-T_ZERO)/(T_MAX-T_ZERO);
-    else
-        if(termal > 0)
-        {
-            termal /= TERMAL_MAX;
-            return termal*(tcell-T_ZERO)/(T_MAX-T_ZERO);
-        }
-        else
-            if(termal < -10.0)
-            {
-                ESP_LOGW(TAG, "Cell-sensor unhealth,room-temp used");
-                return (troom-T_ZERO)/(T_MAX-T_ZERO);
-            }
-            else
-                return 0.0;
-}
-
-static float fusion(float major,float minor)
-{
-    float merger;
-    merger = major*DEVIDE+minor*(1-DEVIDE);
-    merger *= SCALE;
-    if(merger > 1.0)
-        return 1.0;
-    else
-        if(merger < 0)
-            return 0;
-        else
-            return merger;
-}
-
-static float ntc2temp(int voltage)
-{
-    float temp = 3.79e-5;
-
-    temp -= 6.76e-9*voltage;
-    temp *= voltage;
-    temp *= voltage;
-    temp -= 9.65e-2*voltage;
-    return temp + 116.0;
-}
 
 void temp_read(void *arg)
 {
 
-    static float tsens_esp;
-    temperature_sensor_handle_t temp_sensor = NULL;
-    temperature_sensor_config_t temp_sensor_config = TEMPERATURE_SENSOR_CONFIG_DEFAULT(-10, 80);
+    static q16_t tsens[2];  // FAN_FRAME_TSENS group: filtered room, raw die
+    q16_t *troom_filted = &tsens[0];
+    q16_t *tsens_esp = &tsens[1];
+    int64_t acq_us;
+    fan_perf_task_register(FAN_PERF_TEMP, SENSOR_TASK_STACK);
     //-------------temp sensor Init---------------//
-    ESP_LOGI(TAG, "Install temperature sensor, expected temp ranger range: -10~80 ℃");
-    ESP_ERROR_CHECK(temperature_sensor_install(&temp_sensor_config, &temp_sensor));
-    ESP_LOGI(TAG, "Enable temperature sensor");
-    ESP_ERROR_CHECK(temperature_sensor_enable(temp_sensor));
+    ESP_ERROR_CHECK(fan_hal_tsens_init());
     //-------------temp sensor first read---------------//
-    vTaskDelay(100 / portTICK_PERIOD_MS);
-    ESP_ERROR_CHECK(temperature_sensor_get_celsius(temp_sensor, &troom_filted));
-    ESP_LOGI(TAG, "Temperature first read: %.1f ℃", troom_filted);
+    fan_hal_delay_ms(100);
+    ESP_ERROR_CHECK(fan_hal_tsens_read(tsens_esp));
+    *troom_filted = *tsens_esp;
+    ESP_LOGI(TAG, "Temperature first read: " Q16_FMT1 " ℃", Q16_DEC1(*troom_filted));
+    fan_frame_publish(FAN_FRAME_TSENS, tsens, fan_hal_now_us());
 
     while(1)
     {
-        if(FAN_ON == true)
-            vTaskDelay(6000 / portTICK_PERIOD_MS);
-        else
-            vTaskDelay(4000 / portTICK_PERIOD_MS);
-
-        ESP_ERROR_CHECK(temperature_sensor_get_celsius(temp_sensor, &tsens_esp));
-        troom_filted *= 1.0-TSENS_FILTFACTOR;
-        troom_filted += (tsens_esp-SELFHEAT)*TSENS_FILTFACTOR;
+        fan_sched_wait(SCHED_TEMP_TICK);
+        const fan_tuning_t *tune = fan_tuning();
+        //-------------A failed or implausible read leaves the field to age---------------//
+        acq_us = fan_hal_now_us();
+        esp_err_t ret = fan_hal_tsens_read(tsens_esp);
+        fan_perf_add(FAN_PERF_TSENS_ACQ, fan_hal_now_us() - acq_us);
+        if(fan_fault_check_tsens(ret, *tsens_esp))
+        {
+            *troom_filted = q16_ema(*troom_filted, *tsens_esp-tune->selfheat,
+                                    fan_sched_factor(tune->tsens_filt, FAN_TSENS_FILT_BASE_MS));
+            fan_frame_publish(FAN_FRAME_TSENS, tsens, fan_hal_now_us());
+        }
+        else if(ret != ESP_OK)
+        {
+            //-------------Driver restart before the next tick, the fault monitor reports---------------//
+            fan_hal_tsens_recover();
+        }
+        fan_sched_done(SCHED_TEMP_DONE);
     }
     
 }
@@ -239,346 +93,366 @@ void temp_read(void *arg)
 void adc_regulars(void *arg)
 {
     const static char *TAG_adc = "ADC-Reg";
-    static int adc_raw0;
-    static int adc_raw1;
-    static int vol_idc;
-    static int vol_ntc;
+    static fan_hal_adc_frame_t frame;
+    static q16_t filted[4 * FAN_ZONE_NUM];  // FAN_FRAME_ADC group: tcell, current, raw NTC, raw current per zone
+    int64_t acq_us;
+    fan_perf_task_register(FAN_PERF_ADC, SENSOR_TASK_STACK);
 
     //-------------ADC1 Init---------------//
-    ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config1, &adc1_handle));
-
-    //-------------ADC1 Config---------------//
-    adc_oneshot_chan_cfg_t config = {
-        .atten = EXAMPLE_ADC_ATTEN,
-        .bitwidth = ADC_BITWIDTH_DEFAULT,
-    };
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, EXAMPLE_ADC1_CHAN0, &config));
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, EXAMPLE_ADC1_CHAN1, &config));
+    ESP_ERROR_CHECK(fan_hal_adc_init());
     ESP_LOGI(TAG_adc, "ADC1 initialized and configured");
 
-    //-------------ADC1 Calibration Init---------------//
-    adc_cali_handle_t adc1_cali_chan0_handle = NULL;
-    adc_cali_handle_t adc1_cali_chan1_handle = NULL;
-    bool do_calibration1_chan0 = example_adc_calibration_init(ADC_UNIT_1, EXAMPLE_ADC1_CHAN0, EXAMPLE_ADC_ATTEN, &adc1_cali_chan0_handle);
-    bool do_calibration1_chan1 = example_adc_calibration_init(ADC_UNIT_1, EXAMPLE_ADC1_CHAN1, EXAMPLE_ADC_ATTEN, &adc1_cali_chan1_handle);
-
-    //-------------ADC1 ch0 first Read---------------//
-    ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, EXAMPLE_ADC1_CHAN0, &adc_raw0));
-    ESP_LOGI(TAG_adc, "ADC%d Channel[%d] Raw Data: %d", ADC_UNIT_1 + 1, EXAMPLE_ADC1_CHAN0, adc_raw0);
-    if (do_calibration1_chan0) {
-        ESP_ERROR_CHECK(adc_cali_raw_to_voltage(adc1_cali_chan0_handle, adc_raw0, &vol_idc));
-        ESP_LOGI(TAG_adc, "ADC%d Channel[%d] Cali Voltage: %d mV", ADC_UNIT_1 + 1, EXAMPLE_ADC1_CHAN0, vol_idc);
-    }
-    current_filted = (float)vol_idc;
-    //-------------ADC1 ch1 first Read---------------//
-    ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, EXAMPLE_ADC1_CHAN1, &adc_raw1));
-    ESP_LOGI(TAG_adc, "ADC%d Channel[%d] Raw Data: %d", ADC_UNIT_1 + 1, EXAMPLE_ADC1_CHAN1, adc_raw1);
-    if (do_calibration1_chan1) {
-        ESP_ERROR_CHECK(adc_cali_raw_to_voltage(adc1_cali_chan1_handle, adc_raw1, &vol_ntc));
-        ESP_LOGI(TAG_adc, "ADC%d Channel[%d] Cali Voltage: %d mV", ADC_UNIT_1 + 1, EXAMPLE_ADC1_CHAN1, vol_ntc);
+    //-------------ADC1 first Frame---------------//
+    ESP_ERROR_CHECK(fan_hal_adc_read_frame(&frame));
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++)
+    {
+        ESP_LOGI(TAG_adc, "%s: Current Voltage: " Q16_FMT1 " mV, NTC Voltage: " Q16_FMT1 " mV (%d samples)", fan_zones[zone].name,
+                 Q16_DEC1(frame.mv[zone][FAN_HAL_ADC_CURRENT]), Q16_DEC1(frame.mv[zone][FAN_HAL_ADC_NTC]), frame.samples);
+        filted[4 * zone] = ntc2temp_q(frame.mv[zone][FAN_HAL_ADC_NTC]);
+        filted[4 * zone + 1] = frame.mv[zone][FAN_HAL_ADC_CURRENT];
+        filted[4 * zone + 2] = frame.mv[zone][FAN_HAL_ADC_NTC];
+        filted[4 * zone + 3] = frame.mv[zone][FAN_HAL_ADC_CURRENT];
     }
-    tcell_filted = ntc2temp(vol_ntc);
+    fan_frame_publish(FAN_FRAME_ADC, filted, fan_hal_now_us());
 
     while(1)
     {
-        //-------------ADC1 ch0 Read---------------//
-        ESP_ERROR_CHECK(adc_oneshot_get_calibrated_result(adc1_handle, adc1_cali_chan0_handle, EXAMPLE_ADC1_CHAN0, &vol_idc));
-        //-------------ADC1 ch1 Read---------------//
-        ESP_ERROR_CHECK(adc_oneshot_get_calibrated_result(adc1_handle, adc1_cali_chan1_handle, EXAMPLE_ADC1_CHAN1, &vol_ntc));
-
-        //-------------ADC1 Data Filter---------------//
-        tcell_filted *= 1.0-TCELL_FILTFACTOR;
-        tcell_filted += ntc2temp(vol_ntc)*TCELL_FILTFACTOR;
-
-        current_filted *= 1.0-CURRENT_FILTFACTOR;
-        current_filted += CURRENT_FILTFACTOR*vol_idc;
-
-        vTaskDelay(2000 / portTICK_PERIOD_MS);
-        if(ON_SYNC == false)
+        //-------------ADC1 Frame Read, all zones in one scan---------------//
+        fan_sched_wait(SCHED_ADC_TICK);
+        acq_us = fan_hal_now_us();
+        esp_err_t ret = fan_hal_adc_read_frame(&frame);
+        fan_perf_add(FAN_PERF_ADC_ACQ, fan_hal_now_us() - acq_us);
+        fan_fault_observe(FAN_FAULT_ADC, -1, ret != ESP_OK);
+        if(ret != ESP_OK)
         {
-            //-------------ADC1 De-Init---------------//
-            ESP_ERROR_CHECK(adc_oneshot_del_unit(adc1_handle));
-            vTaskDelay(6000 / portTICK_PERIOD_MS);
-            //-------------ADC1 Re-Init---------------//
-            ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config1, &adc1_handle));
-            //-------------ADC1 Config---------------//
-            ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, EXAMPLE_ADC1_CHAN0, &config));
-            ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, EXAMPLE_ADC1_CHAN1, &config));
-            ON_SYNC = FAN_ON;
+            //-------------Driver restart before the next tick, the fault monitor reports---------------//
+            fan_hal_adc_recover();
+            fan_sched_done(SCHED_ADC_DONE);
+            continue;
         }
 
-        ESP_LOGI(TAG_adc, "Room-T: %.1f℃, Cell-T: %.1f℃, Current: %.0fmA", troom_filted, tcell_filted, current_filted);
-    }
+        //-------------Rail energy of the block---------------//
+        fan_energy_feed(&frame, fan_hal_now_us());
 
-    //Tear Down
-    ESP_ERROR_CHECK(adc_oneshot_del_unit(adc1_handle));
-    if (do_calibration1_chan0) {
-       example_adc_calibration_deinit(adc1_cali_chan0_handle);
-    }
-    if (do_calibration1_chan1) {
-       example_adc_calibration_deinit(adc1_cali_chan1_handle);
+        //-------------ADC1 Data Filter---------------//
+        const fan_tuning_t *tune = fan_tuning();
+        q16_t tcell_factor = fan_sched_factor(tune->tcell_filt, FAN_ADC_FILT_BASE_MS);
+        q16_t current_factor = fan_sched_factor(tune->current_filt, FAN_ADC_FILT_BASE_MS);
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++)
+        {
+            filted[4 * zone] = q16_ema(filted[4 * zone], ntc2temp_q(frame.mv[zone][FAN_HAL_ADC_NTC]), tcell_factor);
+            filted[4 * zone + 1] = q16_ema(filted[4 * zone + 1], frame.mv[zone][FAN_HAL_ADC_CURRENT], current_factor);
+            filted[4 * zone + 2] = frame.mv[zone][FAN_HAL_ADC_NTC];
+            filted[4 * zone + 3] = frame.mv[zone][FAN_HAL_ADC_CURRENT];
+        }
+        fan_frame_publish(FAN_FRAME_ADC, filted, fan_hal_now_us());
+        fan_sched_done(SCHED_ADC_DONE);
     }
 }
 
 void app_main(void *)
 {
+    const static char *TAG_boot = "Fan-Boot";
+    fan_perf_task_register(FAN_PERF_CTL, MAIN_TASK_STACK);
+#if FAN_CURVE_SELFTEST
+    ESP_ERROR_CHECK(fan_curve_selftest());
+    ESP_ERROR_CHECK(fan_est_selftest());
+    ESP_ERROR_CHECK(fan_telem_selftest());
+#endif
+    ESP_ERROR_CHECK(fan_hal_init());
+    //-------------Fault monitor before the first driver call it watches---------------//
+    ESP_ERROR_CHECK(fan_fault_init());
     //-------------Fan PWM Init---------------//
     // Set the LEDC peripheral configuration
-    fan_pwm_init();
-    ledc_stop(LEDC_MODE, LEDC_CHANNEL, 1);
-    ESP_LOGI(TAG, "FAN PWM initialized");
-    //-------------GPIO Init---------------//
-    //zero-initialize the config structure.
-    gpio_config_t io_conf = {};
-    //disable interrupt
-    io_conf.intr_type = GPIO_INTR_DISABLE;
-    //set as output mode
-    io_conf.mode = GPIO_MODE_OUTPUT;
-    //bit mask of the pins that you want to set,e.g.GPIO18/19
-    io_conf.pin_bit_mask = GPIO_OUTPUT_PIN_SEL;
-    //disable pull-down mode
-    io_conf.pull_down_en = 0;
-    //disable pull-up mode
-    io_conf.pull_up_en = 0;
-    //configure GPIO with the given settings
-    gpio_config(&io_conf);
-    gpio_set_level(GPIO_OUTPUT_LED_B, 0);
-    ESP_LOGI(TAG, "GPIO initialized");
-
-#if EXAMPLE_USE_ADC2
-    //-------------ADC2 Init---------------//
-    adc_oneshot_unit_handle_t adc2_handle;
-    adc_oneshot_unit_init_cfg_t init_config2 = {
-        .unit_id = ADC_UNIT_2,
-        .ulp_mode = ADC_ULP_MODE_DISABLE,
-    };
-    ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config2, &adc2_handle));
-
-    //-------------ADC2 Calibration Init---------------//
-    adc_cali_handle_t adc2_cali_handle = NULL;
-    bool do_calibration2 = example_adc_calibration_init(ADC_UNIT_2, EXAMPLE_ADC2_CHAN0, EXAMPLE_ADC_ATTEN, &adc2_cali_handle);
-
-    //-------------ADC2 Config---------------//
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc2_handle, EXAMPLE_ADC2_CHAN0, &config));
-#endif  //#if EXAMPLE_USE_ADC2
-
-    xTaskCreate(temp_read, "tempread_task", 4*1024, NULL, 2, NULL );
-    xTaskCreate(adc_regulars, "adc_regular_task", 4*1024, NULL, 2, NULL );
-    vTaskDelay(pdMS_TO_TICKS(2000));
+    ESP_ERROR_CHECK(fan_hal_pwm_init());
+    ESP_ERROR_CHECK(fan_pwm_init());
+    ESP_LOGI(TAG, "FAN PWM initialized, %d zones", FAN_ZONE_NUM);
+
+    //-------------Control profile from NVS, before anything reads the tuning---------------//
+    ESP_ERROR_CHECK(fan_hal_store_init());
+    ESP_ERROR_CHECK(fan_profile_init());
+
+    //-------------Binary records replace the per tick text---------------//
+    ESP_ERROR_CHECK(fan_telem_init());
+    ESP_ERROR_CHECK(fan_trace_init());
+    if(FAN_TELEM_BINARY)
+        esp_log_level_set(TAG, ESP_LOG_WARN);
+    //-------------Rail energy counters from NVS, before the ADC task meters---------------//
+    ESP_ERROR_CHECK(fan_energy_init());
+    //-------------Flash history, the fans run without it---------------//
+    if(fan_hist_init() != ESP_OK)
+        ESP_LOGW(TAG_boot, "Running without history");
+    //-------------SMART temperatures pushed by the NAS, the NTC does without---------------//
+    if(fan_host_init() != ESP_OK)
+        ESP_LOGW(TAG_boot, "Running without host link");
+    //-------------perf/tasks/pm commands, off while the UART carries telemetry---------------//
+    if(fan_console_init() != ESP_OK)
+        ESP_LOGW(TAG_boot, "Running without console");
+
+    ESP_ERROR_CHECK(fan_sched_init());
+    //-------------DS18B20 per bay, converting between the ticks---------------//
+    if(fan_bus_init() != ESP_OK)
+        ESP_LOGW(TAG_boot, "Running without bay sensors");
+    xTaskCreate(temp_read, "tempread_task", SENSOR_TASK_STACK, NULL, 2, NULL );
+    xTaskCreate(adc_regulars, "adc_regular_task", SENSOR_TASK_STACK, NULL, 2, NULL );
     //-------------PCNT Init---------------//
-    ESP_LOGI(TAG, "install pcnt unit");
-    pcnt_unit_config_t unit_config = {
-        .high_limit = PCNT_HIGH_LIMIT,
-        .low_limit = PCNT_LOW_LIMIT,
-    };
-    pcnt_unit_handle_t pcnt_unit = NULL;
-    ESP_ERROR_CHECK(pcnt_new_unit(&unit_config, &pcnt_unit));
-
-    ESP_LOGI(TAG, "set glitch filter");
-    pcnt_glitch_filter_config_t filter_config = {
-        .max_glitch_ns = 6000,
-    };
-    ESP_ERROR_CHECK(pcnt_unit_set_glitch_filter(pcnt_unit, &filter_config));
-//    ESP_ERROR_CHECK(pcnt_unit_set_glitch_filter(pcnt_unit, NULL));
-
-    ESP_LOGI(TAG, "install pcnt channels");
-    pcnt_chan_config_t chan_config = {
-        .edge_gpio_num = PCNT_GPIO_EDGE,
-        .level_gpio_num = PCNT_GPIO_LEVEL,
-    };
-    pcnt_channel_handle_t pcnt_chan = NULL;
-    ESP_ERROR_CHECK(pcnt_new_channel(pcnt_unit, &chan_config, &pcnt_chan));
-
-    // hold the counter on rising edge, increase the counter on falling edge
-    ESP_ERROR_CHECK(pcnt_channel_set_edge_action(pcnt_chan, PCNT_CHANNEL_EDGE_ACTION_HOLD, PCNT_CHANNEL_EDGE_ACTION_INCREASE));
-
-    ESP_LOGI(TAG, "enable pcnt unit");
-    ESP_ERROR_CHECK(pcnt_unit_enable(pcnt_unit));
-    ESP_LOGI(TAG, "clear pcnt unit");
-    ESP_ERROR_CHECK(pcnt_unit_clear_count(pcnt_unit));
-    ESP_LOGI(TAG, "start pcnt unit");
-    ESP_ERROR_CHECK(pcnt_unit_start(pcnt_unit));
-
-    static int pulse_count = 0;
-    ESP_ERROR_CHECK(pcnt_unit_get_count(pcnt_unit, &pulse_count));
-    ESP_LOGI(TAG, "waiting for Fan stop rotation...");
-    while(pulse_count != 0)
+    ESP_ERROR_CHECK(fan_tach_init());
+    ESP_LOGI(TAG, "start tach engine");
+
+    //-------------Start thresholds from NVS, self-test only the zones without one---------------//
+    ESP_ERROR_CHECK(fan_selftest_boot());
+    ESP_ERROR_CHECK(fan_cycle_init());
+    int cached = 0;
+    for (int zone = 0; zone < FAN_ZONE_NUM; zone++)
     {
-        ESP_ERROR_CHECK(pcnt_unit_clear_count(pcnt_unit));
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        ESP_ERROR_CHECK(pcnt_unit_get_count(pcnt_unit, &pulse_count));
+        //-------------Feed-forward and start/stop duties anchored at the detected start duty---------------//
+        fan_rpm_init(zone, fan_selftest_result(zone)->start_duty);
+        fan_cycle_set_start(zone, fan_selftest_result(zone)->start_duty, !fan_selftest_result(zone)->cached);
+        cached += fan_selftest_result(zone)->cached;
     }
-    vTaskDelay(pdMS_TO_TICKS(3000));
-
-    //-------------Fan Self-Test program---------------//
-    int DutyTestInv;
-    ESP_LOGI(TAG, "Fan Self-testing processing..."); 
-    for(DutyTestInv=255; DutyTestInv>(int)(255-FAN_SELFTEST_UPER*255); DutyTestInv--)
+    //-------------Fitted fan lines into the feed-forward---------------//
+    ESP_ERROR_CHECK(fan_tune_init());
+
+    static q16_t idc;
+    static q16_t tdc;
+    static q16_t duty[FAN_ZONE_NUM];
+    static q16_t duty_out;
+    static q16_t duty_applied[FAN_ZONE_NUM];   // Set on the PWM, where its fade ends
+    static fan_frame_t frame;
+    static q16_t troom;
+    static q16_t tcell;
+    static q16_t tdisk;
+    static q16_t tbus;
+    static q16_t current;
+    static q16_t tcell_last[FAN_ZONE_NUM];
+    static q16_t current_last[FAN_ZONE_NUM];
+    static q16_t duty_last[FAN_ZONE_NUM];
+    static fan_est_t est;
+#if FAN_EST_ENABLE
+    static fan_est_input_t est_in;
+    uint32_t est_start;
+#endif
+    bool settled = false;
+    bool controlling = false;
+    bool fan_on_last;
+    bool full;
+    bool running;
+    fan_selftest_step_t retest;
+    uint32_t faults;
+    uint8_t flags;
+    int64_t now_us;
+
+    ESP_ERROR_CHECK(fan_hal_pm_init());
+
+    //-------------Single aligned wakeup per tick for all zones---------------//
+    while (1)
     {
-        ESP_ERROR_CHECK(ledc_set_duty(LEDC_MODE, LEDC_CHANNEL, DutyTestInv));
-        ESP_ERROR_CHECK(ledc_update_duty(LEDC_MODE, LEDC_CHANNEL));
-        vTaskDelay(pdMS_TO_TICKS(150));
-        gpio_set_level(GPIO_OUTPUT_LED_B, 1);
-        vTaskDelay(pdMS_TO_TICKS(50));
-        gpio_set_level(GPIO_OUTPUT_LED_B, 0);
-
-        ESP_ERROR_CHECK(pcnt_unit_get_count(pcnt_unit, &pulse_count));
-
-        if(pulse_count > 12)
+        //-------------Tick boundary: sensor tasks are parked, a staged profile goes in whole---------------//
+        if(fan_profile_apply())
+            settled = false;
+        const fan_tuning_t *tune = fan_tuning();
+        //-------------A timer that failed to arm: try again after the shortest period---------------//
+        if(fan_fault_driver(fan_sched_next(settled), -1, "tick timer") != ESP_OK)
         {
-            ESP_LOGI(TAG, "Startup duty cycle detected at: %d%%", 100-(int)(0.392151*DutyTestInv)); //(1-DutyTestInv/255)*100
-            vTaskDelay(pdMS_TO_TICKS(1000));
-            break;
+            fan_hal_delay_ms(SCHED_PERIOD_MIN_MS);
+            continue;
+        }
+        fan_sched_wait_batch();
+
+        //-------------One consistent snapshot per tick---------------//
+        fan_frame_read(&frame);
+        now_us = fan_hal_now_us();
+        //-------------Closed hours and days of the rail energy, disk count changes---------------//
+        fan_energy_report();
+        settled = true;
+        //-------------Hold until the fault monitor has a verdict, then run on the fallback---------------//
+        if(fan_frame_age_ms(&frame, FAN_FIELD_TROOM, now_us) > FAN_FRAME_STALE_MS && !fan_fault_active(FAN_FAULT_TSENS, -1))
+        {
+            ESP_LOGW(TAG, "Stale room temperature, holding all zones");
+            settled = false;
+            continue;
+        }
+        troom = fan_frame_value(&frame, FAN_FIELD_TROOM, now_us);
+        if(!controlling)
+        {
+            ESP_LOGI(TAG_boot, "Boot to first control: %dms, %d of %d zones from cache", (int)(now_us / 1000), cached, FAN_ZONE_NUM);
+            controlling = true;
         }
-    }
-    if(DutyTestInv <= (int)(255-FAN_SELFTEST_UPER*255))
-    {
-        gpio_set_level(GPIO_OUTPUT_LED_B, 1);
-        ESP_LOGE(TAG, "Fan Self-testing fail due to missing FG signal!"); 
-    }
 
-    static float idc;
-    static float tdc;
-    static float duty;
-    static float duty_inv;
+        for (int zone = 0; zone < FAN_ZONE_NUM; zone++)
+        {
+            const fan_zone_t *z = &fan_zones[zone];
+            const fan_curve_t *curve = &tune->curve[zone];
 
-    #if CONFIG_PM_ENABLE
-    // Configure dynamic frequency scaling:
-    // maximum and minimum frequencies are set in sdkconfig,
-    // automatic light sleep is enabled if tickless idle support is enabled.
-    esp_pm_config_t pm_config = {
-            .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
-            .min_freq_mhz = CONFIG_XTAL_FREQ,
-#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
-            .light_sleep_enable = true
+            faults = fan_fault_mask(zone);
+            if((fan_frame_age_ms(&frame, FAN_FIELD_TCELL(zone), now_us) > FAN_FRAME_STALE_MS
+             || fan_frame_age_ms(&frame, FAN_FIELD_CURRENT(zone), now_us) > FAN_FRAME_STALE_MS)
+            && !(faults & BIT(FAN_FAULT_ADC)))
+            {
+                ESP_LOGW(TAG, "%s: Stale sensor frame, holding duty %d%%", z->name, q16_to_scaled(duty[zone], 100));
+                settled = false;
+                continue;
+            }
+#if FAN_EST_ENABLE
+            //-------------Estimator on the raw readings, the EMA fields stay aside---------------//
+            est_start = fan_hal_bench_now();
+            est_in.tcell = ntc2temp_q(frame.field[FAN_FIELD_NTC_MV(zone)].value);
+            est_in.tamb = frame.field[FAN_FIELD_TSENS_RAW].value - tune->selfheat;
+            est_in.current = frame.field[FAN_FIELD_CURRENT_MV(zone)].value;
+            est_in.seq[FAN_EST_NTC] = frame.field[FAN_FIELD_NTC_MV(zone)].seq;
+            est_in.seq[FAN_EST_TSENS] = frame.field[FAN_FIELD_TSENS_RAW].seq;
+            est_in.seq[FAN_EST_CURRENT] = frame.field[FAN_FIELD_CURRENT_MV(zone)].seq;
+            est_in.skip = (faults & (BIT(FAN_FAULT_NTC_OPEN) | BIT(FAN_FAULT_NTC_SHORT)) ? BIT(FAN_EST_NTC) : 0)
+                        | (faults & BIT(FAN_FAULT_TSENS) ? BIT(FAN_EST_TSENS) : 0)
+                        | (faults & BIT(FAN_FAULT_CURRENT_SAT) ? BIT(FAN_EST_CURRENT) : 0);
+            est_in.rpm = fan_tach_rpm_avg(zone);
+            est_in.stamp_us = frame.field[FAN_FIELD_NTC_MV(zone)].stamp_us;
+            fan_est_update(zone, &curve->model, &est_in, &est);
+            fan_perf_add(FAN_PERF_EST_CPU, fan_hal_bench_now() - est_start);
+            troom = est.tamb;
+            tcell = est.tcell;
+            current = est.current;
+#else
+            tcell = fan_frame_value(&frame, FAN_FIELD_TCELL(zone), now_us);
+            current = fan_frame_value(&frame, FAN_FIELD_CURRENT(zone), now_us);
+            if(faults & (BIT(FAN_FAULT_NTC_OPEN) | BIT(FAN_FAULT_NTC_SHORT)))
+                tcell = troom;
 #endif
-    };
-    ESP_ERROR_CHECK( esp_pm_configure(&pm_config) );
-#endif // CONFIG_PM_ENABLE
-
-    while (1)
-    {
-        idc = i2duty(current_filted);
-        tdc = tt2duty(troom_filted,tcell_filted);
-        duty = fusion(tdc,idc);
-        duty_inv = 1.0-duty;
-        ESP_LOGI(TAG, "T->duty: %.02f,I->duty: %.02f =>Merger: %.02f", tdc, idc, duty);
-
-        if(FAN_ON == true)
-        {
-            ESP_ERROR_CHECK(pcnt_unit_clear_count(pcnt_unit));
-            vTaskDelay(pdMS_TO_TICKS(2000));
-            ESP_ERROR_CHECK(pcnt_unit_get_count(pcnt_unit, &pulse_count));
-            if(pulse_count > 12 || duty > FAN_START_DUTY)
+            //-------------Raw readings against their plausible range---------------//
+            fan_fault_check_sensors(zone, frame.field[FAN_FIELD_NTC_MV(zone)].value, frame.field[FAN_FIELD_CURRENT_MV(zone)].value,
+                                    ntc2temp_q(frame.field[FAN_FIELD_NTC_MV(zone)].value), troom);
+            ESP_LOGI(TAG, "%s: Room-T: " Q16_FMT1 "℃, Cell-T: " Q16_FMT1 "℃, Current: %dmA", z->name,
+                     Q16_DEC1(troom), Q16_DEC1(tcell), q16_to_scaled(current, 1));
+
+            fan_on_last = FAN_ON[zone];
+            flags = 0;
+            idc = i2duty_q(curve, current);
+            //-------------Host's disk temperature while fresh and hotter than the cage NTC---------------//
+            if(!fan_host_tdisk(&frame, zone, now_us, &tdisk) || tdisk < tcell)
+                tdisk = tcell;
+            //-------------Hottest bay (or weighted bays) of the sensor bus likewise---------------//
+            if(fan_bus_tzone(&frame, zone, now_us, &tbus) && tbus > tdisk)
+                tdisk = tbus;
+            tdc = tt2duty_q(curve, troom, tdisk);
+            duty[zone] = fusion_q(curve, tdc, idc);
+            //-------------Identification holds the demand at its steps---------------//
+            duty[zone] = fan_tune_demand(zone, duty[zone], tcell);
+            //-------------Fail-safe of an active fault over the demand---------------//
+            duty[zone] = fan_fault_failsafe(zone, duty[zone], &full);
+            ESP_LOGI(TAG, "%s: T->duty: %d%%,I->duty: %d%% =>Merger: %d%%", z->name,
+                     q16_to_scaled(tdc, 100), q16_to_scaled(idc, 100), q16_to_scaled(duty[zone], 100));
+
+            //-------------No tach while driven at the start duty or more: stall fault---------------//
+            if(FAN_ON[zone])
+                fan_fault_observe(FAN_FAULT_STALL, zone, fan_tach_stalled(zone) && fan_pwm_duty(zone) >= fan_selftest_result(zone)->start_duty);
+
+            //-------------Cached threshold no longer fits the fan, test it again; not a stalled one---------------//
+            running = FAN_ON[zone] && !fan_fault_seen(FAN_FAULT_STALL, zone);
+            if(running)
+                fan_selftest_observe(zone, fan_pwm_duty(zone), fan_tach_rpm_avg(zone), fan_tach_stalled(zone));
+            running = running && fan_cycle_state(zone) == FAN_CYCLE_RUN;
+            //-------------A probe per tick, the other zones keep control; put off while the cage needs its fan---------------//
+            retest = fan_selftest_step(zone, running,
+                                       duty[zone] >= Q16(FAN_CYCLE_URGENT) || fan_fault_pending() || fan_fault_mask(zone));
+            if(retest == FAN_SELFTEST_BUSY)
             {
-                ledc_set_duty(LEDC_MODE, LEDC_CHANNEL, (unsigned char)(duty_inv*255));
-                ledc_update_duty(LEDC_MODE, LEDC_CHANNEL);
-                ESP_LOGI(TAG, "Duty: %d%%, RPM=%d", (int)(duty*100), pulse_count*15);   //pulse/2(pole)/2(sec)*60(sec)
+                duty_applied[zone] = fan_pwm_duty(zone);
+                flags |= FAN_TELEM_RETEST;
+                FAN_ON[zone] = false;
+                settled = false;
             }
-            else
+            else if(retest != FAN_SELFTEST_IDLE)
             {
-                ledc_stop(LEDC_MODE, LEDC_CHANNEL, 1);
-                ESP_ERROR_CHECK(pcnt_unit_disable(pcnt_unit));
-                ESP_LOGI(TAG, "Low RPM: %d%%, Fan => OFF", (int)(duty*100));
-                FAN_ON = false;
-                ON_SYNC = false;
+                fan_rpm_init(zone, fan_selftest_result(zone)->start_duty);
+                fan_cycle_set_start(zone, fan_selftest_result(zone)->start_duty, retest == FAN_SELFTEST_DONE);
+                duty_applied[zone] = 0;
+                flags |= FAN_TELEM_RETEST;
+                FAN_ON[zone] = false;
             }
-        }
-        else
-        {
-            if(duty > FAN_START_DUTY)
+            //-------------Start/stop state machine: kick, run down to the floor, dwell---------------//
+            else switch(fan_cycle_update(zone, duty[zone], duty_applied[zone], fan_tach_stalled(zone), &duty_out))
             {
-                ledc_set_duty(LEDC_MODE, LEDC_CHANNEL, (unsigned char)(duty_inv*255));
-                ledc_update_duty(LEDC_MODE, LEDC_CHANNEL);
-                ESP_LOGI(TAG, "Duty: %d%%, Fan => START", (int)(duty*100));
+            case FAN_CYCLE_START:
                 //pcnt eable and start
-                ESP_ERROR_CHECK(pcnt_unit_enable(pcnt_unit));
-                ESP_ERROR_CHECK(pcnt_unit_start(pcnt_unit));
-                FAN_ON = true;
+                fan_fault_driver(fan_tach_start(zone), zone, "tach start");
+                flags |= FAN_TELEM_START;
+                FAN_ON[zone] = true;
+                /* fall through */
+            case FAN_CYCLE_RESTART:
+                fan_pwm_jump(zone, duty_out);
+                duty_applied[zone] = duty_out;
+                ESP_LOGI(TAG, "%s: Duty: %d%%, Fan => KICK %d%%", z->name, Q16_INT(duty[zone]*100), Q16_INT(duty_out*100));
+                break;
+            case FAN_CYCLE_SPIN:
+                fan_rpm_reset(zone);
+                /* fall through */
+            case FAN_CYCLE_RUNNING:
+                if(!fan_tach_running(zone))
+                    fan_fault_driver(fan_tach_start(zone), zone, "tach start");
+                duty_out = fan_rpm_update(zone, duty_out, fan_tach_rpm_avg(zone));
+                //-------------Fade there at the slew rate, the LEDC ramps while the CPU sleeps; a fail-safe jumps---------------//
+                if(fan_fault_mask(zone))
+                    fan_pwm_jump(zone, duty_out);
+                else
+                    fan_pwm_set(zone, duty_out);
+                duty_applied[zone] = duty_out;
+                ESP_LOGI(TAG, "%s: Duty: %d%%, RPM=%d (avg %d, target %d)", z->name,
+                         Q16_INT(duty_out*100), fan_tach_rpm(zone), fan_tach_rpm_avg(zone), fan_rpm_target(zone));
+                break;
+            case FAN_CYCLE_STOP:
+                fan_pwm_stop(zone);
+                fan_fault_driver(fan_tach_stop(zone), zone, "tach stop");
+                ESP_LOGI(TAG, "%s: Low demand: %d%%, Fan => OFF", z->name, Q16_INT(duty[zone]*100));
+                duty_applied[zone] = 0;
+                flags |= FAN_TELEM_STOP;
+                FAN_ON[zone] = false;
+                break;
+            default:
+                break;
+            }
+            //-------------Stalled fan or blind ADC: flat out now, past the RPM loop and the kick---------------//
+            if(full && FAN_ON[zone] && fan_pwm_duty(zone) != Q16_ONE)
+            {
+                fan_pwm_jump(zone, Q16_ONE);
+                duty_applied[zone] = Q16_ONE;
             }
-            vTaskDelay(pdMS_TO_TICKS(4000));
-        }
-//        esp_pm_dump_locks(stdout);
-
-#if EXAMPLE_USE_ADC2
-        ESP_ERROR_CHECK(adc_oneshot_read(adc2_handle, EXAMPLE_ADC2_CHAN0, &adc_raw[1][0]));
-        ESP_LOGI(TAG, "ADC%d Channel[%d] Raw Data: %d", ADC_UNIT_2 + 1, EXAMPLE_ADC2_CHAN0, adc_raw[1][0]);
-        if (do_calibration2) {
-            ESP_ERROR_CHECK(adc_cali_raw_to_voltage(adc2_cali_handle, adc_raw[1][0], &voltage[1][0]));
-            ESP_LOGI(TAG, "ADC%d Channel[%d] Cali Voltage: %d mV", ADC_UNIT_2 + 1, EXAMPLE_ADC2_CHAN0, voltage[1][0]);
-        }
-        vTaskDelay(pdMS_TO_TICKS(1000));
-#endif  //#if EXAMPLE_USE_ADC2
-    }
-
-#if EXAMPLE_USE_ADC2
-    ESP_ERROR_CHECK(adc_oneshot_del_unit(adc2_handle));
-    if (do_calibration2) {
-        example_adc_calibration_deinit(adc2_cali_handle);
-    }
-#endif //#if EXAMPLE_USE_ADC2
-}
-
-/*---------------------------------------------------------------
-        ADC Calibration
----------------------------------------------------------------*/
-static bool example_adc_calibration_init(adc_unit_t unit, adc_channel_t channel, adc_atten_t atten, adc_cali_handle_t *out_handle)
-{
-    adc_cali_handle_t handle = NULL;
-    esp_err_t ret = ESP_FAIL;
-    bool calibrated = false;
-
-#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
-    if (!calibrated) {
-        ESP_LOGI(TAG, "calibration scheme version is %s", "Curve Fitting");
-        adc_cali_curve_fitting_config_t cali_config = {
-            .unit_id = unit,
-            .chan = channel,
-            .atten = atten,
-            .bitwidth = ADC_BITWIDTH_DEFAULT,
-        };
-        ret = adc_cali_create_scheme_curve_fitting(&cali_config, &handle);
-        if (ret == ESP_OK) {
-            calibrated = true;
-        }
-    }
-#endif
 
-#if ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
-    if (!calibrated) {
-        ESP_LOGI(TAG, "calibration scheme version is %s", "Line Fitting");
-        adc_cali_line_fitting_config_t cali_config = {
-            .unit_id = unit,
-            .atten = atten,
-            .bitwidth = ADC_BITWIDTH_DEFAULT,
-        };
-        ret = adc_cali_create_scheme_line_fitting(&cali_config, &handle);
-        if (ret == ESP_OK) {
-            calibrated = true;
+            //-------------Stretch the period while every cage is settled, never while capturing a trace---------------//
+            settled = settled && !FAN_TRACE_CAPTURE && FAN_ON[zone] == fan_on_last && !fan_fault_pending()
+                   && fan_cycle_state(zone) != FAN_CYCLE_KICK
+                   && (!FAN_ON[zone] || fan_rpm_settled(zone))
+                   && abs(tcell - tcell_last[zone]) < Q16(SCHED_DELTA_TCELL)
+                   && abs(current - current_last[zone]) < Q16(SCHED_DELTA_CURRENT)
+                   && abs(duty[zone] - duty_last[zone]) < Q16(SCHED_DELTA_DUTY);
+            tcell_last[zone] = tcell;
+            current_last[zone] = current;
+            duty_last[zone] = duty[zone];
+
+            //-------------One telemetry record per zone and tick---------------//
+            flags |= (FAN_ON[zone] ? FAN_TELEM_ON : 0) | (fan_tach_stalled(zone) ? FAN_TELEM_STALLED : 0)
+                   | (FAN_ON[zone] && fan_rpm_settled(zone) ? FAN_TELEM_SETTLED : 0)
+                   | (FAN_EST_ENABLE && est.suspect ? FAN_TELEM_SUSPECT : 0);
+            fan_telem_sample_t sample = {
+                .tsens = frame.field[FAN_FIELD_TSENS_RAW].value,
+                .troom = troom,
+                .ntc_mv = frame.field[FAN_FIELD_NTC_MV(zone)].value,
+                .tcell = tcell,
+                .current_mv = frame.field[FAN_FIELD_CURRENT_MV(zone)].value,
+                .current = current,
+                .tdc = tdc,
+                .idc = idc,
+                .duty = duty[zone],
+                .duty_out = duty_applied[zone],
+                .rpm = fan_tach_rpm_avg(zone),
+                .target = FAN_ON[zone] ? fan_rpm_target(zone) : 0,
+                .flags = flags,
+            };
+            fan_telem_record(zone, &sample);
+            fan_trace_record(zone, &frame, flags);
+            fan_hist_record(zone, &sample);
+            //-------------Identification only on healthy sensors---------------//
+            if(!faults)
+                fan_tune_observe(zone, &sample);
         }
     }
-#endif
-
-    *out_handle = handle;
-    if (ret == ESP_OK) {
-        ESP_LOGI(TAG, "Calibration Success");
-    } else if (ret == ESP_ERR_NOT_SUPPORTED || !calibrated) {
-        ESP_LOGW(TAG, "eFuse not burnt, skip software calibration");
-    } else {
-        ESP_LOGE(TAG, "Invalid arg or no memory");
-    }
-
-    return calibrated;
 }
-
-static void example_adc_calibration_deinit(adc_cali_handle_t handle)
-{
-#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
-    ESP_LOGI(TAG, "deregister %s calibration scheme", "Curve Fitting");
-    ESP_ERROR_CHECK(adc_cali_delete_scheme_curve_fitting(handle));
-
-#elif ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
-    ESP_LOGI(TAG, "deregister %s calibration scheme", "Line Fitting");
-    ESP_ERROR_CHECK(adc_cali_delete_scheme_line_fitting(handle));
-#endif
-}
\ No newline at end of file
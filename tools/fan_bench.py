@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""Compare the trace replay scores of two simulator runs.
+
+The linux target writes fan_bench.json at the end of every run (see
+SIM_BENCH_FILE in main/fan_hal_sim.c). With SIM_TRACE naming a capture in
+the environment it replays a recorded sensor trace, so two runs of the
+same trace differ only in the firmware. The base is a cold boot replay of
+tools/fan_bench_trace.bin. Every zone is checked against the base run; a score worse than
+its tolerance is a regression and the exit status is 1.
+
+Duty and starts come from the open loop, the recorded sensors through the
+firmware's filters and curves; minutes above the ceiling and the cell
+maximum from the closed loop, where the fans cool the simulated cages.
+Control ticks and wakeups per hour are counts and gated on every host.
+CPU time is host nanoseconds on the simulator and only checked with --cpu,
+on the same machine; a base in CPU cycles is always checked.
+
+    SIM_TRACE=tools/fan_bench_trace.bin ./build/nas-fan-control.elf    # no fan_store.bin
+    tools/fan_bench.py tools/fan_bench_base.json fan_bench.json
+    tools/fan_bench.py fan_bench.json        # replayed against recorded, same trace
+
+With one file the replay is checked against the controller that recorded
+the trace, which only makes sense for a run with a trace: its starts
+against the open loop, the cell against the closed loop. The trace holds
+the PWM duty and not the demand, so the duty is not compared.
+"""
+import argparse
+import json
+import sys
+from typing import Dict, List, Tuple
+
+# Score, allowed increase over the base; every score is better lower
+OPEN_LOOP = (('mean_duty', 1.0), ('peak_duty', 5.0), ('starts', 0))
+CLOSED_LOOP = (('above_min', 5.0), ('cell_max', 0.5))
+COUNT_FACTOR = 1.05     # ticks_h, wakeups_h
+CPU_FACTOR = 1.5
+
+
+def load(path: str) -> dict:
+    with open(path) as f:
+        return json.load(f)
+
+
+def compare(base: Dict[str, dict], new: Dict[str, dict], tolerance: tuple) -> Tuple[List[List[str]], int]:
+    rows = []
+    worse = 0
+    for zone in base:
+        if zone not in new:
+            rows.append([zone, 'missing', '', '', ''])
+            worse += 1
+            continue
+        for key, tol in tolerance:
+            a, b = base[zone][key], new[zone][key]
+            bad = b > a + tol
+            worse += bad
+            rows.append([zone, key, f'{a:g}', f'{b:g}', 'WORSE' if bad else ''])
+    return rows, worse
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('base', help='fan_bench.json of the base run')
+    parser.add_argument('new', nargs='?', help='fan_bench.json of the run under test')
+    parser.add_argument('--cpu', action='store_true', help='also check host nanoseconds, same machine only')
+    parser.add_argument('--no-cpu', action='store_true', help='skip the CPU time, also in cycles')
+    args = parser.parse_args()
+
+    base = load(args.base)
+    if args.new:
+        new = load(args.new)
+        if base['trace'] != new['trace']:
+            print(f'warning: traces differ ({base["trace"] or "none"} vs {new["trace"] or "none"})', file=sys.stderr)
+        if 'open_loop' in base and 'open_loop' in new:
+            rows, worse = compare(base['open_loop'], new['open_loop'], OPEN_LOOP)
+            more, n = compare(base['replayed'], new['replayed'], CLOSED_LOOP)
+            rows, worse = rows + more, worse + n
+        else:
+            rows, worse = compare(base['replayed'], new['replayed'], OPEN_LOOP + CLOSED_LOOP)
+    elif 'recorded' in base:
+        new = base
+        rows, worse = compare(base['recorded'], base['open_loop'], OPEN_LOOP[2:])
+        more, n = compare(base['recorded'], base['replayed'], CLOSED_LOOP)
+        rows, worse = rows + more, worse + n
+    else:
+        parser.error(f'{args.base} has no recorded scores, run with SIM_TRACE or give two files')
+
+    if args.new:
+        for key in ('ticks_h', 'wakeups_h'):
+            a, b = base[key], new[key]
+            bad = b > a * COUNT_FACTOR
+            worse += bad
+            rows.append(['all', key, str(a), str(b), 'WORSE' if bad else ''])
+    cpu = not args.no_cpu and (args.cpu or new['cpu_unit'] != 'ns')
+    if args.new and cpu:
+        for key in ('ctl_cpu', 'open_loop_cpu'):
+            if key in base and key in new:
+                a, b = base[key], new[key]
+                bad = b > a * CPU_FACTOR
+                worse += bad
+                rows.append(['all', f'{key} ({new["cpu_unit"]})', str(a), str(b), 'WORSE' if bad else ''])
+
+    widths = [max(len(r[i]) for r in rows) for i in range(4)]
+    for r in rows:
+        print('  '.join(c.ljust(w) for c, w in zip(r, widths)) + '  ' + r[4])
+    print(f'{worse} regressions in {base["hours"]:g} h against {args.base}' if args.new else
+          f'{worse} regressions against the recorded controller')
+    return 1 if worse else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
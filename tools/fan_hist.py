@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""Export the flash history of main/fan_hist.c to CSV.
+
+Read the partition off the board first:
+
+    parttool.py read_partition --partition-name history --output history.bin
+    tools/fan_hist.py history.bin --tier minute > minute.csv
+
+On the linux target the partition is fan_history.bin in the working
+directory. Pages with a bad CRC (torn by a reset) are skipped and counted.
+Rows come out in write order, oldest first; times are seconds since the
+boot in the first column. Tick records carry milliseconds modulo 2^32
+(49.7 days); they are unwrapped against the newest minute or hour record
+of the same boot, which is never more than a few hours away.
+"""
+import argparse
+import binascii
+import csv
+import struct
+import sys
+
+PAGE = 256
+MAGIC = 0x4846
+HEADER = struct.Struct('<HBBIHHI')          # fan_hist_page_hdr_t
+TICK = struct.Struct('<IBBhhHHH')           # fan_hist_tick_t
+AGG = struct.Struct('<IBBHhhhhHHHHHHHH')    # fan_hist_agg_t
+TIERS = {'tick': 0, 'minute': 1, 'hour': 2}
+WRAP_MS = 1 << 32
+
+FLAGS = ((0x01, 'on'), (0x02, 'stalled'), (0x04, 'settled'), (0x08, 'start'), (0x10, 'stop'), (0x20, 'retest'),
+         (0x80, 'suspect'))
+
+
+def flag_names(flags: int) -> str:
+    return '|'.join(name for bit, name in FLAGS if flags & bit)
+
+
+def temp(v: int) -> str:
+    return f'{v / 256:.2f}'
+
+
+def duty(v: int) -> str:
+    return f'{v / 65536:.4f}'
+
+
+def unwrap(ms: int, near_ms: int) -> int:
+    """The ms + k * 2^32 closest to near_ms."""
+    return ms + WRAP_MS * round((near_ms - ms) / WRAP_MS)
+
+
+def tick_row(boot: int, rec: tuple, ms: int) -> list:
+    _, zone, flags, troom, tcell, current, dc, rpm = rec
+    return [boot, f'{ms / 1000:.3f}', zone, flag_names(flags), temp(troom), temp(tcell), current, duty(dc), rpm]
+
+
+def agg_row(boot: int, rec: tuple, _ms: int) -> list:
+    (s, zone, starts, ticks, troom, tcell_min, tcell_avg, tcell_max, i_min, i_avg, i_max,
+     d_min, d_avg, d_max, rpm_avg, rpm_max) = rec
+    return [boot, s, zone, ticks, starts, temp(troom), temp(tcell_min), temp(tcell_avg), temp(tcell_max),
+            i_min, i_avg, i_max, duty(d_min), duty(d_avg), duty(d_max), rpm_avg, rpm_max]
+
+
+TICK_COLUMNS = ['boot', 's', 'zone', 'flags', 'troom', 'tcell', 'current', 'duty', 'rpm']
+AGG_COLUMNS = ['boot', 's', 'zone', 'ticks', 'starts', 'troom_avg', 'tcell_min', 'tcell_avg', 'tcell_max',
+               'current_min', 'current_avg', 'current_max', 'duty_min', 'duty_avg', 'duty_max', 'rpm_avg', 'rpm_max']
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('image', help='partition dump')
+    parser.add_argument('--tier', choices=TIERS, default='minute')
+    args = parser.parse_args()
+
+    data = open(args.image, 'rb').read()
+    tier = TIERS[args.tier]
+    pages = []
+    anchor = {}                             # Newest aggregate of every boot, ms since that boot
+    torn = 0
+    for off in range(0, len(data) - PAGE + 1, PAGE):
+        page = data[off:off + PAGE]
+        magic, page_tier, count, seq, boot, _, crc = HEADER.unpack_from(page)
+        if magic != MAGIC or page_tier not in TIERS.values():
+            continue
+        if binascii.crc32(page[:HEADER.size - 4] + page[HEADER.size:]) != crc:
+            torn += page_tier == tier
+            continue
+        if page_tier != 0:
+            for r in AGG.iter_unpack(page[HEADER.size:HEADER.size + count * AGG.size]):
+                anchor[boot] = max(anchor.get(boot, 0), r[0] * 1000)
+        if page_tier == tier:
+            pages.append((seq, boot, count, page[HEADER.size:]))
+
+    rec, row, columns = (TICK, tick_row, TICK_COLUMNS) if tier == 0 else (AGG, agg_row, AGG_COLUMNS)
+    out = csv.writer(sys.stdout)
+    out.writerow(columns)
+    rows = 0
+    last = {}                               # Unwrapped time of the previous tick of every boot
+    for seq, boot, count, body in sorted(pages):
+        for r in rec.iter_unpack(body[:count * rec.size]):
+            ms = 0
+            if tier == 0:
+                ms = unwrap(r[0], last.get(boot, anchor.get(boot, r[0])))
+                last[boot] = ms
+            out.writerow(row(boot, r, ms))
+            rows += 1
+    print(f'{args.tier}: {rows} records in {len(pages)} pages, {torn} torn pages skipped', file=sys.stderr)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""Push SMART disk temperatures and spin states to the fan controller (main/fan_host.h).
+
+Run on the NAS, one --disk per drive with the zone (fan_zones[] index) of its
+cage. Every period the drives are read with smartctl, without spinning up the
+ones in standby, and sent as one DISKS frame; the controller answers each one
+with an ACK. Needs pyserial, and smartctl unless --fake is given.
+
+    tools/fan_host.py --port /dev/ttyUSB1 --disk /dev/sda:0 --disk /dev/sdb:0 --disk /dev/nvme0:3
+    tools/fan_host.py --port /dev/pts/7 --disk sda:0 --disk sdb:1 --fake disks.json --period 5
+
+--fake reads the readings from a JSON file instead, re-read on every push, so
+a test can change them while the daemon runs:
+
+    {"sda": {"temp": 41.5, "state": "active"}, "sdb": {"temp": 38, "state": "standby"}}
+"""
+import argparse
+import binascii
+import json
+import struct
+import subprocess
+import sys
+import time
+from typing import List, Optional, Tuple
+
+SYNC = b'\xfa\xde'
+VERSION = 1
+DISKS = 0x01
+ACK = 0x81
+HEADER = struct.Struct('<2sBBBB')        # sync, version, type, seq, len
+ENTRY = struct.Struct('<BBhB')           # zone, disk, temp 1/256 ℃, state
+CRC = struct.Struct('<I')
+WAKE = b'\x55' * 4                       # FAN_HOST_WAKE_BYTES
+WAKE_S = 0.005                           # FAN_HOST_WAKE_MS
+DISKS_MAX = 16
+STATES = {'unknown': 0, 'active': 1, 'idle': 2, 'standby': 3}
+ACK_STATUS = {0: 'ok', 1: 'bad length', 2: 'bad entry'}
+
+
+def frame(kind: int, seq: int, payload: bytes) -> bytes:
+    body = HEADER.pack(SYNC, VERSION, kind, seq & 0xff, len(payload)) + payload
+    return body + CRC.pack(binascii.crc32(body))
+
+
+def disks_frame(seq: int, period_s: int, readings: List[Tuple[int, int, float, str]]) -> bytes:
+    payload = struct.pack('<BB', period_s, len(readings))
+    for zone, disk, temp, state in readings:
+        payload += ENTRY.pack(zone, disk, round(temp * 256), STATES[state])
+    return frame(DISKS, seq, payload)
+
+
+def read_smart(dev: str) -> Tuple[Optional[float], str]:
+    # -n standby leaves a sleeping drive alone and exits with bit 1 set
+    res = subprocess.run(['smartctl', '-n', 'standby', '-A', '-j', dev], capture_output=True, text=True)
+    if res.returncode & 0x02 and 'STANDBY' in res.stdout.upper():
+        return None, 'standby'
+    try:
+        temp = json.loads(res.stdout)['temperature']['current']
+    except (ValueError, KeyError):
+        return None, 'unknown'
+    return float(temp), 'active'
+
+
+def read_fake(path: str, name: str) -> Tuple[Optional[float], str]:
+    try:
+        with open(path) as f:
+            disk = json.load(f).get(name)
+    except (OSError, ValueError):
+        return None, 'unknown'
+    if disk is None:
+        return None, 'unknown'
+    return float(disk['temp']), disk.get('state', 'active')
+
+
+def acks(port, seq: int, timeout_s: float) -> Optional[Tuple[int, int]]:
+    """Status and disks taken of the ACK for seq, None when none came."""
+    buf = b''
+    deadline = time.monotonic() + timeout_s
+    while time.monotonic() < deadline:
+        buf += port.read(64)
+        while True:
+            start = buf.find(SYNC)
+            if start < 0 or len(buf) - start < HEADER.size:
+                break
+            _, version, kind, ack_seq, length = HEADER.unpack_from(buf, start)
+            end = start + HEADER.size + length + CRC.size
+            if len(buf) < end:
+                break
+            body = buf[start:end - CRC.size]
+            good = CRC.unpack_from(buf, end - CRC.size)[0] == binascii.crc32(body)
+            buf = buf[end:] if good else buf[start + 1:]
+            if good and version == VERSION and kind == ACK and ack_seq == seq & 0xff and length == 2:
+                return body[HEADER.size], body[HEADER.size + 1]
+    return None
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('--port', required=True, help='serial device of the controller link, or the pty of the simulator')
+    ap.add_argument('--baud', type=int, default=115200)
+    ap.add_argument('--disk', action='append', required=True, metavar='DEV:ZONE',
+                    help='drive and the zone of its cage, repeat per drive')
+    ap.add_argument('--period', type=int, default=30, help='seconds between pushes (1..255)')
+    ap.add_argument('--fake', metavar='JSON', help='readings from this file instead of smartctl')
+    ap.add_argument('--count', type=int, default=0, help='stop after this many pushes, 0 runs forever')
+    ap.add_argument('-v', '--verbose', action='store_true', help='print every push and its ACK')
+    args = ap.parse_args()
+
+    import serial  # pyserial, only needed past the argument check
+
+    disks = []
+    for i, spec in enumerate(args.disk):
+        dev, _, zone = spec.rpartition(':')
+        if not dev or not zone.isdigit():
+            ap.error(f'--disk {spec}: expected DEV:ZONE')
+        disks.append((dev, int(zone), i))
+    if len(disks) > DISKS_MAX:
+        ap.error(f'at most {DISKS_MAX} disks per controller')
+    if not 1 <= args.period <= 255:
+        ap.error('--period must be 1..255 s')
+
+    port = serial.Serial(args.port, args.baud, timeout=0.1)
+    seq = 0
+    missed = 0
+    while args.count == 0 or seq < args.count:
+        started = time.monotonic()
+        readings = []
+        for dev, zone, index in disks:
+            temp, state = read_fake(args.fake, dev) if args.fake else read_smart(dev)
+            # A standby drive goes without a reading, the controller leaves it out of the fold
+            readings.append((zone, index, temp if temp is not None else 0.0, state))
+        readings = [r for r in readings if r[3] != 'unknown']
+
+        port.reset_input_buffer()
+        port.write(WAKE)
+        port.flush()
+        time.sleep(WAKE_S)
+        port.write(disks_frame(seq, args.period, readings))
+        port.flush()
+        ack = acks(port, seq, min(1.0, args.period / 2))
+        if ack is None:
+            missed += 1
+            print(f'push {seq}: no ACK ({missed} in a row)', file=sys.stderr)
+        else:
+            missed = 0
+            if ack[0] != 0 or args.verbose:
+                print(f'push {seq}: {len(readings)} disks, ACK {ACK_STATUS.get(ack[0], ack[0])}, {ack[1]} taken, '
+                      + ', '.join(f'{args.disk[i]} {t:.1f}C {s}' for _, i, t, s in readings), file=sys.stderr)
+        seq += 1
+        time.sleep(max(0.0, args.period - (time.monotonic() - started)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
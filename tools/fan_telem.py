@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""Decode the binary telemetry stream of main/fan_telem.c to CSV.
+
+The input is a raw capture of the console UART (or fan_telem.bin from the
+linux target). Log text between packets is skipped, packets with a bad CRC
+are counted and dropped. With --trace the sensor trace packets of
+main/fan_trace.c are decoded instead, from the same capture. --keep writes
+the packets it decoded to a file as they came, without the log text, the
+other stream and the bad packets: a day of UART becomes a trace for
+SIM_TRACE (main/fan_hal_sim.c).
+
+    tools/fan_telem.py capture.bin > telem.csv
+    tools/fan_telem.py --trace capture.bin > trace.csv
+    tools/fan_telem.py --trace --keep trace.bin capture.bin > /dev/null
+    tools/fan_telem.py --port /dev/ttyUSB0 > telem.csv    # needs pyserial
+"""
+import argparse
+import binascii
+import csv
+import struct
+import sys
+from typing import BinaryIO, Iterator, Optional, Tuple
+
+SYNC = b'\xfa\xce'
+VERSION = 1
+HEADER = struct.Struct('<2sBBHH')                # sync, version, count, seq, dropped
+RECORD = struct.Struct('<IBBhhHhHHHHHHHH')       # fan_telem_rec_t
+CRC = struct.Struct('<I')
+
+FLAGS = ((0x01, 'on'), (0x02, 'stalled'), (0x04, 'settled'), (0x08, 'start'), (0x10, 'stop'), (0x20, 'retest'),
+         (0x80, 'suspect'))
+COLUMNS = ['ms', 'zone', 'flags', 'tsens', 'troom', 'ntc_mv', 'tcell', 'current_mv', 'current',
+           'tdc', 'idc', 'duty', 'duty_out', 'rpm', 'target']
+
+TRACE_SYNC = b'\xfa\xcf'
+TRACE_VERSION = 1
+TRACE_RECORD = struct.Struct('<IBBHHhHH')        # fan_trace_rec_t
+TRACE_COLUMNS = ['ms', 'zone', 'flags', 'ntc_mv', 'current_mv', 'tsens', 'pulses', 'duty']
+
+
+class Stats:
+    packets = 0
+    records = 0
+    crc_errors = 0
+    lost = 0            # Dropped in the ring, reported by the firmware
+    seq_gaps = 0        # Packets missing from the capture
+
+
+def read_chunks(src: BinaryIO) -> Iterator[bytes]:
+    while True:
+        chunk = src.read(4096)
+        if not chunk:
+            return
+        yield chunk
+
+
+def packets(chunks: Iterator[bytes], stats: Stats, sync: bytes = SYNC, want: int = VERSION,
+            record: struct.Struct = RECORD, keep: Optional[BinaryIO] = None) -> Iterator[Tuple[int, bytes]]:
+    buf = b''
+    for chunk in chunks:
+        buf += chunk
+        while True:
+            start = buf.find(sync)
+            if start < 0:
+                buf = buf[-1:]
+                break
+            buf = buf[start:]
+            if len(buf) < HEADER.size:
+                break
+            _, version, count, seq, dropped = HEADER.unpack_from(buf)
+            length = HEADER.size + count * record.size + CRC.size
+            if version != want or count == 0:
+                buf = buf[1:]
+                continue
+            if len(buf) < length:
+                break
+            (crc,) = CRC.unpack_from(buf, length - CRC.size)
+            if binascii.crc32(buf[:length - CRC.size]) != crc:
+                stats.crc_errors += 1
+                buf = buf[1:]
+                continue
+            stats.lost += dropped
+            if keep:
+                keep.write(buf[:length])
+            yield seq, buf[HEADER.size:length - CRC.size]
+            buf = buf[length:]
+
+
+def flag_names(flags: int) -> str:
+    return '|'.join(name for bit, name in FLAGS if flags & bit)
+
+
+def decode(chunks: Iterator[bytes], out: csv.writer, stats: Stats, keep: Optional[BinaryIO]) -> None:
+    last_seq = None
+    for seq, body in packets(chunks, stats, keep=keep):
+        if last_seq is not None and seq != (last_seq + 1) & 0xffff:
+            stats.seq_gaps += (seq - last_seq - 1) & 0xffff
+        last_seq = seq
+        stats.packets += 1
+        for rec in RECORD.iter_unpack(body):
+            ms, zone, flags, tsens, troom, ntc_mv, tcell, current_mv, current, tdc, idc, duty, duty_out, rpm, target = rec
+            out.writerow([ms, zone, flag_names(flags),
+                          f'{tsens / 256:.2f}', f'{troom / 256:.2f}', ntc_mv, f'{tcell / 256:.2f}',
+                          current_mv, current,
+                          f'{tdc / 65536:.4f}', f'{idc / 65536:.4f}', f'{duty / 65536:.4f}', f'{duty_out / 65536:.4f}',
+                          rpm, target])
+            stats.records += 1
+
+
+def decode_trace(chunks: Iterator[bytes], out: csv.writer, stats: Stats, keep: Optional[BinaryIO]) -> None:
+    last_seq = None
+    for seq, body in packets(chunks, stats, TRACE_SYNC, TRACE_VERSION, TRACE_RECORD, keep):
+        if last_seq is not None and seq != (last_seq + 1) & 0xffff:
+            stats.seq_gaps += (seq - last_seq - 1) & 0xffff
+        last_seq = seq
+        stats.packets += 1
+        for rec in TRACE_RECORD.iter_unpack(body):
+            ms, zone, flags, ntc_mv, current_mv, tsens, pulses, duty = rec
+            out.writerow([ms, zone, flag_names(flags), f'{ntc_mv / 16:.2f}', f'{current_mv / 16:.2f}',
+                          f'{tsens / 256:.2f}', pulses, f'{duty / 65536:.4f}'])
+            stats.records += 1
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', nargs='?', help='raw capture file, stdin when omitted')
+    parser.add_argument('--port', help='read a serial port instead')
+    parser.add_argument('--baud', type=int, default=115200)
+    parser.add_argument('--trace', action='store_true', help='decode the sensor trace packets instead')
+    parser.add_argument('--keep', metavar='FILE', help='also write the decoded packets as they came')
+    args = parser.parse_args()
+
+    if args.port:
+        import serial  # pyserial, only needed for live capture
+        port = serial.Serial(args.port, args.baud, timeout=1)
+        chunks = (port.read(port.in_waiting or 1) for _ in iter(int, 1))
+    elif args.capture:
+        chunks = read_chunks(open(args.capture, 'rb'))
+    else:
+        chunks = read_chunks(sys.stdin.buffer)
+
+    out = csv.writer(sys.stdout)
+    out.writerow(TRACE_COLUMNS if args.trace else COLUMNS)
+    stats = Stats()
+    keep = open(args.keep, 'wb') if args.keep else None
+    try:
+        (decode_trace if args.trace else decode)(chunks, out, stats, keep)
+    except KeyboardInterrupt:
+        pass
+    if keep:
+        keep.close()
+    print(f'{stats.records} records in {stats.packets} packets, {stats.crc_errors} CRC errors, '
+          f'{stats.seq_gaps} packets missing, {stats.lost} records dropped on the device', file=sys.stderr)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())